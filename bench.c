@@ -0,0 +1,309 @@
+/* bench.c - tdefl/tinfl throughput and ratio at levels 0-10 and with the TDEFL_* matcher flags, over CHTL, web and binary corpora from 1 KB to 100 MB.
+   Build: cc -O2 bench.c miniz.c -o bench
+   Usage: bench [-t min_seconds] [-s max_size] [CHTL.md] > bench.json
+   Results go to stdout as JSON. MB/s counts 10^6 uncompressed bytes per second of CPU time, ratio is uncompressed size / compressed size. */
+#include "miniz.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct
+{
+    const char *m_pName;
+    int m_level;
+    mz_uint m_extra_flags;
+} bench_config;
+
+/* Levels map to raw deflate flags like mz_deflate() does, the flag variants are added on top of level 6 */
+static const bench_config s_configs[] = {
+    { "level0", 0, 0 }, { "level1", 1, 0 }, { "level2", 2, 0 }, { "level3", 3, 0 }, { "level4", 4, 0 }, { "level5", 5, 0 },
+    { "level6", 6, 0 }, { "level7", 7, 0 }, { "level8", 8, 0 }, { "level9", 9, 0 }, { "level10", 10, 0 },
+    { "greedy", 6, TDEFL_GREEDY_PARSING_FLAG }, { "rle", 6, TDEFL_RLE_MATCHES }, { "filter", 6, TDEFL_FILTER_MATCHES }, { "static", 6, TDEFL_FORCE_ALL_STATIC_BLOCKS }
+};
+
+static const size_t s_sizes[] = { 1024, 64 * 1024, 1024 * 1024, 16 * 1024 * 1024, 100 * 1024 * 1024 };
+
+static const char *s_words[] = { "header", "nav", "card", "button", "modal", "gallery", "footer", "sidebar", "panel", "list",
+                                 "item", "title", "icon", "avatar", "badge", "tab", "menu", "form", "input", "label" };
+
+#define BENCH_NUM_WORDS (sizeof(s_words) / sizeof(s_words[0]))
+
+static mz_uint32 s_seed = 1;
+
+/* Deterministic LCG, so every run compresses the same bytes */
+static mz_uint32 bench_rand(void)
+{
+    s_seed = s_seed * 1664525U + 1013904223U;
+    return s_seed >> 8;
+}
+
+static double bench_seconds(void)
+{
+    return (double)clock() / CLOCKS_PER_SEC;
+}
+
+/* The code blocks of a markdown file that are fenced as ```chtl, each one's text ends at a NUL */
+typedef struct
+{
+    char *m_pText;
+    char **m_ppBlocks;
+    size_t m_num_blocks;
+} bench_chtl;
+
+static int bench_load_chtl(bench_chtl *pChtl, const char *pFilename)
+{
+    FILE *pFile = fopen(pFilename, "rb");
+    long size;
+    char *p;
+
+    memset(pChtl, 0, sizeof(*pChtl));
+    if (!pFile)
+        return 0;
+    if ((fseek(pFile, 0, SEEK_END) != 0) || ((size = ftell(pFile)) <= 0) || (fseek(pFile, 0, SEEK_SET) != 0) ||
+        (NULL == (pChtl->m_pText = (char *)malloc((size_t)size + 1))) || (fread(pChtl->m_pText, 1, (size_t)size, pFile) != (size_t)size))
+    {
+        fclose(pFile);
+        free(pChtl->m_pText);
+        return 0;
+    }
+    fclose(pFile);
+    pChtl->m_pText[size] = '\0';
+    if (NULL == (pChtl->m_ppBlocks = (char **)malloc(((size_t)size / 8 + 1) * sizeof(char *))))
+        return 0;
+
+    for (p = pChtl->m_pText; (p = strstr(p, "```chtl")) != NULL;)
+    {
+        char *pEnd;
+        /* The block starts on the line after the fence, which may end in CRLF */
+        if ((NULL == (p = strchr(p, '\n'))) || (NULL == (pEnd = strstr(p++, "\n```"))))
+            break;
+        pEnd[1] = '\0';
+        pChtl->m_ppBlocks[pChtl->m_num_blocks++] = p;
+        p = pEnd + 4;
+    }
+    return pChtl->m_num_blocks != 0;
+}
+
+/* Copies as much of pStr as fits, returns the new fill position */
+static size_t bench_append(mz_uint8 *pBuf, size_t ofs, size_t size, const char *pStr)
+{
+    size_t len = strlen(pStr);
+    if (len > size - ofs)
+        len = size - ofs;
+    memcpy(pBuf + ofs, pStr, len);
+    return ofs + len;
+}
+
+/* CHTL sources: the spec's examples in random order, the way a project is many small files that share most of their syntax */
+static void bench_fill_chtl(mz_uint8 *pBuf, size_t size, const bench_chtl *pChtl)
+{
+    size_t ofs = 0;
+    while (ofs < size)
+    {
+        ofs = bench_append(pBuf, ofs, size, pChtl->m_ppBlocks[bench_rand() % pChtl->m_num_blocks]);
+        ofs = bench_append(pBuf, ofs, size, "\n");
+    }
+}
+
+/* Generated HTML, CSS and JS, like what the CHTL compiler emits for a page of components */
+static void bench_fill_web(mz_uint8 *pBuf, size_t size)
+{
+    char snippet[1024];
+    size_t ofs = 0;
+    while (ofs < size)
+    {
+        const char *a = s_words[bench_rand() % BENCH_NUM_WORDS], *b = s_words[bench_rand() % BENCH_NUM_WORDS];
+        mz_uint32 id = bench_rand() % 1000;
+        switch (bench_rand() % 3)
+        {
+            case 0:
+                sprintf(snippet, ".%s-%s-%u {\n    display: flex;\n    margin: %upx %upx;\n    color: #%06x;\n    background: rgba(%u, %u, %u, 0.%u);\n}\n",
+                        a, b, (unsigned)id, (unsigned)(bench_rand() % 32), (unsigned)(bench_rand() % 32), (unsigned)(bench_rand() & 0xFFFFFF),
+                        (unsigned)(bench_rand() % 256), (unsigned)(bench_rand() % 256), (unsigned)(bench_rand() % 256), (unsigned)(bench_rand() % 10));
+                break;
+            case 1:
+                sprintf(snippet, "<div class=\"%s-%s-%u\" id=\"%s%u\">\n  <span class=\"%s\">%s %s</span>\n  <a href=\"/%s/%u.html\">%s</a>\n</div>\n",
+                        a, b, (unsigned)id, a, (unsigned)id, b, a, b, a, (unsigned)(bench_rand() % 100), b);
+                break;
+            default:
+                sprintf(snippet, "function %s_%s_%u(el) {\n    const items = el.querySelectorAll('.%s');\n    for (let i = 0; i < items.length; i++) {\n        items[i].style.opacity = %u / 100;\n    }\n    return items.length + %u;\n}\n",
+                        a, b, (unsigned)id, b, (unsigned)(bench_rand() % 100), (unsigned)id);
+                break;
+        }
+        ofs = bench_append(pBuf, ofs, size, snippet);
+    }
+}
+
+/* Raw RGBA sprites, 512 pixels wide: 32x32 tiles that are flat, a gradient, or a gradient with noise */
+static void bench_fill_pixels(mz_uint8 *pBuf, size_t size)
+{
+    size_t i;
+    for (i = 0; i < size; i++)
+    {
+        mz_uint32 pixel = (mz_uint32)(i / 4), x = pixel % 512, y = pixel / 512, c = (mz_uint32)(i % 4);
+        mz_uint32 tile = (x / 32) * 2654435761U ^ (y / 32) * 40503U, v;
+        switch (tile % 3)
+        {
+            case 0:
+                v = (tile >> (c * 8));
+                break;
+            case 1:
+                v = x * 2 + y + c * 64;
+                break;
+            default:
+                v = x + y * 2 + c * 32 + (bench_rand() & 15);
+                break;
+        }
+        pBuf[i] = (mz_uint8)((c == 3) ? (((tile >> 4) % 5) ? 255 : v) : v);
+    }
+}
+
+/* Already compressed assets (images, fonts, archives) look like random bytes to deflate */
+static void bench_fill_random(mz_uint8 *pBuf, size_t size)
+{
+    size_t i;
+    for (i = 0; i < size; i++)
+        pBuf[i] = (mz_uint8)bench_rand();
+}
+
+static void bench_usage(void)
+{
+    fprintf(stderr, "Usage: bench [-t min_seconds] [-s max_size] [CHTL.md] > bench.json\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+    static const char *s_corpora[] = { "chtl", "web", "pixels", "random" };
+    tdefl_compressor *pComp;
+    bench_chtl chtl;
+    const char *pChtl_filename = "CHTL.md";
+    double min_seconds = 0.25;
+    size_t max_size = s_sizes[sizeof(s_sizes) / sizeof(s_sizes[0]) - 1], buf_size = 0, comp_cap;
+    mz_uint8 *pSrc, *pComp_buf, *pDecomp_buf;
+    int i, corpus, first = 1;
+
+    for (i = 1; i < argc; i++)
+    {
+        if ((!strcmp(argv[i], "-t")) && (i + 1 < argc))
+            min_seconds = atof(argv[++i]);
+        else if ((!strcmp(argv[i], "-s")) && (i + 1 < argc))
+            max_size = (size_t)strtoul(argv[++i], NULL, 10);
+        else if (argv[i][0] == '-')
+            bench_usage();
+        else
+            pChtl_filename = argv[i];
+    }
+
+    if (!bench_load_chtl(&chtl, pChtl_filename))
+    {
+        fprintf(stderr, "Couldn't read any ```chtl code blocks from %s\n", pChtl_filename);
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < (int)(sizeof(s_sizes) / sizeof(s_sizes[0])); i++)
+    {
+        if (s_sizes[i] <= max_size)
+            buf_size = s_sizes[i];
+    }
+    if (!buf_size)
+        bench_usage();
+    /* Even forced static blocks of random bytes stay well under 1/8 larger than their input */
+    comp_cap = buf_size + buf_size / 8 + 4096;
+    pSrc = (mz_uint8 *)malloc(buf_size);
+    pComp_buf = (mz_uint8 *)malloc(comp_cap);
+    pDecomp_buf = (mz_uint8 *)malloc(buf_size);
+    pComp = (tdefl_compressor *)malloc(sizeof(tdefl_compressor));
+    if ((!pSrc) || (!pComp_buf) || (!pDecomp_buf) || (!pComp))
+    {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("{\n  \"miniz_version\": \"%s\",\n", MZ_VERSION);
+#ifdef __VERSION__
+    printf("  \"compiler\": \"%s\",\n", __VERSION__);
+#endif
+    printf("  \"min_seconds\": %g,\n  \"chtl_blocks\": %u,\n  \"results\": [", min_seconds, (unsigned)chtl.m_num_blocks);
+
+    for (corpus = 0; corpus < (int)(sizeof(s_corpora) / sizeof(s_corpora[0])); corpus++)
+    {
+        int size_index, config;
+
+        /* Each corpus is generated once at the largest size, the smaller sizes are its prefixes */
+        s_seed = 1;
+        switch (corpus)
+        {
+            case 0:
+                bench_fill_chtl(pSrc, buf_size, &chtl);
+                break;
+            case 1:
+                bench_fill_web(pSrc, buf_size);
+                break;
+            case 2:
+                bench_fill_pixels(pSrc, buf_size);
+                break;
+            default:
+                bench_fill_random(pSrc, buf_size);
+                break;
+        }
+
+        for (size_index = 0; (size_index < (int)(sizeof(s_sizes) / sizeof(s_sizes[0]))) && (s_sizes[size_index] <= buf_size); size_index++)
+        {
+            const size_t size = s_sizes[size_index];
+
+            for (config = 0; config < (int)(sizeof(s_configs) / sizeof(s_configs[0])); config++)
+            {
+                const mz_uint flags = tdefl_create_comp_flags_from_zip_params(s_configs[config].m_level, -15, 0) | s_configs[config].m_extra_flags;
+                size_t comp_len = 0, iters = 0, decomp_len = 0;
+                double start, comp_seconds, decomp_seconds;
+
+                start = bench_seconds();
+                do
+                {
+                    size_t in_len = size;
+                    comp_len = comp_cap;
+                    if ((tdefl_init(pComp, NULL, NULL, (int)flags) != TDEFL_STATUS_OKAY) ||
+                        (tdefl_compress(pComp, pSrc, &in_len, pComp_buf, &comp_len, TDEFL_FINISH) != TDEFL_STATUS_DONE))
+                    {
+                        fprintf(stderr, "%s %u bytes %s: compression failed\n", s_corpora[corpus], (unsigned)size, s_configs[config].m_pName);
+                        return EXIT_FAILURE;
+                    }
+                    iters++;
+                } while ((comp_seconds = bench_seconds() - start) < min_seconds);
+                comp_seconds /= iters;
+
+                iters = 0;
+                start = bench_seconds();
+                do
+                {
+                    decomp_len = tinfl_decompress_mem_to_mem(pDecomp_buf, size, pComp_buf, comp_len, 0);
+                    iters++;
+                } while ((decomp_seconds = bench_seconds() - start) < min_seconds);
+                decomp_seconds /= iters;
+
+                if ((decomp_len != size) || (memcmp(pDecomp_buf, pSrc, size) != 0))
+                {
+                    fprintf(stderr, "%s %u bytes %s: decompressed data doesn't match\n", s_corpora[corpus], (unsigned)size, s_configs[config].m_pName);
+                    return EXIT_FAILURE;
+                }
+
+                printf("%s\n    { \"corpus\": \"%s\", \"size\": %u, \"config\": \"%s\", \"level\": %d, \"flags\": \"0x%05X\", \"compressed_size\": %u, \"ratio\": %.3f, \"compress_mb_s\": %.2f, \"decompress_mb_s\": %.2f }",
+                       first ? "" : ",", s_corpora[corpus], (unsigned)size, s_configs[config].m_pName, s_configs[config].m_level, flags, (unsigned)comp_len,
+                       (double)size / comp_len, size / (comp_seconds * 1e6), size / (decomp_seconds * 1e6));
+                fflush(stdout);
+                first = 0;
+            }
+        }
+    }
+    printf("\n  ]\n}\n");
+
+    free(pComp);
+    free(pDecomp_buf);
+    free(pComp_buf);
+    free(pSrc);
+    free(chtl.m_ppBlocks);
+    free(chtl.m_pText);
+    return EXIT_SUCCESS;
+}
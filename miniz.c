@@ -201,11 +201,11 @@ int mz_deflateInit2(mz_streamp pStream, int level, int method, int window_bits,
 
     if (!pStream)
         return MZ_STREAM_ERROR;
-    if ((method != MZ_DEFLATED) || ((mem_level < 1) || (mem_level > 9)) || ((window_bits != MZ_DEFAULT_WINDOW_BITS) && (-window_bits != MZ_DEFAULT_WINDOW_BITS)))
+    if ((method != MZ_DEFLATED) || ((mem_level < 1) || (mem_level > 9)) || ((window_bits != MZ_DEFAULT_WINDOW_BITS) && (-window_bits != MZ_DEFAULT_WINDOW_BITS) && (window_bits != MZ_DEFAULT_WINDOW_BITS + 16)))
         return MZ_PARAM_ERROR;
 
     pStream->data_type = 0;
-    pStream->adler = MZ_ADLER32_INIT;
+    pStream->adler = (window_bits > MZ_DEFAULT_WINDOW_BITS) ? MZ_CRC32_INIT : MZ_ADLER32_INIT;
     pStream->msg = NULL;
     pStream->reserved = 0;
     pStream->total_in = 0;
@@ -245,14 +245,11 @@ int mz_deflate(mz_streamp pStream, int flush)
     mz_ulong orig_total_in, orig_total_out;
     int mz_status = MZ_OK;
 
-    if ((!pStream) || (!pStream->state) || (flush < 0) || (flush > MZ_FINISH) || (!pStream->next_out))
+    if ((!pStream) || (!pStream->state) || (flush < 0) || (flush > MZ_BLOCK) || (!pStream->next_out))
         return MZ_STREAM_ERROR;
     if (!pStream->avail_out)
         return MZ_BUF_ERROR;
 
-    if (flush == MZ_PARTIAL_FLUSH)
-        flush = MZ_SYNC_FLUSH;
-
     if (((tdefl_compressor *)pStream->state)->m_prev_return_status == TDEFL_STATUS_DONE)
         return (flush == MZ_FINISH) ? MZ_STREAM_END : MZ_BUF_ERROR;
 
@@ -297,6 +294,56 @@ int mz_deflate(mz_streamp pStream, int flush)
     return mz_status;
 }
 
+int mz_deflateParams(mz_streamp pStream, int level, int strategy)
+{
+    tdefl_compressor *pComp;
+    mz_uint comp_flags;
+
+    if ((!pStream) || (!pStream->state) || (level < MZ_DEFAULT_COMPRESSION) || (level > MZ_UBER_COMPRESSION) || (strategy < MZ_DEFAULT_STRATEGY) || (strategy > MZ_FIXED))
+        return MZ_STREAM_ERROR;
+
+    pComp = (tdefl_compressor *)pStream->state;
+    comp_flags = (pComp->m_flags & (TDEFL_WRITE_ZLIB_HEADER | TDEFL_WRITE_GZIP_HEADER | TDEFL_COMPUTE_ADLER32)) | tdefl_create_comp_flags_from_zip_params(level, -MZ_DEFAULT_WINDOW_BITS, strategy);
+    if (comp_flags == pComp->m_flags)
+        return MZ_OK;
+
+    /* Whatever was passed in with the old parameters has to be compressed with them, end it with an unaligned block boundary. */
+    if (pStream->total_in)
+    {
+        int status = mz_deflate(pStream, MZ_BLOCK);
+        if ((status < 0) && (status != MZ_BUF_ERROR))
+            return status;
+        if ((status == MZ_BUF_ERROR) || (pStream->avail_in) || (pComp->m_lookahead_size) || (pComp->m_output_flush_remaining))
+            return MZ_BUF_ERROR;
+    }
+
+    /* Same as tdefl_init(), the hash chains are left alone: stale entries are harmless as every match is verified against the dictionary. */
+    pComp->m_flags = comp_flags;
+    pComp->m_max_probes[0] = 1 + ((comp_flags & 0xFFF) + 2) / 3;
+    pComp->m_greedy_parsing = (comp_flags & TDEFL_GREEDY_PARSING_FLAG) != 0;
+    pComp->m_max_probes[1] = 1 + (((comp_flags & 0xFFF) >> 2) + 2) / 3;
+
+    return MZ_OK;
+}
+
+int mz_deflatePrime(mz_streamp pStream, int bits, int value)
+{
+    tdefl_compressor *pComp;
+
+    if ((!pStream) || (!pStream->state) || (bits < 0) || (bits > 16))
+        return MZ_STREAM_ERROR;
+
+    pComp = (tdefl_compressor *)pStream->state;
+    if (pComp->m_num_prime_bits + bits > 32)
+        return MZ_BUF_ERROR;
+    if (bits)
+    {
+        pComp->m_prime_bit_buf |= ((mz_uint)value & ((1U << bits) - 1U)) << pComp->m_num_prime_bits;
+        pComp->m_num_prime_bits += bits;
+    }
+    return MZ_OK;
+}
+
 int mz_deflateEnd(mz_streamp pStream)
 {
     if (!pStream)
@@ -312,8 +359,9 @@ int mz_deflateEnd(mz_streamp pStream)
 mz_ulong mz_deflateBound(mz_streamp pStream, mz_ulong source_len)
 {
     (void)pStream;
-    /* This is really over conservative. (And lame, but it's actually pretty tricky to compute a true upper bound given the way tdefl's blocking works.) */
-    return MZ_MAX(128 + (source_len * 110) / 100, 128 + source_len + ((source_len / (31 * 1024)) + 1) * 5);
+    /* Incompressible blocks are sent as stored blocks of at least 16KB (a little over 21KB with TDEFL_LESS_MEMORY), each costing at most 6 bytes (block header, padding and LEN/NLEN). */
+    /* Two more blocks' worth covers a partial last block and up to 32 bits from mz_deflatePrime(), and 18 bytes covers the gzip header and footer (zlib's are 6). */
+    return source_len + 6 * ((source_len >> 14) + 2) + 18;
 }
 
 int mz_compress2(unsigned char *pDest, mz_ulong *pDest_len, const unsigned char *pSource, mz_ulong source_len, int level)
@@ -364,17 +412,36 @@ typedef struct
 {
     tinfl_decompressor m_decomp;
     mz_uint m_dict_ofs, m_dict_avail, m_first_call, m_has_flushed;
+    mz_uint m_sync_have, m_sync_searching, m_synced;
     int m_window_bits;
     mz_uint8 m_dict[TINFL_LZ_DICT_SIZE];
     tinfl_status m_last_status;
 } inflate_state;
 
+/* MZ_TRUE if the stream just finished a gzip member, which another member may follow. */
+static mz_bool mz_inflate_gzip_member_done(inflate_state *pState)
+{
+    return (pState->m_window_bits > MZ_DEFAULT_WINDOW_BITS) && (!pState->m_synced) && (pState->m_last_status == TINFL_STATUS_DONE) && (pState->m_decomp.m_zhdr0 == 0x1F);
+}
+
+/* MZ_TRUE if the stream just finished a gzip member and the next one is waiting in the input. */
+static mz_bool mz_inflate_gzip_member_follows(mz_streamp pStream, inflate_state *pState)
+{
+    return (mz_inflate_gzip_member_done(pState)) && (pStream->avail_in) && (*pStream->next_in == 0x1F);
+}
+
+/* A gzip member that ended exactly at the end of the input isn't the end of the stream until the next call shows whether another member starts there. */
+static mz_bool mz_inflate_gzip_member_pending(mz_streamp pStream, inflate_state *pState, int flush)
+{
+    return (flush != MZ_FINISH) && (!pStream->avail_in) && (mz_inflate_gzip_member_done(pState));
+}
+
 int mz_inflateInit2(mz_streamp pStream, int window_bits)
 {
     inflate_state *pDecomp;
     if (!pStream)
         return MZ_STREAM_ERROR;
-    if ((window_bits != MZ_DEFAULT_WINDOW_BITS) && (-window_bits != MZ_DEFAULT_WINDOW_BITS))
+    if ((window_bits != MZ_DEFAULT_WINDOW_BITS) && (-window_bits != MZ_DEFAULT_WINDOW_BITS) && (window_bits != MZ_DEFAULT_WINDOW_BITS + 16) && (window_bits != MZ_DEFAULT_WINDOW_BITS + 32))
         return MZ_PARAM_ERROR;
 
     pStream->data_type = 0;
@@ -400,6 +467,7 @@ int mz_inflateInit2(mz_streamp pStream, int window_bits)
     pDecomp->m_last_status = TINFL_STATUS_NEEDS_MORE_INPUT;
     pDecomp->m_first_call = 1;
     pDecomp->m_has_flushed = 0;
+    pDecomp->m_sync_have = pDecomp->m_sync_searching = pDecomp->m_synced = 0;
     pDecomp->m_window_bits = window_bits;
 
     return MZ_OK;
@@ -431,6 +499,7 @@ int mz_inflateReset(mz_streamp pStream)
     pDecomp->m_last_status = TINFL_STATUS_NEEDS_MORE_INPUT;
     pDecomp->m_first_call = 1;
     pDecomp->m_has_flushed = 0;
+    pDecomp->m_sync_have = pDecomp->m_sync_searching = pDecomp->m_synced = 0;
     /* pDecomp->m_window_bits = window_bits */;
 
     return MZ_OK;
@@ -451,7 +520,15 @@ int mz_inflate(mz_streamp pStream, int flush)
         return MZ_STREAM_ERROR;
 
     pState = (inflate_state *)pStream->state;
-    if (pState->m_window_bits > 0)
+    if (pState->m_sync_searching)
+        return MZ_DATA_ERROR;
+    if (pState->m_synced)
+        decomp_flags = TINFL_FLAG_COMPUTE_ADLER32; /* Resumed by mz_inflateSync() in the middle of the deflate data, there's no header left to parse. */
+    else if (pState->m_window_bits > MZ_DEFAULT_WINDOW_BITS + 16)
+        decomp_flags |= TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_PARSE_GZIP_HEADER;
+    else if (pState->m_window_bits > MZ_DEFAULT_WINDOW_BITS)
+        decomp_flags |= TINFL_FLAG_PARSE_GZIP_HEADER;
+    else if (pState->m_window_bits > 0)
         decomp_flags |= TINFL_FLAG_PARSE_ZLIB_HEADER;
     orig_avail_in = pStream->avail_in;
 
@@ -468,17 +545,24 @@ int mz_inflate(mz_streamp pStream, int flush)
     {
         /* MZ_FINISH on the first call implies that the input and output buffers are large enough to hold the entire compressed/decompressed file. */
         decomp_flags |= TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF;
-        in_bytes = pStream->avail_in;
-        out_bytes = pStream->avail_out;
-        status = tinfl_decompress(&pState->m_decomp, pStream->next_in, &in_bytes, pStream->next_out, pStream->next_out, &out_bytes, decomp_flags);
-        pState->m_last_status = status;
-        pStream->next_in += (mz_uint)in_bytes;
-        pStream->avail_in -= (mz_uint)in_bytes;
-        pStream->total_in += (mz_uint)in_bytes;
-        pStream->adler = tinfl_get_adler32(&pState->m_decomp);
-        pStream->next_out += (mz_uint)out_bytes;
-        pStream->avail_out -= (mz_uint)out_bytes;
-        pStream->total_out += (mz_uint)out_bytes;
+        for (;;)
+        {
+            in_bytes = pStream->avail_in;
+            out_bytes = pStream->avail_out;
+            status = tinfl_decompress(&pState->m_decomp, pStream->next_in, &in_bytes, pStream->next_out, pStream->next_out, &out_bytes, decomp_flags);
+            pState->m_last_status = status;
+            pStream->next_in += (mz_uint)in_bytes;
+            pStream->avail_in -= (mz_uint)in_bytes;
+            pStream->total_in += (mz_uint)in_bytes;
+            pStream->adler = tinfl_get_adler32(&pState->m_decomp);
+            pStream->next_out += (mz_uint)out_bytes;
+            pStream->avail_out -= (mz_uint)out_bytes;
+            pStream->total_out += (mz_uint)out_bytes;
+
+            if (!mz_inflate_gzip_member_follows(pStream, pState))
+                break;
+            tinfl_init(&pState->m_decomp);
+        }
 
         if (status < 0)
             return MZ_DATA_ERROR;
@@ -502,7 +586,7 @@ int mz_inflate(mz_streamp pStream, int flush)
         pStream->total_out += n;
         pState->m_dict_avail -= n;
         pState->m_dict_ofs = (pState->m_dict_ofs + n) & (TINFL_LZ_DICT_SIZE - 1);
-        return ((pState->m_last_status == TINFL_STATUS_DONE) && (!pState->m_dict_avail)) ? MZ_STREAM_END : MZ_OK;
+        return ((pState->m_last_status == TINFL_STATUS_DONE) && (!pState->m_dict_avail) && (!mz_inflate_gzip_member_follows(pStream, pState)) && (!mz_inflate_gzip_member_pending(pStream, pState, flush))) ? MZ_STREAM_END : MZ_OK;
     }
 
     for (;;)
@@ -528,6 +612,12 @@ int mz_inflate(mz_streamp pStream, int flush)
         pState->m_dict_avail -= n;
         pState->m_dict_ofs = (pState->m_dict_ofs + n) & (TINFL_LZ_DICT_SIZE - 1);
 
+        if ((!pState->m_dict_avail) && (mz_inflate_gzip_member_follows(pStream, pState)))
+        {
+            tinfl_init(&pState->m_decomp);
+            continue;
+        }
+
         if (status < 0)
             return MZ_DATA_ERROR; /* Stream is corrupted (there could be some uncompressed data left in the output dictionary - oh well). */
         else if ((status == TINFL_STATUS_NEEDS_MORE_INPUT) && (!orig_avail_in))
@@ -541,13 +631,85 @@ int mz_inflate(mz_streamp pStream, int flush)
             else if (!pStream->avail_out)
                 return MZ_BUF_ERROR;
         }
-        else if ((status == TINFL_STATUS_DONE) || (!pStream->avail_in) || (!pStream->avail_out) || (pState->m_dict_avail))
+        /* Output that stopped at the end of the dictionary must be returned even without more input, a flushed stream has to decode completely. */
+        else if ((status == TINFL_STATUS_DONE) || ((!pStream->avail_in) && (status != TINFL_STATUS_HAS_MORE_OUTPUT)) || (!pStream->avail_out) || (pState->m_dict_avail))
             break;
     }
 
+    if ((status == TINFL_STATUS_DONE) && (!pState->m_dict_avail) && (mz_inflate_gzip_member_pending(pStream, pState, flush)))
+        return orig_avail_in ? MZ_OK : MZ_BUF_ERROR;
+
     return ((status == TINFL_STATUS_DONE) && (!pState->m_dict_avail)) ? MZ_STREAM_END : MZ_OK;
 }
 
+/* Same as zlib's syncsearch(): *pHave counts how much of the 00 00 FF FF marker has been seen so far, which may span calls. Returns the number of bytes examined. */
+static mz_uint mz_inflate_sync_search(mz_uint *pHave, const mz_uint8 *pBuf, mz_uint len)
+{
+    mz_uint got = *pHave, next = 0;
+    while ((next < len) && (got < 4))
+    {
+        if (pBuf[next] == ((got < 2) ? 0 : 0xFF))
+            got++;
+        else if (pBuf[next])
+            got = 0;
+        else
+            got = 4 - got;
+        next++;
+    }
+    *pHave = got;
+    return next;
+}
+
+int mz_inflateSync(mz_streamp pStream)
+{
+    inflate_state *pState;
+    tinfl_decompressor *r;
+    mz_uint n;
+
+    if ((!pStream) || (!pStream->state))
+        return MZ_STREAM_ERROR;
+    pState = (inflate_state *)pStream->state;
+    r = &pState->m_decomp;
+    /* tinfl_init() only resets m_state, the bit buffer is set up by the first tinfl_decompress() call. */
+    if (!r->m_state)
+        r->m_num_bits = 0;
+    if ((!pStream->avail_in) && (r->m_num_bits < 8))
+        return MZ_BUF_ERROR;
+
+    if (!pState->m_sync_searching)
+    {
+        /* The whole bytes tinfl already pulled into its bit buffer come first (m_num_bits may overstate them after a failure). */
+        mz_uint8 buf[sizeof(tinfl_bit_buf_t)];
+        mz_uint len = 0;
+        r->m_bit_buf >>= (r->m_num_bits & 7);
+        r->m_num_bits &= ~7U;
+        while ((r->m_num_bits >= 8) && (len < sizeof(buf)))
+        {
+            buf[len++] = (mz_uint8)r->m_bit_buf;
+            r->m_bit_buf >>= 8;
+            r->m_num_bits -= 8;
+        }
+        pState->m_sync_have = 0;
+        pState->m_sync_searching = 1;
+        mz_inflate_sync_search(&pState->m_sync_have, buf, len);
+    }
+
+    n = mz_inflate_sync_search(&pState->m_sync_have, pStream->next_in, pStream->avail_in);
+    pStream->next_in += n;
+    pStream->avail_in -= n;
+    pStream->total_in += n;
+    if (pState->m_sync_have != 4)
+        return MZ_DATA_ERROR;
+
+    /* Start over at the next block, keeping the dictionary and any output not yet returned. */
+    tinfl_init(r);
+    pState->m_last_status = TINFL_STATUS_NEEDS_MORE_INPUT;
+    pState->m_first_call = 0;
+    pState->m_sync_searching = 0;
+    pState->m_synced = 1;
+    return MZ_OK;
+}
+
 int mz_inflateEnd(mz_streamp pStream)
 {
     if (!pStream)
@@ -676,6 +838,29 @@ const char *mz_error(int err)
 
 #ifndef MINIZ_NO_DEFLATE_APIS
 
+/* Wraps the statements that keep the MINIZ_STATS counters. */
+#ifdef MINIZ_STATS
+#define TDEFL_STATS(x) x
+#ifndef MINIZ_NO_TIME
+#include <time.h>
+#define TDEFL_STATS_CLOCK() ((mz_uint64)clock())
+#else
+#define TDEFL_STATS_CLOCK() 0
+#endif
+#else
+#define TDEFL_STATS(x)
+#endif
+
+/* MINIZ_DEFLATE_THREADS is opt-in: tdefl_compress_mem_to_output_parallel() then deflates large inputs on a pool of POSIX threads instead of the calling thread alone. */
+#if defined(MINIZ_DEFLATE_THREADS) && ((!defined(__unix__) && !defined(__APPLE__)) || defined(__STRICT_ANSI__) || defined(MINIZ_NO_MALLOC))
+#undef MINIZ_DEFLATE_THREADS
+#endif
+
+#ifdef MINIZ_DEFLATE_THREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -1242,6 +1427,19 @@ static mz_bool tdefl_compress_lz_codes(tdefl_compressor *d)
 }
 #endif /* MINIZ_USE_UNALIGNED_LOADS_AND_STORES && MINIZ_LITTLE_ENDIAN && MINIZ_HAS_64BIT_REGISTERS */
 
+/* Bits the current block's LZ codes and end of block code take, with the fixed codes or the ones in m_huff_code_sizes. */
+static mz_uint tdefl_lz_code_bits(const tdefl_compressor *d, mz_bool static_codes)
+{
+    mz_uint i, bits = static_codes ? 7 : d->m_huff_code_sizes[0][256];
+    for (i = 0; i < 256; i++)
+        bits += d->m_huff_count[0][i] * (static_codes ? ((i < 144) ? 8 : 9) : d->m_huff_code_sizes[0][i]);
+    for (i = 257; i < 286; i++)
+        bits += d->m_huff_count[0][i] * ((static_codes ? ((i < 280) ? 7 : 8) : d->m_huff_code_sizes[0][i]) + (((i < 265) || (i == 285)) ? 0 : ((i - 261) >> 2)));
+    for (i = 0; i < 30; i++)
+        bits += d->m_huff_count[1][i] * ((static_codes ? 5 : d->m_huff_code_sizes[1][i]) + ((i < 4) ? 0 : ((i >> 1) - 1)));
+    return bits;
+}
+
 static mz_bool tdefl_compress_block(tdefl_compressor *d, mz_bool static_block)
 {
     if (static_block)
@@ -1253,6 +1451,33 @@ static mz_bool tdefl_compress_block(tdefl_compressor *d, mz_bool static_block)
 
 static const mz_uint s_tdefl_num_probes[11];
 
+#ifdef MINIZ_STATS
+/* Counts the literals and matches of the block about to be flushed. */
+static void tdefl_stats_count_lz_codes(tdefl_compressor *d)
+{
+    const mz_uint8 *pLZ_codes = d->m_lz_code_buf;
+    mz_uint flags = 1;
+
+    while (pLZ_codes < d->m_pLZ_code_buf)
+    {
+        if (flags == 1)
+            flags = *pLZ_codes++ | 0x100;
+        if (flags & 1)
+        {
+            d->m_stats.m_num_matches++;
+            d->m_stats.m_match_len_histogram[pLZ_codes[0]]++;
+            pLZ_codes += 3;
+        }
+        else
+        {
+            d->m_stats.m_num_literals++;
+            pLZ_codes++;
+        }
+        flags >>= 1;
+    }
+}
+#endif
+
 static int tdefl_flush_block(tdefl_compressor *d, int flush)
 {
     mz_uint saved_bit_buf, saved_bits_in;
@@ -1260,6 +1485,10 @@ static int tdefl_flush_block(tdefl_compressor *d, int flush)
     mz_bool comp_block_succeeded = MZ_FALSE;
     int n, use_raw_block = ((d->m_flags & TDEFL_FORCE_ALL_RAW_BLOCKS) != 0) && (d->m_lookahead_pos - d->m_lz_code_buf_dict_pos) <= d->m_dict_size;
     mz_uint8 *pOutput_buf_start = ((d->m_pPut_buf_func == NULL) && ((*d->m_pOut_buf_size - d->m_out_buf_ofs) >= TDEFL_OUT_BUF_SIZE)) ? ((mz_uint8 *)d->m_pOut_buf + d->m_out_buf_ofs) : d->m_output_buf;
+    mz_bool static_block = (d->m_flags & TDEFL_FORCE_ALL_STATIC_BLOCKS) || (d->m_total_lz_bytes < 48);
+#ifdef MINIZ_STATS
+    mz_uint64 start_time = TDEFL_STATS_CLOCK();
+#endif
 
     d->m_pOutput_buf = pOutput_buf_start;
     d->m_pOutput_buf_end = d->m_pOutput_buf + TDEFL_OUT_BUF_SIZE - 16;
@@ -1270,8 +1499,19 @@ static int tdefl_flush_block(tdefl_compressor *d, int flush)
 
     *d->m_pLZ_flags = (mz_uint8)(*d->m_pLZ_flags >> d->m_num_flags_left);
     d->m_pLZ_code_buf -= (d->m_num_flags_left == 8);
+    TDEFL_STATS(tdefl_stats_count_lz_codes(d));
 
-    if ((d->m_flags & TDEFL_WRITE_ZLIB_HEADER) && (!d->m_block_index))
+    if ((d->m_flags & TDEFL_WRITE_GZIP_HEADER) && (!d->m_block_index))
+    {
+        /* ID1, ID2, CM (deflate), FLG (no optional fields), MTIME (unknown), XFL, OS (unknown) */
+        static const mz_uint8 s_gzip_header[10] = { 0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF };
+        mz_uint i;
+        for (i = 0; i < sizeof(s_gzip_header); i++)
+        {
+            TDEFL_PUT_BITS(s_gzip_header[i], 8);
+        }
+    }
+    else if ((d->m_flags & TDEFL_WRITE_ZLIB_HEADER) && (!d->m_block_index))
     {
         const mz_uint8 cmf = 0x78;
         mz_uint8 flg, flevel = 3;
@@ -1296,6 +1536,17 @@ static int tdefl_flush_block(tdefl_compressor *d, int flush)
         TDEFL_PUT_BITS(flg, 8);
     }
 
+    if (d->m_num_prime_bits)
+    {
+        /* Bits inserted by mz_deflatePrime() */
+        TDEFL_PUT_BITS(d->m_prime_bit_buf & 0xFFFF, MZ_MIN(d->m_num_prime_bits, 16));
+        if (d->m_num_prime_bits > 16)
+        {
+            TDEFL_PUT_BITS(d->m_prime_bit_buf >> 16, d->m_num_prime_bits - 16);
+        }
+        d->m_prime_bit_buf = d->m_num_prime_bits = 0;
+    }
+
     TDEFL_PUT_BITS(flush == TDEFL_FINISH, 1);
 
     pSaved_output_buf = d->m_pOutput_buf;
@@ -1303,7 +1554,22 @@ static int tdefl_flush_block(tdefl_compressor *d, int flush)
     saved_bits_in = d->m_bits_in;
 
     if (!use_raw_block)
-        comp_block_succeeded = tdefl_compress_block(d, (d->m_flags & TDEFL_FORCE_ALL_STATIC_BLOCKS) || (d->m_total_lz_bytes < 48));
+    {
+        if (!static_block)
+        {
+            tdefl_start_dynamic_block(d);
+            /* Small blocks (like the ones frequent flushing produces) can cost less with the fixed codes than with a dynamic code table. */
+            if ((mz_uint)(d->m_pOutput_buf - pSaved_output_buf) * 8 + d->m_bits_in + tdefl_lz_code_bits(d, MZ_FALSE) > saved_bits_in + 2 + tdefl_lz_code_bits(d, MZ_TRUE))
+            {
+                d->m_pOutput_buf = pSaved_output_buf;
+                d->m_bit_buffer = saved_bit_buf, d->m_bits_in = saved_bits_in;
+                static_block = MZ_TRUE;
+            }
+        }
+        if (static_block)
+            tdefl_start_static_block(d);
+        comp_block_succeeded = tdefl_compress_lz_codes(d);
+    }
 
     /* If the block gets expanded, forget the current contents of the output buffer and send a raw block instead. */
     if (((use_raw_block) || ((d->m_total_lz_bytes) && ((d->m_pOutput_buf - pSaved_output_buf + 1U) >= d->m_total_lz_bytes))) &&
@@ -1312,6 +1578,7 @@ static int tdefl_flush_block(tdefl_compressor *d, int flush)
         mz_uint i;
         d->m_pOutput_buf = pSaved_output_buf;
         d->m_bit_buffer = saved_bit_buf, d->m_bits_in = saved_bits_in;
+        TDEFL_STATS(d->m_stats.m_num_blocks[0]++);
         TDEFL_PUT_BITS(0, 2);
         if (d->m_bits_in)
         {
@@ -1332,7 +1599,12 @@ static int tdefl_flush_block(tdefl_compressor *d, int flush)
         d->m_pOutput_buf = pSaved_output_buf;
         d->m_bit_buffer = saved_bit_buf, d->m_bits_in = saved_bits_in;
         tdefl_compress_block(d, MZ_TRUE);
+        TDEFL_STATS(d->m_stats.m_num_blocks[1]++);
     }
+#ifdef MINIZ_STATS
+    else
+        d->m_stats.m_num_blocks[static_block ? 1 : 2]++;
+#endif
 
     if (flush)
     {
@@ -1342,7 +1614,22 @@ static int tdefl_flush_block(tdefl_compressor *d, int flush)
             {
                 TDEFL_PUT_BITS(0, 8 - d->m_bits_in);
             }
-            if (d->m_flags & TDEFL_WRITE_ZLIB_HEADER)
+            if (d->m_flags & TDEFL_WRITE_GZIP_HEADER)
+            {
+                /* The CRC-32 and the input size modulo 2^32, which m_lookahead_pos is once all the input has been consumed */
+                mz_uint i, c = d->m_adler32, size = d->m_lookahead_pos;
+                for (i = 0; i < 4; i++)
+                {
+                    TDEFL_PUT_BITS(c & 0xFF, 8);
+                    c >>= 8;
+                }
+                for (i = 0; i < 4; i++)
+                {
+                    TDEFL_PUT_BITS(size & 0xFF, 8);
+                    size >>= 8;
+                }
+            }
+            else if (d->m_flags & TDEFL_WRITE_ZLIB_HEADER)
             {
                 mz_uint i, a = d->m_adler32;
                 for (i = 0; i < 4; i++)
@@ -1352,7 +1639,17 @@ static int tdefl_flush_block(tdefl_compressor *d, int flush)
                 }
             }
         }
-        else
+        else if (flush == TDEFL_PARTIAL_FLUSH)
+        {
+            /* Everything so far is decodable once the bits held back can only belong to the end of block code (stored blocks end byte aligned). */
+            /* If they don't, push them out with an empty static block: 10 bits instead of the 4-5 bytes of a sync flush. */
+            if (d->m_bits_in > d->m_huff_code_sizes[0][256])
+            {
+                TDEFL_PUT_BITS(2, 3);
+                TDEFL_PUT_BITS(0, 7);
+            }
+        }
+        else if (flush != TDEFL_BLOCK)
         {
             mz_uint i, z = 0;
             TDEFL_PUT_BITS(0, 3);
@@ -1379,6 +1676,11 @@ static int tdefl_flush_block(tdefl_compressor *d, int flush)
     d->m_total_lz_bytes = 0;
     d->m_block_index++;
 
+#ifdef MINIZ_STATS
+    d->m_stats.m_bytes_out += (mz_uint64)(d->m_pOutput_buf - pOutput_buf_start);
+    d->m_stats.m_flush_block_clocks += TDEFL_STATS_CLOCK() - start_time;
+#endif
+
     if ((n = (int)(d->m_pOutput_buf - pOutput_buf_start)) != 0)
     {
         if (d->m_pPut_buf_func)
@@ -1434,6 +1736,7 @@ static MZ_FORCEINLINE void tdefl_find_match(tdefl_compressor *d, mz_uint lookahe
     MZ_ASSERT(max_match_len <= TDEFL_MAX_MATCH_LEN);
     if (max_match_len <= match_len)
         return;
+    TDEFL_STATS(d->m_stats.m_num_find_match_calls++);
     for (;;)
     {
         for (;;)
@@ -1441,6 +1744,7 @@ static MZ_FORCEINLINE void tdefl_find_match(tdefl_compressor *d, mz_uint lookahe
             if (--num_probes_left == 0)
                 return;
 #define TDEFL_PROBE                                                                             \
+    TDEFL_STATS(d->m_stats.m_num_probes++);                                                     \
     next_probe_pos = d->m_next[probe_pos];                                                      \
     if ((!next_probe_pos) || ((dist = (mz_uint16)(lookahead_pos - next_probe_pos)) > max_dist)) \
         return;                                                                                 \
@@ -1487,6 +1791,7 @@ static MZ_FORCEINLINE void tdefl_find_match(tdefl_compressor *d, mz_uint lookahe
     MZ_ASSERT(max_match_len <= TDEFL_MAX_MATCH_LEN);
     if (max_match_len <= match_len)
         return;
+    TDEFL_STATS(d->m_stats.m_num_find_match_calls++);
     for (;;)
     {
         for (;;)
@@ -1494,6 +1799,7 @@ static MZ_FORCEINLINE void tdefl_find_match(tdefl_compressor *d, mz_uint lookahe
             if (--num_probes_left == 0)
                 return;
 #define TDEFL_PROBE                                                                               \
+    TDEFL_STATS(d->m_stats.m_num_probes++);                                                       \
     next_probe_pos = d->m_next[probe_pos];                                                        \
     if ((!next_probe_pos) || ((dist = (mz_uint16)(lookahead_pos - next_probe_pos)) > max_dist))   \
         return;                                                                                   \
@@ -1638,7 +1944,9 @@ static mz_bool tdefl_compress_fast(tdefl_compressor *d)
             MZ_ASSERT(lookahead_size >= cur_match_len);
             lookahead_size -= cur_match_len;
 
-            if (pLZ_code_buf > &d->m_lz_code_buf[TDEFL_LZ_CODE_BUF_SIZE - 8])
+            /* Like tdefl_compress_normal(), end nearly incompressible blocks while they're still inside dict_size (which the 4KB lookahead shrinks) so they can be sent as stored blocks. */
+            if ((pLZ_code_buf > &d->m_lz_code_buf[TDEFL_LZ_CODE_BUF_SIZE - 8]) ||
+                ((total_lz_bytes > 27 * 1024) && ((((mz_uint)(pLZ_code_buf - d->m_lz_code_buf) * 115) >> 7) >= total_lz_bytes)))
             {
                 int n;
                 d->m_lookahead_pos = lookahead_pos;
@@ -1677,7 +1985,8 @@ static mz_bool tdefl_compress_fast(tdefl_compressor *d)
             cur_pos = (cur_pos + 1) & TDEFL_LZ_DICT_SIZE_MASK;
             lookahead_size--;
 
-            if (pLZ_code_buf > &d->m_lz_code_buf[TDEFL_LZ_CODE_BUF_SIZE - 8])
+            if ((pLZ_code_buf > &d->m_lz_code_buf[TDEFL_LZ_CODE_BUF_SIZE - 8]) ||
+                ((total_lz_bytes > 27 * 1024) && ((((mz_uint)(pLZ_code_buf - d->m_lz_code_buf) * 115) >> 7) >= total_lz_bytes)))
             {
                 int n;
                 d->m_lookahead_pos = lookahead_pos;
@@ -1964,10 +2273,18 @@ tdefl_status tdefl_compress(tdefl_compressor *d, const void *pIn_buf, size_t *pI
             return d->m_prev_return_status;
     }
 
-    if ((d->m_flags & (TDEFL_WRITE_ZLIB_HEADER | TDEFL_COMPUTE_ADLER32)) && (pIn_buf))
+#ifdef MINIZ_STATS
+    if (pIn_buf)
+        d->m_stats.m_bytes_in += (mz_uint64)(d->m_pSrc - (const mz_uint8 *)pIn_buf);
+#endif
+
+    if ((d->m_flags & TDEFL_WRITE_GZIP_HEADER) && (pIn_buf))
+        d->m_adler32 = (mz_uint32)mz_crc32(d->m_adler32, (const mz_uint8 *)pIn_buf, d->m_pSrc - (const mz_uint8 *)pIn_buf);
+    else if ((d->m_flags & (TDEFL_WRITE_ZLIB_HEADER | TDEFL_COMPUTE_ADLER32)) && (pIn_buf))
         d->m_adler32 = (mz_uint32)mz_adler32(d->m_adler32, (const mz_uint8 *)pIn_buf, d->m_pSrc - (const mz_uint8 *)pIn_buf);
 
-    if ((flush) && (!d->m_lookahead_size) && (!d->m_src_buf_left) && (!d->m_output_flush_remaining))
+    /* A TDEFL_BLOCK flush with nothing pending has no block to end. */
+    if ((flush) && (!d->m_lookahead_size) && (!d->m_src_buf_left) && (!d->m_output_flush_remaining) && ((flush != TDEFL_BLOCK) || (d->m_total_lz_bytes)))
     {
         if (tdefl_flush_block(d, flush) < 0)
             return d->m_prev_return_status;
@@ -2001,6 +2318,7 @@ tdefl_status tdefl_init(tdefl_compressor *d, tdefl_put_buf_func_ptr pPut_buf_fun
         MZ_CLEAR_ARR(d->m_hash);
     d->m_lookahead_pos = d->m_lookahead_size = d->m_dict_size = d->m_total_lz_bytes = d->m_lz_code_buf_dict_pos = d->m_bits_in = 0;
     d->m_output_flush_ofs = d->m_output_flush_remaining = d->m_finished = d->m_block_index = d->m_bit_buffer = d->m_wants_to_finish = 0;
+    d->m_prime_bit_buf = d->m_num_prime_bits = 0;
     d->m_pLZ_code_buf = d->m_lz_code_buf + 1;
     d->m_pLZ_flags = d->m_lz_code_buf;
     *d->m_pLZ_flags = 0;
@@ -2009,7 +2327,7 @@ tdefl_status tdefl_init(tdefl_compressor *d, tdefl_put_buf_func_ptr pPut_buf_fun
     d->m_pOutput_buf_end = d->m_output_buf;
     d->m_prev_return_status = TDEFL_STATUS_OKAY;
     d->m_saved_match_dist = d->m_saved_match_len = d->m_saved_lit = 0;
-    d->m_adler32 = 1;
+    d->m_adler32 = (flags & TDEFL_WRITE_GZIP_HEADER) ? MZ_CRC32_INIT : MZ_ADLER32_INIT;
     d->m_pIn_buf = NULL;
     d->m_pOut_buf = NULL;
     d->m_pIn_buf_size = NULL;
@@ -2022,9 +2340,17 @@ tdefl_status tdefl_init(tdefl_compressor *d, tdefl_put_buf_func_ptr pPut_buf_fun
         MZ_CLEAR_ARR(d->m_dict);
     memset(&d->m_huff_count[0][0], 0, sizeof(d->m_huff_count[0][0]) * TDEFL_MAX_HUFF_SYMBOLS_0);
     memset(&d->m_huff_count[1][0], 0, sizeof(d->m_huff_count[1][0]) * TDEFL_MAX_HUFF_SYMBOLS_1);
+    TDEFL_STATS(memset(&d->m_stats, 0, sizeof(d->m_stats)));
     return TDEFL_STATUS_OKAY;
 }
 
+#ifdef MINIZ_STATS
+const tdefl_stats *tdefl_get_stats(const tdefl_compressor *d)
+{
+    return &d->m_stats;
+}
+#endif
+
 tdefl_status tdefl_get_prev_return_status(tdefl_compressor *d)
 {
     return d->m_prev_return_status;
@@ -2110,13 +2436,243 @@ size_t tdefl_compress_mem_to_mem(void *pOut_buf, size_t out_buf_len, const void
     return out_buf.m_size;
 }
 
+#define TDEFL_PARALLEL_DEFAULT_BLOCK_SIZE (1024U * 1024U)
+
+#ifdef MINIZ_DEFLATE_THREADS
+/* One block of the input and its deflate data. m_status is 0 until a worker is done with it, then 1, or -1 if it failed. */
+typedef struct
+{
+    tdefl_output_buffer m_out;
+    int m_status;
+} tdefl_parallel_block;
+
+/* The state shared by the workers of tdefl_compress_mem_to_output_parallel(). Workers stay at most m_max_ahead blocks ahead of the caller, which writes the blocks out in order. */
+typedef struct
+{
+    const mz_uint8 *m_pSrc;
+    size_t m_src_len, m_block_size, m_num_blocks, m_next_block, m_num_written, m_max_ahead;
+    int m_flags;
+    mz_bool m_stop;
+    tdefl_parallel_block *m_pBlocks;
+    pthread_mutex_t m_mutex;
+    pthread_cond_t m_cond;
+} tdefl_parallel_job;
+
+static void *tdefl_parallel_thread_func(void *pArg)
+{
+    tdefl_parallel_job *pJob = (tdefl_parallel_job *)pArg;
+    tdefl_compressor *pComp = (tdefl_compressor *)MZ_MALLOC(sizeof(tdefl_compressor));
+
+    for (;;)
+    {
+        size_t block_index, ofs, len;
+        tdefl_parallel_block *pBlock;
+        mz_bool last, status;
+        int flags;
+
+        pthread_mutex_lock(&pJob->m_mutex);
+        while ((!pJob->m_stop) && (pJob->m_next_block < pJob->m_num_blocks) && (pJob->m_next_block >= pJob->m_num_written + pJob->m_max_ahead))
+            pthread_cond_wait(&pJob->m_cond, &pJob->m_mutex);
+        if ((!pComp) || (pJob->m_stop) || (pJob->m_next_block >= pJob->m_num_blocks))
+        {
+            /* Without a compressor this worker can't help, and the caller may be waiting for a block only it would do */
+            if (!pComp)
+                pJob->m_stop = MZ_TRUE;
+            pthread_cond_broadcast(&pJob->m_cond);
+            pthread_mutex_unlock(&pJob->m_mutex);
+            break;
+        }
+        block_index = pJob->m_next_block++;
+        pthread_mutex_unlock(&pJob->m_mutex);
+
+        /* The first block gets the zlib/gzip header, the caller appends the trailer. Every block but the last ends with a sync flush, so they can simply be concatenated. */
+        pBlock = &pJob->m_pBlocks[block_index];
+        ofs = block_index * pJob->m_block_size;
+        len = MZ_MIN(pJob->m_block_size, pJob->m_src_len - ofs);
+        last = (block_index == pJob->m_num_blocks - 1);
+        flags = pJob->m_flags & ~TDEFL_COMPUTE_ADLER32;
+        if (block_index)
+            flags &= ~(TDEFL_WRITE_ZLIB_HEADER | TDEFL_WRITE_GZIP_HEADER);
+        status = (tdefl_init(pComp, tdefl_output_buffer_putter, &pBlock->m_out, flags) == TDEFL_STATUS_OKAY) &&
+                 (tdefl_compress_buffer(pComp, pJob->m_pSrc + ofs, len, last ? TDEFL_FINISH : TDEFL_SYNC_FLUSH) == (last ? TDEFL_STATUS_DONE : TDEFL_STATUS_OKAY));
+
+        pthread_mutex_lock(&pJob->m_mutex);
+        pBlock->m_status = status ? 1 : -1;
+        if (!status)
+            pJob->m_stop = MZ_TRUE;
+        pthread_cond_broadcast(&pJob->m_cond);
+        pthread_mutex_unlock(&pJob->m_mutex);
+    }
+
+    MZ_FREE(pComp);
+    return NULL;
+}
+
+/* Feeds len bytes to the put buf callback, which takes an int */
+static mz_bool tdefl_put_buf_all(tdefl_put_buf_func_ptr pPut_buf_func, void *pPut_buf_user, const mz_uint8 *pBuf, size_t len)
+{
+    while (len)
+    {
+        int n = (int)MZ_MIN(len, TDEFL_OUT_BUF_SIZE);
+        if (!(*pPut_buf_func)(pBuf, n, pPut_buf_user))
+            return MZ_FALSE;
+        pBuf += n;
+        len -= n;
+    }
+    return MZ_TRUE;
+}
+
+static mz_bool tdefl_compress_mem_to_output_threaded(tdefl_parallel_job *pJob, mz_uint num_threads, tdefl_put_buf_func_ptr pPut_buf_func, void *pPut_buf_user)
+{
+    const mz_bool gzip = (pJob->m_flags & TDEFL_WRITE_GZIP_HEADER) != 0, zlib = (!gzip) && (pJob->m_flags & TDEFL_WRITE_ZLIB_HEADER);
+    mz_uint32 check = gzip ? MZ_CRC32_INIT : MZ_ADLER32_INIT;
+    mz_bool status = MZ_TRUE;
+    pthread_t *pThreads;
+    mz_uint i, num_started = 0;
+    size_t block_index;
+
+    if (NULL == (pThreads = (pthread_t *)MZ_MALLOC(num_threads * sizeof(pthread_t))))
+        return MZ_FALSE;
+    if (NULL == (pJob->m_pBlocks = (tdefl_parallel_block *)MZ_MALLOC(pJob->m_num_blocks * sizeof(tdefl_parallel_block))))
+    {
+        MZ_FREE(pThreads);
+        return MZ_FALSE;
+    }
+    memset(pJob->m_pBlocks, 0, pJob->m_num_blocks * sizeof(tdefl_parallel_block));
+    for (block_index = 0; block_index < pJob->m_num_blocks; block_index++)
+        pJob->m_pBlocks[block_index].m_out.m_expandable = MZ_TRUE;
+
+    if (pthread_mutex_init(&pJob->m_mutex, NULL) != 0)
+        status = MZ_FALSE;
+    else if (pthread_cond_init(&pJob->m_cond, NULL) != 0)
+    {
+        pthread_mutex_destroy(&pJob->m_mutex);
+        status = MZ_FALSE;
+    }
+    else
+    {
+        for (i = 0; i < num_threads; i++)
+        {
+            if (pthread_create(&pThreads[num_started], NULL, tdefl_parallel_thread_func, pJob) != 0)
+                break;
+            num_started++;
+        }
+        status = (num_started != 0);
+
+        /* Checksum each block while the workers deflate it, then write it out as soon as it's done */
+        for (block_index = 0; (status) && (block_index < pJob->m_num_blocks); block_index++)
+        {
+            tdefl_parallel_block *pBlock = &pJob->m_pBlocks[block_index];
+            size_t ofs = block_index * pJob->m_block_size, len = MZ_MIN(pJob->m_block_size, pJob->m_src_len - ofs);
+
+            if (gzip)
+                check = (mz_uint32)mz_crc32(check, pJob->m_pSrc + ofs, len);
+            else if (zlib)
+                check = (mz_uint32)mz_adler32(check, pJob->m_pSrc + ofs, len);
+
+            pthread_mutex_lock(&pJob->m_mutex);
+            while ((!pBlock->m_status) && (!pJob->m_stop))
+                pthread_cond_wait(&pJob->m_cond, &pJob->m_mutex);
+            pthread_mutex_unlock(&pJob->m_mutex);
+
+            status = (pBlock->m_status > 0) && (tdefl_put_buf_all(pPut_buf_func, pPut_buf_user, pBlock->m_out.m_pBuf, pBlock->m_out.m_size));
+            MZ_FREE(pBlock->m_out.m_pBuf);
+            pBlock->m_out.m_pBuf = NULL;
+
+            pthread_mutex_lock(&pJob->m_mutex);
+            pJob->m_num_written = block_index + 1;
+            pJob->m_stop |= !status;
+            pthread_cond_broadcast(&pJob->m_cond);
+            pthread_mutex_unlock(&pJob->m_mutex);
+        }
+
+        for (i = 0; i < num_started; i++)
+            pthread_join(pThreads[i], NULL);
+        pthread_cond_destroy(&pJob->m_cond);
+        pthread_mutex_destroy(&pJob->m_mutex);
+    }
+
+    for (block_index = 0; block_index < pJob->m_num_blocks; block_index++)
+        MZ_FREE(pJob->m_pBlocks[block_index].m_out.m_pBuf);
+    MZ_FREE(pJob->m_pBlocks);
+    MZ_FREE(pThreads);
+
+    if ((status) && ((gzip) || (zlib)))
+    {
+        mz_uint8 trailer[8];
+        mz_uint32 size = (mz_uint32)pJob->m_src_len;
+        if (gzip)
+        {
+            for (i = 0; i < 4; i++)
+            {
+                trailer[i] = (mz_uint8)(check >> (i * 8));
+                trailer[4 + i] = (mz_uint8)(size >> (i * 8));
+            }
+        }
+        else
+        {
+            for (i = 0; i < 4; i++)
+                trailer[i] = (mz_uint8)(check >> (24 - i * 8));
+        }
+        status = (*pPut_buf_func)(trailer, gzip ? 8 : 4, pPut_buf_user);
+    }
+
+    return status;
+}
+
+/* How many workers tdefl_compress_mem_to_output_parallel() starts for its arguments, below 2 it deflates on the calling thread */
+static mz_uint tdefl_parallel_num_threads(size_t buf_len, size_t block_size, mz_uint num_threads)
+{
+    size_t num_blocks = buf_len / block_size + ((buf_len % block_size) != 0);
+    if (!num_threads)
+    {
+        long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = (num_cpus > 0) ? (mz_uint)num_cpus : 1;
+    }
+    return (num_threads > num_blocks) ? (mz_uint)num_blocks : num_threads;
+}
+#endif
+
+mz_bool tdefl_compress_mem_to_output_parallel(const void *pBuf, size_t buf_len, tdefl_put_buf_func_ptr pPut_buf_func, void *pPut_buf_user, int flags, size_t block_size, mz_uint num_threads)
+{
+#ifdef MINIZ_DEFLATE_THREADS
+    tdefl_parallel_job job;
+#endif
+
+    if (((buf_len) && (!pBuf)) || (!pPut_buf_func))
+        return MZ_FALSE;
+    if (!block_size)
+        block_size = TDEFL_PARALLEL_DEFAULT_BLOCK_SIZE;
+
+#ifdef MINIZ_DEFLATE_THREADS
+    num_threads = tdefl_parallel_num_threads(buf_len, block_size, num_threads);
+    if (num_threads >= 2)
+    {
+        memset(&job, 0, sizeof(job));
+        job.m_pSrc = (const mz_uint8 *)pBuf;
+        job.m_src_len = buf_len;
+        job.m_block_size = block_size;
+        job.m_num_blocks = buf_len / block_size + ((buf_len % block_size) != 0);
+        job.m_max_ahead = (size_t)num_threads * 2;
+        job.m_flags = flags;
+        return tdefl_compress_mem_to_output_threaded(&job, num_threads, pPut_buf_func, pPut_buf_user);
+    }
+#else
+    (void)num_threads;
+#endif
+
+    return tdefl_compress_mem_to_output(pBuf, buf_len, pPut_buf_func, pPut_buf_user, flags);
+}
+
 static const mz_uint s_tdefl_num_probes[11] = { 0, 1, 6, 32, 16, 32, 128, 256, 512, 768, 1500 };
 
 /* level may actually range from [0,10] (10 is a "hidden" max level, where we want a bit more compression and it's fine if throughput to fall off a cliff on some files). */
 mz_uint tdefl_create_comp_flags_from_zip_params(int level, int window_bits, int strategy)
 {
     mz_uint comp_flags = s_tdefl_num_probes[(level >= 0) ? MZ_MIN(10, level) : MZ_DEFAULT_LEVEL] | ((level <= 3) ? TDEFL_GREEDY_PARSING_FLAG : 0);
-    if (window_bits > 0)
+    if (window_bits > 15)
+        comp_flags |= TDEFL_WRITE_GZIP_HEADER;
+    else if (window_bits > 0)
         comp_flags |= TDEFL_WRITE_ZLIB_HEADER;
 
     if (!level)
@@ -2141,38 +2697,190 @@ mz_uint tdefl_create_comp_flags_from_zip_params(int level, int window_bits, int
 /* Simple PNG writer function by Alex Evans, 2011. Released into the public domain: https://gist.github.com/908299, more context at
  http://altdevblogaday.org/2011/04/06/a-smaller-jpg-encoder/.
  This is actually a modification of Alex's original code so PNG files generated by this function pass pngcheck. */
-void *tdefl_write_image_to_png_file_in_memory_ex(const void *pImage, int w, int h, int num_chans, size_t *pLen_out, mz_uint level, mz_bool flip)
+/* Using a local copy of this array here in case MINIZ_NO_ZLIB_APIS was defined. */
+static const mz_uint s_tdefl_png_num_probes[11] = { 0, 1, 6, 32, 16, 32, 128, 256, 512, 768, 1500 };
+
+/* The compressor flags for a PNG level, with greedy parsing at levels 1-3 like tdefl_create_comp_flags_from_zip_params() */
+static int tdefl_png_comp_flags(mz_uint level)
 {
-    /* Using a local copy of this array here in case MINIZ_NO_ZLIB_APIS was defined. */
-    static const mz_uint s_tdefl_png_num_probes[11] = { 0, 1, 6, 32, 16, 32, 128, 256, 512, 768, 1500 };
-    tdefl_compressor *pComp = (tdefl_compressor *)MZ_MALLOC(sizeof(tdefl_compressor));
-    tdefl_output_buffer out_buf;
-    int i, bpl = w * num_chans, y, z;
-    mz_uint32 c;
-    *pLen_out = 0;
-    if (!pComp)
-        return NULL;
-    MZ_CLEAR_OBJ(out_buf);
-    out_buf.m_expandable = MZ_TRUE;
-    out_buf.m_capacity = 57 + MZ_MAX(64, (1 + bpl) * h);
-    if (NULL == (out_buf.m_pBuf = (mz_uint8 *)MZ_MALLOC(out_buf.m_capacity)))
-    {
+    return (int)(s_tdefl_png_num_probes[MZ_MIN(10, level)] | TDEFL_WRITE_ZLIB_HEADER | (((level) && (level <= 3)) ? TDEFL_GREEDY_PARSING_FLAG : 0));
+}
+
+/* The absolute value of a filtered byte read as a signed byte, which is what the filter heuristic sums up */
+#define TDEFL_PNG_FILTER_COST(v) (((v) < 128) ? (mz_uint32)(v) : (256U - (v)))
+
+/* Applies PNG filter type 0-4 (None, Sub, Up, Average, Paeth) to a scanline and returns the sum of the filtered bytes' costs. */
+/* The first bpp bytes have no left neighbour, splitting the loops there keeps their bodies branch free so compilers can vectorize them. */
+static mz_uint32 tdefl_png_filter_row(mz_uint8 *pDst, const mz_uint8 *pRow, const mz_uint8 *pPrev, int bpl, int bpp, int filter)
+{
+    mz_uint32 sum = 0;
+    int i;
+    mz_uint8 v;
+    switch (filter)
+    {
+        case 0:
+            for (i = 0; i < bpl; i++)
+            {
+                v = pDst[i] = pRow[i];
+                sum += TDEFL_PNG_FILTER_COST(v);
+            }
+            break;
+        case 1:
+            for (i = 0; i < bpp; i++)
+            {
+                v = pDst[i] = pRow[i];
+                sum += TDEFL_PNG_FILTER_COST(v);
+            }
+            for (; i < bpl; i++)
+            {
+                v = pDst[i] = (mz_uint8)(pRow[i] - pRow[i - bpp]);
+                sum += TDEFL_PNG_FILTER_COST(v);
+            }
+            break;
+        case 2:
+            for (i = 0; i < bpl; i++)
+            {
+                v = pDst[i] = (mz_uint8)(pRow[i] - pPrev[i]);
+                sum += TDEFL_PNG_FILTER_COST(v);
+            }
+            break;
+        case 3:
+            for (i = 0; i < bpp; i++)
+            {
+                v = pDst[i] = (mz_uint8)(pRow[i] - (pPrev[i] >> 1));
+                sum += TDEFL_PNG_FILTER_COST(v);
+            }
+            for (; i < bpl; i++)
+            {
+                v = pDst[i] = (mz_uint8)(pRow[i] - ((pRow[i - bpp] + pPrev[i]) >> 1));
+                sum += TDEFL_PNG_FILTER_COST(v);
+            }
+            break;
+        default:
+            for (i = 0; i < bpp; i++)
+            {
+                v = pDst[i] = (mz_uint8)(pRow[i] - pPrev[i]);
+                sum += TDEFL_PNG_FILTER_COST(v);
+            }
+            for (; i < bpl; i++)
+            {
+                int a = pRow[i - bpp], b = pPrev[i], c = pPrev[i - bpp];
+                int pa = b - c, pb = a - c, pc = pa + pb;
+                pa = (pa < 0) ? -pa : pa;
+                pb = (pb < 0) ? -pb : pb;
+                pc = (pc < 0) ? -pc : pc;
+                v = pDst[i] = (mz_uint8)(pRow[i] - (((pa <= pb) && (pa <= pc)) ? a : ((pb <= pc) ? b : c)));
+                sum += TDEFL_PNG_FILTER_COST(v);
+            }
+            break;
+    }
+    return sum;
+}
+
+/* Tries every filter type on a scanline. Returns the one with the smallest cost, whose output is left in *ppBest (*ppTrial is scratch). */
+static int tdefl_png_choose_filter(mz_uint8 **ppBest, mz_uint8 **ppTrial, const mz_uint8 *pRow, const mz_uint8 *pPrev, int bpl, int bpp)
+{
+    mz_uint32 best_sum = 0;
+    int filter, best_filter = 0;
+    for (filter = 0; filter <= 4; filter++)
+    {
+        mz_uint32 sum = tdefl_png_filter_row(*ppTrial, pRow, pPrev, bpl, bpp, filter);
+        if ((!filter) || (sum < best_sum))
+        {
+            mz_uint8 *pTemp = *ppBest;
+            *ppBest = *ppTrial;
+            *ppTrial = pTemp;
+            best_sum = sum;
+            best_filter = filter;
+        }
+    }
+    return best_filter;
+}
+
+/* Below this level every scanline gets the Up filter, a single cheap pass that comes close to the adaptive choice on most images */
+#define TDEFL_PNG_ADAPTIVE_FILTER_LEVEL 7
+
+/* Filters a scanline for a compression level above 0. Returns the filter type, whose output is left in *ppBest (*ppTrial is scratch). */
+static int tdefl_png_filter_scanline(mz_uint8 **ppBest, mz_uint8 **ppTrial, const mz_uint8 *pRow, const mz_uint8 *pPrev, int bpl, int bpp, mz_uint level)
+{
+    if (level >= TDEFL_PNG_ADAPTIVE_FILTER_LEVEL)
+        return tdefl_png_choose_filter(ppBest, ppTrial, pRow, pPrev, bpl, bpp);
+    tdefl_png_filter_row(*ppBest, pRow, pPrev, bpl, bpp, 2);
+    return 2;
+}
+
+void *tdefl_write_image_to_png_file_in_memory_ex(const void *pImage, int w, int h, int num_chans, size_t *pLen_out, mz_uint level, mz_bool flip)
+{
+    tdefl_compressor *pComp = NULL;
+    tdefl_output_buffer out_buf;
+    int i, bpl = w * num_chans, y, z;
+    size_t filtered_size = (size_t)(1 + bpl) * h;
+    mz_uint8 *pRow_buf, *pZero_row, *pBest, *pTrial, *pFiltered = NULL;
+    mz_bool status;
+    mz_uint32 c;
+    *pLen_out = 0;
+    /* A row of zeros (the row above the first one) and two scratch rows for the filters */
+    if (NULL == (pRow_buf = (mz_uint8 *)MZ_MALLOC((size_t)bpl * 3)))
+        return NULL;
+    pZero_row = pRow_buf;
+    pBest = pZero_row + bpl;
+    pTrial = pBest + bpl;
+    memset(pZero_row, 0, bpl);
+#ifdef MINIZ_DEFLATE_THREADS
+    /* Deflating on several threads needs all the filtered scanlines up front, otherwise each is compressed as soon as it's filtered */
+    if (tdefl_parallel_num_threads(filtered_size, TDEFL_PARALLEL_DEFAULT_BLOCK_SIZE, 0) >= 2)
+        pFiltered = (mz_uint8 *)MZ_MALLOC(filtered_size);
+#endif
+    if ((!pFiltered) && (NULL == (pComp = (tdefl_compressor *)MZ_MALLOC(sizeof(tdefl_compressor)))))
+    {
+        MZ_FREE(pRow_buf);
+        return NULL;
+    }
+    MZ_CLEAR_OBJ(out_buf);
+    out_buf.m_expandable = MZ_TRUE;
+    out_buf.m_capacity = 57 + MZ_MAX(64, (1 + bpl) * h);
+    if (NULL == (out_buf.m_pBuf = (mz_uint8 *)MZ_MALLOC(out_buf.m_capacity)))
+    {
+        MZ_FREE(pFiltered);
         MZ_FREE(pComp);
+        MZ_FREE(pRow_buf);
         return NULL;
     }
     /* write dummy header */
     for (z = 41; z; --z)
         tdefl_output_buffer_putter(&z, 1, &out_buf);
-    /* compress image data */
-    tdefl_init(pComp, tdefl_output_buffer_putter, &out_buf, s_tdefl_png_num_probes[MZ_MIN(10, level)] | TDEFL_WRITE_ZLIB_HEADER);
-    for (y = 0; y < h; ++y)
+    /* filter and compress image data */
+    status = (pFiltered) || (tdefl_init(pComp, tdefl_output_buffer_putter, &out_buf, tdefl_png_comp_flags(level)) == TDEFL_STATUS_OKAY);
+    for (y = 0; (status) && (y < h); ++y)
     {
-        tdefl_compress_buffer(pComp, &z, 1, TDEFL_NO_FLUSH);
-        tdefl_compress_buffer(pComp, (mz_uint8 *)pImage + (flip ? (h - 1 - y) : y) * bpl, bpl, TDEFL_NO_FLUSH);
+        const mz_uint8 *pRow = (const mz_uint8 *)pImage + (size_t)(flip ? (h - 1 - y) : y) * bpl;
+        const mz_uint8 *pPrev = y ? (pRow + (flip ? bpl : -bpl)) : pZero_row;
+        const mz_uint8 *pData = pRow;
+        mz_uint8 filter = 0;
+        if (level)
+        {
+            filter = (mz_uint8)tdefl_png_filter_scanline(&pBest, &pTrial, pRow, pPrev, bpl, num_chans, level);
+            pData = pBest;
+        }
+        if (pFiltered)
+        {
+            mz_uint8 *pDst = pFiltered + (size_t)y * (1 + bpl);
+            pDst[0] = filter;
+            memcpy(pDst + 1, pData, bpl);
+        }
+        else
+            status = (tdefl_compress_buffer(pComp, &filter, 1, TDEFL_NO_FLUSH) == TDEFL_STATUS_OKAY) &&
+                     (tdefl_compress_buffer(pComp, pData, bpl, TDEFL_NO_FLUSH) == TDEFL_STATUS_OKAY);
     }
-    if (tdefl_compress_buffer(pComp, NULL, 0, TDEFL_FINISH) != TDEFL_STATUS_DONE)
+    if (pFiltered)
+        status = (status) && (tdefl_compress_mem_to_output_parallel(pFiltered, filtered_size, tdefl_output_buffer_putter, &out_buf, tdefl_png_comp_flags(level), TDEFL_PARALLEL_DEFAULT_BLOCK_SIZE, 0));
+    else
+        status = (status) && (tdefl_compress_buffer(pComp, NULL, 0, TDEFL_FINISH) == TDEFL_STATUS_DONE);
+    MZ_FREE(pFiltered);
+    MZ_FREE(pComp);
+    MZ_FREE(pRow_buf);
+    if (!status)
     {
-        MZ_FREE(pComp);
         MZ_FREE(out_buf.m_pBuf);
         return NULL;
     }
@@ -2207,7 +2915,6 @@ void *tdefl_write_image_to_png_file_in_memory_ex(const void *pImage, int w, int
     if (!tdefl_output_buffer_putter("\0\0\0\0\0\0\0\0\x49\x45\x4e\x44\xae\x42\x60\x82", 16, &out_buf))
     {
         *pLen_out = 0;
-        MZ_FREE(pComp);
         MZ_FREE(out_buf.m_pBuf);
         return NULL;
     }
@@ -2216,7 +2923,6 @@ void *tdefl_write_image_to_png_file_in_memory_ex(const void *pImage, int w, int
         (out_buf.m_pBuf + out_buf.m_size - 16)[i] = (mz_uint8)(c >> 24);
     /* compute final size of file, grab compressed data buffer and return */
     *pLen_out += 57;
-    MZ_FREE(pComp);
     return out_buf.m_pBuf;
 }
 void *tdefl_write_image_to_png_file_in_memory(const void *pImage, int w, int h, int num_chans, size_t *pLen_out)
@@ -2225,6 +2931,304 @@ void *tdefl_write_image_to_png_file_in_memory(const void *pImage, int w, int h,
     return tdefl_write_image_to_png_file_in_memory_ex(pImage, w, h, num_chans, pLen_out, 6, MZ_FALSE);
 }
 
+struct tdefl_png_writer_tag
+{
+    tdefl_compressor m_comp;
+    tdefl_put_buf_func_ptr m_pPut_buf_func;
+    void *m_pPut_buf_user;
+    int m_samples_per_line, m_bytes_per_line, m_bytes_per_pixel, m_bit_depth, m_rows_left;
+    mz_uint m_filter_level;
+    mz_bool m_failed;
+    /* The previous and current scanline as they'll be stored (16-bit samples big endian), and two rows for tdefl_png_filter_scanline(), all in m_pRow_buf */
+    mz_uint8 *m_pRow_buf, *m_pPrev_row, *m_pCur_row, *m_pBest, *m_pTrial;
+};
+
+/* Writes a PNG chunk: its length, type, data and the CRC-32 of type and data */
+static mz_bool tdefl_png_write_chunk(tdefl_png_writer *pWriter, const char *pType, const void *pData, int len)
+{
+    mz_uint8 hdr[8], crc[4];
+    mz_uint32 c;
+    int i;
+    for (i = 0; i < 4; i++)
+    {
+        hdr[i] = (mz_uint8)((mz_uint32)len >> (24 - i * 8));
+        hdr[4 + i] = (mz_uint8)pType[i];
+    }
+    c = (mz_uint32)mz_crc32(MZ_CRC32_INIT, hdr + 4, 4);
+    c = (mz_uint32)mz_crc32(c, (const mz_uint8 *)pData, len);
+    for (i = 0; i < 4; i++)
+        crc[i] = (mz_uint8)(c >> (24 - i * 8));
+    return (*pWriter->m_pPut_buf_func)(hdr, 8, pWriter->m_pPut_buf_user) &&
+           ((!len) || ((*pWriter->m_pPut_buf_func)(pData, len, pWriter->m_pPut_buf_user))) &&
+           (*pWriter->m_pPut_buf_func)(crc, 4, pWriter->m_pPut_buf_user);
+}
+
+/* The compressor's put buf callback: each buffer it flushes becomes an IDAT chunk */
+static mz_bool tdefl_png_writer_put_idat(const void *pBuf, int len, void *pUser)
+{
+    return tdefl_png_write_chunk((tdefl_png_writer *)pUser, "IDAT", pBuf, len);
+}
+
+tdefl_png_writer *tdefl_png_writer_begin(int w, int h, int num_chans, int bit_depth, const void *pPalette, int palette_size, mz_uint level, tdefl_put_buf_func_ptr pPut_buf_func, void *pPut_buf_user)
+{
+    static const mz_uint8 s_png_signature[8] = { 0x89, 0x50, 0x4e, 0x47, 0x0d, 0x0a, 0x1a, 0x0a };
+    static const mz_uint8 s_color_types[] = { 0, 0, 4, 2, 6 };
+    tdefl_png_writer *pWriter;
+    mz_uint8 ihdr[13], palette[256 * 3], alpha[256];
+    mz_bool status;
+    size_t row_size;
+    int i;
+
+    if ((w <= 0) || (h <= 0) || (num_chans < 1) || (num_chans > 4) || (!pPut_buf_func))
+        return NULL;
+    if (pPalette ? ((bit_depth != 8) || (num_chans < 3) || (palette_size < 1) || (palette_size > 256)) : ((bit_depth != 8) && (bit_depth != 16)))
+        return NULL;
+    /* The scanline size must fit an int, plus the filter type byte */
+    row_size = (size_t)w * (pPalette ? 1 : num_chans) * (bit_depth / 8);
+    if (row_size >= 0x7FFFFFFF)
+        return NULL;
+
+    if (NULL == (pWriter = (tdefl_png_writer *)MZ_MALLOC(sizeof(tdefl_png_writer))))
+        return NULL;
+    MZ_CLEAR_OBJ(*pWriter);
+    if (NULL == (pWriter->m_pRow_buf = (mz_uint8 *)MZ_MALLOC(row_size * 4)))
+    {
+        MZ_FREE(pWriter);
+        return NULL;
+    }
+    pWriter->m_pPrev_row = pWriter->m_pRow_buf;
+    pWriter->m_pCur_row = pWriter->m_pPrev_row + row_size;
+    pWriter->m_pBest = pWriter->m_pCur_row + row_size;
+    pWriter->m_pTrial = pWriter->m_pBest + row_size;
+    memset(pWriter->m_pPrev_row, 0, row_size);
+    pWriter->m_pPut_buf_func = pPut_buf_func;
+    pWriter->m_pPut_buf_user = pPut_buf_user;
+    pWriter->m_samples_per_line = w * (pPalette ? 1 : num_chans);
+    pWriter->m_bytes_per_line = (int)row_size;
+    pWriter->m_bytes_per_pixel = (pPalette ? 1 : num_chans) * (bit_depth / 8);
+    pWriter->m_bit_depth = bit_depth;
+    pWriter->m_rows_left = h;
+    /* Filtering rarely helps palette images, PNG's own recommendation is to leave them unfiltered */
+    pWriter->m_filter_level = pPalette ? 0 : level;
+
+    for (i = 0; i < 4; i++)
+    {
+        ihdr[i] = (mz_uint8)((mz_uint32)w >> (24 - i * 8));
+        ihdr[4 + i] = (mz_uint8)((mz_uint32)h >> (24 - i * 8));
+    }
+    ihdr[8] = (mz_uint8)bit_depth;
+    ihdr[9] = pPalette ? 3 : s_color_types[num_chans];
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;
+    status = (*pPut_buf_func)(s_png_signature, sizeof(s_png_signature), pPut_buf_user) && tdefl_png_write_chunk(pWriter, "IHDR", ihdr, sizeof(ihdr));
+
+    /* The palette's colors go into PLTE, and for RGBA entries their alpha into tRNS */
+    if ((status) && (pPalette))
+    {
+        for (i = 0; i < palette_size; i++)
+        {
+            memcpy(palette + i * 3, (const mz_uint8 *)pPalette + i * num_chans, 3);
+            alpha[i] = (num_chans == 4) ? ((const mz_uint8 *)pPalette)[i * num_chans + 3] : 0xFF;
+        }
+        status = tdefl_png_write_chunk(pWriter, "PLTE", palette, palette_size * 3);
+        if ((status) && (num_chans == 4))
+            status = tdefl_png_write_chunk(pWriter, "tRNS", alpha, palette_size);
+    }
+
+    if ((!status) || (tdefl_init(&pWriter->m_comp, tdefl_png_writer_put_idat, pWriter, tdefl_png_comp_flags(level)) != TDEFL_STATUS_OKAY))
+    {
+        MZ_FREE(pWriter->m_pRow_buf);
+        MZ_FREE(pWriter);
+        return NULL;
+    }
+    return pWriter;
+}
+
+mz_bool tdefl_png_writer_add_rows(tdefl_png_writer *pWriter, const void *pRows, int num_rows)
+{
+    int y, i;
+
+    if ((!pWriter) || (pWriter->m_failed))
+        return MZ_FALSE;
+    if ((num_rows < 0) || (num_rows > pWriter->m_rows_left) || ((num_rows) && (!pRows)))
+    {
+        pWriter->m_failed = MZ_TRUE;
+        return MZ_FALSE;
+    }
+
+    for (y = 0; y < num_rows; y++)
+    {
+        const mz_uint8 *pRow = (const mz_uint8 *)pRows + (size_t)y * pWriter->m_bytes_per_line;
+        const mz_uint8 *pData = pWriter->m_pCur_row;
+        mz_uint8 filter = 0, *pTemp;
+
+        /* 16-bit samples are stored big endian */
+        if (pWriter->m_bit_depth == 16)
+        {
+            const mz_uint16 *pSamples = (const mz_uint16 *)pRow;
+            for (i = 0; i < pWriter->m_samples_per_line; i++)
+            {
+                pWriter->m_pCur_row[i * 2] = (mz_uint8)(pSamples[i] >> 8);
+                pWriter->m_pCur_row[i * 2 + 1] = (mz_uint8)pSamples[i];
+            }
+        }
+        else
+            memcpy(pWriter->m_pCur_row, pRow, pWriter->m_bytes_per_line);
+
+        if (pWriter->m_filter_level)
+        {
+            filter = (mz_uint8)tdefl_png_filter_scanline(&pWriter->m_pBest, &pWriter->m_pTrial, pWriter->m_pCur_row, pWriter->m_pPrev_row, pWriter->m_bytes_per_line, pWriter->m_bytes_per_pixel, pWriter->m_filter_level);
+            pData = pWriter->m_pBest;
+        }
+
+        if ((tdefl_compress_buffer(&pWriter->m_comp, &filter, 1, TDEFL_NO_FLUSH) != TDEFL_STATUS_OKAY) ||
+            (tdefl_compress_buffer(&pWriter->m_comp, pData, pWriter->m_bytes_per_line, TDEFL_NO_FLUSH) != TDEFL_STATUS_OKAY))
+        {
+            pWriter->m_failed = MZ_TRUE;
+            return MZ_FALSE;
+        }
+
+        pTemp = pWriter->m_pPrev_row;
+        pWriter->m_pPrev_row = pWriter->m_pCur_row;
+        pWriter->m_pCur_row = pTemp;
+        pWriter->m_rows_left--;
+    }
+
+    return MZ_TRUE;
+}
+
+mz_bool tdefl_png_writer_end(tdefl_png_writer *pWriter)
+{
+    mz_bool status;
+
+    if (!pWriter)
+        return MZ_FALSE;
+
+    status = (!pWriter->m_failed) && (!pWriter->m_rows_left) &&
+             (tdefl_compress_buffer(&pWriter->m_comp, NULL, 0, TDEFL_FINISH) == TDEFL_STATUS_DONE) &&
+             (tdefl_png_write_chunk(pWriter, "IEND", NULL, 0));
+
+    MZ_FREE(pWriter->m_pRow_buf);
+    MZ_FREE(pWriter);
+    return status;
+}
+
+/* Writes smaller than this are copied and compressed together. */
+#define TDEFL_STREAM_WRITER_BUF_SIZE 4096U
+
+struct tdefl_stream_writer_tag
+{
+    tdefl_compressor m_comp;
+    mz_uint64 m_max_delay, m_oldest;
+    mz_bool m_pending, m_failed;
+    size_t m_buf_len;
+    mz_uint8 m_buf[TDEFL_STREAM_WRITER_BUF_SIZE];
+};
+
+static mz_bool tdefl_stream_writer_compress(tdefl_stream_writer *pWriter, const void *pBuf, size_t len, tdefl_flush flush)
+{
+    if (tdefl_compress_buffer(&pWriter->m_comp, pBuf, len, flush) < TDEFL_STATUS_OKAY)
+        pWriter->m_failed = MZ_TRUE;
+    return !pWriter->m_failed;
+}
+
+tdefl_stream_writer *tdefl_stream_writer_begin(int flags, mz_uint64 max_delay, tdefl_put_buf_func_ptr pPut_buf_func, void *pPut_buf_user)
+{
+    tdefl_stream_writer *pWriter;
+
+    if (!pPut_buf_func)
+        return NULL;
+    if (NULL == (pWriter = (tdefl_stream_writer *)MZ_MALLOC(sizeof(tdefl_stream_writer))))
+        return NULL;
+    if (tdefl_init(&pWriter->m_comp, pPut_buf_func, pPut_buf_user, flags) != TDEFL_STATUS_OKAY)
+    {
+        MZ_FREE(pWriter);
+        return NULL;
+    }
+    pWriter->m_max_delay = max_delay;
+    pWriter->m_oldest = 0;
+    pWriter->m_pending = pWriter->m_failed = MZ_FALSE;
+    pWriter->m_buf_len = 0;
+    return pWriter;
+}
+
+mz_bool tdefl_stream_writer_write(tdefl_stream_writer *pWriter, const void *pBuf, size_t len, mz_uint64 now)
+{
+    if ((!pWriter) || (pWriter->m_failed) || ((len) && (!pBuf)))
+        return MZ_FALSE;
+
+    if (len)
+    {
+        if (!pWriter->m_pending)
+        {
+            pWriter->m_pending = MZ_TRUE;
+            pWriter->m_oldest = now;
+        }
+        if (pWriter->m_buf_len + len > TDEFL_STREAM_WRITER_BUF_SIZE)
+        {
+            if (!tdefl_stream_writer_compress(pWriter, pWriter->m_buf, pWriter->m_buf_len, TDEFL_NO_FLUSH))
+                return MZ_FALSE;
+            pWriter->m_buf_len = 0;
+        }
+        if (len >= TDEFL_STREAM_WRITER_BUF_SIZE)
+        {
+            if (!tdefl_stream_writer_compress(pWriter, pBuf, len, TDEFL_NO_FLUSH))
+                return MZ_FALSE;
+        }
+        else
+        {
+            memcpy(pWriter->m_buf + pWriter->m_buf_len, pBuf, len);
+            pWriter->m_buf_len += len;
+        }
+    }
+
+    return tdefl_stream_writer_poll(pWriter, now);
+}
+
+mz_bool tdefl_stream_writer_poll(tdefl_stream_writer *pWriter, mz_uint64 now)
+{
+    if ((!pWriter) || (pWriter->m_failed))
+        return MZ_FALSE;
+    /* A clock that went backwards wraps around here and flushes, which is harmless. */
+    if ((pWriter->m_pending) && (now - pWriter->m_oldest >= pWriter->m_max_delay))
+        return tdefl_stream_writer_flush(pWriter);
+    return MZ_TRUE;
+}
+
+mz_bool tdefl_stream_writer_flush(tdefl_stream_writer *pWriter)
+{
+    if ((!pWriter) || (pWriter->m_failed))
+        return MZ_FALSE;
+    if (!pWriter->m_pending)
+        return MZ_TRUE;
+    if (!tdefl_stream_writer_compress(pWriter, pWriter->m_buf, pWriter->m_buf_len, TDEFL_PARTIAL_FLUSH))
+        return MZ_FALSE;
+    pWriter->m_buf_len = 0;
+    pWriter->m_pending = MZ_FALSE;
+    return MZ_TRUE;
+}
+
+mz_bool tdefl_stream_writer_deadline(const tdefl_stream_writer *pWriter, mz_uint64 *pDeadline)
+{
+    if ((!pWriter) || (!pWriter->m_pending) || (pWriter->m_failed))
+        return MZ_FALSE;
+    if (pDeadline)
+        *pDeadline = pWriter->m_oldest + pWriter->m_max_delay;
+    return MZ_TRUE;
+}
+
+mz_bool tdefl_stream_writer_end(tdefl_stream_writer *pWriter)
+{
+    mz_bool status;
+
+    if (!pWriter)
+        return MZ_FALSE;
+
+    status = (!pWriter->m_failed) && (tdefl_compress_buffer(&pWriter->m_comp, pWriter->m_buf, pWriter->m_buf_len, TDEFL_FINISH) == TDEFL_STATUS_DONE);
+
+    MZ_FREE(pWriter);
+    return status;
+}
+
 #ifndef MINIZ_NO_MALLOC
 /* Allocate the tdefl_compressor and tinfl_decompressor structures in C so that */
 /* non-C language bindings to tdefL_ and tinfl_ API don't need to worry about */
@@ -2288,6 +3292,16 @@ extern "C" {
 #define TINFL_MEMCPY(d, s, l) memcpy(d, s, l)
 #define TINFL_MEMSET(p, c, l) memset(p, c, l)
 
+/* MZ_TRUE once the first header byte shows a gzip member (a zlib CMF byte can't be 0x1F). */
+#define TINFL_IS_GZIP(r, decomp_flags) (((decomp_flags) & TINFL_FLAG_PARSE_GZIP_HEADER) && ((r)->m_zhdr0 == 0x1F))
+
+/* Wraps the statements that keep the MINIZ_STATS counters. */
+#ifdef MINIZ_STATS
+#define TINFL_STATS(x) x
+#else
+#define TINFL_STATS(x)
+#endif
+
 #define TINFL_CR_BEGIN  \
     switch (r->m_state) \
     {                   \
@@ -2476,11 +3490,62 @@ tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_nex
     TINFL_CR_BEGIN
 
     bit_buf = num_bits = dist = counter = num_extra = r->m_zhdr0 = r->m_zhdr1 = 0;
+    TINFL_STATS(memset(&r->m_stats, 0, sizeof(r->m_stats)));
     r->m_z_adler32 = r->m_check_adler32 = 1;
-    if (decomp_flags & TINFL_FLAG_PARSE_ZLIB_HEADER)
+    if (decomp_flags & (TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_PARSE_GZIP_HEADER))
     {
         TINFL_GET_BYTE(1, r->m_zhdr0);
         TINFL_GET_BYTE(2, r->m_zhdr1);
+    }
+    if (TINFL_IS_GZIP(r, decomp_flags))
+    {
+        /* ID1 and ID2 are in m_zhdr0/m_zhdr1, then CM, FLG, MTIME, XFL and OS, then the optional fields FLG announces. m_zhdr1 keeps FLG. */
+        TINFL_GET_BYTE(43, dist);
+        counter = (r->m_zhdr1 != 0x8B) || (dist != 8);
+        if (!(decomp_flags & TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF))
+            counter |= ((out_buf_size_mask + 1) < 32768U);
+        TINFL_GET_BYTE(44, r->m_zhdr1);
+        if ((counter) || (r->m_zhdr1 & 0xE0))
+        {
+            TINFL_CR_RETURN_FOREVER(45, TINFL_STATUS_FAILED);
+        }
+        for (counter = 0; counter < 6; counter++)
+        {
+            TINFL_GET_BYTE(46, dist);
+        }
+        if (r->m_zhdr1 & 4) /* FEXTRA */
+        {
+            TINFL_GET_BYTE(47, counter);
+            TINFL_GET_BYTE(48, dist);
+            for (counter |= dist << 8; counter; counter--)
+            {
+                TINFL_GET_BYTE(49, dist);
+            }
+        }
+        if (r->m_zhdr1 & 8) /* FNAME */
+        {
+            do
+            {
+                TINFL_GET_BYTE(50, dist);
+            } while (dist);
+        }
+        if (r->m_zhdr1 & 16) /* FCOMMENT */
+        {
+            do
+            {
+                TINFL_GET_BYTE(54, dist);
+            } while (dist);
+        }
+        if (r->m_zhdr1 & 2) /* FHCRC */
+        {
+            TINFL_GET_BYTE(55, dist);
+            TINFL_GET_BYTE(56, dist);
+        }
+        r->m_check_adler32 = MZ_CRC32_INIT;
+        r->m_gzip_isize = 0;
+    }
+    else if (decomp_flags & TINFL_FLAG_PARSE_ZLIB_HEADER)
+    {
         counter = (((r->m_zhdr0 * 256 + r->m_zhdr1) % 31 != 0) || (r->m_zhdr1 & 32) || ((r->m_zhdr0 & 15) != 8));
         if (!(decomp_flags & TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF))
             counter |= (((1U << (8U + (r->m_zhdr0 >> 4))) > 32768U) || ((out_buf_size_mask + 1) < (size_t)((size_t)1 << (8U + (r->m_zhdr0 >> 4)))));
@@ -2489,11 +3554,16 @@ tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_nex
             TINFL_CR_RETURN_FOREVER(36, TINFL_STATUS_FAILED);
         }
     }
+    else if (decomp_flags & TINFL_FLAG_PARSE_GZIP_HEADER)
+    {
+        TINFL_CR_RETURN_FOREVER(59, TINFL_STATUS_FAILED);
+    }
 
     do
     {
         TINFL_GET_BITS(3, r->m_final, 3);
         r->m_type = r->m_final >> 1;
+        TINFL_STATS(if (r->m_type < 3) r->m_stats.m_num_blocks[r->m_type]++);
         if (r->m_type == 0)
         {
             TINFL_SKIP_BITS(5, num_bits & 7);
@@ -2516,6 +3586,7 @@ tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_nex
                     TINFL_CR_RETURN(52, TINFL_STATUS_HAS_MORE_OUTPUT);
                 }
                 *pOut_buf_cur++ = (mz_uint8)dist;
+                TINFL_STATS(r->m_stats.m_stored_bytes++);
                 counter--;
             }
             while (counter)
@@ -2531,6 +3602,7 @@ tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_nex
                 }
                 n = MZ_MIN(MZ_MIN((size_t)(pOut_buf_end - pOut_buf_cur), (size_t)(pIn_buf_end - pIn_buf_cur)), counter);
                 TINFL_MEMCPY(pOut_buf_cur, pIn_buf_cur, n);
+                TINFL_STATS(r->m_stats.m_stored_bytes += n);
                 pIn_buf_cur += n;
                 pOut_buf_cur += n;
                 counter -= (mz_uint)n;
@@ -2684,6 +3756,7 @@ tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_nex
                             TINFL_CR_RETURN(24, TINFL_STATUS_HAS_MORE_OUTPUT);
                         }
                         *pOut_buf_cur++ = (mz_uint8)counter;
+                        TINFL_STATS(r->m_stats.m_num_literals++; r->m_stats.m_slow_path_bytes++);
                     }
                     else
                     {
@@ -2742,6 +3815,7 @@ tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_nex
                         num_bits -= code_len;
 
                         pOut_buf_cur[0] = (mz_uint8)counter;
+                        TINFL_STATS(r->m_stats.m_num_literals++);
                         if (sym2 & 256)
                         {
                             pOut_buf_cur++;
@@ -2749,6 +3823,7 @@ tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_nex
                             break;
                         }
                         pOut_buf_cur[1] = (mz_uint8)sym2;
+                        TINFL_STATS(r->m_stats.m_num_literals++);
                         pOut_buf_cur += 2;
                     }
                 }
@@ -2781,9 +3856,11 @@ tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_nex
                 }
 
                 pSrc = pOut_buf_start + ((dist_from_out_buf_start - dist) & out_buf_size_mask);
+                TINFL_STATS(r->m_stats.m_num_matches++);
 
                 if ((MZ_MAX(pOut_buf_cur, pSrc) + counter) > pOut_buf_end)
                 {
+                    TINFL_STATS(r->m_stats.m_slow_path_bytes += counter);
                     while (counter--)
                     {
                         while (pOut_buf_cur >= pOut_buf_end)
@@ -2852,7 +3929,23 @@ tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_nex
     bit_buf &= ~(~(tinfl_bit_buf_t)0 << num_bits);
     MZ_ASSERT(!num_bits); /* if this assert fires then we've read beyond the end of non-deflate/zlib streams with following data (such as gzip streams). */
 
-    if (decomp_flags & TINFL_FLAG_PARSE_ZLIB_HEADER)
+    if (TINFL_IS_GZIP(r, decomp_flags))
+    {
+        /* Little endian CRC-32 into m_z_adler32, then the size into m_zhdr1 */
+        for (counter = 0; counter < 8; ++counter)
+        {
+            mz_uint s;
+            if (num_bits)
+                TINFL_GET_BITS(57, s, 8);
+            else
+                TINFL_GET_BYTE(58, s);
+            if (counter < 4)
+                r->m_z_adler32 = (r->m_z_adler32 >> 8) | (s << 24);
+            else
+                r->m_zhdr1 = (r->m_zhdr1 >> 8) | (s << 24);
+        }
+    }
+    else if (decomp_flags & TINFL_FLAG_PARSE_ZLIB_HEADER)
     {
         for (counter = 0; counter < 4; ++counter)
         {
@@ -2888,7 +3981,19 @@ common_exit:
     r->m_dist_from_out_buf_start = dist_from_out_buf_start;
     *pIn_buf_size = pIn_buf_cur - pIn_buf_next;
     *pOut_buf_size = pOut_buf_cur - pOut_buf_next;
-    if ((decomp_flags & (TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_COMPUTE_ADLER32)) && (status >= 0))
+#ifdef MINIZ_STATS
+    r->m_stats.m_bytes_in += *pIn_buf_size;
+    r->m_stats.m_bytes_out += *pOut_buf_size;
+    r->m_stats.m_fast_path_bytes = r->m_stats.m_bytes_out - r->m_stats.m_stored_bytes - r->m_stats.m_slow_path_bytes;
+#endif
+    if ((TINFL_IS_GZIP(r, decomp_flags)) && (status >= 0))
+    {
+        r->m_check_adler32 = (mz_uint32)mz_crc32(r->m_check_adler32, pOut_buf_next, *pOut_buf_size);
+        r->m_gzip_isize += (mz_uint32)*pOut_buf_size;
+        if ((status == TINFL_STATUS_DONE) && ((r->m_check_adler32 != r->m_z_adler32) || (r->m_gzip_isize != r->m_zhdr1)))
+            status = TINFL_STATUS_ADLER32_MISMATCH;
+    }
+    else if ((decomp_flags & (TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_COMPUTE_ADLER32)) && (status >= 0))
     {
         const mz_uint8 *ptr = pOut_buf_next;
         size_t buf_len = *pOut_buf_size;
@@ -2921,6 +4026,19 @@ common_exit:
 }
 
 /* Higher level helper functions. */
+#ifdef MINIZ_STATS
+const tinfl_stats *tinfl_get_stats(const tinfl_decompressor *r)
+{
+    return &r->m_stats;
+}
+#endif
+
+/* MZ_TRUE if r just finished a gzip member and another one starts at pIn_buf. */
+static mz_bool tinfl_gzip_member_follows(const tinfl_decompressor *r, int flags, const void *pIn_buf, size_t in_buf_size)
+{
+    return (TINFL_IS_GZIP(r, flags)) && (in_buf_size) && (*(const mz_uint8 *)pIn_buf == 0x1F);
+}
+
 void *tinfl_decompress_mem_to_heap(const void *pSrc_buf, size_t src_buf_len, size_t *pOut_len, int flags)
 {
     tinfl_decompressor decomp;
@@ -2942,7 +4060,12 @@ void *tinfl_decompress_mem_to_heap(const void *pSrc_buf, size_t src_buf_len, siz
         src_buf_ofs += src_buf_size;
         *pOut_len += dst_buf_size;
         if (status == TINFL_STATUS_DONE)
-            break;
+        {
+            if (!tinfl_gzip_member_follows(&decomp, flags, (const mz_uint8 *)pSrc_buf + src_buf_ofs, src_buf_len - src_buf_ofs))
+                break;
+            tinfl_init(&decomp);
+            continue;
+        }
         new_out_buf_capacity = out_buf_capacity * 2;
         if (new_out_buf_capacity < 128)
             new_out_buf_capacity = 128;
@@ -2963,9 +4086,19 @@ size_t tinfl_decompress_mem_to_mem(void *pOut_buf, size_t out_buf_len, const voi
 {
     tinfl_decompressor decomp;
     tinfl_status status;
+    size_t src_buf_ofs = 0, out_buf_ofs = 0;
     tinfl_init(&decomp);
-    status = tinfl_decompress(&decomp, (const mz_uint8 *)pSrc_buf, &src_buf_len, (mz_uint8 *)pOut_buf, (mz_uint8 *)pOut_buf, &out_buf_len, (flags & ~TINFL_FLAG_HAS_MORE_INPUT) | TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF);
-    return (status != TINFL_STATUS_DONE) ? TINFL_DECOMPRESS_MEM_TO_MEM_FAILED : out_buf_len;
+    for (;;)
+    {
+        size_t src_buf_size = src_buf_len - src_buf_ofs, dst_buf_size = out_buf_len - out_buf_ofs;
+        status = tinfl_decompress(&decomp, (const mz_uint8 *)pSrc_buf + src_buf_ofs, &src_buf_size, (mz_uint8 *)pOut_buf, (mz_uint8 *)pOut_buf + out_buf_ofs, &dst_buf_size, (flags & ~TINFL_FLAG_HAS_MORE_INPUT) | TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF);
+        src_buf_ofs += src_buf_size;
+        out_buf_ofs += dst_buf_size;
+        if ((status != TINFL_STATUS_DONE) || (!tinfl_gzip_member_follows(&decomp, flags, (const mz_uint8 *)pSrc_buf + src_buf_ofs, src_buf_len - src_buf_ofs)))
+            break;
+        tinfl_init(&decomp);
+    }
+    return (status != TINFL_STATUS_DONE) ? TINFL_DECOMPRESS_MEM_TO_MEM_FAILED : out_buf_ofs;
 }
 
 int tinfl_decompress_mem_to_callback(const void *pIn_buf, size_t *pIn_buf_size, tinfl_put_buf_func_ptr pPut_buf_func, void *pPut_buf_user, int flags)
@@ -2986,7 +4119,9 @@ int tinfl_decompress_mem_to_callback(const void *pIn_buf, size_t *pIn_buf_size,
         in_buf_ofs += in_buf_size;
         if ((dst_buf_size) && (!(*pPut_buf_func)(pDict + dict_ofs, (int)dst_buf_size, pPut_buf_user)))
             break;
-        if (status != TINFL_STATUS_HAS_MORE_OUTPUT)
+        if ((status == TINFL_STATUS_DONE) && (tinfl_gzip_member_follows(&decomp, flags, (const mz_uint8 *)pIn_buf + in_buf_ofs, *pIn_buf_size - in_buf_ofs)))
+            tinfl_init(&decomp);
+        else if (status != TINFL_STATUS_HAS_MORE_OUTPUT)
         {
             result = (status == TINFL_STATUS_DONE);
             break;
@@ -3205,6 +4340,55 @@ static int mz_stat64(const char *path, struct __stat64 *buffer)
 #endif /* #ifdef _MSC_VER */
 #endif /* #ifdef MINIZ_NO_STDIO */
 
+/* Used to shrink archive files after entries were deleted or compacted away. */
+#if !defined(MINIZ_NO_STDIO) && !defined(MINIZ_NO_ARCHIVE_WRITING_APIS)
+#if defined(_WIN32)
+#include <io.h>
+#define MZ_FTRUNCATE(f, s) (_chsize_s(_fileno(f), (__int64)(s)) == 0)
+#elif (defined(__unix__) || defined(__APPLE__)) && !defined(__STRICT_ANSI__)
+#include <unistd.h>
+#define MZ_FTRUNCATE(f, s) (ftruncate(fileno(f), (off_t)(s)) == 0)
+#endif
+#endif
+
+/* On Linux, mz_zip_writer_add_from_zip_reader() can copy raw entry data between two stdio backed archives with copy_file_range()/sendfile() instead of a user space buffer. */
+/* Define MINIZ_NO_ZIP_KERNEL_COPY to always use the buffered path. */
+#if !defined(MINIZ_NO_STDIO) && !defined(MINIZ_NO_ARCHIVE_WRITING_APIS) && !defined(MINIZ_NO_ZIP_KERNEL_COPY) && defined(__linux__) && !defined(__STRICT_ANSI__)
+#define MINIZ_ZIP_KERNEL_COPY 1
+#include <errno.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#endif
+
+/* MINIZ_ZIP_ASYNC_IO is opt-in: on Linux it lets the batch extraction functions read ahead with io_uring, or a pool of pread() threads on kernels without it, while entries are being inflated. */
+/* Older C libraries need -pthread to link it. */
+#if defined(MINIZ_ZIP_ASYNC_IO) && (defined(MINIZ_NO_STDIO) || !defined(__linux__) || defined(__STRICT_ANSI__))
+#undef MINIZ_ZIP_ASYNC_IO
+#endif
+
+/* MINIZ_ZIP_THREADS is opt-in: mz_zip_validate_archive_parallel() then validates entries on a pool of POSIX threads instead of the calling thread alone. */
+#if defined(MINIZ_ZIP_THREADS) && ((!defined(__unix__) && !defined(__APPLE__)) || defined(__STRICT_ANSI__))
+#undef MINIZ_ZIP_THREADS
+#endif
+
+#ifdef MINIZ_ZIP_THREADS
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#ifdef MINIZ_ZIP_ASYNC_IO
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
 #define MZ_TOLOWER(c) ((((c) >= 'A') && ((c) <= 'Z')) ? ((c) - 'A' + 'a') : (c))
 
 /* Various ZIP archive enums. To completely avoid cross platform compiler alignment and platform endian issues, miniz.c doesn't use structs for any of this stuff. */
@@ -3228,6 +4412,22 @@ enum
     MZ_ZIP_DATA_DESCRIPTER_SIZE64 = 24,
     MZ_ZIP_DATA_DESCRIPTER_SIZE32 = 16,
 
+    /* mz_zip_internal_state::m_cd_entry_flags bits */
+    MZ_ZIP_CD_ENTRY_IS_DIRECTORY = 1,
+    MZ_ZIP_CD_ENTRY_IS_ENCRYPTED = 2,
+    MZ_ZIP_CD_ENTRY_IS_SUPPORTED = 4,
+    MZ_ZIP_CD_ENTRY_HAS_ZIP64_EXTRA = 8,
+
+    /* Lookup index trailer (MZ_ZIP_FLAG_WRITE_INDEX), immediately followed by the central directory */
+    MZ_ZIP_INDEX_TRAILER_SIG = 0x58495a4d, /* "MZIX" */
+    MZ_ZIP_INDEX_TRAILER_SIZE = 20,
+    MZ_ZIP_INDEX_VERSION = 1,
+    MZ_ZIP_INDEX_SIG_OFS = 0,           /* 4 bytes */
+    MZ_ZIP_INDEX_VERSION_OFS = 4,       /* 2 bytes */
+    MZ_ZIP_INDEX_TOTAL_ENTRIES_OFS = 8, /* 4 bytes */
+    MZ_ZIP_INDEX_CDIR_SIZE_OFS = 12,    /* 4 bytes */
+    MZ_ZIP_INDEX_CRC32_OFS = 16,        /* 4 bytes, of both tables */
+
     /* Central directory header record offsets */
     MZ_ZIP_CDH_SIG_OFS = 0,
     MZ_ZIP_CDH_VERSION_MADE_BY_OFS = 4,
@@ -3304,6 +4504,17 @@ typedef struct
     mz_uint m_element_size;
 } mz_zip_array;
 
+/* Where the compressed data of an entry added by mz_zip_writer_add_mem_ex_v2() lives, so later identical entries can copy it instead of compressing again. */
+typedef struct
+{
+    mz_uint64 m_uncomp_size;
+    mz_uint64 m_comp_size;
+    mz_uint64 m_data_ofs;
+    mz_uint64 m_hash;
+    mz_uint32 m_crc32;
+    mz_uint16 m_method;
+} mz_zip_writer_dedup_entry;
+
 struct mz_zip_internal_state_tag
 {
     mz_zip_array m_central_dir;
@@ -3319,6 +4530,36 @@ struct mz_zip_internal_state_tag
     /* MZ_TRUE if we found zip64 extended info in the central directory (m_zip64 will also be slammed to true too, even if we didn't find a zip64 end of central dir header, etc.) */
     mz_bool m_zip64_has_extended_info_fields;
 
+    /* Central dir records [0, m_num_indexed_files) have been validated and have valid offsets, the next record starts at m_next_central_dir_record_ofs. */
+    /* Only MZ_ZIP_FLAG_LAZY_CENTRAL_DIRECTORY readers (m_lazy_central_dir) ever see a partial index, m_sort_pending is set until they build the sorted offsets. */
+    mz_bool m_lazy_central_dir;
+    mz_bool m_sort_pending;
+    mz_uint32 m_num_indexed_files;
+    mz_uint32 m_next_central_dir_record_ofs;
+    mz_uint32 m_cdir_num_this_disk;
+    mz_uint32 m_num_lazy_lookups;
+
+    /* MZ_TRUE if the record offsets and sorted offsets came from the archive's persisted lookup index. Lazy readers then validate records individually, tracked by the m_validated_files bitmap. */
+    mz_bool m_index_loaded;
+    mz_zip_array m_validated_files;
+
+    /* Reader only: the central dir fields stat and extraction need, decoded into one array per field (MZ_ZIP_FLAG_DECODE_CENTRAL_DIRECTORY). */
+    /* mz_uint64 sizes and offsets with zip64 extra fields applied, and mz_uint8 MZ_ZIP_CD_ENTRY_* flags. m_cd_entry_flags is empty unless the whole central dir is decoded. */
+    mz_zip_array m_cd_comp_sizes;
+    mz_zip_array m_cd_uncomp_sizes;
+    mz_zip_array m_cd_local_header_ofs;
+    mz_zip_array m_cd_entry_flags;
+
+#ifndef MINIZ_NO_TIME
+    /* The last DOS date/time converted by mz_zip_file_stat_internal() */
+    mz_uint32 m_last_dos_date_time;
+    MZ_TIME_T m_last_time;
+    mz_bool m_have_last_time;
+#endif
+
+    /* Writer only: emit the lookup index before the central directory (MZ_ZIP_FLAG_WRITE_INDEX). */
+    mz_bool m_write_index;
+
     /* These fields are used by the file, FILE, memory, and memory/heap read/write helpers. */
     MZ_FILE *m_pFile;
     mz_uint64 m_file_archive_start_ofs;
@@ -3326,8 +4567,174 @@ struct mz_zip_internal_state_tag
     void *m_pMem;
     size_t m_mem_size;
     size_t m_mem_capacity;
+
+    /* Block pointers used by the chunked heap writer (MZ_ZIP_FLAG_WRITE_HEAP_CHUNKED). m_mem_size holds the logical archive size in this mode, m_pMem stays NULL. */
+    mz_zip_array m_heap_chunks;
+
+    /* Writer only: number of entries dropped by mz_zip_writer_delete_file(), and the dead space percentage that triggers compaction in mz_zip_writer_finalize_archive(). */
+    mz_uint32 m_num_deleted_files;
+    mz_uint m_compact_threshold;
+
+    /* MZ_TRUE if the archive may end up smaller than it was, so the file must be truncated when finalized. */
+    mz_bool m_truncate_on_finalize;
+
+    /* Writer only: fingerprints of the data added by mz_zip_writer_add_mem_ex_v2(), and an open addressing hash table (keyed by CRC-32) over them, for MZ_ZIP_FLAG_WRITE_DEDUPLICATE. */
+    mz_zip_array m_dedup_entries;
+    mz_zip_array m_dedup_table;
+    mz_bool m_dedup;
+
+#ifdef MINIZ_STATS
+    /* The counters returned by mz_zip_get_stats(), and where the last read and write ended, to count seeks. */
+    /* m_stats_reads_redirected is set while the batch extractor serves reads from its own buffer, those aren't I/O. */
+    mz_zip_stats m_stats;
+    mz_uint64 m_stats_read_end;
+    mz_uint64 m_stats_write_end;
+    mz_bool m_stats_reads_redirected;
+#endif
 };
 
+/* Wraps the statements that keep the MINIZ_STATS counters. */
+#ifdef MINIZ_STATS
+#define MZ_ZIP_STATS(x) x
+#else
+#define MZ_ZIP_STATS(x)
+#endif
+
+#ifdef MINIZ_STATS
+#ifndef MINIZ_NO_TIME
+#define MZ_ZIP_STATS_CLOCK() ((mz_uint64)clock())
+#else
+#define MZ_ZIP_STATS_CLOCK() 0
+#endif
+
+static void mz_zip_stats_count_read(mz_zip_internal_state *pState, mz_uint64 file_ofs, size_t n, mz_uint64 start_time)
+{
+    mz_zip_stats *pStats = &pState->m_stats;
+    pStats->m_num_reads++;
+    pStats->m_bytes_read += n;
+    if (file_ofs != pState->m_stats_read_end)
+        pStats->m_num_read_seeks++;
+    pState->m_stats_read_end = file_ofs + n;
+    pStats->m_io_clocks += MZ_ZIP_STATS_CLOCK() - start_time;
+}
+
+static void mz_zip_stats_count_alloc(mz_zip_internal_state *pState, size_t old_size, size_t new_size)
+{
+    mz_zip_stats *pStats = &pState->m_stats;
+    pStats->m_num_allocs++;
+    pStats->m_bytes_allocated += new_size;
+    pStats->m_cur_heap_size -= MZ_MIN(pStats->m_cur_heap_size, (mz_uint64)old_size);
+    pStats->m_cur_heap_size += new_size;
+    pStats->m_peak_heap_size = MZ_MAX(pStats->m_peak_heap_size, pStats->m_cur_heap_size);
+}
+
+/* The state whose counters a read through pZip->m_pRead should go to, if any. */
+static MZ_FORCEINLINE mz_zip_internal_state *mz_zip_stats_read_state(mz_zip_archive *pZip)
+{
+    return ((pZip->m_pState) && (!pZip->m_pState->m_stats_reads_redirected)) ? pZip->m_pState : NULL;
+}
+
+static size_t mz_zip_stats_read(mz_zip_internal_state *pState, mz_file_read_func pRead, void *pIO_opaque, mz_uint64 file_ofs, void *pBuf, size_t n)
+{
+    mz_uint64 start_time = MZ_ZIP_STATS_CLOCK();
+    size_t result = pRead(pIO_opaque, file_ofs, pBuf, n);
+    if (pState)
+        mz_zip_stats_count_read(pState, file_ofs, result, start_time);
+    return result;
+}
+
+#ifndef MINIZ_NO_ARCHIVE_WRITING_APIS
+static size_t mz_zip_stats_write(mz_zip_archive *pZip, mz_uint64 file_ofs, const void *pBuf, size_t n)
+{
+    mz_zip_internal_state *pState = pZip->m_pState;
+    mz_uint64 start_time = MZ_ZIP_STATS_CLOCK();
+    size_t result = pZip->m_pWrite(pZip->m_pIO_opaque, file_ofs, pBuf, n);
+    if (pState)
+    {
+        pState->m_stats.m_num_writes++;
+        pState->m_stats.m_bytes_written += result;
+        if (file_ofs != pState->m_stats_write_end)
+            pState->m_stats.m_num_write_seeks++;
+        pState->m_stats_write_end = file_ofs + result;
+        pState->m_stats.m_io_clocks += MZ_ZIP_STATS_CLOCK() - start_time;
+    }
+    return result;
+}
+#endif
+
+static void *mz_zip_stats_alloc(mz_zip_archive *pZip, size_t items, size_t size)
+{
+    void *p = pZip->m_pAlloc(pZip->m_pAlloc_opaque, items, size);
+    if ((p) && (pZip->m_pState))
+        mz_zip_stats_count_alloc(pZip->m_pState, 0, items * size);
+    return p;
+}
+
+static void *mz_zip_stats_realloc(mz_zip_archive *pZip, void *p, size_t old_size, size_t items, size_t size)
+{
+    void *pNew_p = pZip->m_pRealloc(pZip->m_pAlloc_opaque, p, items, size);
+    if ((pNew_p) && (pZip->m_pState))
+        mz_zip_stats_count_alloc(pZip->m_pState, old_size, items * size);
+    return pNew_p;
+}
+
+static void mz_zip_stats_free(mz_zip_archive *pZip, void *p, size_t size)
+{
+    if ((p) && (pZip->m_pState))
+        pZip->m_pState->m_stats.m_cur_heap_size -= MZ_MIN(pZip->m_pState->m_stats.m_cur_heap_size, (mz_uint64)size);
+    pZip->m_pFree(pZip->m_pAlloc_opaque, p);
+}
+
+static mz_ulong mz_zip_stats_crc32(mz_zip_archive *pZip, mz_ulong crc, const mz_uint8 *ptr, size_t buf_len)
+{
+    mz_uint64 start_time = MZ_ZIP_STATS_CLOCK();
+    crc = mz_crc32(crc, ptr, buf_len);
+    if (pZip->m_pState)
+        pZip->m_pState->m_stats.m_crc32_clocks += MZ_ZIP_STATS_CLOCK() - start_time;
+    return crc;
+}
+
+static tinfl_status mz_zip_stats_inflate(mz_zip_archive *pZip, tinfl_decompressor *r, const mz_uint8 *pIn_buf_next, size_t *pIn_buf_size, mz_uint8 *pOut_buf_start, mz_uint8 *pOut_buf_next, size_t *pOut_buf_size, const mz_uint32 decomp_flags)
+{
+    mz_uint64 start_time = MZ_ZIP_STATS_CLOCK();
+    tinfl_status status = tinfl_decompress(r, pIn_buf_next, pIn_buf_size, pOut_buf_start, pOut_buf_next, pOut_buf_size, decomp_flags);
+    if (pZip->m_pState)
+        pZip->m_pState->m_stats.m_inflate_clocks += MZ_ZIP_STATS_CLOCK() - start_time;
+    return status;
+}
+
+#ifndef MINIZ_NO_ARCHIVE_WRITING_APIS
+/* The compressor writes the archive from its output callback, that time goes to m_io_clocks instead. */
+static tdefl_status mz_zip_stats_deflate(mz_zip_archive *pZip, tdefl_compressor *d, const void *pIn_buf, size_t in_buf_size, tdefl_flush flush)
+{
+    mz_uint64 start_time = MZ_ZIP_STATS_CLOCK(), start_io_clocks = pZip->m_pState ? pZip->m_pState->m_stats.m_io_clocks : 0;
+    tdefl_status status = tdefl_compress_buffer(d, pIn_buf, in_buf_size, flush);
+    if (pZip->m_pState)
+        pZip->m_pState->m_stats.m_deflate_clocks += (MZ_ZIP_STATS_CLOCK() - start_time) - (pZip->m_pState->m_stats.m_io_clocks - start_io_clocks);
+    return status;
+}
+#endif
+
+#define MZ_ZIP_READ(pZip, file_ofs, pBuf, n) mz_zip_stats_read(mz_zip_stats_read_state(pZip), (pZip)->m_pRead, (pZip)->m_pIO_opaque, file_ofs, pBuf, n)
+#define MZ_ZIP_WRITE(pZip, file_ofs, pBuf, n) mz_zip_stats_write(pZip, file_ofs, pBuf, n)
+#define MZ_ZIP_ALLOC(pZip, items, size) mz_zip_stats_alloc(pZip, items, size)
+#define MZ_ZIP_REALLOC(pZip, p, old_size, items, size) mz_zip_stats_realloc(pZip, p, old_size, items, size)
+#define MZ_ZIP_FREE(pZip, p, size) mz_zip_stats_free(pZip, p, size)
+#define MZ_ZIP_CRC32(pZip, crc, ptr, buf_len) mz_zip_stats_crc32(pZip, crc, ptr, buf_len)
+#define MZ_ZIP_INFLATE(pZip, r, pIn_buf_next, pIn_buf_size, pOut_buf_start, pOut_buf_next, pOut_buf_size, decomp_flags) mz_zip_stats_inflate(pZip, r, pIn_buf_next, pIn_buf_size, pOut_buf_start, pOut_buf_next, pOut_buf_size, decomp_flags)
+#define MZ_ZIP_DEFLATE(pZip, d, pIn_buf, in_buf_size, flush) mz_zip_stats_deflate(pZip, d, pIn_buf, in_buf_size, flush)
+#else
+/* Without MINIZ_STATS these are the plain callback and library calls. The sizes passed to MZ_ZIP_REALLOC() and MZ_ZIP_FREE() are only used for the heap counters. */
+#define MZ_ZIP_READ(pZip, file_ofs, pBuf, n) (pZip)->m_pRead((pZip)->m_pIO_opaque, file_ofs, pBuf, n)
+#define MZ_ZIP_WRITE(pZip, file_ofs, pBuf, n) (pZip)->m_pWrite((pZip)->m_pIO_opaque, file_ofs, pBuf, n)
+#define MZ_ZIP_ALLOC(pZip, items, size) (pZip)->m_pAlloc((pZip)->m_pAlloc_opaque, items, size)
+#define MZ_ZIP_REALLOC(pZip, p, old_size, items, size) (pZip)->m_pRealloc((pZip)->m_pAlloc_opaque, p, items, size)
+#define MZ_ZIP_FREE(pZip, p, size) (pZip)->m_pFree((pZip)->m_pAlloc_opaque, p)
+#define MZ_ZIP_CRC32(pZip, crc, ptr, buf_len) mz_crc32(crc, ptr, buf_len)
+#define MZ_ZIP_INFLATE(pZip, r, pIn_buf_next, pIn_buf_size, pOut_buf_start, pOut_buf_next, pOut_buf_size, decomp_flags) tinfl_decompress(r, pIn_buf_next, pIn_buf_size, pOut_buf_start, pOut_buf_next, pOut_buf_size, decomp_flags)
+#define MZ_ZIP_DEFLATE(pZip, d, pIn_buf, in_buf_size, flush) tdefl_compress_buffer(d, pIn_buf, in_buf_size, flush)
+#endif
+
 #define MZ_ZIP_ARRAY_SET_ELEMENT_SIZE(array_ptr, element_size) (array_ptr)->m_element_size = element_size
 
 #if defined(DEBUG) || defined(_DEBUG)
@@ -3349,7 +4756,7 @@ static MZ_FORCEINLINE void mz_zip_array_init(mz_zip_array *pArray, mz_uint32 ele
 
 static MZ_FORCEINLINE void mz_zip_array_clear(mz_zip_archive *pZip, mz_zip_array *pArray)
 {
-    pZip->m_pFree(pZip->m_pAlloc_opaque, pArray->m_p);
+    MZ_ZIP_FREE(pZip, pArray->m_p, pArray->m_capacity * pArray->m_element_size);
     memset(pArray, 0, sizeof(mz_zip_array));
 }
 
@@ -3366,7 +4773,7 @@ static mz_bool mz_zip_array_ensure_capacity(mz_zip_archive *pZip, mz_zip_array *
         while (new_capacity < min_new_capacity)
             new_capacity *= 2;
     }
-    if (NULL == (pNew_p = pZip->m_pRealloc(pZip->m_pAlloc_opaque, pArray->m_p, pArray->m_element_size, new_capacity)))
+    if (NULL == (pNew_p = MZ_ZIP_REALLOC(pZip, pArray->m_p, pArray->m_capacity * pArray->m_element_size, pArray->m_element_size, new_capacity)))
         return MZ_FALSE;
     pArray->m_p = pNew_p;
     pArray->m_capacity = new_capacity;
@@ -3504,9 +4911,15 @@ static mz_bool mz_zip_reader_init_internal(mz_zip_archive *pZip, mz_uint flags)
         return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
 
     memset(pZip->m_pState, 0, sizeof(mz_zip_internal_state));
+    MZ_ZIP_STATS(mz_zip_stats_count_alloc(pZip->m_pState, 0, sizeof(mz_zip_internal_state)));
     MZ_ZIP_ARRAY_SET_ELEMENT_SIZE(&pZip->m_pState->m_central_dir, sizeof(mz_uint8));
     MZ_ZIP_ARRAY_SET_ELEMENT_SIZE(&pZip->m_pState->m_central_dir_offsets, sizeof(mz_uint32));
     MZ_ZIP_ARRAY_SET_ELEMENT_SIZE(&pZip->m_pState->m_sorted_central_dir_offsets, sizeof(mz_uint32));
+    MZ_ZIP_ARRAY_SET_ELEMENT_SIZE(&pZip->m_pState->m_validated_files, sizeof(mz_uint8));
+    MZ_ZIP_ARRAY_SET_ELEMENT_SIZE(&pZip->m_pState->m_cd_comp_sizes, sizeof(mz_uint64));
+    MZ_ZIP_ARRAY_SET_ELEMENT_SIZE(&pZip->m_pState->m_cd_uncomp_sizes, sizeof(mz_uint64));
+    MZ_ZIP_ARRAY_SET_ELEMENT_SIZE(&pZip->m_pState->m_cd_local_header_ofs, sizeof(mz_uint64));
+    MZ_ZIP_ARRAY_SET_ELEMENT_SIZE(&pZip->m_pState->m_cd_entry_flags, sizeof(mz_uint8));
     pZip->m_pState->m_init_flags = flags;
     pZip->m_pState->m_zip64 = MZ_FALSE;
     pZip->m_pState->m_zip64_has_extended_info_fields = MZ_FALSE;
@@ -3544,21 +4957,14 @@ static MZ_FORCEINLINE mz_bool mz_zip_reader_filename_less(const mz_zip_array *pC
     }                        \
     MZ_MACRO_END
 
-/* Heap sort of lowercased filenames, used to help accelerate plain central directory searches by mz_zip_reader_locate_file(). (Could also use qsort(), but it could allocate memory.) */
-static void mz_zip_reader_sort_central_dir_offsets_by_filename(mz_zip_archive *pZip)
+/* Heap sort of pIndices[0..size) by mz_zip_reader_filename_less(), needs no memory or stack */
+static void mz_zip_reader_heap_sort_indices(const mz_zip_array *pCentral_dir, const mz_zip_array *pCentral_dir_offsets, mz_uint32 *pIndices, mz_uint32 size)
 {
-    mz_zip_internal_state *pState = pZip->m_pState;
-    const mz_zip_array *pCentral_dir_offsets = &pState->m_central_dir_offsets;
-    const mz_zip_array *pCentral_dir = &pState->m_central_dir;
-    mz_uint32 *pIndices;
     mz_uint32 start, end;
-    const mz_uint32 size = pZip->m_total_files;
 
     if (size <= 1U)
         return;
 
-    pIndices = &MZ_ZIP_ARRAY_ELEMENT(&pState->m_sorted_central_dir_offsets, mz_uint32, 0);
-
     start = (size - 2U) >> 1U;
     for (;;)
     {
@@ -3597,6 +5003,171 @@ static void mz_zip_reader_sort_central_dir_offsets_by_filename(mz_zip_archive *p
     }
 }
 
+/* The central dir sort works on these: up to 8 case folded filename bytes from some depth on, packed big endian, so comparing keys orders names like mz_zip_reader_filename_less() does. */
+typedef struct
+{
+    mz_uint64 m_key;
+    mz_uint32 m_index;
+} mz_zip_sort_key;
+
+/* Below this many names, an insertion sort with full filename compares beats another radix pass */
+#define MZ_ZIP_SORT_INSERTION_THRESHOLD 16
+
+/* Each radix level recurses once per 8 name bytes, ties this deep go to the heap sort instead so long shared prefixes can't blow the stack */
+#define MZ_ZIP_SORT_MAX_RADIX_DEPTH 256
+
+/* LSD radix sort on m_key, skipping the byte positions every key has in common. pTemp must hold n keys. */
+static void mz_zip_radix_sort_keys(mz_zip_sort_key *pKeys, mz_zip_sort_key *pTemp, mz_uint32 n)
+{
+    mz_uint32 hist[8][256];
+    mz_zip_sort_key *pSrc = pKeys, *pDst = pTemp, *pT;
+    mz_uint32 i, pass;
+
+    memset(hist, 0, sizeof(hist));
+    for (i = 0; i < n; i++)
+    {
+        mz_uint64 key = pKeys[i].m_key;
+        for (pass = 0; pass < 8; pass++)
+            hist[pass][(key >> (pass * 8)) & 0xFF]++;
+    }
+
+    for (pass = 0; pass < 8; pass++)
+    {
+        mz_uint32 *pHist = hist[pass], total = 0;
+        const mz_uint shift = pass * 8;
+
+        if (pHist[(pSrc[0].m_key >> shift) & 0xFF] == n)
+            continue;
+
+        for (i = 0; i < 256; i++)
+        {
+            mz_uint32 count = pHist[i];
+            pHist[i] = total;
+            total += count;
+        }
+
+        for (i = 0; i < n; i++)
+            pDst[pHist[(pSrc[i].m_key >> shift) & 0xFF]++] = pSrc[i];
+
+        pT = pSrc;
+        pSrc = pDst;
+        pDst = pT;
+    }
+
+    if (pSrc != pKeys)
+        memcpy(pKeys, pSrc, n * sizeof(mz_zip_sort_key));
+}
+
+/* MSD radix sort in 8 byte steps: sorts the keys (of names that match up to depth) by the next 8 bytes of their names, then each run of ties by the 8 after that. */
+static void mz_zip_reader_sort_keys(const mz_zip_array *pCentral_dir_array, const mz_zip_array *pCentral_dir_offsets, mz_zip_sort_key *pKeys, mz_zip_sort_key *pTemp, mz_uint32 n, mz_uint depth)
+{
+    mz_uint32 i, j, max_len = 0;
+
+    if (n < 2)
+        return;
+
+    if (depth >= MZ_ZIP_SORT_MAX_RADIX_DEPTH)
+    {
+        /* pTemp holds n keys, plenty of room for n indices */
+        mz_uint32 *pIndices = (mz_uint32 *)pTemp;
+        for (i = 0; i < n; i++)
+            pIndices[i] = pKeys[i].m_index;
+        mz_zip_reader_heap_sort_indices(pCentral_dir_array, pCentral_dir_offsets, pIndices, n);
+        for (i = 0; i < n; i++)
+            pKeys[i].m_index = pIndices[i];
+        return;
+    }
+
+    if (n <= MZ_ZIP_SORT_INSERTION_THRESHOLD)
+    {
+        for (i = 1; i < n; i++)
+        {
+            mz_zip_sort_key key = pKeys[i];
+            for (j = i; (j > 0) && (mz_zip_reader_filename_less(pCentral_dir_array, pCentral_dir_offsets, key.m_index, pKeys[j - 1].m_index)); j--)
+                pKeys[j] = pKeys[j - 1];
+            pKeys[j] = key;
+        }
+        return;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        const mz_uint8 *p = &MZ_ZIP_ARRAY_ELEMENT(pCentral_dir_array, mz_uint8, MZ_ZIP_ARRAY_ELEMENT(pCentral_dir_offsets, mz_uint32, pKeys[i].m_index));
+        mz_uint len = MZ_READ_LE16(p + MZ_ZIP_CDH_FILENAME_LEN_OFS), k, end = MZ_MIN(len, depth + 8);
+        mz_uint64 key = 0;
+
+        p += MZ_ZIP_CENTRAL_DIR_HEADER_SIZE;
+        for (k = depth; k < end; k++)
+            key = (key << 8) | (mz_uint8)MZ_TOLOWER(p[k]);
+        pKeys[i].m_key = (k > depth) ? (key << ((depth + 8 - k) * 8)) : 0;
+        max_len = MZ_MAX(max_len, len);
+    }
+
+    if (depth >= max_len)
+    {
+        /* All names end here, the ones still tied only differ in length (trailing NUL bytes) */
+        for (i = 0; i < n; i++)
+            pKeys[i].m_key = MZ_READ_LE16(&MZ_ZIP_ARRAY_ELEMENT(pCentral_dir_array, mz_uint8, MZ_ZIP_ARRAY_ELEMENT(pCentral_dir_offsets, mz_uint32, pKeys[i].m_index)) + MZ_ZIP_CDH_FILENAME_LEN_OFS);
+        mz_zip_radix_sort_keys(pKeys, pTemp, n);
+        return;
+    }
+
+    mz_zip_radix_sort_keys(pKeys, pTemp, n);
+
+    for (i = 0; i < n; i = j)
+    {
+        for (j = i + 1; (j < n) && (pKeys[j].m_key == pKeys[i].m_key); j++)
+            ;
+        if (j - i > 1)
+            mz_zip_reader_sort_keys(pCentral_dir_array, pCentral_dir_offsets, pKeys + i, pTemp, j - i, depth + 8);
+    }
+}
+
+/* Radix sort of lowercased filenames into m_sorted_central_dir_offsets, returns MZ_FALSE if it couldn't allocate its keys. */
+static mz_bool mz_zip_reader_radix_sort_central_dir_offsets(mz_zip_archive *pZip)
+{
+    mz_zip_internal_state *pState = pZip->m_pState;
+    const mz_uint32 size = pZip->m_total_files;
+    mz_uint32 *pIndices = &MZ_ZIP_ARRAY_ELEMENT(&pState->m_sorted_central_dir_offsets, mz_uint32, 0);
+    mz_zip_sort_key *pKeys;
+    mz_uint32 i;
+
+    /* Can't overflow, two keys take less memory than the central dir record they're for */
+    if (NULL == (pKeys = (mz_zip_sort_key *)MZ_ZIP_ALLOC(pZip, (size_t)size * 2, sizeof(mz_zip_sort_key))))
+        return MZ_FALSE;
+
+    for (i = 0; i < size; i++)
+        pKeys[i].m_index = pIndices[i];
+
+    mz_zip_reader_sort_keys(&pState->m_central_dir, &pState->m_central_dir_offsets, pKeys, pKeys + size, size, 0);
+
+    for (i = 0; i < size; i++)
+        pIndices[i] = pKeys[i].m_index;
+
+    MZ_ZIP_FREE(pZip, pKeys, (size_t)size * 2 * sizeof(mz_zip_sort_key));
+    return MZ_TRUE;
+}
+
+/* Heap sort of lowercased filenames, used to help accelerate plain central directory searches by mz_zip_reader_locate_file(). (Could also use qsort(), but it could allocate memory.) */
+/* The radix sort above is a lot faster on large archives, this is the fallback if it can't allocate. */
+static void mz_zip_reader_sort_central_dir_offsets_by_filename(mz_zip_archive *pZip)
+{
+    mz_zip_internal_state *pState = pZip->m_pState;
+    const mz_zip_array *pCentral_dir_offsets = &pState->m_central_dir_offsets;
+    const mz_zip_array *pCentral_dir = &pState->m_central_dir;
+    mz_uint32 *pIndices;
+    const mz_uint32 size = pZip->m_total_files;
+
+    if (size <= 1U)
+        return;
+
+    if (mz_zip_reader_radix_sort_central_dir_offsets(pZip))
+        return;
+
+    pIndices = &MZ_ZIP_ARRAY_ELEMENT(&pState->m_sorted_central_dir_offsets, mz_uint32, 0);
+    mz_zip_reader_heap_sort_indices(pCentral_dir, pCentral_dir_offsets, pIndices, size);
+}
+
 static mz_bool mz_zip_reader_locate_header_sig(mz_zip_archive *pZip, mz_uint32 record_sig, mz_uint32 record_size, mz_int64 *pOfs)
 {
     mz_int64 cur_file_ofs;
@@ -3613,7 +5184,7 @@ static mz_bool mz_zip_reader_locate_header_sig(mz_zip_archive *pZip, mz_uint32 r
     {
         int i, n = (int)MZ_MIN(sizeof(buf_u32), pZip->m_archive_size - cur_file_ofs);
 
-        if (pZip->m_pRead(pZip->m_pIO_opaque, cur_file_ofs, pBuf, n) != (mz_uint)n)
+        if (MZ_ZIP_READ(pZip, cur_file_ofs, pBuf, n) != (mz_uint)n)
             return MZ_FALSE;
 
         for (i = n - 4; i >= 0; --i)
@@ -3643,60 +5214,363 @@ static mz_bool mz_zip_reader_locate_header_sig(mz_zip_archive *pZip, mz_uint32 r
     return MZ_TRUE;
 }
 
-static mz_bool mz_zip_reader_read_central_dir(mz_zip_archive *pZip, mz_uint flags)
+static mz_bool mz_zip_reader_index_central_dir_record(mz_zip_archive *pZip, mz_uint32 file_index);
+
+/* Sanity checks a single central directory record, which has n bytes of central directory left after it starts. */
+static mz_bool mz_zip_reader_validate_central_dir_record(mz_zip_archive *pZip, const mz_uint8 *p, mz_uint n, mz_uint *pTotal_header_size)
 {
-    mz_uint cdir_size = 0, cdir_entries_on_this_disk = 0, num_this_disk = 0, cdir_disk_index = 0;
-    mz_uint64 cdir_ofs = 0;
-    mz_int64 cur_file_ofs = 0;
-    const mz_uint8 *p;
+    mz_zip_internal_state *pState = pZip->m_pState;
+    mz_uint total_header_size, disk_index, bit_flags, filename_size, ext_data_size;
+    mz_uint64 comp_size, decomp_size, local_header_ofs;
 
-    mz_uint32 buf_u32[4096 / sizeof(mz_uint32)];
-    mz_uint8 *pBuf = (mz_uint8 *)buf_u32;
-    mz_bool sort_central_dir = ((flags & MZ_ZIP_FLAG_DO_NOT_SORT_CENTRAL_DIRECTORY) == 0);
-    mz_uint32 zip64_end_of_central_dir_locator_u32[(MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE + sizeof(mz_uint32) - 1) / sizeof(mz_uint32)];
-    mz_uint8 *pZip64_locator = (mz_uint8 *)zip64_end_of_central_dir_locator_u32;
+    if ((n < MZ_ZIP_CENTRAL_DIR_HEADER_SIZE) || (MZ_READ_LE32(p) != MZ_ZIP_CENTRAL_DIR_HEADER_SIG))
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
 
-    mz_uint32 zip64_end_of_central_dir_header_u32[(MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE + sizeof(mz_uint32) - 1) / sizeof(mz_uint32)];
-    mz_uint8 *pZip64_end_of_central_dir = (mz_uint8 *)zip64_end_of_central_dir_header_u32;
+    comp_size = MZ_READ_LE32(p + MZ_ZIP_CDH_COMPRESSED_SIZE_OFS);
+    decomp_size = MZ_READ_LE32(p + MZ_ZIP_CDH_DECOMPRESSED_SIZE_OFS);
+    local_header_ofs = MZ_READ_LE32(p + MZ_ZIP_CDH_LOCAL_HEADER_OFS);
+    filename_size = MZ_READ_LE16(p + MZ_ZIP_CDH_FILENAME_LEN_OFS);
+    ext_data_size = MZ_READ_LE16(p + MZ_ZIP_CDH_EXTRA_LEN_OFS);
 
-    mz_uint64 zip64_end_of_central_dir_ofs = 0;
+    if ((!pState->m_zip64_has_extended_info_fields) &&
+        (ext_data_size) &&
+        (MZ_MAX(MZ_MAX(comp_size, decomp_size), local_header_ofs) == MZ_UINT32_MAX))
+    {
+        /* Attempt to find zip64 extended information field in the entry's extra data */
+        mz_uint32 extra_size_remaining = ext_data_size;
 
-    /* Basic sanity checks - reject files which are too small, and check the first 4 bytes of the file to make sure a local header is there. */
-    if (pZip->m_archive_size < MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIZE)
-        return mz_zip_set_error(pZip, MZ_ZIP_NOT_AN_ARCHIVE);
+        if (extra_size_remaining)
+        {
+					const mz_uint8 *pExtra_data;
+					void* buf = NULL;
 
-    if (!mz_zip_reader_locate_header_sig(pZip, MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIG, MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIZE, &cur_file_ofs))
-        return mz_zip_set_error(pZip, MZ_ZIP_FAILED_FINDING_CENTRAL_DIR);
+					if (MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + filename_size + ext_data_size > n)
+					{
+						buf = MZ_MALLOC(ext_data_size);
+						if(buf==NULL)
+							return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
 
-    /* Read and verify the end of central directory record. */
-    if (pZip->m_pRead(pZip->m_pIO_opaque, cur_file_ofs, pBuf, MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIZE) != MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIZE)
-        return mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
+						if (MZ_ZIP_READ(pZip, pZip->m_central_directory_file_ofs + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + filename_size, buf, ext_data_size) != ext_data_size)
+						{
+							MZ_FREE(buf);
+							return mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
+						}
 
-    if (MZ_READ_LE32(pBuf + MZ_ZIP_ECDH_SIG_OFS) != MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIG)
-        return mz_zip_set_error(pZip, MZ_ZIP_NOT_AN_ARCHIVE);
+						pExtra_data = (mz_uint8*)buf;
+					}
+					else
+					{
+						pExtra_data = p + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + filename_size;
+					}
 
-    if (cur_file_ofs >= (MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE + MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE))
-    {
-        if (pZip->m_pRead(pZip->m_pIO_opaque, cur_file_ofs - MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE, pZip64_locator, MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE) == MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE)
-        {
-            if (MZ_READ_LE32(pZip64_locator + MZ_ZIP64_ECDL_SIG_OFS) == MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIG)
+            do
             {
-                zip64_end_of_central_dir_ofs = MZ_READ_LE64(pZip64_locator + MZ_ZIP64_ECDL_REL_OFS_TO_ZIP64_ECDR_OFS);
-                if (zip64_end_of_central_dir_ofs > (pZip->m_archive_size - MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE))
-                    return mz_zip_set_error(pZip, MZ_ZIP_NOT_AN_ARCHIVE);
+                mz_uint32 field_id;
+                mz_uint32 field_data_size;
 
-                if (pZip->m_pRead(pZip->m_pIO_opaque, zip64_end_of_central_dir_ofs, pZip64_end_of_central_dir, MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE) == MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE)
-                {
-                    if (MZ_READ_LE32(pZip64_end_of_central_dir + MZ_ZIP64_ECDH_SIG_OFS) == MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIG)
-                    {
-                        pZip->m_pState->m_zip64 = MZ_TRUE;
-                    }
-                }
-            }
-        }
-    }
+						if (extra_size_remaining < (sizeof(mz_uint16) * 2))
+						{
+							MZ_FREE(buf);
+							return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
+						}
 
-    pZip->m_total_files = MZ_READ_LE16(pBuf + MZ_ZIP_ECDH_CDIR_TOTAL_ENTRIES_OFS);
+                field_id = MZ_READ_LE16(pExtra_data);
+                field_data_size = MZ_READ_LE16(pExtra_data + sizeof(mz_uint16));
+
+						if ((field_data_size + sizeof(mz_uint16) * 2) > extra_size_remaining)
+						{
+							MZ_FREE(buf);
+							return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
+						}
+
+                if (field_id == MZ_ZIP64_EXTENDED_INFORMATION_FIELD_HEADER_ID)
+                {
+                    /* Ok, the archive didn't have any zip64 headers but it uses a zip64 extended information field so mark it as zip64 anyway (this can occur with infozip's zip util when it reads compresses files from stdin). */
+                    pState->m_zip64 = MZ_TRUE;
+                    pState->m_zip64_has_extended_info_fields = MZ_TRUE;
+                    break;
+                }
+
+                pExtra_data += sizeof(mz_uint16) * 2 + field_data_size;
+                extra_size_remaining = extra_size_remaining - sizeof(mz_uint16) * 2 - field_data_size;
+            } while (extra_size_remaining);
+
+					MZ_FREE(buf);
+        }
+    }
+
+    /* I've seen archives that aren't marked as zip64 that uses zip64 ext data, argh */
+    if ((comp_size != MZ_UINT32_MAX) && (decomp_size != MZ_UINT32_MAX))
+    {
+        if (((!MZ_READ_LE32(p + MZ_ZIP_CDH_METHOD_OFS)) && (decomp_size != comp_size)) || (decomp_size && !comp_size))
+            return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
+    }
+
+    disk_index = MZ_READ_LE16(p + MZ_ZIP_CDH_DISK_START_OFS);
+    if ((disk_index == MZ_UINT16_MAX) || ((disk_index != pState->m_cdir_num_this_disk) && (disk_index != 1)))
+        return mz_zip_set_error(pZip, MZ_ZIP_UNSUPPORTED_MULTIDISK);
+
+    if (comp_size != MZ_UINT32_MAX)
+    {
+        if (((mz_uint64)MZ_READ_LE32(p + MZ_ZIP_CDH_LOCAL_HEADER_OFS) + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + comp_size) > pZip->m_archive_size)
+            return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
+    }
+
+    bit_flags = MZ_READ_LE16(p + MZ_ZIP_CDH_BIT_FLAG_OFS);
+    if (bit_flags & MZ_ZIP_GENERAL_PURPOSE_BIT_FLAG_LOCAL_DIR_IS_MASKED)
+        return mz_zip_set_error(pZip, MZ_ZIP_UNSUPPORTED_ENCRYPTION);
+
+    if ((*pTotal_header_size = total_header_size = MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + MZ_READ_LE16(p + MZ_ZIP_CDH_FILENAME_LEN_OFS) + MZ_READ_LE16(p + MZ_ZIP_CDH_EXTRA_LEN_OFS) + MZ_READ_LE16(p + MZ_ZIP_CDH_COMMENT_LEN_OFS)) > n)
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
+
+
+    return MZ_TRUE;
+}
+
+/* Validates central directory records and records their offsets, up to (but not including) entry num_files. Records are parsed in order, so this picks up where the last call stopped. */
+/* If the offsets came from a persisted index (m_validated_files is in use), the records are only validated. */
+static mz_bool mz_zip_reader_index_central_dir(mz_zip_archive *pZip, mz_uint32 num_files)
+{
+    mz_zip_internal_state *pState = pZip->m_pState;
+    const mz_uint8 *p = (const mz_uint8 *)pState->m_central_dir.m_p + pState->m_next_central_dir_record_ofs;
+    mz_uint n = (mz_uint)pState->m_central_dir.m_size - pState->m_next_central_dir_record_ofs;
+    mz_uint total_header_size;
+    mz_uint32 i;
+
+    if (pState->m_validated_files.m_size)
+    {
+        for (i = pState->m_num_indexed_files; i < num_files; ++i)
+        {
+            if (!mz_zip_reader_index_central_dir_record(pZip, i))
+                return MZ_FALSE;
+        }
+
+        if (num_files == pZip->m_total_files)
+            pState->m_num_indexed_files = num_files;
+        return MZ_TRUE;
+    }
+
+    for (i = pState->m_num_indexed_files; i < num_files; ++i)
+    {
+        mz_uint32 record_ofs = (mz_uint32)(p - (const mz_uint8 *)pState->m_central_dir.m_p);
+
+        if (!mz_zip_reader_validate_central_dir_record(pZip, p, n, &total_header_size))
+            return MZ_FALSE;
+
+        /* An index loaded by the eager reader is only trusted if it matches the records */
+        if ((pState->m_index_loaded) && (MZ_ZIP_ARRAY_ELEMENT(&pState->m_central_dir_offsets, mz_uint32, i) != record_ofs))
+            pState->m_index_loaded = MZ_FALSE;
+
+        MZ_ZIP_ARRAY_ELEMENT(&pState->m_central_dir_offsets, mz_uint32, i) = record_ofs;
+
+        n -= total_header_size;
+        p += total_header_size;
+
+        pState->m_num_indexed_files = i + 1;
+        pState->m_next_central_dir_record_ofs = (mz_uint32)(p - (const mz_uint8 *)pState->m_central_dir.m_p);
+    }
+
+    return MZ_TRUE;
+}
+
+/* Makes sure central dir record file_index has been validated and its offset is known. */
+static mz_bool mz_zip_reader_index_central_dir_record(mz_zip_archive *pZip, mz_uint32 file_index)
+{
+    mz_zip_internal_state *pState = pZip->m_pState;
+    mz_uint8 *pValidated = (mz_uint8 *)pState->m_validated_files.m_p;
+    mz_uint32 record_ofs;
+    mz_uint total_header_size;
+
+    if (!pState->m_validated_files.m_size)
+        return mz_zip_reader_index_central_dir(pZip, file_index + 1);
+
+    /* With a persisted index, any record can be validated on its own */
+    if (pValidated[file_index >> 3] & (1 << (file_index & 7)))
+        return MZ_TRUE;
+
+    record_ofs = MZ_ZIP_ARRAY_ELEMENT(&pState->m_central_dir_offsets, mz_uint32, file_index);
+    if (!mz_zip_reader_validate_central_dir_record(pZip, (const mz_uint8 *)pState->m_central_dir.m_p + record_ofs, (mz_uint)pState->m_central_dir.m_size - record_ofs, &total_header_size))
+        return MZ_FALSE;
+
+    pValidated[file_index >> 3] |= (mz_uint8)(1 << (file_index & 7));
+    return MZ_TRUE;
+}
+
+/* Builds the sorted central dir offsets used by mz_zip_locate_file_binary_search(). */
+static mz_bool mz_zip_reader_sort_central_dir(mz_zip_archive *pZip)
+{
+    mz_zip_internal_state *pState = pZip->m_pState;
+    mz_uint32 i;
+
+    pState->m_sort_pending = MZ_FALSE;
+
+    if (!mz_zip_reader_index_central_dir(pZip, pZip->m_total_files))
+        return MZ_FALSE;
+
+    if (!mz_zip_array_resize(pZip, &pState->m_sorted_central_dir_offsets, pZip->m_total_files, MZ_FALSE))
+        return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+
+    for (i = 0; i < pZip->m_total_files; i++)
+        MZ_ZIP_ARRAY_ELEMENT(&pState->m_sorted_central_dir_offsets, mz_uint32, i) = i;
+
+    mz_zip_reader_sort_central_dir_offsets_by_filename(pZip);
+    return MZ_TRUE;
+}
+
+static mz_bool mz_zip_reader_decode_central_dir(mz_zip_archive *pZip);
+
+static void mz_zip_reader_clear_decoded_central_dir(mz_zip_archive *pZip, mz_zip_internal_state *pState)
+{
+    mz_zip_array_clear(pZip, &pState->m_cd_comp_sizes);
+    mz_zip_array_clear(pZip, &pState->m_cd_uncomp_sizes);
+    mz_zip_array_clear(pZip, &pState->m_cd_local_header_ofs);
+    mz_zip_array_clear(pZip, &pState->m_cd_entry_flags);
+}
+
+/* Loads the lookup index written by MZ_ZIP_FLAG_WRITE_INDEX: the central dir record offsets and the sorted offsets, stored right before the central directory and followed by a trailer. */
+/* Anything unexpected just means the archive is treated as if it had no index. */
+static mz_bool mz_zip_reader_load_index(mz_zip_archive *pZip, mz_uint64 cdir_ofs, mz_uint32 cdir_size)
+{
+    mz_zip_internal_state *pState = pZip->m_pState;
+    mz_uint32 trailer_u32[MZ_ZIP_INDEX_TRAILER_SIZE / sizeof(mz_uint32)];
+    mz_uint8 *pTrailer = (mz_uint8 *)trailer_u32;
+    const mz_uint32 total_files = pZip->m_total_files;
+    const mz_uint64 table_size = (mz_uint64)total_files * sizeof(mz_uint32);
+    const size_t seen_size = ((size_t)total_files + 7) >> 3;
+    mz_uint32 *pOffsets, *pSorted, index_crc32, i;
+    mz_uint8 *pSeen;
+
+    if (cdir_ofs < MZ_ZIP_INDEX_TRAILER_SIZE + table_size * 2)
+        return MZ_FALSE;
+
+    if (MZ_ZIP_READ(pZip, cdir_ofs - MZ_ZIP_INDEX_TRAILER_SIZE, pTrailer, MZ_ZIP_INDEX_TRAILER_SIZE) != MZ_ZIP_INDEX_TRAILER_SIZE)
+        return MZ_FALSE;
+
+    if ((MZ_READ_LE32(pTrailer + MZ_ZIP_INDEX_SIG_OFS) != MZ_ZIP_INDEX_TRAILER_SIG) || (MZ_READ_LE16(pTrailer + MZ_ZIP_INDEX_VERSION_OFS) != MZ_ZIP_INDEX_VERSION) ||
+        (MZ_READ_LE32(pTrailer + MZ_ZIP_INDEX_TOTAL_ENTRIES_OFS) != total_files) || (MZ_READ_LE32(pTrailer + MZ_ZIP_INDEX_CDIR_SIZE_OFS) != cdir_size))
+        return MZ_FALSE;
+
+    if (!mz_zip_array_resize(pZip, &pState->m_sorted_central_dir_offsets, total_files, MZ_FALSE))
+        return MZ_FALSE;
+
+    pOffsets = (mz_uint32 *)pState->m_central_dir_offsets.m_p;
+    pSorted = (mz_uint32 *)pState->m_sorted_central_dir_offsets.m_p;
+
+    if ((MZ_ZIP_READ(pZip, cdir_ofs - MZ_ZIP_INDEX_TRAILER_SIZE - table_size * 2, pOffsets, (size_t)table_size) != table_size) ||
+        (MZ_ZIP_READ(pZip, cdir_ofs - MZ_ZIP_INDEX_TRAILER_SIZE - table_size, pSorted, (size_t)table_size) != table_size))
+        goto invalid_index;
+
+    index_crc32 = (mz_uint32)MZ_ZIP_CRC32(pZip, MZ_CRC32_INIT, (const mz_uint8 *)pOffsets, (size_t)table_size);
+    index_crc32 = (mz_uint32)MZ_ZIP_CRC32(pZip, index_crc32, (const mz_uint8 *)pSorted, (size_t)table_size);
+    if (index_crc32 != MZ_READ_LE32(pTrailer + MZ_ZIP_INDEX_CRC32_OFS))
+        goto invalid_index;
+
+    /* The sorted offsets must be a permutation, a repeated entry would hide another one from lookups. pSeen has a bit per entry. */
+    if (NULL == (pSeen = (mz_uint8 *)MZ_ZIP_ALLOC(pZip, 1, seen_size)))
+        goto invalid_index;
+    memset(pSeen, 0, seen_size);
+
+    for (i = 0; i < total_files; i++)
+    {
+#if !MINIZ_LITTLE_ENDIAN
+        pOffsets[i] = MZ_READ_LE32(&pOffsets[i]);
+        pSorted[i] = MZ_READ_LE32(&pSorted[i]);
+#endif
+        if ((pSorted[i] >= total_files) || (pSeen[pSorted[i] >> 3] & (1U << (pSorted[i] & 7))) || (pOffsets[i] > cdir_size - MZ_ZIP_CENTRAL_DIR_HEADER_SIZE) || ((i) && (pOffsets[i] <= pOffsets[i - 1])) || ((!i) && (pOffsets[i])))
+            break;
+        pSeen[pSorted[i] >> 3] |= (mz_uint8)(1U << (pSorted[i] & 7));
+    }
+
+    MZ_ZIP_FREE(pZip, pSeen, seen_size);
+    if (i < total_files)
+        goto invalid_index;
+
+    /* The binary search reads filenames straight out of the central dir before the records are validated, so each record must at least fit before the next one */
+    for (i = 0; i < total_files; i++)
+    {
+        const mz_uint8 *p = (const mz_uint8 *)pState->m_central_dir.m_p + pOffsets[i];
+        mz_uint32 record_end = (i + 1 < total_files) ? pOffsets[i + 1] : cdir_size;
+        if ((mz_uint64)pOffsets[i] + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + MZ_READ_LE16(p + MZ_ZIP_CDH_FILENAME_LEN_OFS) + MZ_READ_LE16(p + MZ_ZIP_CDH_EXTRA_LEN_OFS) + MZ_READ_LE16(p + MZ_ZIP_CDH_COMMENT_LEN_OFS) > record_end)
+            goto invalid_index;
+    }
+
+    pState->m_index_loaded = MZ_TRUE;
+    return MZ_TRUE;
+
+invalid_index:
+    mz_zip_array_resize(pZip, &pState->m_sorted_central_dir_offsets, 0, MZ_FALSE);
+    return MZ_FALSE;
+}
+
+/* Checks the sorted offsets loaded from a persisted index against the filenames, in one pass. */
+static mz_bool mz_zip_reader_index_is_sorted(mz_zip_archive *pZip)
+{
+    mz_zip_internal_state *pState = pZip->m_pState;
+    const mz_uint32 *pSorted = (const mz_uint32 *)pState->m_sorted_central_dir_offsets.m_p;
+    mz_uint32 i;
+
+    for (i = 1; i < pZip->m_total_files; i++)
+    {
+        if (mz_zip_reader_filename_less(&pState->m_central_dir, &pState->m_central_dir_offsets, pSorted[i], pSorted[i - 1]))
+            return MZ_FALSE;
+    }
+
+    return MZ_TRUE;
+}
+
+static mz_bool mz_zip_reader_read_central_dir(mz_zip_archive *pZip, mz_uint flags)
+{
+    mz_uint cdir_size = 0, cdir_entries_on_this_disk = 0, num_this_disk = 0, cdir_disk_index = 0;
+    mz_uint64 cdir_ofs = 0;
+    mz_int64 cur_file_ofs = 0;
+
+    mz_uint32 buf_u32[4096 / sizeof(mz_uint32)];
+    mz_uint8 *pBuf = (mz_uint8 *)buf_u32;
+    mz_bool sort_central_dir = ((flags & MZ_ZIP_FLAG_DO_NOT_SORT_CENTRAL_DIRECTORY) == 0);
+    mz_uint32 zip64_end_of_central_dir_locator_u32[(MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE + sizeof(mz_uint32) - 1) / sizeof(mz_uint32)];
+    mz_uint8 *pZip64_locator = (mz_uint8 *)zip64_end_of_central_dir_locator_u32;
+
+    mz_uint32 zip64_end_of_central_dir_header_u32[(MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE + sizeof(mz_uint32) - 1) / sizeof(mz_uint32)];
+    mz_uint8 *pZip64_end_of_central_dir = (mz_uint8 *)zip64_end_of_central_dir_header_u32;
+
+    mz_uint64 zip64_end_of_central_dir_ofs = 0;
+
+    /* Basic sanity checks - reject files which are too small, and check the first 4 bytes of the file to make sure a local header is there. */
+    if (pZip->m_archive_size < MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIZE)
+        return mz_zip_set_error(pZip, MZ_ZIP_NOT_AN_ARCHIVE);
+
+    if (!mz_zip_reader_locate_header_sig(pZip, MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIG, MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIZE, &cur_file_ofs))
+        return mz_zip_set_error(pZip, MZ_ZIP_FAILED_FINDING_CENTRAL_DIR);
+
+    /* Read and verify the end of central directory record. */
+    if (MZ_ZIP_READ(pZip, cur_file_ofs, pBuf, MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIZE) != MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIZE)
+        return mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
+
+    if (MZ_READ_LE32(pBuf + MZ_ZIP_ECDH_SIG_OFS) != MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIG)
+        return mz_zip_set_error(pZip, MZ_ZIP_NOT_AN_ARCHIVE);
+
+    if (cur_file_ofs >= (MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE + MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE))
+    {
+        if (MZ_ZIP_READ(pZip, cur_file_ofs - MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE, pZip64_locator, MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE) == MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE)
+        {
+            if (MZ_READ_LE32(pZip64_locator + MZ_ZIP64_ECDL_SIG_OFS) == MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIG)
+            {
+                zip64_end_of_central_dir_ofs = MZ_READ_LE64(pZip64_locator + MZ_ZIP64_ECDL_REL_OFS_TO_ZIP64_ECDR_OFS);
+                if (zip64_end_of_central_dir_ofs > (pZip->m_archive_size - MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE))
+                    return mz_zip_set_error(pZip, MZ_ZIP_NOT_AN_ARCHIVE);
+
+                if (MZ_ZIP_READ(pZip, zip64_end_of_central_dir_ofs, pZip64_end_of_central_dir, MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE) == MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE)
+                {
+                    if (MZ_READ_LE32(pZip64_end_of_central_dir + MZ_ZIP64_ECDH_SIG_OFS) == MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIG)
+                    {
+                        pZip->m_pState->m_zip64 = MZ_TRUE;
+                    }
+                }
+            }
+        }
+    }
+
+    pZip->m_total_files = MZ_READ_LE16(pBuf + MZ_ZIP_ECDH_CDIR_TOTAL_ENTRIES_OFS);
     cdir_entries_on_this_disk = MZ_READ_LE16(pBuf + MZ_ZIP_ECDH_CDIR_NUM_ENTRIES_ON_DISK_OFS);
     num_this_disk = MZ_READ_LE16(pBuf + MZ_ZIP_ECDH_NUM_THIS_DISK_OFS);
     cdir_disk_index = MZ_READ_LE16(pBuf + MZ_ZIP_ECDH_NUM_DISK_CDIR_OFS);
@@ -3754,151 +5628,240 @@ static mz_bool mz_zip_reader_read_central_dir(mz_zip_archive *pZip, mz_uint flag
         return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
 
     pZip->m_central_directory_file_ofs = cdir_ofs;
+    pZip->m_pState->m_cdir_num_this_disk = num_this_disk;
 
     if (pZip->m_total_files)
     {
-        mz_uint i, n;
-        /* Read the entire central directory into a heap block, and allocate another heap block to hold the unsorted central dir file record offsets, and possibly another to hold the sorted indices. */
+        /* Read the entire central directory into a heap block, and allocate another heap block to hold the unsorted central dir file record offsets. */
         if ((!mz_zip_array_resize(pZip, &pZip->m_pState->m_central_dir, cdir_size, MZ_FALSE)) ||
             (!mz_zip_array_resize(pZip, &pZip->m_pState->m_central_dir_offsets, pZip->m_total_files, MZ_FALSE)))
             return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
 
-        if (sort_central_dir)
-        {
-            if (!mz_zip_array_resize(pZip, &pZip->m_pState->m_sorted_central_dir_offsets, pZip->m_total_files, MZ_FALSE))
-                return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
-        }
-
-        if (pZip->m_pRead(pZip->m_pIO_opaque, cdir_ofs, pZip->m_pState->m_central_dir.m_p, cdir_size) != cdir_size)
+        if (MZ_ZIP_READ(pZip, cdir_ofs, pZip->m_pState->m_central_dir.m_p, cdir_size) != cdir_size)
             return mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
 
-        /* Now create an index into the central directory file records, do some basic sanity checking on each record */
-        p = (const mz_uint8 *)pZip->m_pState->m_central_dir.m_p;
-        for (n = cdir_size, i = 0; i < pZip->m_total_files; ++i)
+        /* Pick up the archive's persisted lookup index (MZ_ZIP_FLAG_WRITE_INDEX), if it has one */
+        if ((sort_central_dir) || (flags & MZ_ZIP_FLAG_LAZY_CENTRAL_DIRECTORY))
+            mz_zip_reader_load_index(pZip, cdir_ofs, cdir_size);
+
+        /* In lazy mode records are validated and indexed as they're first accessed, and the sorted offsets are only built once lookups by name make it worthwhile. */
+        if (flags & MZ_ZIP_FLAG_LAZY_CENTRAL_DIRECTORY)
         {
-            mz_uint total_header_size, disk_index, bit_flags, filename_size, ext_data_size;
-            mz_uint64 comp_size, decomp_size, local_header_ofs;
+            pZip->m_pState->m_lazy_central_dir = MZ_TRUE;
 
-            if ((n < MZ_ZIP_CENTRAL_DIR_HEADER_SIZE) || (MZ_READ_LE32(p) != MZ_ZIP_CENTRAL_DIR_HEADER_SIG))
-                return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
+            if (pZip->m_pState->m_index_loaded)
+            {
+                /* Every record offset is already known, so records can be validated one at a time, in any order */
+                mz_uint32 validated_size = (pZip->m_total_files + 7) >> 3;
+                if (!mz_zip_array_resize(pZip, &pZip->m_pState->m_validated_files, validated_size, MZ_FALSE))
+                    return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+                memset(pZip->m_pState->m_validated_files.m_p, 0, validated_size);
 
-            MZ_ZIP_ARRAY_ELEMENT(&pZip->m_pState->m_central_dir_offsets, mz_uint32, i) = (mz_uint32)(p - (const mz_uint8 *)pZip->m_pState->m_central_dir.m_p);
+                if (!sort_central_dir)
+                    mz_zip_array_resize(pZip, &pZip->m_pState->m_sorted_central_dir_offsets, 0, MZ_FALSE);
+            }
+            else
+                pZip->m_pState->m_sort_pending = sort_central_dir;
 
-            if (sort_central_dir)
-                MZ_ZIP_ARRAY_ELEMENT(&pZip->m_pState->m_sorted_central_dir_offsets, mz_uint32, i) = i;
+            return MZ_TRUE;
+        }
 
-            comp_size = MZ_READ_LE32(p + MZ_ZIP_CDH_COMPRESSED_SIZE_OFS);
-            decomp_size = MZ_READ_LE32(p + MZ_ZIP_CDH_DECOMPRESSED_SIZE_OFS);
-            local_header_ofs = MZ_READ_LE32(p + MZ_ZIP_CDH_LOCAL_HEADER_OFS);
-            filename_size = MZ_READ_LE16(p + MZ_ZIP_CDH_FILENAME_LEN_OFS);
-            ext_data_size = MZ_READ_LE16(p + MZ_ZIP_CDH_EXTRA_LEN_OFS);
+        /* Now create an index into the central directory file records, do some basic sanity checking on each record */
+        if (!mz_zip_reader_index_central_dir(pZip, pZip->m_total_files))
+            return MZ_FALSE;
 
-            if ((!pZip->m_pState->m_zip64_has_extended_info_fields) &&
-                (ext_data_size) &&
-                (MZ_MAX(MZ_MAX(comp_size, decomp_size), local_header_ofs) == MZ_UINT32_MAX))
+        if (sort_central_dir)
+        {
+            /* A persisted index saves sorting if it matches the central dir */
+            if ((!pZip->m_pState->m_index_loaded) || (!mz_zip_reader_index_is_sorted(pZip)))
             {
-                /* Attempt to find zip64 extended information field in the entry's extra data */
-                mz_uint32 extra_size_remaining = ext_data_size;
+                if (!mz_zip_reader_sort_central_dir(pZip))
+                    return MZ_FALSE;
+            }
+        }
 
-                if (extra_size_remaining)
-                {
-					const mz_uint8 *pExtra_data;
-					void* buf = NULL;
+        if ((flags & MZ_ZIP_FLAG_DECODE_CENTRAL_DIRECTORY) && (!mz_zip_reader_decode_central_dir(pZip)))
+            return MZ_FALSE;
+    }
 
-					if (MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + filename_size + ext_data_size > n)
-					{
-						buf = MZ_MALLOC(ext_data_size);
-						if(buf==NULL)
-							return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+    return MZ_TRUE;
+}
 
-						if (pZip->m_pRead(pZip->m_pIO_opaque, cdir_ofs + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + filename_size, buf, ext_data_size) != ext_data_size)
-						{
-							MZ_FREE(buf);
-							return mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
-						}
+void mz_zip_zero_struct(mz_zip_archive *pZip)
+{
+    if (pZip)
+        MZ_CLEAR_PTR(pZip);
+}
 
-						pExtra_data = (mz_uint8*)buf;
-					}
-					else
-					{
-						pExtra_data = p + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + filename_size;
-					}
+/* Every arena allocation is preceded by its size, padded so the returned memory stays suitably aligned. */
+#define MZ_ZIP_ARENA_ALIGN 16
+#define MZ_ZIP_ARENA_ROUND_UP(n) (((n) + (MZ_ZIP_ARENA_ALIGN - 1)) & ~(size_t)(MZ_ZIP_ARENA_ALIGN - 1))
 
-                    do
-                    {
-                        mz_uint32 field_id;
-                        mz_uint32 field_data_size;
+typedef struct mz_zip_arena_block_tag
+{
+    struct mz_zip_arena_block_tag *m_pNext;
+    size_t m_size;
+} mz_zip_arena_block;
 
-						if (extra_size_remaining < (sizeof(mz_uint16) * 2))
-						{
-							MZ_FREE(buf);
-							return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
-						}
+#define MZ_ZIP_ARENA_BLOCK_HEADER_SIZE MZ_ZIP_ARENA_ROUND_UP(sizeof(mz_zip_arena_block))
 
-                        field_id = MZ_READ_LE16(pExtra_data);
-                        field_data_size = MZ_READ_LE16(pExtra_data + sizeof(mz_uint16));
+void mz_zip_arena_init(mz_zip_arena *pArena, size_t block_size)
+{
+    if (!pArena)
+        return;
 
-						if ((field_data_size + sizeof(mz_uint16) * 2) > extra_size_remaining)
-						{
-							MZ_FREE(buf);
-							return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
-						}
+    MZ_CLEAR_PTR(pArena);
+    pArena->m_block_size = block_size ? block_size : (size_t)MZ_ZIP_ARENA_BLOCK_SIZE;
+}
 
-                        if (field_id == MZ_ZIP64_EXTENDED_INFORMATION_FIELD_HEADER_ID)
-                        {
-                            /* Ok, the archive didn't have any zip64 headers but it uses a zip64 extended information field so mark it as zip64 anyway (this can occur with infozip's zip util when it reads compresses files from stdin). */
-                            pZip->m_pState->m_zip64 = MZ_TRUE;
-                            pZip->m_pState->m_zip64_has_extended_info_fields = MZ_TRUE;
-                            break;
-                        }
+static void *mz_zip_arena_alloc_func(void *pOpaque, size_t items, size_t size)
+{
+    mz_zip_arena *pArena = (mz_zip_arena *)pOpaque;
+    size_t n, needed;
+    mz_uint8 *p;
 
-                        pExtra_data += sizeof(mz_uint16) * 2 + field_data_size;
-                        extra_size_remaining = extra_size_remaining - sizeof(mz_uint16) * 2 - field_data_size;
-                    } while (extra_size_remaining);
+    if ((size) && (items > (size_t)-1 / size))
+        return NULL;
+    n = items * size;
+    if (n > (size_t)-1 - MZ_ZIP_ARENA_BLOCK_HEADER_SIZE - MZ_ZIP_ARENA_ALIGN * 2)
+        return NULL;
+    needed = MZ_ZIP_ARENA_ALIGN + MZ_ZIP_ARENA_ROUND_UP(n);
 
-					MZ_FREE(buf);
-                }
-            }
+    if (pArena->m_cur_size - pArena->m_cur_ofs < needed)
+    {
+        size_t block_size = MZ_MAX(pArena->m_block_size, needed);
+        mz_zip_arena_block *pBlock = (mz_zip_arena_block *)MZ_MALLOC(MZ_ZIP_ARENA_BLOCK_HEADER_SIZE + block_size);
+        if (!pBlock)
+            return NULL;
 
-            /* I've seen archives that aren't marked as zip64 that uses zip64 ext data, argh */
-            if ((comp_size != MZ_UINT32_MAX) && (decomp_size != MZ_UINT32_MAX))
-            {
-                if (((!MZ_READ_LE32(p + MZ_ZIP_CDH_METHOD_OFS)) && (decomp_size != comp_size)) || (decomp_size && !comp_size))
-                    return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
-            }
+        pBlock->m_pNext = (mz_zip_arena_block *)pArena->m_pBlocks;
+        pBlock->m_size = block_size;
+        pArena->m_pBlocks = pBlock;
+        pArena->m_pCur = (mz_uint8 *)pBlock + MZ_ZIP_ARENA_BLOCK_HEADER_SIZE;
+        pArena->m_cur_ofs = 0;
+        pArena->m_cur_size = block_size;
+    }
 
-            disk_index = MZ_READ_LE16(p + MZ_ZIP_CDH_DISK_START_OFS);
-            if ((disk_index == MZ_UINT16_MAX) || ((disk_index != num_this_disk) && (disk_index != 1)))
-                return mz_zip_set_error(pZip, MZ_ZIP_UNSUPPORTED_MULTIDISK);
+    p = pArena->m_pCur + pArena->m_cur_ofs;
+    *(size_t *)p = n;
+    p += MZ_ZIP_ARENA_ALIGN;
+    pArena->m_cur_ofs += needed;
+    pArena->m_pLast = p;
 
-            if (comp_size != MZ_UINT32_MAX)
-            {
-                if (((mz_uint64)MZ_READ_LE32(p + MZ_ZIP_CDH_LOCAL_HEADER_OFS) + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + comp_size) > pZip->m_archive_size)
-                    return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
-            }
+    return p;
+}
 
-            bit_flags = MZ_READ_LE16(p + MZ_ZIP_CDH_BIT_FLAG_OFS);
-            if (bit_flags & MZ_ZIP_GENERAL_PURPOSE_BIT_FLAG_LOCAL_DIR_IS_MASKED)
-                return mz_zip_set_error(pZip, MZ_ZIP_UNSUPPORTED_ENCRYPTION);
+static void mz_zip_arena_free_func(void *pOpaque, void *address)
+{
+    mz_zip_arena *pArena = (mz_zip_arena *)pOpaque;
 
-            if ((total_header_size = MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + MZ_READ_LE16(p + MZ_ZIP_CDH_FILENAME_LEN_OFS) + MZ_READ_LE16(p + MZ_ZIP_CDH_EXTRA_LEN_OFS) + MZ_READ_LE16(p + MZ_ZIP_CDH_COMMENT_LEN_OFS)) > n)
-                return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
+    /* Only the most recent allocation can be given back, which covers the temporary buffers extraction frees right away */
+    if ((address) && (address == pArena->m_pLast))
+    {
+        pArena->m_cur_ofs = (size_t)((mz_uint8 *)address - MZ_ZIP_ARENA_ALIGN - pArena->m_pCur);
+        pArena->m_pLast = NULL;
+    }
+}
+
+static void *mz_zip_arena_realloc_func(void *pOpaque, void *address, size_t items, size_t size)
+{
+    mz_zip_arena *pArena = (mz_zip_arena *)pOpaque;
+    size_t old_size, n;
+    void *pNew;
 
-            n -= total_header_size;
-            p += total_header_size;
+    if (!address)
+        return mz_zip_arena_alloc_func(pOpaque, items, size);
+
+    if ((size) && (items > (size_t)-1 / size))
+        return NULL;
+    n = items * size;
+    old_size = *(size_t *)((mz_uint8 *)address - MZ_ZIP_ARENA_ALIGN);
+
+    /* Grow the most recent allocation in place if the block has room */
+    if ((address == pArena->m_pLast) && (n <= (size_t)-1 - MZ_ZIP_ARENA_ALIGN * 2))
+    {
+        size_t ofs = (size_t)((mz_uint8 *)address - pArena->m_pCur);
+        if (pArena->m_cur_size - ofs >= MZ_ZIP_ARENA_ROUND_UP(n))
+        {
+            *(size_t *)((mz_uint8 *)address - MZ_ZIP_ARENA_ALIGN) = n;
+            pArena->m_cur_ofs = ofs + MZ_ZIP_ARENA_ROUND_UP(n);
+            return address;
         }
     }
 
-    if (sort_central_dir)
-        mz_zip_reader_sort_central_dir_offsets_by_filename(pZip);
+    if (NULL == (pNew = mz_zip_arena_alloc_func(pOpaque, items, size)))
+        return NULL;
+    memcpy(pNew, address, MZ_MIN(old_size, n));
 
-    return MZ_TRUE;
+    return pNew;
 }
 
-void mz_zip_zero_struct(mz_zip_archive *pZip)
+void mz_zip_arena_attach(mz_zip_arena *pArena, mz_zip_archive *pZip)
 {
-    if (pZip)
-        MZ_CLEAR_PTR(pZip);
+    if ((!pArena) || (!pZip))
+        return;
+
+    pZip->m_pAlloc = mz_zip_arena_alloc_func;
+    pZip->m_pFree = mz_zip_arena_free_func;
+    pZip->m_pRealloc = mz_zip_arena_realloc_func;
+    pZip->m_pAlloc_opaque = pArena;
+}
+
+void mz_zip_arena_reset(mz_zip_arena *pArena)
+{
+    mz_zip_arena_block *pBlock, *pKeep = NULL;
+
+    if (!pArena)
+        return;
+
+    /* Keep one regular sized block, oversized ones were for one-off large allocations */
+    for (pBlock = (mz_zip_arena_block *)pArena->m_pBlocks; pBlock; pBlock = pBlock->m_pNext)
+    {
+        if (pBlock->m_size == pArena->m_block_size)
+            pKeep = pBlock;
+    }
+
+    pBlock = (mz_zip_arena_block *)pArena->m_pBlocks;
+    while (pBlock)
+    {
+        mz_zip_arena_block *pNext = pBlock->m_pNext;
+        if (pBlock != pKeep)
+            MZ_FREE(pBlock);
+        pBlock = pNext;
+    }
+
+    pArena->m_pBlocks = pKeep;
+    pArena->m_pLast = NULL;
+    pArena->m_cur_ofs = 0;
+    if (pKeep)
+    {
+        pKeep->m_pNext = NULL;
+        pArena->m_pCur = (mz_uint8 *)pKeep + MZ_ZIP_ARENA_BLOCK_HEADER_SIZE;
+        pArena->m_cur_size = pKeep->m_size;
+    }
+    else
+    {
+        pArena->m_pCur = NULL;
+        pArena->m_cur_size = 0;
+    }
+}
+
+void mz_zip_arena_free(mz_zip_arena *pArena)
+{
+    mz_zip_arena_block *pBlock;
+
+    if (!pArena)
+        return;
+
+    pBlock = (mz_zip_arena_block *)pArena->m_pBlocks;
+    while (pBlock)
+    {
+        mz_zip_arena_block *pNext = pBlock->m_pNext;
+        MZ_FREE(pBlock);
+        pBlock = pNext;
+    }
+
+    mz_zip_arena_init(pArena, pArena->m_block_size);
 }
 
 static mz_bool mz_zip_reader_end_internal(mz_zip_archive *pZip, mz_bool set_last_error)
@@ -3924,6 +5887,8 @@ static mz_bool mz_zip_reader_end_internal(mz_zip_archive *pZip, mz_bool set_last
         mz_zip_array_clear(pZip, &pState->m_central_dir);
         mz_zip_array_clear(pZip, &pState->m_central_dir_offsets);
         mz_zip_array_clear(pZip, &pState->m_sorted_central_dir_offsets);
+        mz_zip_array_clear(pZip, &pState->m_validated_files);
+        mz_zip_reader_clear_decoded_central_dir(pZip, pState);
 
 #ifndef MINIZ_NO_STDIO
         if (pState->m_pFile)
@@ -4133,6 +6098,8 @@ static MZ_FORCEINLINE const mz_uint8 *mz_zip_get_cdh(mz_zip_archive *pZip, mz_ui
 {
     if ((!pZip) || (!pZip->m_pState) || (file_index >= pZip->m_total_files))
         return NULL;
+    if ((pZip->m_pState->m_lazy_central_dir) && (file_index >= pZip->m_pState->m_num_indexed_files) && (!mz_zip_reader_index_central_dir_record(pZip, file_index)))
+        return NULL;
     return &MZ_ZIP_ARRAY_ELEMENT(&pZip->m_pState->m_central_dir, mz_uint8, MZ_ZIP_ARRAY_ELEMENT(&pZip->m_pState->m_central_dir_offsets, mz_uint32, file_index));
 }
 
@@ -4218,54 +6185,12 @@ mz_bool mz_zip_reader_is_file_a_directory(mz_zip_archive *pZip, mz_uint file_ind
     return MZ_FALSE;
 }
 
-static mz_bool mz_zip_file_stat_internal(mz_zip_archive *pZip, mz_uint file_index, const mz_uint8 *pCentral_dir_header, mz_zip_archive_file_stat *pStat, mz_bool *pFound_zip64_extra_data)
+/* Replaces any sizes or offset the central dir header p stores as 0xFFFFFFFF with their values from the zip64 extended information field. */
+static mz_bool mz_zip_reader_read_zip64_extra(mz_zip_archive *pZip, const mz_uint8 *p, mz_uint64 *pComp_size, mz_uint64 *pUncomp_size, mz_uint64 *pLocal_header_ofs, mz_bool *pFound_zip64_extra_data)
 {
-    mz_uint n;
-    const mz_uint8 *p = pCentral_dir_header;
-
-    if (pFound_zip64_extra_data)
-        *pFound_zip64_extra_data = MZ_FALSE;
-
-    if ((!p) || (!pStat))
-        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
-
-    /* Extract fields from the central directory record. */
-    pStat->m_file_index = file_index;
-    pStat->m_central_dir_ofs = MZ_ZIP_ARRAY_ELEMENT(&pZip->m_pState->m_central_dir_offsets, mz_uint32, file_index);
-    pStat->m_version_made_by = MZ_READ_LE16(p + MZ_ZIP_CDH_VERSION_MADE_BY_OFS);
-    pStat->m_version_needed = MZ_READ_LE16(p + MZ_ZIP_CDH_VERSION_NEEDED_OFS);
-    pStat->m_bit_flag = MZ_READ_LE16(p + MZ_ZIP_CDH_BIT_FLAG_OFS);
-    pStat->m_method = MZ_READ_LE16(p + MZ_ZIP_CDH_METHOD_OFS);
-#ifndef MINIZ_NO_TIME
-    pStat->m_time = mz_zip_dos_to_time_t(MZ_READ_LE16(p + MZ_ZIP_CDH_FILE_TIME_OFS), MZ_READ_LE16(p + MZ_ZIP_CDH_FILE_DATE_OFS));
-#endif
-    pStat->m_crc32 = MZ_READ_LE32(p + MZ_ZIP_CDH_CRC32_OFS);
-    pStat->m_comp_size = MZ_READ_LE32(p + MZ_ZIP_CDH_COMPRESSED_SIZE_OFS);
-    pStat->m_uncomp_size = MZ_READ_LE32(p + MZ_ZIP_CDH_DECOMPRESSED_SIZE_OFS);
-    pStat->m_internal_attr = MZ_READ_LE16(p + MZ_ZIP_CDH_INTERNAL_ATTR_OFS);
-    pStat->m_external_attr = MZ_READ_LE32(p + MZ_ZIP_CDH_EXTERNAL_ATTR_OFS);
-    pStat->m_local_header_ofs = MZ_READ_LE32(p + MZ_ZIP_CDH_LOCAL_HEADER_OFS);
-
-    /* Copy as much of the filename and comment as possible. */
-    n = MZ_READ_LE16(p + MZ_ZIP_CDH_FILENAME_LEN_OFS);
-    n = MZ_MIN(n, MZ_ZIP_MAX_ARCHIVE_FILENAME_SIZE - 1);
-    memcpy(pStat->m_filename, p + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE, n);
-    pStat->m_filename[n] = '\0';
-
-    n = MZ_READ_LE16(p + MZ_ZIP_CDH_COMMENT_LEN_OFS);
-    n = MZ_MIN(n, MZ_ZIP_MAX_ARCHIVE_FILE_COMMENT_SIZE - 1);
-    pStat->m_comment_size = n;
-    memcpy(pStat->m_comment, p + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + MZ_READ_LE16(p + MZ_ZIP_CDH_FILENAME_LEN_OFS) + MZ_READ_LE16(p + MZ_ZIP_CDH_EXTRA_LEN_OFS), n);
-    pStat->m_comment[n] = '\0';
-
-    /* Set some flags for convienance */
-    pStat->m_is_directory = mz_zip_reader_is_file_a_directory(pZip, file_index);
-    pStat->m_is_encrypted = mz_zip_reader_is_file_encrypted(pZip, file_index);
-    pStat->m_is_supported = mz_zip_reader_is_file_supported(pZip, file_index);
-
     /* See if we need to read any zip64 extended information fields. */
     /* Confusingly, these zip64 fields can be present even on non-zip64 archives (Debian zip on a huge files from stdin piped to stdout creates them). */
-    if (MZ_MAX(MZ_MAX(pStat->m_comp_size, pStat->m_uncomp_size), pStat->m_local_header_ofs) == MZ_UINT32_MAX)
+    if (MZ_MAX(MZ_MAX(*pComp_size, *pUncomp_size), *pLocal_header_ofs) == MZ_UINT32_MAX)
     {
         /* Attempt to find zip64 extended information field in the entry's extra data */
         mz_uint32 extra_size_remaining = MZ_READ_LE16(p + MZ_ZIP_CDH_EXTRA_LEN_OFS);
@@ -4296,32 +6221,32 @@ static mz_bool mz_zip_file_stat_internal(mz_zip_archive *pZip, mz_uint file_inde
                     if (pFound_zip64_extra_data)
                         *pFound_zip64_extra_data = MZ_TRUE;
 
-                    if (pStat->m_uncomp_size == MZ_UINT32_MAX)
+                    if (*pUncomp_size == MZ_UINT32_MAX)
                     {
                         if (field_data_remaining < sizeof(mz_uint64))
                             return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
 
-                        pStat->m_uncomp_size = MZ_READ_LE64(pField_data);
+                        *pUncomp_size = MZ_READ_LE64(pField_data);
                         pField_data += sizeof(mz_uint64);
                         field_data_remaining -= sizeof(mz_uint64);
                     }
 
-                    if (pStat->m_comp_size == MZ_UINT32_MAX)
+                    if (*pComp_size == MZ_UINT32_MAX)
                     {
                         if (field_data_remaining < sizeof(mz_uint64))
                             return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
 
-                        pStat->m_comp_size = MZ_READ_LE64(pField_data);
+                        *pComp_size = MZ_READ_LE64(pField_data);
                         pField_data += sizeof(mz_uint64);
                         field_data_remaining -= sizeof(mz_uint64);
                     }
 
-                    if (pStat->m_local_header_ofs == MZ_UINT32_MAX)
+                    if (*pLocal_header_ofs == MZ_UINT32_MAX)
                     {
                         if (field_data_remaining < sizeof(mz_uint64))
                             return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
 
-                        pStat->m_local_header_ofs = MZ_READ_LE64(pField_data);
+                        *pLocal_header_ofs = MZ_READ_LE64(pField_data);
                         pField_data += sizeof(mz_uint64);
                         field_data_remaining -= sizeof(mz_uint64);
                     }
@@ -4338,6 +6263,146 @@ static mz_bool mz_zip_file_stat_internal(mz_zip_archive *pZip, mz_uint file_inde
     return MZ_TRUE;
 }
 
+static mz_bool mz_zip_file_stat_internal(mz_zip_archive *pZip, mz_uint file_index, const mz_uint8 *pCentral_dir_header, mz_zip_archive_file_stat *pStat, mz_bool *pFound_zip64_extra_data)
+{
+    mz_uint n;
+    const mz_uint8 *p = pCentral_dir_header;
+
+    if (pFound_zip64_extra_data)
+        *pFound_zip64_extra_data = MZ_FALSE;
+
+    if ((!p) || (!pStat))
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+
+    /* Extract fields from the central directory record. */
+    pStat->m_file_index = file_index;
+    pStat->m_central_dir_ofs = MZ_ZIP_ARRAY_ELEMENT(&pZip->m_pState->m_central_dir_offsets, mz_uint32, file_index);
+    pStat->m_version_made_by = MZ_READ_LE16(p + MZ_ZIP_CDH_VERSION_MADE_BY_OFS);
+    pStat->m_version_needed = MZ_READ_LE16(p + MZ_ZIP_CDH_VERSION_NEEDED_OFS);
+    pStat->m_bit_flag = MZ_READ_LE16(p + MZ_ZIP_CDH_BIT_FLAG_OFS);
+    pStat->m_method = MZ_READ_LE16(p + MZ_ZIP_CDH_METHOD_OFS);
+#ifndef MINIZ_NO_TIME
+    {
+        /* mktime() is by far the slowest part of a stat, and entries tend to share their timestamps */
+        mz_uint32 dos_date_time = MZ_READ_LE32(p + MZ_ZIP_CDH_FILE_TIME_OFS);
+        if ((!pZip->m_pState->m_have_last_time) || (pZip->m_pState->m_last_dos_date_time != dos_date_time))
+        {
+            pZip->m_pState->m_last_time = mz_zip_dos_to_time_t(MZ_READ_LE16(p + MZ_ZIP_CDH_FILE_TIME_OFS), MZ_READ_LE16(p + MZ_ZIP_CDH_FILE_DATE_OFS));
+            pZip->m_pState->m_last_dos_date_time = dos_date_time;
+            pZip->m_pState->m_have_last_time = MZ_TRUE;
+        }
+        pStat->m_time = pZip->m_pState->m_last_time;
+    }
+#endif
+    pStat->m_crc32 = MZ_READ_LE32(p + MZ_ZIP_CDH_CRC32_OFS);
+    pStat->m_comp_size = MZ_READ_LE32(p + MZ_ZIP_CDH_COMPRESSED_SIZE_OFS);
+    pStat->m_uncomp_size = MZ_READ_LE32(p + MZ_ZIP_CDH_DECOMPRESSED_SIZE_OFS);
+    pStat->m_internal_attr = MZ_READ_LE16(p + MZ_ZIP_CDH_INTERNAL_ATTR_OFS);
+    pStat->m_external_attr = MZ_READ_LE32(p + MZ_ZIP_CDH_EXTERNAL_ATTR_OFS);
+    pStat->m_local_header_ofs = MZ_READ_LE32(p + MZ_ZIP_CDH_LOCAL_HEADER_OFS);
+
+    /* Copy as much of the filename and comment as possible. */
+    n = MZ_READ_LE16(p + MZ_ZIP_CDH_FILENAME_LEN_OFS);
+    n = MZ_MIN(n, MZ_ZIP_MAX_ARCHIVE_FILENAME_SIZE - 1);
+    memcpy(pStat->m_filename, p + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE, n);
+    pStat->m_filename[n] = '\0';
+
+    n = MZ_READ_LE16(p + MZ_ZIP_CDH_COMMENT_LEN_OFS);
+    n = MZ_MIN(n, MZ_ZIP_MAX_ARCHIVE_FILE_COMMENT_SIZE - 1);
+    pStat->m_comment_size = n;
+    memcpy(pStat->m_comment, p + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + MZ_READ_LE16(p + MZ_ZIP_CDH_FILENAME_LEN_OFS) + MZ_READ_LE16(p + MZ_ZIP_CDH_EXTRA_LEN_OFS), n);
+    pStat->m_comment[n] = '\0';
+
+    /* The decoded central dir already has everything below */
+    if (file_index < pZip->m_pState->m_cd_entry_flags.m_size)
+    {
+        const mz_uint8 entry_flags = MZ_ZIP_ARRAY_ELEMENT(&pZip->m_pState->m_cd_entry_flags, mz_uint8, file_index);
+        pStat->m_comp_size = MZ_ZIP_ARRAY_ELEMENT(&pZip->m_pState->m_cd_comp_sizes, mz_uint64, file_index);
+        pStat->m_uncomp_size = MZ_ZIP_ARRAY_ELEMENT(&pZip->m_pState->m_cd_uncomp_sizes, mz_uint64, file_index);
+        pStat->m_local_header_ofs = MZ_ZIP_ARRAY_ELEMENT(&pZip->m_pState->m_cd_local_header_ofs, mz_uint64, file_index);
+        pStat->m_is_directory = (entry_flags & MZ_ZIP_CD_ENTRY_IS_DIRECTORY) != 0;
+        pStat->m_is_encrypted = (entry_flags & MZ_ZIP_CD_ENTRY_IS_ENCRYPTED) != 0;
+        pStat->m_is_supported = (entry_flags & MZ_ZIP_CD_ENTRY_IS_SUPPORTED) != 0;
+        if (!pStat->m_is_supported)
+            mz_zip_reader_is_file_supported(pZip, file_index); /* for the error code */
+        if (pFound_zip64_extra_data)
+            *pFound_zip64_extra_data = (entry_flags & MZ_ZIP_CD_ENTRY_HAS_ZIP64_EXTRA) != 0;
+        return MZ_TRUE;
+    }
+
+    /* Set some flags for convienance */
+    pStat->m_is_directory = mz_zip_reader_is_file_a_directory(pZip, file_index);
+    pStat->m_is_encrypted = mz_zip_reader_is_file_encrypted(pZip, file_index);
+    pStat->m_is_supported = mz_zip_reader_is_file_supported(pZip, file_index);
+
+    return mz_zip_reader_read_zip64_extra(pZip, p, &pStat->m_comp_size, &pStat->m_uncomp_size, &pStat->m_local_header_ofs, pFound_zip64_extra_data);
+}
+
+/* Decodes the central dir fields stat and extraction need into one array per field (MZ_ZIP_FLAG_DECODE_CENTRAL_DIRECTORY). */
+static mz_bool mz_zip_reader_decode_central_dir(mz_zip_archive *pZip)
+{
+    mz_zip_internal_state *pState = pZip->m_pState;
+    const mz_uint32 total_files = pZip->m_total_files;
+    mz_uint8 *pEntry_flags;
+    mz_uint32 i;
+
+    if ((!mz_zip_array_resize(pZip, &pState->m_cd_comp_sizes, total_files, MZ_FALSE)) ||
+        (!mz_zip_array_resize(pZip, &pState->m_cd_uncomp_sizes, total_files, MZ_FALSE)) ||
+        (!mz_zip_array_resize(pZip, &pState->m_cd_local_header_ofs, total_files, MZ_FALSE)) ||
+        (!mz_zip_array_resize(pZip, &pState->m_cd_entry_flags, total_files, MZ_FALSE)))
+    {
+        mz_zip_reader_clear_decoded_central_dir(pZip, pState);
+        return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+    }
+
+    /* Leave m_cd_entry_flags empty until everything is decoded, mz_zip_file_stat_internal() relies on its size */
+    pEntry_flags = (mz_uint8 *)pState->m_cd_entry_flags.m_p;
+    pState->m_cd_entry_flags.m_size = 0;
+
+    for (i = 0; i < total_files; i++)
+    {
+        const mz_uint8 *p = mz_zip_get_cdh(pZip, i);
+        mz_uint64 comp_size, uncomp_size, local_header_ofs;
+        mz_bool found_zip64_extra_data = MZ_FALSE;
+        mz_uint8 entry_flags = 0;
+        mz_zip_error last_error = pZip->m_last_error;
+
+        if (!p)
+        {
+            mz_zip_reader_clear_decoded_central_dir(pZip, pState);
+            return MZ_FALSE;
+        }
+
+        comp_size = MZ_READ_LE32(p + MZ_ZIP_CDH_COMPRESSED_SIZE_OFS);
+        uncomp_size = MZ_READ_LE32(p + MZ_ZIP_CDH_DECOMPRESSED_SIZE_OFS);
+        local_header_ofs = MZ_READ_LE32(p + MZ_ZIP_CDH_LOCAL_HEADER_OFS);
+        if (!mz_zip_reader_read_zip64_extra(pZip, p, &comp_size, &uncomp_size, &local_header_ofs, &found_zip64_extra_data))
+        {
+            mz_zip_reader_clear_decoded_central_dir(pZip, pState);
+            return MZ_FALSE;
+        }
+
+        if (mz_zip_reader_is_file_a_directory(pZip, i))
+            entry_flags |= MZ_ZIP_CD_ENTRY_IS_DIRECTORY;
+        if (mz_zip_reader_is_file_encrypted(pZip, i))
+            entry_flags |= MZ_ZIP_CD_ENTRY_IS_ENCRYPTED;
+        if (mz_zip_reader_is_file_supported(pZip, i))
+            entry_flags |= MZ_ZIP_CD_ENTRY_IS_SUPPORTED;
+        if (found_zip64_extra_data)
+            entry_flags |= MZ_ZIP_CD_ENTRY_HAS_ZIP64_EXTRA;
+        pZip->m_last_error = last_error;
+
+        MZ_ZIP_ARRAY_ELEMENT(&pState->m_cd_comp_sizes, mz_uint64, i) = comp_size;
+        MZ_ZIP_ARRAY_ELEMENT(&pState->m_cd_uncomp_sizes, mz_uint64, i) = uncomp_size;
+        MZ_ZIP_ARRAY_ELEMENT(&pState->m_cd_local_header_ofs, mz_uint64, i) = local_header_ofs;
+        pEntry_flags[i] = entry_flags;
+    }
+
+    pState->m_cd_entry_flags.m_size = total_files;
+    return MZ_TRUE;
+}
+
+
 static MZ_FORCEINLINE mz_bool mz_zip_string_equal(const char *pA, const char *pB, mz_uint len, mz_uint flags)
 {
     mz_uint i;
@@ -4429,9 +6494,21 @@ mz_bool mz_zip_reader_locate_file_v2(mz_zip_archive *pZip, const char *pName, co
     /* See if we can use a binary search */
     if (((pZip->m_pState->m_init_flags & MZ_ZIP_FLAG_DO_NOT_SORT_CENTRAL_DIRECTORY) == 0) &&
         (pZip->m_zip_mode == MZ_ZIP_MODE_READING) &&
-        ((flags & (MZ_ZIP_FLAG_IGNORE_PATH | MZ_ZIP_FLAG_CASE_SENSITIVE)) == 0) && (!pComment) && (pZip->m_pState->m_sorted_central_dir_offsets.m_size))
+        ((flags & (MZ_ZIP_FLAG_IGNORE_PATH | MZ_ZIP_FLAG_CASE_SENSITIVE)) == 0) && (!pComment))
     {
-        return mz_zip_locate_file_binary_search(pZip, pName, pIndex);
+        if (pZip->m_pState->m_sort_pending)
+        {
+            /* A lazy reader scans the central dir for its first few lookups, sorting costs about as much as log2(num files) scans */
+            mz_uint32 log2_total_files = 0;
+            while ((pZip->m_total_files >> log2_total_files) > 1)
+                log2_total_files++;
+
+            if ((++pZip->m_pState->m_num_lazy_lookups > log2_total_files) && (!mz_zip_reader_sort_central_dir(pZip)))
+                return MZ_FALSE;
+        }
+
+        if (pZip->m_pState->m_sorted_central_dir_offsets.m_size)
+            return mz_zip_locate_file_binary_search(pZip, pName, pIndex);
     }
 
     /* Locate the entry by scanning the entire central directory */
@@ -4445,9 +6522,13 @@ mz_bool mz_zip_reader_locate_file_v2(mz_zip_archive *pZip, const char *pName, co
 
     for (file_index = 0; file_index < pZip->m_total_files; file_index++)
     {
-        const mz_uint8 *pHeader = &MZ_ZIP_ARRAY_ELEMENT(&pZip->m_pState->m_central_dir, mz_uint8, MZ_ZIP_ARRAY_ELEMENT(&pZip->m_pState->m_central_dir_offsets, mz_uint32, file_index));
-        mz_uint filename_len = MZ_READ_LE16(pHeader + MZ_ZIP_CDH_FILENAME_LEN_OFS);
-        const char *pFilename = (const char *)pHeader + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE;
+        const mz_uint8 *pHeader = mz_zip_get_cdh(pZip, file_index);
+        mz_uint filename_len;
+        const char *pFilename;
+        if (!pHeader)
+            return MZ_FALSE;
+        filename_len = MZ_READ_LE16(pHeader + MZ_ZIP_CDH_FILENAME_LEN_OFS);
+        pFilename = (const char *)pHeader + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE;
         if (filename_len < name_len)
             continue;
         if (comment_len)
@@ -4480,65 +6561,216 @@ mz_bool mz_zip_reader_locate_file_v2(mz_zip_archive *pZip, const char *pName, co
     return mz_zip_set_error(pZip, MZ_ZIP_FILE_NOT_FOUND);
 }
 
-static
-mz_bool mz_zip_reader_extract_to_mem_no_alloc1(mz_zip_archive *pZip, mz_uint file_index, void *pBuf, size_t buf_size, mz_uint flags, void *pUser_read_buf, size_t user_read_buf_size, const mz_zip_archive_file_stat *st)
+/* Matches a filename against a mz_zip_reader_find_first() pattern. */
+static mz_bool mz_zip_glob_match(const char *pPattern, const char *pName, mz_uint name_len, mz_uint flags)
 {
-    int status = TINFL_STATUS_DONE;
-    mz_uint64 needed_size, cur_file_ofs, comp_remaining, out_buf_ofs = 0, read_buf_size, read_buf_ofs = 0, read_buf_avail;
-    mz_zip_archive_file_stat file_stat;
-    void *pRead_buf;
-    mz_uint32 local_header_u32[(MZ_ZIP_LOCAL_DIR_HEADER_SIZE + sizeof(mz_uint32) - 1) / sizeof(mz_uint32)];
-    mz_uint8 *pLocal_header = (mz_uint8 *)local_header_u32;
-    tinfl_decompressor inflator;
+    while (*pPattern)
+    {
+        if (*pPattern == '*')
+        {
+            mz_bool cross_dirs = MZ_FALSE;
+            while (*pPattern == '*')
+            {
+                cross_dirs |= (pPattern[1] == '*');
+                pPattern++;
+            }
 
-    if ((!pZip) || (!pZip->m_pState) || ((buf_size) && (!pBuf)) || ((user_read_buf_size) && (!pUser_read_buf)) || (!pZip->m_pRead))
-        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+            if (!*pPattern)
+                return cross_dirs || (!memchr(pName, '/', name_len));
 
-    if (st) {
-        file_stat = *st;
-    } else
-    if (!mz_zip_reader_file_stat(pZip, file_index, &file_stat))
-        return MZ_FALSE;
+            /* Try each possible length for the wildcard */
+            for (;;)
+            {
+                if (mz_zip_glob_match(pPattern, pName, name_len, flags))
+                    return MZ_TRUE;
+                if ((!name_len) || ((!cross_dirs) && (*pName == '/')))
+                    return MZ_FALSE;
+                pName++;
+                name_len--;
+            }
+        }
 
-    /* A directory or zero length file */
-    if ((file_stat.m_is_directory) || (!file_stat.m_comp_size))
-        return MZ_TRUE;
+        if (!name_len)
+            return MZ_FALSE;
 
-    /* Encryption and patch files are not supported. */
-    if (file_stat.m_bit_flag & (MZ_ZIP_GENERAL_PURPOSE_BIT_FLAG_IS_ENCRYPTED | MZ_ZIP_GENERAL_PURPOSE_BIT_FLAG_USES_STRONG_ENCRYPTION | MZ_ZIP_GENERAL_PURPOSE_BIT_FLAG_COMPRESSED_PATCH_FLAG))
-        return mz_zip_set_error(pZip, MZ_ZIP_UNSUPPORTED_ENCRYPTION);
+        if (*pPattern == '?')
+        {
+            if (*pName == '/')
+                return MZ_FALSE;
+        }
+        else if (!mz_zip_string_equal(pPattern, pName, 1, flags))
+            return MZ_FALSE;
 
-    /* This function only supports decompressing stored and deflate. */
-    if ((!(flags & MZ_ZIP_FLAG_COMPRESSED_DATA)) && (file_stat.m_method != 0) && (file_stat.m_method != MZ_DEFLATED))
-        return mz_zip_set_error(pZip, MZ_ZIP_UNSUPPORTED_METHOD);
+        pPattern++;
+        pName++;
+        name_len--;
+    }
 
-    /* Ensure supplied output buffer is large enough. */
-    needed_size = (flags & MZ_ZIP_FLAG_COMPRESSED_DATA) ? file_stat.m_comp_size : file_stat.m_uncomp_size;
-    if (buf_size < needed_size)
-        return mz_zip_set_error(pZip, MZ_ZIP_BUF_TOO_SMALL);
+    return name_len == 0;
+}
 
-    /* Read and parse the local directory entry. */
-    cur_file_ofs = file_stat.m_local_header_ofs;
-    if (pZip->m_pRead(pZip->m_pIO_opaque, cur_file_ofs, pLocal_header, MZ_ZIP_LOCAL_DIR_HEADER_SIZE) != MZ_ZIP_LOCAL_DIR_HEADER_SIZE)
-        return mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
+/* Compares the start of a filename against a prefix, the same way the central dir is sorted. Returns 0 if the filename begins with the prefix. */
+static MZ_FORCEINLINE int mz_zip_filename_compare_prefix(const mz_zip_array *pCentral_dir_array, const mz_zip_array *pCentral_dir_offsets, mz_uint l_index, const char *pR, mz_uint r_len)
+{
+    const mz_uint8 *pL = &MZ_ZIP_ARRAY_ELEMENT(pCentral_dir_array, mz_uint8, MZ_ZIP_ARRAY_ELEMENT(pCentral_dir_offsets, mz_uint32, l_index)), *pE;
+    mz_uint l_len = MZ_READ_LE16(pL + MZ_ZIP_CDH_FILENAME_LEN_OFS);
+    mz_uint8 l = 0, r = 0;
+    pL += MZ_ZIP_CENTRAL_DIR_HEADER_SIZE;
+    pE = pL + MZ_MIN(l_len, r_len);
+    while (pL < pE)
+    {
+        if ((l = MZ_TOLOWER(*pL)) != (r = MZ_TOLOWER(*pR)))
+            break;
+        pL++;
+        pR++;
+    }
+    return (pL == pE) ? ((l_len < r_len) ? -1 : 0) : (l - r);
+}
 
-    if (MZ_READ_LE32(pLocal_header) != MZ_ZIP_LOCAL_DIR_HEADER_SIG)
-        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
+mz_bool mz_zip_reader_find_first(mz_zip_archive *pZip, const char *pPattern, mz_uint flags, mz_zip_reader_find_state *pState, mz_uint32 *pIndex)
+{
+    if (pIndex)
+        *pIndex = 0;
 
-    cur_file_ofs += MZ_ZIP_LOCAL_DIR_HEADER_SIZE + MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_FILENAME_LEN_OFS) + MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_EXTRA_LEN_OFS);
-    if ((cur_file_ofs + file_stat.m_comp_size) > pZip->m_archive_size)
-        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
+    if ((!pZip) || (!pZip->m_pState) || (!pPattern) || (!pState) || (pZip->m_zip_mode != MZ_ZIP_MODE_READING))
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
 
-    if ((flags & MZ_ZIP_FLAG_COMPRESSED_DATA) || (!file_stat.m_method))
+    memset(pState, 0, sizeof(*pState));
+    pState->m_pZip = pZip;
+    pState->m_pPattern = pPattern;
+    pState->m_flags = flags;
+    pState->m_prefix_len = (mz_uint)strcspn(pPattern, "*?");
+
+    if ((pZip->m_pState->m_init_flags & MZ_ZIP_FLAG_DO_NOT_SORT_CENTRAL_DIRECTORY) == 0)
     {
-        /* The file is stored or the caller has requested the compressed data. */
-        if (pZip->m_pRead(pZip->m_pIO_opaque, cur_file_ofs, pBuf, (size_t)needed_size) != needed_size)
+        /* Enumerating is worth sorting a lazy reader's central dir for */
+        if ((pZip->m_pState->m_sort_pending) && (!mz_zip_reader_sort_central_dir(pZip)))
+            return MZ_FALSE;
+
+        pState->m_sorted = pZip->m_pState->m_sorted_central_dir_offsets.m_size != 0;
+    }
+
+    if ((pState->m_sorted) && (pState->m_prefix_len))
+    {
+        /* Find the first entry that sorts at or after the prefix, every entry starting with it follows */
+        const mz_uint32 *pIndices = &MZ_ZIP_ARRAY_ELEMENT(&pZip->m_pState->m_sorted_central_dir_offsets, mz_uint32, 0);
+        mz_uint32 l = 0, h = pZip->m_total_files;
+
+        while (l < h)
+        {
+            mz_uint32 m = l + ((h - l) >> 1);
+            if (mz_zip_filename_compare_prefix(&pZip->m_pState->m_central_dir, &pZip->m_pState->m_central_dir_offsets, pIndices[m], pPattern, pState->m_prefix_len) < 0)
+                l = m + 1;
+            else
+                h = m;
+        }
+
+        pState->m_next = l;
+    }
+
+    return mz_zip_reader_find_next(pState, pIndex);
+}
+
+mz_bool mz_zip_reader_find_next(mz_zip_reader_find_state *pState, mz_uint32 *pIndex)
+{
+    mz_zip_archive *pZip;
+
+    if (pIndex)
+        *pIndex = 0;
+
+    if ((!pState) || (!pState->m_pZip) || (!pState->m_pZip->m_pState))
+        return MZ_FALSE;
+
+    pZip = pState->m_pZip;
+
+    while (pState->m_next < pZip->m_total_files)
+    {
+        mz_uint32 file_index = pState->m_sorted ? MZ_ZIP_ARRAY_ELEMENT(&pZip->m_pState->m_sorted_central_dir_offsets, mz_uint32, pState->m_next) : pState->m_next;
+        const mz_uint8 *pHeader;
+
+        if ((pState->m_sorted) && (pState->m_prefix_len) &&
+            (mz_zip_filename_compare_prefix(&pZip->m_pState->m_central_dir, &pZip->m_pState->m_central_dir_offsets, file_index, pState->m_pPattern, pState->m_prefix_len) != 0))
+        {
+            /* Past the last entry sharing the prefix */
+            pState->m_next = pZip->m_total_files;
+            break;
+        }
+
+        pState->m_next++;
+
+        if (!(pHeader = mz_zip_get_cdh(pZip, file_index)))
+            return MZ_FALSE;
+
+        if (mz_zip_glob_match(pState->m_pPattern, (const char *)pHeader + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE, MZ_READ_LE16(pHeader + MZ_ZIP_CDH_FILENAME_LEN_OFS), pState->m_flags))
+        {
+            if (pIndex)
+                *pIndex = file_index;
+            return MZ_TRUE;
+        }
+    }
+
+    return mz_zip_set_error(pZip, MZ_ZIP_FILE_NOT_FOUND);
+}
+
+static
+mz_bool mz_zip_reader_extract_to_mem_no_alloc1(mz_zip_archive *pZip, mz_uint file_index, void *pBuf, size_t buf_size, mz_uint flags, void *pUser_read_buf, size_t user_read_buf_size, const mz_zip_archive_file_stat *st)
+{
+    int status = TINFL_STATUS_DONE;
+    mz_uint64 needed_size, cur_file_ofs, comp_remaining, out_buf_ofs = 0, read_buf_size, read_buf_ofs = 0, read_buf_avail;
+    mz_zip_archive_file_stat file_stat;
+    void *pRead_buf;
+    mz_uint32 local_header_u32[(MZ_ZIP_LOCAL_DIR_HEADER_SIZE + sizeof(mz_uint32) - 1) / sizeof(mz_uint32)];
+    mz_uint8 *pLocal_header = (mz_uint8 *)local_header_u32;
+    tinfl_decompressor inflator;
+
+    if ((!pZip) || (!pZip->m_pState) || ((buf_size) && (!pBuf)) || ((user_read_buf_size) && (!pUser_read_buf)) || (!pZip->m_pRead))
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+
+    if (st) {
+        file_stat = *st;
+    } else
+    if (!mz_zip_reader_file_stat(pZip, file_index, &file_stat))
+        return MZ_FALSE;
+
+    /* A directory or zero length file */
+    if ((file_stat.m_is_directory) || (!file_stat.m_comp_size))
+        return MZ_TRUE;
+
+    /* Encryption and patch files are not supported. */
+    if (file_stat.m_bit_flag & (MZ_ZIP_GENERAL_PURPOSE_BIT_FLAG_IS_ENCRYPTED | MZ_ZIP_GENERAL_PURPOSE_BIT_FLAG_USES_STRONG_ENCRYPTION | MZ_ZIP_GENERAL_PURPOSE_BIT_FLAG_COMPRESSED_PATCH_FLAG))
+        return mz_zip_set_error(pZip, MZ_ZIP_UNSUPPORTED_ENCRYPTION);
+
+    /* This function only supports decompressing stored and deflate. */
+    if ((!(flags & MZ_ZIP_FLAG_COMPRESSED_DATA)) && (file_stat.m_method != 0) && (file_stat.m_method != MZ_DEFLATED))
+        return mz_zip_set_error(pZip, MZ_ZIP_UNSUPPORTED_METHOD);
+
+    /* Ensure supplied output buffer is large enough. */
+    needed_size = (flags & MZ_ZIP_FLAG_COMPRESSED_DATA) ? file_stat.m_comp_size : file_stat.m_uncomp_size;
+    if (buf_size < needed_size)
+        return mz_zip_set_error(pZip, MZ_ZIP_BUF_TOO_SMALL);
+
+    /* Read and parse the local directory entry. */
+    cur_file_ofs = file_stat.m_local_header_ofs;
+    if (MZ_ZIP_READ(pZip, cur_file_ofs, pLocal_header, MZ_ZIP_LOCAL_DIR_HEADER_SIZE) != MZ_ZIP_LOCAL_DIR_HEADER_SIZE)
+        return mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
+
+    if (MZ_READ_LE32(pLocal_header) != MZ_ZIP_LOCAL_DIR_HEADER_SIG)
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
+
+    cur_file_ofs += MZ_ZIP_LOCAL_DIR_HEADER_SIZE + MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_FILENAME_LEN_OFS) + MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_EXTRA_LEN_OFS);
+    if ((cur_file_ofs + file_stat.m_comp_size) > pZip->m_archive_size)
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
+
+    if ((flags & MZ_ZIP_FLAG_COMPRESSED_DATA) || (!file_stat.m_method))
+    {
+        /* The file is stored or the caller has requested the compressed data. */
+        if (MZ_ZIP_READ(pZip, cur_file_ofs, pBuf, (size_t)needed_size) != needed_size)
             return mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
 
 #ifndef MINIZ_DISABLE_ZIP_READER_CRC32_CHECKS
         if ((flags & MZ_ZIP_FLAG_COMPRESSED_DATA) == 0)
         {
-            if (mz_crc32(MZ_CRC32_INIT, (const mz_uint8 *)pBuf, (size_t)file_stat.m_uncomp_size) != file_stat.m_crc32)
+            if (MZ_ZIP_CRC32(pZip, MZ_CRC32_INIT, (const mz_uint8 *)pBuf, (size_t)file_stat.m_uncomp_size) != file_stat.m_crc32)
                 return mz_zip_set_error(pZip, MZ_ZIP_CRC_CHECK_FAILED);
         }
 #endif
@@ -4573,7 +6805,7 @@ mz_bool mz_zip_reader_extract_to_mem_no_alloc1(mz_zip_archive *pZip, mz_uint fil
         if (((sizeof(size_t) == sizeof(mz_uint32))) && (read_buf_size > 0x7FFFFFFF))
             return mz_zip_set_error(pZip, MZ_ZIP_INTERNAL_ERROR);
 
-        if (NULL == (pRead_buf = pZip->m_pAlloc(pZip->m_pAlloc_opaque, 1, (size_t)read_buf_size)))
+        if (NULL == (pRead_buf = MZ_ZIP_ALLOC(pZip, 1, (size_t)read_buf_size)))
             return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
 
         read_buf_avail = 0;
@@ -4587,7 +6819,7 @@ mz_bool mz_zip_reader_extract_to_mem_no_alloc1(mz_zip_archive *pZip, mz_uint fil
         if ((!read_buf_avail) && (!pZip->m_pState->m_pMem))
         {
             read_buf_avail = MZ_MIN(read_buf_size, comp_remaining);
-            if (pZip->m_pRead(pZip->m_pIO_opaque, cur_file_ofs, pRead_buf, (size_t)read_buf_avail) != read_buf_avail)
+            if (MZ_ZIP_READ(pZip, cur_file_ofs, pRead_buf, (size_t)read_buf_avail) != read_buf_avail)
             {
                 status = TINFL_STATUS_FAILED;
                 mz_zip_set_error(pZip, MZ_ZIP_DECOMPRESSION_FAILED);
@@ -4598,7 +6830,7 @@ mz_bool mz_zip_reader_extract_to_mem_no_alloc1(mz_zip_archive *pZip, mz_uint fil
             read_buf_ofs = 0;
         }
         in_buf_size = (size_t)read_buf_avail;
-        status = tinfl_decompress(&inflator, (mz_uint8 *)pRead_buf + read_buf_ofs, &in_buf_size, (mz_uint8 *)pBuf, (mz_uint8 *)pBuf + out_buf_ofs, &out_buf_size, TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF | (comp_remaining ? TINFL_FLAG_HAS_MORE_INPUT : 0));
+        status = MZ_ZIP_INFLATE(pZip, &inflator, (mz_uint8 *)pRead_buf + read_buf_ofs, &in_buf_size, (mz_uint8 *)pBuf, (mz_uint8 *)pBuf + out_buf_ofs, &out_buf_size, TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF | (comp_remaining ? TINFL_FLAG_HAS_MORE_INPUT : 0));
         read_buf_avail -= in_buf_size;
         read_buf_ofs += in_buf_size;
         out_buf_ofs += out_buf_size;
@@ -4613,7 +6845,7 @@ mz_bool mz_zip_reader_extract_to_mem_no_alloc1(mz_zip_archive *pZip, mz_uint fil
             status = TINFL_STATUS_FAILED;
         }
 #ifndef MINIZ_DISABLE_ZIP_READER_CRC32_CHECKS
-        else if (mz_crc32(MZ_CRC32_INIT, (const mz_uint8 *)pBuf, (size_t)file_stat.m_uncomp_size) != file_stat.m_crc32)
+        else if (MZ_ZIP_CRC32(pZip, MZ_CRC32_INIT, (const mz_uint8 *)pBuf, (size_t)file_stat.m_uncomp_size) != file_stat.m_crc32)
         {
             mz_zip_set_error(pZip, MZ_ZIP_CRC_CHECK_FAILED);
             status = TINFL_STATUS_FAILED;
@@ -4622,7 +6854,7 @@ mz_bool mz_zip_reader_extract_to_mem_no_alloc1(mz_zip_archive *pZip, mz_uint fil
     }
 
     if ((!pZip->m_pState->m_pMem) && (!pUser_read_buf))
-        pZip->m_pFree(pZip->m_pAlloc_opaque, pRead_buf);
+        MZ_ZIP_FREE(pZip, pRead_buf, (size_t)read_buf_size);
 
     return status == TINFL_STATUS_DONE;
 }
@@ -4669,7 +6901,7 @@ void *mz_zip_reader_extract_to_heap(mz_zip_archive *pZip, mz_uint file_index, si
         return NULL;
     }
 
-    if (NULL == (pBuf = pZip->m_pAlloc(pZip->m_pAlloc_opaque, 1, (size_t)alloc_size)))
+    if (NULL == (pBuf = MZ_ZIP_ALLOC(pZip, 1, (size_t)alloc_size)))
     {
         mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
         return NULL;
@@ -4677,7 +6909,7 @@ void *mz_zip_reader_extract_to_heap(mz_zip_archive *pZip, mz_uint file_index, si
 
     if (!mz_zip_reader_extract_to_mem_no_alloc1(pZip, file_index, pBuf, (size_t)alloc_size, flags, NULL, 0, &file_stat))
     {
-        pZip->m_pFree(pZip->m_pAlloc_opaque, pBuf);
+        MZ_ZIP_FREE(pZip, pBuf, (size_t)alloc_size);
         return NULL;
     }
 
@@ -4698,1591 +6930,3442 @@ void *mz_zip_reader_extract_file_to_heap(mz_zip_archive *pZip, const char *pFile
     return mz_zip_reader_extract_to_heap(pZip, file_index, pSize, flags);
 }
 
-mz_bool mz_zip_reader_extract_to_callback(mz_zip_archive *pZip, mz_uint file_index, mz_file_write_func pCallback, void *pOpaque, mz_uint flags)
+/* A file index and its local header offset, for walking entries in archive order. */
+typedef struct
 {
-    int status = TINFL_STATUS_DONE;
-#ifndef MINIZ_DISABLE_ZIP_READER_CRC32_CHECKS
-    mz_uint file_crc32 = MZ_CRC32_INIT;
+    mz_uint64 m_local_header_ofs;
+    mz_uint32 m_file_index;
+} mz_zip_local_header_entry;
+
+static void mz_zip_sort_by_local_header_ofs(mz_zip_local_header_entry *pEntries, mz_uint32 size)
+{
+    mz_int64 start = (size - 2U) >> 1U, end;
+    mz_zip_local_header_entry t;
+
+    if (size <= 1U)
+        return;
+
+    /* Heap sort by local header offset, same as mz_zip_reader_sort_central_dir_offsets_by_filename() */
+    while (start >= 0)
+    {
+        mz_int64 child, root = start;
+        for (;;)
+        {
+            if ((child = (root << 1U) + 1U) >= size)
+                break;
+            child += (((child + 1U) < size) && (pEntries[child].m_local_header_ofs < pEntries[child + 1U].m_local_header_ofs));
+            if (pEntries[root].m_local_header_ofs >= pEntries[child].m_local_header_ofs)
+                break;
+            t = pEntries[root];
+            pEntries[root] = pEntries[child];
+            pEntries[child] = t;
+            root = child;
+        }
+        start--;
+    }
+
+    end = size - 1;
+    while (end > 0)
+    {
+        mz_int64 child, root = 0;
+        t = pEntries[end];
+        pEntries[end] = pEntries[0];
+        pEntries[0] = t;
+        for (;;)
+        {
+            if ((child = (root << 1U) + 1U) >= end)
+                break;
+            child += (((child + 1U) < end) && (pEntries[child].m_local_header_ofs < pEntries[child + 1U].m_local_header_ofs));
+            if (pEntries[root].m_local_header_ofs >= pEntries[child].m_local_header_ofs)
+                break;
+            t = pEntries[root];
+            pEntries[root] = pEntries[child];
+            pEntries[child] = t;
+            root = child;
+        }
+        end--;
+    }
+}
+
+#if defined(MINIZ_ZIP_ASYNC_IO) || defined(MINIZ_ZIP_THREADS)
+/* Reads n bytes at ofs, unless the file ends first. Returns the number of bytes read, or -1 on error. */
+static mz_int64 mz_zip_pread(int fd, void *pBuf, size_t n, mz_uint64 ofs)
+{
+    size_t total = 0;
+    while (total < n)
+    {
+        ssize_t r = pread(fd, (mz_uint8 *)pBuf + total, n - total, (off_t)(ofs + total));
+        if (r < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (!r)
+            break;
+        total += (size_t)r;
+    }
+    return (mz_int64)total;
+}
 #endif
-    mz_uint64 read_buf_size, read_buf_ofs = 0, read_buf_avail, comp_remaining, out_buf_ofs = 0, cur_file_ofs;
-    mz_zip_archive_file_stat file_stat;
-    void *pRead_buf = NULL;
-    void *pWrite_buf = NULL;
-    mz_uint32 local_header_u32[(MZ_ZIP_LOCAL_DIR_HEADER_SIZE + sizeof(mz_uint32) - 1) / sizeof(mz_uint32)];
-    mz_uint8 *pLocal_header = (mz_uint8 *)local_header_u32;
 
-    if ((!pZip) || (!pZip->m_pState) || (!pCallback) || (!pZip->m_pRead))
-        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+#ifdef MINIZ_ZIP_ASYNC_IO
+/* Read-ahead for the batch extraction functions: the next runs of entries are read with io_uring, or by a small pool of pread() threads if io_uring is unavailable, while the current run is being inflated. */
+typedef struct
+{
+    void *m_pBuf;
+    mz_uint64 m_ofs;
+    size_t m_size;
+    mz_int64 m_result;
+    int m_pending, m_done;
+    struct iovec m_iov;
+} mz_zip_async_read;
 
-    if (!mz_zip_reader_file_stat(pZip, file_index, &file_stat))
+typedef struct
+{
+    int m_fd;
+    mz_zip_async_read m_reads[MZ_ZIP_ASYNC_READ_DEPTH];
+
+    /* io_uring, used if m_ring_fd >= 0 */
+    int m_ring_fd;
+    void *m_pSq_ring, *m_pCq_ring;
+    size_t m_sq_ring_size, m_cq_ring_size, m_sqes_size;
+    struct io_uring_sqe *m_pSqes;
+    struct io_uring_cqe *m_pCqes;
+    unsigned *m_pSq_tail, *m_pSq_mask, *m_pSq_array, *m_pCq_head, *m_pCq_tail, *m_pCq_mask;
+
+    /* pread() thread pool fallback */
+    pthread_t m_threads[MZ_ZIP_ASYNC_READ_DEPTH];
+    int m_num_threads;
+    pthread_mutex_t m_mutex;
+    pthread_cond_t m_cond;
+    int m_queue[MZ_ZIP_ASYNC_READ_DEPTH];
+    int m_queue_head, m_queue_count, m_shutdown;
+} mz_zip_async_reader;
+
+static void *mz_zip_async_thread_func(void *pArg)
+{
+    mz_zip_async_reader *pReader = (mz_zip_async_reader *)pArg;
+
+    pthread_mutex_lock(&pReader->m_mutex);
+    for (;;)
+    {
+        mz_zip_async_read *pRead;
+        mz_int64 result;
+
+        while ((!pReader->m_queue_count) && (!pReader->m_shutdown))
+            pthread_cond_wait(&pReader->m_cond, &pReader->m_mutex);
+        if (!pReader->m_queue_count)
+            break;
+
+        pRead = &pReader->m_reads[pReader->m_queue[pReader->m_queue_head]];
+        pReader->m_queue_head = (pReader->m_queue_head + 1) % MZ_ZIP_ASYNC_READ_DEPTH;
+        pReader->m_queue_count--;
+        pthread_mutex_unlock(&pReader->m_mutex);
+
+        result = mz_zip_pread(pReader->m_fd, pRead->m_pBuf, pRead->m_size, pRead->m_ofs);
+
+        pthread_mutex_lock(&pReader->m_mutex);
+        pRead->m_result = result;
+        pRead->m_done = 1;
+        pthread_cond_broadcast(&pReader->m_cond);
+    }
+    pthread_mutex_unlock(&pReader->m_mutex);
+
+    return NULL;
+}
+
+static mz_bool mz_zip_async_init_ring(mz_zip_async_reader *pReader)
+{
+    struct io_uring_params params;
+    int fd;
+
+    memset(&params, 0, sizeof(params));
+    if ((fd = (int)syscall(__NR_io_uring_setup, MZ_ZIP_ASYNC_READ_DEPTH, &params)) < 0)
         return MZ_FALSE;
 
-    /* A directory or zero length file */
-    if ((file_stat.m_is_directory) || (!file_stat.m_comp_size))
+    pReader->m_ring_fd = fd;
+    pReader->m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    pReader->m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    pReader->m_sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        pReader->m_sq_ring_size = pReader->m_cq_ring_size = MZ_MAX(pReader->m_sq_ring_size, pReader->m_cq_ring_size);
+
+    pReader->m_pSq_ring = mmap(NULL, pReader->m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (pReader->m_pSq_ring == MAP_FAILED)
+        goto failed;
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        pReader->m_pCq_ring = pReader->m_pSq_ring;
+    else if ((pReader->m_pCq_ring = mmap(NULL, pReader->m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING)) == MAP_FAILED)
+        goto failed;
+
+    if ((pReader->m_pSqes = (struct io_uring_sqe *)mmap(NULL, pReader->m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES)) == MAP_FAILED)
+        goto failed;
+
+    pReader->m_pSq_tail = (unsigned *)((mz_uint8 *)pReader->m_pSq_ring + params.sq_off.tail);
+    pReader->m_pSq_mask = (unsigned *)((mz_uint8 *)pReader->m_pSq_ring + params.sq_off.ring_mask);
+    pReader->m_pSq_array = (unsigned *)((mz_uint8 *)pReader->m_pSq_ring + params.sq_off.array);
+    pReader->m_pCq_head = (unsigned *)((mz_uint8 *)pReader->m_pCq_ring + params.cq_off.head);
+    pReader->m_pCq_tail = (unsigned *)((mz_uint8 *)pReader->m_pCq_ring + params.cq_off.tail);
+    pReader->m_pCq_mask = (unsigned *)((mz_uint8 *)pReader->m_pCq_ring + params.cq_off.ring_mask);
+    pReader->m_pCqes = (struct io_uring_cqe *)((mz_uint8 *)pReader->m_pCq_ring + params.cq_off.cqes);
+    return MZ_TRUE;
+
+failed:
+    if ((pReader->m_pSq_ring) && (pReader->m_pSq_ring != MAP_FAILED))
+        munmap(pReader->m_pSq_ring, pReader->m_sq_ring_size);
+    if ((pReader->m_pCq_ring) && (pReader->m_pCq_ring != MAP_FAILED) && (pReader->m_pCq_ring != pReader->m_pSq_ring))
+        munmap(pReader->m_pCq_ring, pReader->m_cq_ring_size);
+    close(fd);
+    pReader->m_ring_fd = -1;
+    return MZ_FALSE;
+}
+
+static mz_bool mz_zip_async_init(mz_zip_async_reader *pReader, int fd)
+{
+    memset(pReader, 0, sizeof(*pReader));
+    pReader->m_fd = fd;
+    pReader->m_ring_fd = -1;
+
+    if (mz_zip_async_init_ring(pReader))
         return MZ_TRUE;
 
-    /* Encryption and patch files are not supported. */
-    if (file_stat.m_bit_flag & (MZ_ZIP_GENERAL_PURPOSE_BIT_FLAG_IS_ENCRYPTED | MZ_ZIP_GENERAL_PURPOSE_BIT_FLAG_USES_STRONG_ENCRYPTION | MZ_ZIP_GENERAL_PURPOSE_BIT_FLAG_COMPRESSED_PATCH_FLAG))
-        return mz_zip_set_error(pZip, MZ_ZIP_UNSUPPORTED_ENCRYPTION);
+    if (pthread_mutex_init(&pReader->m_mutex, NULL))
+        return MZ_FALSE;
+    if (pthread_cond_init(&pReader->m_cond, NULL))
+    {
+        pthread_mutex_destroy(&pReader->m_mutex);
+        return MZ_FALSE;
+    }
 
-    /* This function only supports decompressing stored and deflate. */
-    if ((!(flags & MZ_ZIP_FLAG_COMPRESSED_DATA)) && (file_stat.m_method != 0) && (file_stat.m_method != MZ_DEFLATED))
-        return mz_zip_set_error(pZip, MZ_ZIP_UNSUPPORTED_METHOD);
+    while (pReader->m_num_threads < MZ_ZIP_ASYNC_READ_DEPTH)
+    {
+        if (pthread_create(&pReader->m_threads[pReader->m_num_threads], NULL, mz_zip_async_thread_func, pReader))
+            break;
+        pReader->m_num_threads++;
+    }
 
-    /* Read and do some minimal validation of the local directory entry (this doesn't crack the zip64 stuff, which we already have from the central dir) */
-    cur_file_ofs = file_stat.m_local_header_ofs;
-    if (pZip->m_pRead(pZip->m_pIO_opaque, cur_file_ofs, pLocal_header, MZ_ZIP_LOCAL_DIR_HEADER_SIZE) != MZ_ZIP_LOCAL_DIR_HEADER_SIZE)
-        return mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
+    if (!pReader->m_num_threads)
+    {
+        pthread_cond_destroy(&pReader->m_cond);
+        pthread_mutex_destroy(&pReader->m_mutex);
+        return MZ_FALSE;
+    }
 
-    if (MZ_READ_LE32(pLocal_header) != MZ_ZIP_LOCAL_DIR_HEADER_SIG)
-        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
+    return MZ_TRUE;
+}
 
-    cur_file_ofs += MZ_ZIP_LOCAL_DIR_HEADER_SIZE + MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_FILENAME_LEN_OFS) + MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_EXTRA_LEN_OFS);
-    if ((cur_file_ofs + file_stat.m_comp_size) > pZip->m_archive_size)
-        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
+static mz_bool mz_zip_async_submit(mz_zip_async_reader *pReader, int slot, void *pBuf, mz_uint64 ofs, size_t n)
+{
+    mz_zip_async_read *pRead = &pReader->m_reads[slot];
 
-    /* Decompress the file either directly from memory or from a file input buffer. */
-    if (pZip->m_pState->m_pMem)
+    pRead->m_pBuf = pBuf;
+    pRead->m_ofs = ofs;
+    pRead->m_size = n;
+    pRead->m_result = -1;
+    pRead->m_done = 0;
+
+    if (pReader->m_ring_fd >= 0)
     {
-        pRead_buf = (mz_uint8 *)pZip->m_pState->m_pMem + cur_file_ofs;
-        read_buf_size = read_buf_avail = file_stat.m_comp_size;
-        comp_remaining = 0;
+        unsigned tail = *pReader->m_pSq_tail, index = tail & *pReader->m_pSq_mask;
+        struct io_uring_sqe *pSqe = &pReader->m_pSqes[index];
+
+        /* IORING_OP_READV rather than IORING_OP_READ, which needs a newer kernel */
+        pRead->m_iov.iov_base = pBuf;
+        pRead->m_iov.iov_len = n;
+        memset(pSqe, 0, sizeof(*pSqe));
+        pSqe->opcode = IORING_OP_READV;
+        pSqe->fd = pReader->m_fd;
+        pSqe->off = ofs;
+        pSqe->addr = (mz_uint64)(size_t)&pRead->m_iov;
+        pSqe->len = 1;
+        pSqe->user_data = (mz_uint64)slot;
+        pReader->m_pSq_array[index] = index;
+        __atomic_store_n(pReader->m_pSq_tail, tail + 1, __ATOMIC_RELEASE);
+
+        if (syscall(__NR_io_uring_enter, pReader->m_ring_fd, 1, 0, 0, NULL, 0) != 1)
+        {
+            /* Nothing was consumed, take the entry back */
+            __atomic_store_n(pReader->m_pSq_tail, tail, __ATOMIC_RELEASE);
+            return MZ_FALSE;
+        }
     }
     else
     {
-        read_buf_size = MZ_MIN(file_stat.m_comp_size, (mz_uint64)MZ_ZIP_MAX_IO_BUF_SIZE);
-        if (NULL == (pRead_buf = pZip->m_pAlloc(pZip->m_pAlloc_opaque, 1, (size_t)read_buf_size)))
-            return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
-
-        read_buf_avail = 0;
-        comp_remaining = file_stat.m_comp_size;
+        pthread_mutex_lock(&pReader->m_mutex);
+        pReader->m_queue[(pReader->m_queue_head + pReader->m_queue_count) % MZ_ZIP_ASYNC_READ_DEPTH] = slot;
+        pReader->m_queue_count++;
+        pthread_cond_broadcast(&pReader->m_cond);
+        pthread_mutex_unlock(&pReader->m_mutex);
     }
 
-    if ((flags & MZ_ZIP_FLAG_COMPRESSED_DATA) || (!file_stat.m_method))
+    pRead->m_pending = 1;
+    return MZ_TRUE;
+}
+
+/* Waits for the read submitted to slot, returns MZ_TRUE if it filled the whole buffer. */
+static mz_bool mz_zip_async_wait(mz_zip_async_reader *pReader, int slot)
+{
+    mz_zip_async_read *pRead = &pReader->m_reads[slot];
+
+    if (!pRead->m_pending)
+        return MZ_FALSE;
+
+    if (pReader->m_ring_fd >= 0)
     {
-        /* The file is stored or the caller has requested the compressed data. */
-        if (pZip->m_pState->m_pMem)
+        while (!pRead->m_done)
         {
-            if (((sizeof(size_t) == sizeof(mz_uint32))) && (file_stat.m_comp_size > MZ_UINT32_MAX))
-                return mz_zip_set_error(pZip, MZ_ZIP_INTERNAL_ERROR);
-
-            if (pCallback(pOpaque, out_buf_ofs, pRead_buf, (size_t)file_stat.m_comp_size) != file_stat.m_comp_size)
+            unsigned head = *pReader->m_pCq_head;
+            if (head == __atomic_load_n(pReader->m_pCq_tail, __ATOMIC_ACQUIRE))
             {
-                mz_zip_set_error(pZip, MZ_ZIP_WRITE_CALLBACK_FAILED);
-                status = TINFL_STATUS_FAILED;
+                if ((syscall(__NR_io_uring_enter, pReader->m_ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0) && (errno != EINTR))
+                    return MZ_FALSE;
+                continue;
             }
-            else if (!(flags & MZ_ZIP_FLAG_COMPRESSED_DATA))
+            else
             {
-#ifndef MINIZ_DISABLE_ZIP_READER_CRC32_CHECKS
-                file_crc32 = (mz_uint32)mz_crc32(file_crc32, (const mz_uint8 *)pRead_buf, (size_t)file_stat.m_comp_size);
-#endif
-            }
-
-            cur_file_ofs += file_stat.m_comp_size;
-            out_buf_ofs += file_stat.m_comp_size;
-            comp_remaining = 0;
-        }
-        else
-        {
-            while (comp_remaining)
-            {
-                read_buf_avail = MZ_MIN(read_buf_size, comp_remaining);
-                if (pZip->m_pRead(pZip->m_pIO_opaque, cur_file_ofs, pRead_buf, (size_t)read_buf_avail) != read_buf_avail)
-                {
-                    mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
-                    status = TINFL_STATUS_FAILED;
-                    break;
-                }
-
-#ifndef MINIZ_DISABLE_ZIP_READER_CRC32_CHECKS
-                if (!(flags & MZ_ZIP_FLAG_COMPRESSED_DATA))
-                {
-                    file_crc32 = (mz_uint32)mz_crc32(file_crc32, (const mz_uint8 *)pRead_buf, (size_t)read_buf_avail);
-                }
-#endif
-
-                if (pCallback(pOpaque, out_buf_ofs, pRead_buf, (size_t)read_buf_avail) != read_buf_avail)
-                {
-                    mz_zip_set_error(pZip, MZ_ZIP_WRITE_CALLBACK_FAILED);
-                    status = TINFL_STATUS_FAILED;
-                    break;
-                }
-
-                cur_file_ofs += read_buf_avail;
-                out_buf_ofs += read_buf_avail;
-                comp_remaining -= read_buf_avail;
+                const struct io_uring_cqe *pCqe = &pReader->m_pCqes[head & *pReader->m_pCq_mask];
+                mz_zip_async_read *pCompleted = &pReader->m_reads[pCqe->user_data];
+                pCompleted->m_result = pCqe->res;
+                pCompleted->m_done = 1;
+                __atomic_store_n(pReader->m_pCq_head, head + 1, __ATOMIC_RELEASE);
             }
         }
     }
     else
     {
-        tinfl_decompressor inflator;
-        tinfl_init(&inflator);
+        pthread_mutex_lock(&pReader->m_mutex);
+        while (!pRead->m_done)
+            pthread_cond_wait(&pReader->m_cond, &pReader->m_mutex);
+        pthread_mutex_unlock(&pReader->m_mutex);
+    }
 
-        if (NULL == (pWrite_buf = pZip->m_pAlloc(pZip->m_pAlloc_opaque, 1, TINFL_LZ_DICT_SIZE)))
-        {
-            mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
-            status = TINFL_STATUS_FAILED;
-        }
-        else
-        {
-            do
-            {
-                mz_uint8 *pWrite_buf_cur = (mz_uint8 *)pWrite_buf + (out_buf_ofs & (TINFL_LZ_DICT_SIZE - 1));
-                size_t in_buf_size, out_buf_size = TINFL_LZ_DICT_SIZE - (out_buf_ofs & (TINFL_LZ_DICT_SIZE - 1));
-                if ((!read_buf_avail) && (!pZip->m_pState->m_pMem))
-                {
-                    read_buf_avail = MZ_MIN(read_buf_size, comp_remaining);
-                    if (pZip->m_pRead(pZip->m_pIO_opaque, cur_file_ofs, pRead_buf, (size_t)read_buf_avail) != read_buf_avail)
-                    {
-                        mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
-                        status = TINFL_STATUS_FAILED;
-                        break;
-                    }
-                    cur_file_ofs += read_buf_avail;
-                    comp_remaining -= read_buf_avail;
-                    read_buf_ofs = 0;
-                }
+    pRead->m_pending = 0;
 
-                in_buf_size = (size_t)read_buf_avail;
-                status = tinfl_decompress(&inflator, (const mz_uint8 *)pRead_buf + read_buf_ofs, &in_buf_size, (mz_uint8 *)pWrite_buf, pWrite_buf_cur, &out_buf_size, comp_remaining ? TINFL_FLAG_HAS_MORE_INPUT : 0);
-                read_buf_avail -= in_buf_size;
-                read_buf_ofs += in_buf_size;
+    /* io_uring may complete regular file reads short, finish those off directly */
+    if ((pRead->m_result >= 0) && ((size_t)pRead->m_result < pRead->m_size))
+    {
+        mz_int64 r = mz_zip_pread(pReader->m_fd, (mz_uint8 *)pRead->m_pBuf + pRead->m_result, pRead->m_size - (size_t)pRead->m_result, pRead->m_ofs + pRead->m_result);
+        pRead->m_result = (r < 0) ? -1 : (pRead->m_result + r);
+    }
 
-                if (out_buf_size)
-                {
-                    if (pCallback(pOpaque, out_buf_ofs, pWrite_buf_cur, out_buf_size) != out_buf_size)
-                    {
-                        mz_zip_set_error(pZip, MZ_ZIP_WRITE_CALLBACK_FAILED);
-                        status = TINFL_STATUS_FAILED;
-                        break;
-                    }
+    return pRead->m_result == (mz_int64)pRead->m_size;
+}
 
-#ifndef MINIZ_DISABLE_ZIP_READER_CRC32_CHECKS
-                    file_crc32 = (mz_uint32)mz_crc32(file_crc32, pWrite_buf_cur, out_buf_size);
-#endif
-                    if ((out_buf_ofs += out_buf_size) > file_stat.m_uncomp_size)
-                    {
-                        mz_zip_set_error(pZip, MZ_ZIP_DECOMPRESSION_FAILED);
-                        status = TINFL_STATUS_FAILED;
-                        break;
-                    }
-                }
-            } while ((status == TINFL_STATUS_NEEDS_MORE_INPUT) || (status == TINFL_STATUS_HAS_MORE_OUTPUT));
-        }
-    }
+static void mz_zip_async_end(mz_zip_async_reader *pReader)
+{
+    int i;
 
-    if ((status == TINFL_STATUS_DONE) && (!(flags & MZ_ZIP_FLAG_COMPRESSED_DATA)))
+    /* Reads still in flight must land before their buffers are freed */
+    for (i = 0; i < MZ_ZIP_ASYNC_READ_DEPTH; i++)
+        mz_zip_async_wait(pReader, i);
+
+    if (pReader->m_ring_fd >= 0)
     {
-        /* Make sure the entire file was decompressed, and check its CRC. */
-        if (out_buf_ofs != file_stat.m_uncomp_size)
-        {
-            mz_zip_set_error(pZip, MZ_ZIP_UNEXPECTED_DECOMPRESSED_SIZE);
-            status = TINFL_STATUS_FAILED;
-        }
-#ifndef MINIZ_DISABLE_ZIP_READER_CRC32_CHECKS
-        else if (file_crc32 != file_stat.m_crc32)
-        {
-            mz_zip_set_error(pZip, MZ_ZIP_DECOMPRESSION_FAILED);
-            status = TINFL_STATUS_FAILED;
-        }
-#endif
+        munmap(pReader->m_pSqes, pReader->m_sqes_size);
+        if (pReader->m_pCq_ring != pReader->m_pSq_ring)
+            munmap(pReader->m_pCq_ring, pReader->m_cq_ring_size);
+        munmap(pReader->m_pSq_ring, pReader->m_sq_ring_size);
+        close(pReader->m_ring_fd);
+        return;
     }
 
-    if (!pZip->m_pState->m_pMem)
-        pZip->m_pFree(pZip->m_pAlloc_opaque, pRead_buf);
+    pthread_mutex_lock(&pReader->m_mutex);
+    pReader->m_shutdown = 1;
+    pthread_cond_broadcast(&pReader->m_cond);
+    pthread_mutex_unlock(&pReader->m_mutex);
 
-    if (pWrite_buf)
-        pZip->m_pFree(pZip->m_pAlloc_opaque, pWrite_buf);
+    for (i = 0; i < pReader->m_num_threads; i++)
+        pthread_join(pReader->m_threads[i], NULL);
 
-    return status == TINFL_STATUS_DONE;
+    pthread_cond_destroy(&pReader->m_cond);
+    pthread_mutex_destroy(&pReader->m_mutex);
 }
+#endif /* #ifdef MINIZ_ZIP_ASYNC_IO */
 
-mz_bool mz_zip_reader_extract_file_to_callback(mz_zip_archive *pZip, const char *pFilename, mz_file_write_func pCallback, void *pOpaque, mz_uint flags)
+typedef struct
 {
-    mz_uint32 file_index;
-    if (!mz_zip_reader_locate_file_v2(pZip, pFilename, NULL, flags, &file_index))
-        return MZ_FALSE;
+    mz_file_read_func m_pRead;
+    void *m_pIO_opaque;
+    const mz_uint8 *m_pBuf;
+    mz_uint64 m_buf_ofs;
+    size_t m_buf_size;
+#ifdef MINIZ_STATS
+    mz_zip_internal_state *m_pZip_state;
+#endif
+} mz_zip_batch_read_state;
 
-    return mz_zip_reader_extract_to_callback(pZip, file_index, pCallback, pOpaque, flags);
+/* Serves reads from the coalesced buffer of mz_zip_reader_extract_batch_to_heap(), anything outside of it goes to the archive's own read callback. */
+static size_t mz_zip_batch_read_func(void *pOpaque, mz_uint64 file_ofs, void *pBuf, size_t n)
+{
+    mz_zip_batch_read_state *pState = (mz_zip_batch_read_state *)pOpaque;
+
+    if ((file_ofs >= pState->m_buf_ofs) && (n <= pState->m_buf_size) && (file_ofs - pState->m_buf_ofs <= pState->m_buf_size - n))
+    {
+        memcpy(pBuf, pState->m_pBuf + (size_t)(file_ofs - pState->m_buf_ofs), n);
+        return n;
+    }
+
+#ifdef MINIZ_STATS
+    return mz_zip_stats_read(pState->m_pZip_state, pState->m_pRead, pState->m_pIO_opaque, file_ofs, pBuf, n);
+#else
+    return pState->m_pRead(pState->m_pIO_opaque, file_ofs, pBuf, n);
+#endif
 }
 
-mz_zip_reader_extract_iter_state* mz_zip_reader_extract_iter_new(mz_zip_archive *pZip, mz_uint file_index, mz_uint flags)
+typedef struct
 {
-    mz_zip_reader_extract_iter_state *pState;
-    mz_uint32 local_header_u32[(MZ_ZIP_LOCAL_DIR_HEADER_SIZE + sizeof(mz_uint32) - 1) / sizeof(mz_uint32)];
-    mz_uint8 *pLocal_header = (mz_uint8 *)local_header_u32;
+    mz_uint64 m_start, m_end;
+    mz_uint32 m_first, m_last;
+    mz_bool m_buffered;
+} mz_zip_batch_run;
 
-    /* Argument sanity check */
-    if ((!pZip) || (!pZip->m_pState))
-        return NULL;
+#ifdef MINIZ_ZIP_ASYNC_IO
+static mz_bool mz_zip_batch_submit_run(mz_zip_archive *pZip, mz_zip_async_reader *pReader, int slot, const mz_zip_batch_run *pRun, mz_zip_array *pRead_buf)
+{
+    if (!pRun->m_buffered)
+        return MZ_TRUE;
 
-    /* Allocate an iterator status structure */
-    pState = (mz_zip_reader_extract_iter_state*)pZip->m_pAlloc(pZip->m_pAlloc_opaque, 1, sizeof(mz_zip_reader_extract_iter_state));
-    if (!pState)
+    if (!mz_zip_array_resize(pZip, pRead_buf, (size_t)(pRun->m_end - pRun->m_start), MZ_FALSE))
+        return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+
+    if (!mz_zip_async_submit(pReader, slot, pRead_buf->m_p, pZip->m_pState->m_file_archive_start_ofs + pRun->m_start, pRead_buf->m_size))
+        return mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
+
+    return MZ_TRUE;
+}
+#endif
+
+/* Extracts file file_index, at position batch_index in the batch, wherever the batch function wants it. */
+typedef mz_bool (*mz_zip_batch_entry_func)(mz_zip_archive *pZip, mz_uint32 file_index, mz_uint32 batch_index, void *pOpaque, mz_uint flags);
+
+static mz_bool mz_zip_reader_extract_batch_internal(mz_zip_archive *pZip, const mz_uint32 *pFile_indices, mz_uint32 num_files, mz_zip_batch_entry_func pExtract, void *pOpaque, mz_uint flags)
+{
+    mz_zip_array entries, entry_ends, runs, read_bufs[MZ_ZIP_ASYNC_READ_DEPTH];
+    mz_zip_local_header_entry *pEntries;
+    mz_zip_batch_run *pRuns;
+    mz_uint64 *pEntry_ends;
+    mz_zip_batch_read_state read_state;
+    mz_bool status = MZ_TRUE, async = MZ_FALSE;
+    mz_uint32 i, j, num_runs = 0;
+#ifdef MINIZ_ZIP_ASYNC_IO
+    mz_zip_async_reader async_reader;
+#endif
+
+    if ((!pZip) || (!pZip->m_pState) || ((!pFile_indices) && (num_files)) || (pZip->m_zip_mode != MZ_ZIP_MODE_READING))
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+
+    /* Nothing to coalesce, memory archives are extracted straight out of the buffer */
+    if (pZip->m_pState->m_pMem)
     {
-        mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
-        return NULL;
+        for (i = 0; i < num_files; i++)
+        {
+            if (!pExtract(pZip, pFile_indices[i], i, pOpaque, flags))
+                return MZ_FALSE;
+        }
+        return MZ_TRUE;
     }
 
-    /* Fetch file details */
-    if (!mz_zip_reader_file_stat(pZip, file_index, &pState->file_stat))
+    mz_zip_array_init(&entries, sizeof(mz_zip_local_header_entry));
+    mz_zip_array_init(&entry_ends, sizeof(mz_uint64));
+    mz_zip_array_init(&runs, sizeof(mz_zip_batch_run));
+    for (i = 0; i < MZ_ZIP_ASYNC_READ_DEPTH; i++)
+        mz_zip_array_init(&read_bufs[i], sizeof(mz_uint8));
+
+    if ((!mz_zip_array_resize(pZip, &entries, num_files, MZ_FALSE)) || (!mz_zip_array_resize(pZip, &entry_ends, num_files, MZ_FALSE)) ||
+        (!mz_zip_array_resize(pZip, &runs, num_files, MZ_FALSE)))
     {
-        pZip->m_pFree(pZip->m_pAlloc_opaque, pState);
-        return NULL;
+        status = mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+        goto done;
     }
+    pEntries = (mz_zip_local_header_entry *)entries.m_p;
+    pEntry_ends = (mz_uint64 *)entry_ends.m_p;
+    pRuns = (mz_zip_batch_run *)runs.m_p;
 
-    /* Encryption and patch files are not supported. */
-    if (pState->file_stat.m_bit_flag & (MZ_ZIP_GENERAL_PURPOSE_BIT_FLAG_IS_ENCRYPTED | MZ_ZIP_GENERAL_PURPOSE_BIT_FLAG_USES_STRONG_ENCRYPTION | MZ_ZIP_GENERAL_PURPOSE_BIT_FLAG_COMPRESSED_PATCH_FLAG))
+    for (i = 0; i < num_files; i++)
     {
-        mz_zip_set_error(pZip, MZ_ZIP_UNSUPPORTED_ENCRYPTION);
-        pZip->m_pFree(pZip->m_pAlloc_opaque, pState);
-        return NULL;
+        mz_zip_archive_file_stat file_stat;
+        const mz_uint8 *pCentral_dir_header;
+
+        if ((!mz_zip_reader_file_stat(pZip, pFile_indices[i], &file_stat)) || (!(pCentral_dir_header = mz_zip_get_cdh(pZip, pFile_indices[i]))))
+        {
+            status = MZ_FALSE;
+            goto done;
+        }
+
+        /* The local extra field usually matches the central one, the read slack below covers small differences */
+        pEntries[i].m_local_header_ofs = file_stat.m_local_header_ofs;
+        pEntries[i].m_file_index = i;
+        pEntry_ends[i] = file_stat.m_local_header_ofs + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + MZ_READ_LE16(pCentral_dir_header + MZ_ZIP_CDH_FILENAME_LEN_OFS) +
+                         MZ_READ_LE16(pCentral_dir_header + MZ_ZIP_CDH_EXTRA_LEN_OFS) + file_stat.m_comp_size;
     }
 
-    /* This function only supports decompressing stored and deflate. */
-    if ((!(flags & MZ_ZIP_FLAG_COMPRESSED_DATA)) && (pState->file_stat.m_method != 0) && (pState->file_stat.m_method != MZ_DEFLATED))
+    mz_zip_sort_by_local_header_ofs(pEntries, num_files);
+
+    /* Group the entries into runs that are fetched with a single read, merging neighbours while they're close enough and the read stays reasonably sized */
+    for (i = 0; i < num_files; i = j)
     {
-        mz_zip_set_error(pZip, MZ_ZIP_UNSUPPORTED_METHOD);
-        pZip->m_pFree(pZip->m_pAlloc_opaque, pState);
-        return NULL;
-    }
+        mz_zip_batch_run *pRun = &pRuns[num_runs++];
 
-    /* Init state - save args */
-    pState->pZip = pZip;
-    pState->flags = flags;
+        pRun->m_start = pEntries[i].m_local_header_ofs;
+        pRun->m_end = pEntry_ends[pEntries[i].m_file_index];
+        for (j = i + 1; j < num_files; j++)
+        {
+            mz_uint64 next_end = MZ_MAX(pRun->m_end, pEntry_ends[pEntries[j].m_file_index]);
+            if ((pEntries[j].m_local_header_ofs > pRun->m_end + MZ_ZIP_MAX_BATCH_READ_GAP) || (next_end - pRun->m_start > MZ_ZIP_MAX_BATCH_READ_SIZE))
+                break;
+            pRun->m_end = next_end;
+        }
 
-    /* Init state - reset variables to defaults */
-    pState->status = TINFL_STATUS_DONE;
-#ifndef MINIZ_DISABLE_ZIP_READER_CRC32_CHECKS
-    pState->file_crc32 = MZ_CRC32_INIT;
-#endif
-    pState->read_buf_ofs = 0;
-    pState->out_buf_ofs = 0;
-    pState->pRead_buf = NULL;
-    pState->pWrite_buf = NULL;
-    pState->out_blk_remain = 0;
+        pRun->m_first = i;
+        pRun->m_last = j;
+        pRun->m_end = MZ_MIN(pRun->m_end + MZ_ZIP_MAX_BATCH_READ_GAP, pZip->m_archive_size);
 
-    /* Read and parse the local directory entry. */
-    pState->cur_file_ofs = pState->file_stat.m_local_header_ofs;
-    if (pZip->m_pRead(pZip->m_pIO_opaque, pState->cur_file_ofs, pLocal_header, MZ_ZIP_LOCAL_DIR_HEADER_SIZE) != MZ_ZIP_LOCAL_DIR_HEADER_SIZE)
-    {
-        mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
-        pZip->m_pFree(pZip->m_pAlloc_opaque, pState);
-        return NULL;
+        /* Entries too large to coalesce just read through as usual */
+        pRun->m_buffered = (pRun->m_end > pRun->m_start) && (pRun->m_end - pRun->m_start <= MZ_ZIP_MAX_BATCH_READ_SIZE + MZ_ZIP_MAX_BATCH_READ_GAP);
     }
 
-    if (MZ_READ_LE32(pLocal_header) != MZ_ZIP_LOCAL_DIR_HEADER_SIG)
+#ifdef MINIZ_ZIP_ASYNC_IO
+    /* Keep reading the following runs while the current one is being inflated */
+    if ((num_runs > 1) && (pZip->m_pState->m_pFile) && (pZip->m_pRead == mz_zip_file_read_func) &&
+        ((pZip->m_zip_type == MZ_ZIP_TYPE_FILE) || (pZip->m_zip_type == MZ_ZIP_TYPE_CFILE)))
     {
-        mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
-        pZip->m_pFree(pZip->m_pAlloc_opaque, pState);
-        return NULL;
+        MZ_FFLUSH(pZip->m_pState->m_pFile);
+        async = mz_zip_async_init(&async_reader, fileno(pZip->m_pState->m_pFile));
     }
+#endif
 
-    pState->cur_file_ofs += MZ_ZIP_LOCAL_DIR_HEADER_SIZE + MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_FILENAME_LEN_OFS) + MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_EXTRA_LEN_OFS);
-    if ((pState->cur_file_ofs + pState->file_stat.m_comp_size) > pZip->m_archive_size)
-    {
-        mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
-        pZip->m_pFree(pZip->m_pAlloc_opaque, pState);
-        return NULL;
-    }
+    read_state.m_pRead = pZip->m_pRead;
+    read_state.m_pIO_opaque = pZip->m_pIO_opaque;
+    MZ_ZIP_STATS(read_state.m_pZip_state = pZip->m_pState);
 
-    /* Decompress the file either directly from memory or from a file input buffer. */
-    if (pZip->m_pState->m_pMem)
-    {
-        pState->pRead_buf = (mz_uint8 *)pZip->m_pState->m_pMem + pState->cur_file_ofs;
-        pState->read_buf_size = pState->read_buf_avail = pState->file_stat.m_comp_size;
-        pState->comp_remaining = pState->file_stat.m_comp_size;
-    }
-    else
+#ifdef MINIZ_ZIP_ASYNC_IO
+    for (i = 0; (async) && (status) && (i < MZ_MIN(num_runs, MZ_ZIP_ASYNC_READ_DEPTH)); i++)
+        status = mz_zip_batch_submit_run(pZip, &async_reader, (int)i, &pRuns[i], &read_bufs[i]);
+#endif
+
+    for (i = 0; (status) && (i < num_runs); i++)
     {
-        if (!((flags & MZ_ZIP_FLAG_COMPRESSED_DATA) || (!pState->file_stat.m_method)))
+        mz_zip_batch_run *pRun = &pRuns[i];
+        mz_zip_array *pRead_buf = &read_bufs[async ? (i % MZ_ZIP_ASYNC_READ_DEPTH) : 0];
+
+        read_state.m_buf_size = 0;
+        read_state.m_buf_ofs = pRun->m_start;
+        if (pRun->m_buffered)
         {
-            /* Decompression required, therefore intermediate read buffer required */
-            pState->read_buf_size = MZ_MIN(pState->file_stat.m_comp_size, (mz_uint64)MZ_ZIP_MAX_IO_BUF_SIZE);
-            if (NULL == (pState->pRead_buf = pZip->m_pAlloc(pZip->m_pAlloc_opaque, 1, (size_t)pState->read_buf_size)))
+            if (async)
             {
-                mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
-                pZip->m_pFree(pZip->m_pAlloc_opaque, pState);
-                return NULL;
+#ifdef MINIZ_ZIP_ASYNC_IO
+                MZ_ZIP_STATS(mz_uint64 start_time = MZ_ZIP_STATS_CLOCK());
+                if (!mz_zip_async_wait(&async_reader, i % MZ_ZIP_ASYNC_READ_DEPTH))
+                {
+                    status = mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
+                    break;
+                }
+                MZ_ZIP_STATS(mz_zip_stats_count_read(pZip->m_pState, pRun->m_start, pRead_buf->m_size, start_time));
+#endif
             }
+            else
+            {
+                if (!mz_zip_array_resize(pZip, pRead_buf, (size_t)(pRun->m_end - pRun->m_start), MZ_FALSE))
+                {
+                    status = mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+                    break;
+                }
+
+                if (MZ_ZIP_READ(pZip, pRun->m_start, pRead_buf->m_p, pRead_buf->m_size) != pRead_buf->m_size)
+                {
+                    status = mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
+                    break;
+                }
+            }
+
+            read_state.m_pBuf = (const mz_uint8 *)pRead_buf->m_p;
+            read_state.m_buf_size = pRead_buf->m_size;
         }
-        else
-        {
-            /* Decompression not required - we will be reading directly into user buffer, no temp buf required */
-            pState->read_buf_size = 0;
-        }
-        pState->read_buf_avail = 0;
-        pState->comp_remaining = pState->file_stat.m_comp_size;
-    }
 
-    if (!((flags & MZ_ZIP_FLAG_COMPRESSED_DATA) || (!pState->file_stat.m_method)))
-    {
-        /* Decompression required, init decompressor */
-        tinfl_init( &pState->inflator );
+        pZip->m_pRead = mz_zip_batch_read_func;
+        pZip->m_pIO_opaque = &read_state;
+        MZ_ZIP_STATS(pZip->m_pState->m_stats_reads_redirected = MZ_TRUE);
 
-        /* Allocate write buffer */
-        if (NULL == (pState->pWrite_buf = pZip->m_pAlloc(pZip->m_pAlloc_opaque, 1, TINFL_LZ_DICT_SIZE)))
+        for (j = pRun->m_first; j < pRun->m_last; j++)
         {
-            mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
-            if (pState->pRead_buf)
-                pZip->m_pFree(pZip->m_pAlloc_opaque, pState->pRead_buf);
-            pZip->m_pFree(pZip->m_pAlloc_opaque, pState);
-            return NULL;
+            mz_uint32 n = pEntries[j].m_file_index;
+            if (!pExtract(pZip, pFile_indices[n], n, pOpaque, flags))
+            {
+                status = MZ_FALSE;
+                break;
+            }
         }
+
+        pZip->m_pRead = read_state.m_pRead;
+        pZip->m_pIO_opaque = read_state.m_pIO_opaque;
+        MZ_ZIP_STATS(pZip->m_pState->m_stats_reads_redirected = MZ_FALSE);
+
+#ifdef MINIZ_ZIP_ASYNC_IO
+        /* This run's buffer is free again, start reading the run that reuses it */
+        if ((status) && (async) && (i + MZ_ZIP_ASYNC_READ_DEPTH < num_runs))
+            status = mz_zip_batch_submit_run(pZip, &async_reader, (int)(i % MZ_ZIP_ASYNC_READ_DEPTH), &pRuns[i + MZ_ZIP_ASYNC_READ_DEPTH], pRead_buf);
+#endif
     }
 
-    return pState;
+#ifdef MINIZ_ZIP_ASYNC_IO
+    if (async)
+        mz_zip_async_end(&async_reader);
+#endif
+
+done:
+    mz_zip_array_clear(pZip, &entries);
+    mz_zip_array_clear(pZip, &entry_ends);
+    mz_zip_array_clear(pZip, &runs);
+    for (i = 0; i < MZ_ZIP_ASYNC_READ_DEPTH; i++)
+        mz_zip_array_clear(pZip, &read_bufs[i]);
+
+    return status;
 }
 
-mz_zip_reader_extract_iter_state* mz_zip_reader_extract_file_iter_new(mz_zip_archive *pZip, const char *pFilename, mz_uint flags)
+typedef struct
 {
-    mz_uint32 file_index;
+    mz_zip_batch_extract_func m_pCallback;
+    void *m_pOpaque;
+} mz_zip_batch_callback_state;
 
-    /* Locate file index by name */
-    if (!mz_zip_reader_locate_file_v2(pZip, pFilename, NULL, flags, &file_index))
-        return NULL;
-
-    /* Construct iterator */
-    return mz_zip_reader_extract_iter_new(pZip, file_index, flags);
+static mz_bool mz_zip_batch_callback_func(mz_zip_archive *pZip, mz_uint32 file_index, mz_uint32 batch_index, void *pOpaque, mz_uint flags)
+{
+    mz_zip_batch_callback_state *pState = (mz_zip_batch_callback_state *)pOpaque;
+    size_t size;
+    void *pBuf = mz_zip_reader_extract_to_heap(pZip, file_index, &size, flags);
+    return (pBuf) && (pState->m_pCallback(pState->m_pOpaque, batch_index, pBuf, size));
 }
 
-size_t mz_zip_reader_extract_iter_read(mz_zip_reader_extract_iter_state* pState, void* pvBuf, size_t buf_size)
+typedef struct
 {
-    size_t copied_to_caller = 0;
-
-    /* Argument sanity check */
-    if ((!pState) || (!pState->pZip) || (!pState->pZip->m_pState) || (!pvBuf))
-        return 0;
-
-    if ((pState->flags & MZ_ZIP_FLAG_COMPRESSED_DATA) || (!pState->file_stat.m_method))
-    {
-        /* The file is stored or the caller has requested the compressed data, calc amount to return. */
-        copied_to_caller = (size_t)MZ_MIN( buf_size, pState->comp_remaining );
-
-        /* Zip is in memory....or requires reading from a file? */
-        if (pState->pZip->m_pState->m_pMem)
-        {
-            /* Copy data to caller's buffer */
-            memcpy( pvBuf, pState->pRead_buf, copied_to_caller );
-            pState->pRead_buf = ((mz_uint8*)pState->pRead_buf) + copied_to_caller;
-        }
-        else
-        {
-            /* Read directly into caller's buffer */
-            if (pState->pZip->m_pRead(pState->pZip->m_pIO_opaque, pState->cur_file_ofs, pvBuf, copied_to_caller) != copied_to_caller)
-            {
-                /* Failed to read all that was asked for, flag failure and alert user */
-                mz_zip_set_error(pState->pZip, MZ_ZIP_FILE_READ_FAILED);
-                pState->status = TINFL_STATUS_FAILED;
-                copied_to_caller = 0;
-            }
-        }
-
-#ifndef MINIZ_DISABLE_ZIP_READER_CRC32_CHECKS
-        /* Compute CRC if not returning compressed data only */
-        if (!(pState->flags & MZ_ZIP_FLAG_COMPRESSED_DATA))
-            pState->file_crc32 = (mz_uint32)mz_crc32(pState->file_crc32, (const mz_uint8 *)pvBuf, copied_to_caller);
-#endif
-
-        /* Advance offsets, dec counters */
-        pState->cur_file_ofs += copied_to_caller;
-        pState->out_buf_ofs += copied_to_caller;
-        pState->comp_remaining -= copied_to_caller;
-    }
-    else
-    {
-        do
-        {
-            /* Calc ptr to write buffer - given current output pos and block size */
-            mz_uint8 *pWrite_buf_cur = (mz_uint8 *)pState->pWrite_buf + (pState->out_buf_ofs & (TINFL_LZ_DICT_SIZE - 1));
-
-            /* Calc max output size - given current output pos and block size */
-            size_t in_buf_size, out_buf_size = TINFL_LZ_DICT_SIZE - (pState->out_buf_ofs & (TINFL_LZ_DICT_SIZE - 1));
-
-            if (!pState->out_blk_remain)
-            {
-                /* Read more data from file if none available (and reading from file) */
-                if ((!pState->read_buf_avail) && (!pState->pZip->m_pState->m_pMem))
-                {
-                    /* Calc read size */
-                    pState->read_buf_avail = MZ_MIN(pState->read_buf_size, pState->comp_remaining);
-                    if (pState->pZip->m_pRead(pState->pZip->m_pIO_opaque, pState->cur_file_ofs, pState->pRead_buf, (size_t)pState->read_buf_avail) != pState->read_buf_avail)
-                    {
-                        mz_zip_set_error(pState->pZip, MZ_ZIP_FILE_READ_FAILED);
-                        pState->status = TINFL_STATUS_FAILED;
-                        break;
-                    }
-
-                    /* Advance offsets, dec counters */
-                    pState->cur_file_ofs += pState->read_buf_avail;
-                    pState->comp_remaining -= pState->read_buf_avail;
-                    pState->read_buf_ofs = 0;
-                }
-
-                /* Perform decompression */
-                in_buf_size = (size_t)pState->read_buf_avail;
-                pState->status = tinfl_decompress(&pState->inflator, (const mz_uint8 *)pState->pRead_buf + pState->read_buf_ofs, &in_buf_size, (mz_uint8 *)pState->pWrite_buf, pWrite_buf_cur, &out_buf_size, pState->comp_remaining ? TINFL_FLAG_HAS_MORE_INPUT : 0);
-                pState->read_buf_avail -= in_buf_size;
-                pState->read_buf_ofs += in_buf_size;
-
-                /* Update current output block size remaining */
-                pState->out_blk_remain = out_buf_size;
-            }
-
-            if (pState->out_blk_remain)
-            {
-                /* Calc amount to return. */
-                size_t to_copy = MZ_MIN( (buf_size - copied_to_caller), pState->out_blk_remain );
-
-                /* Copy data to caller's buffer */
-                memcpy( (mz_uint8*)pvBuf + copied_to_caller, pWrite_buf_cur, to_copy );
-
-#ifndef MINIZ_DISABLE_ZIP_READER_CRC32_CHECKS
-                /* Perform CRC */
-                pState->file_crc32 = (mz_uint32)mz_crc32(pState->file_crc32, pWrite_buf_cur, to_copy);
-#endif
+    void **m_ppBufs;
+    size_t *m_pSizes;
+} mz_zip_batch_heap_state;
 
-                /* Decrement data consumed from block */
-                pState->out_blk_remain -= to_copy;
-
-                /* Inc output offset, while performing sanity check */
-                if ((pState->out_buf_ofs += to_copy) > pState->file_stat.m_uncomp_size)
-                {
-                    mz_zip_set_error(pState->pZip, MZ_ZIP_DECOMPRESSION_FAILED);
-                    pState->status = TINFL_STATUS_FAILED;
-                    break;
-                }
-
-                /* Increment counter of data copied to caller */
-                copied_to_caller += to_copy;
-            }
-        } while ( (copied_to_caller < buf_size) && ((pState->status == TINFL_STATUS_NEEDS_MORE_INPUT) || (pState->status == TINFL_STATUS_HAS_MORE_OUTPUT)) );
-    }
-
-    /* Return how many bytes were copied into user buffer */
-    return copied_to_caller;
+static mz_bool mz_zip_batch_heap_func(void *pOpaque, mz_uint32 batch_index, void *pBuf, size_t size)
+{
+    mz_zip_batch_heap_state *pState = (mz_zip_batch_heap_state *)pOpaque;
+    pState->m_ppBufs[batch_index] = pBuf;
+    if (pState->m_pSizes)
+        pState->m_pSizes[batch_index] = size;
+    return MZ_TRUE;
 }
 
-mz_bool mz_zip_reader_extract_iter_free(mz_zip_reader_extract_iter_state* pState)
+mz_bool mz_zip_reader_extract_batch_to_heap(mz_zip_archive *pZip, const mz_uint32 *pFile_indices, mz_uint32 num_files, void **ppBufs, size_t *pSizes, mz_uint flags)
 {
-    int status;
+    mz_zip_batch_heap_state state;
+    mz_zip_batch_callback_state callback_state;
+    mz_uint32 i;
 
-    /* Argument sanity check */
-    if ((!pState) || (!pState->pZip) || (!pState->pZip->m_pState))
-        return MZ_FALSE;
+    if ((!ppBufs) && (num_files))
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
 
-    /* Was decompression completed and requested? */
-    if ((pState->status == TINFL_STATUS_DONE) && (!(pState->flags & MZ_ZIP_FLAG_COMPRESSED_DATA)))
+    for (i = 0; i < num_files; i++)
     {
-        /* Make sure the entire file was decompressed, and check its CRC. */
-        if (pState->out_buf_ofs != pState->file_stat.m_uncomp_size)
-        {
-            mz_zip_set_error(pState->pZip, MZ_ZIP_UNEXPECTED_DECOMPRESSED_SIZE);
-            pState->status = TINFL_STATUS_FAILED;
-        }
-#ifndef MINIZ_DISABLE_ZIP_READER_CRC32_CHECKS
-        else if (pState->file_crc32 != pState->file_stat.m_crc32)
-        {
-            mz_zip_set_error(pState->pZip, MZ_ZIP_DECOMPRESSION_FAILED);
-            pState->status = TINFL_STATUS_FAILED;
-        }
-#endif
+        ppBufs[i] = NULL;
+        if (pSizes)
+            pSizes[i] = 0;
     }
 
-    /* Free buffers */
-    if (!pState->pZip->m_pState->m_pMem)
-        pState->pZip->m_pFree(pState->pZip->m_pAlloc_opaque, pState->pRead_buf);
-    if (pState->pWrite_buf)
-        pState->pZip->m_pFree(pState->pZip->m_pAlloc_opaque, pState->pWrite_buf);
-
-    /* Save status */
-    status = pState->status;
+    state.m_ppBufs = ppBufs;
+    state.m_pSizes = pSizes;
+    callback_state.m_pCallback = mz_zip_batch_heap_func;
+    callback_state.m_pOpaque = &state;
+    if (mz_zip_reader_extract_batch_internal(pZip, pFile_indices, num_files, mz_zip_batch_callback_func, &callback_state, flags))
+        return MZ_TRUE;
 
-    /* Free context */
-    pState->pZip->m_pFree(pState->pZip->m_pAlloc_opaque, pState);
+    for (i = 0; i < num_files; i++)
+    {
+        if (ppBufs[i])
+            MZ_ZIP_FREE(pZip, ppBufs[i], pSizes ? pSizes[i] : 0);
+        ppBufs[i] = NULL;
+        if (pSizes)
+            pSizes[i] = 0;
+    }
 
-    return status == TINFL_STATUS_DONE;
+    return MZ_FALSE;
 }
 
-#ifndef MINIZ_NO_STDIO
-static size_t mz_zip_file_write_callback(void *pOpaque, mz_uint64 ofs, const void *pBuf, size_t n)
+mz_bool mz_zip_reader_extract_batch_to_callback(mz_zip_archive *pZip, const mz_uint32 *pFile_indices, mz_uint32 num_files, mz_zip_batch_extract_func pCallback, void *pOpaque, mz_uint flags)
 {
-    (void)ofs;
+    mz_zip_batch_callback_state callback_state;
 
-    return MZ_FWRITE(pBuf, 1, n, (MZ_FILE *)pOpaque);
+    if (!pCallback)
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+
+    callback_state.m_pCallback = pCallback;
+    callback_state.m_pOpaque = pOpaque;
+    return mz_zip_reader_extract_batch_internal(pZip, pFile_indices, num_files, mz_zip_batch_callback_func, &callback_state, flags);
 }
 
-mz_bool mz_zip_reader_extract_to_file(mz_zip_archive *pZip, mz_uint file_index, const char *pDst_filename, mz_uint flags)
+mz_bool mz_zip_reader_get_batch_block_size(mz_zip_archive *pZip, const mz_uint32 *pFile_indices, mz_uint32 num_files, size_t *pBlock_size, mz_uint flags)
 {
-    mz_bool status;
-    mz_zip_archive_file_stat file_stat;
-    MZ_FILE *pFile;
-
-    if (!mz_zip_reader_file_stat(pZip, file_index, &file_stat))
-        return MZ_FALSE;
-
-    if ((file_stat.m_is_directory) || (!file_stat.m_is_supported))
-        return mz_zip_set_error(pZip, MZ_ZIP_UNSUPPORTED_FEATURE);
+    mz_uint64 total = 0;
+    mz_uint32 i;
 
-    pFile = MZ_FOPEN(pDst_filename, "wb");
-    if (!pFile)
-        return mz_zip_set_error(pZip, MZ_ZIP_FILE_OPEN_FAILED);
+    if (pBlock_size)
+        *pBlock_size = 0;
 
-    status = mz_zip_reader_extract_to_callback(pZip, file_index, mz_zip_file_write_callback, pFile, flags);
+    if ((!pZip) || (!pZip->m_pState) || ((!pFile_indices) && (num_files)) || (!pBlock_size))
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
 
-    if (MZ_FCLOSE(pFile) == EOF)
+    for (i = 0; i < num_files; i++)
     {
-        if (status)
-            mz_zip_set_error(pZip, MZ_ZIP_FILE_CLOSE_FAILED);
+        mz_zip_archive_file_stat file_stat;
 
-        status = MZ_FALSE;
-    }
+        if (!mz_zip_reader_file_stat(pZip, pFile_indices[i], &file_stat))
+            return MZ_FALSE;
 
-#if !defined(MINIZ_NO_TIME) && !defined(MINIZ_NO_STDIO)
-    if (status)
-        mz_zip_set_file_times(pDst_filename, file_stat.m_time, file_stat.m_time);
-#endif
+        total += (flags & MZ_ZIP_FLAG_COMPRESSED_DATA) ? file_stat.m_comp_size : file_stat.m_uncomp_size;
+        if (((sizeof(size_t) == sizeof(mz_uint32))) && (total > 0x7FFFFFFF))
+            return mz_zip_set_error(pZip, MZ_ZIP_INTERNAL_ERROR);
+    }
 
-    return status;
+    *pBlock_size = (size_t)total;
+    return MZ_TRUE;
 }
 
-mz_bool mz_zip_reader_extract_file_to_file(mz_zip_archive *pZip, const char *pArchive_filename, const char *pDst_filename, mz_uint flags)
+typedef struct
 {
-    mz_uint32 file_index;
-    if (!mz_zip_reader_locate_file_v2(pZip, pArchive_filename, NULL, flags, &file_index))
-        return MZ_FALSE;
+    mz_uint8 *m_pBlock;
+    const mz_zip_span *m_pSpans;
+} mz_zip_batch_block_state;
 
-    return mz_zip_reader_extract_to_file(pZip, file_index, pDst_filename, flags);
+static mz_bool mz_zip_batch_block_func(mz_zip_archive *pZip, mz_uint32 file_index, mz_uint32 batch_index, void *pOpaque, mz_uint flags)
+{
+    mz_zip_batch_block_state *pState = (mz_zip_batch_block_state *)pOpaque;
+    const mz_zip_span *pSpan = &pState->m_pSpans[batch_index];
+
+    if (!pSpan->m_size)
+        return MZ_TRUE;
+
+    return mz_zip_reader_extract_to_mem(pZip, file_index, pState->m_pBlock + pSpan->m_ofs, pSpan->m_size, flags);
 }
 
-mz_bool mz_zip_reader_extract_to_cfile(mz_zip_archive *pZip, mz_uint file_index, MZ_FILE *pFile, mz_uint flags)
+mz_bool mz_zip_reader_extract_batch_to_block(mz_zip_archive *pZip, const mz_uint32 *pFile_indices, mz_uint32 num_files, void *pBlock, size_t block_size, mz_zip_span *pSpans, mz_uint flags)
 {
-    mz_zip_archive_file_stat file_stat;
+    mz_zip_batch_block_state state;
+    size_t ofs = 0;
+    mz_uint32 i;
 
-    if (!mz_zip_reader_file_stat(pZip, file_index, &file_stat))
-        return MZ_FALSE;
+    if ((!pZip) || (!pZip->m_pState) || ((!pFile_indices) && (num_files)) || ((!pSpans) && (num_files)) || ((!pBlock) && (block_size)))
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
 
-    if ((file_stat.m_is_directory) || (!file_stat.m_is_supported))
-        return mz_zip_set_error(pZip, MZ_ZIP_UNSUPPORTED_FEATURE);
+    /* Lay the files out back to back, in the order they were asked for */
+    for (i = 0; i < num_files; i++)
+    {
+        mz_zip_archive_file_stat file_stat;
+        mz_uint64 size;
 
-    return mz_zip_reader_extract_to_callback(pZip, file_index, mz_zip_file_write_callback, pFile, flags);
-}
+        if (!mz_zip_reader_file_stat(pZip, pFile_indices[i], &file_stat))
+            return MZ_FALSE;
 
-mz_bool mz_zip_reader_extract_file_to_cfile(mz_zip_archive *pZip, const char *pArchive_filename, MZ_FILE *pFile, mz_uint flags)
-{
-    mz_uint32 file_index;
-    if (!mz_zip_reader_locate_file_v2(pZip, pArchive_filename, NULL, flags, &file_index))
-        return MZ_FALSE;
+        size = (flags & MZ_ZIP_FLAG_COMPRESSED_DATA) ? file_stat.m_comp_size : file_stat.m_uncomp_size;
+        if (size > block_size - ofs)
+            return mz_zip_set_error(pZip, MZ_ZIP_BUF_TOO_SMALL);
 
-    return mz_zip_reader_extract_to_cfile(pZip, file_index, pFile, flags);
-}
-#endif /* #ifndef MINIZ_NO_STDIO */
+        pSpans[i].m_ofs = ofs;
+        pSpans[i].m_size = (size_t)size;
+        ofs += (size_t)size;
+    }
 
-static size_t mz_zip_compute_crc32_callback(void *pOpaque, mz_uint64 file_ofs, const void *pBuf, size_t n)
-{
-    mz_uint32 *p = (mz_uint32 *)pOpaque;
-    (void)file_ofs;
-    *p = (mz_uint32)mz_crc32(*p, (const mz_uint8 *)pBuf, n);
-    return n;
+    state.m_pBlock = (mz_uint8 *)pBlock;
+    state.m_pSpans = pSpans;
+    return mz_zip_reader_extract_batch_internal(pZip, pFile_indices, num_files, mz_zip_batch_block_func, &state, flags);
 }
 
-mz_bool mz_zip_validate_file(mz_zip_archive *pZip, mz_uint file_index, mz_uint flags)
+mz_bool mz_zip_reader_extract_to_callback(mz_zip_archive *pZip, mz_uint file_index, mz_file_write_func pCallback, void *pOpaque, mz_uint flags)
 {
+    int status = TINFL_STATUS_DONE;
+#ifndef MINIZ_DISABLE_ZIP_READER_CRC32_CHECKS
+    mz_uint file_crc32 = MZ_CRC32_INIT;
+#endif
+    mz_uint64 read_buf_size, read_buf_ofs = 0, read_buf_avail, comp_remaining, out_buf_ofs = 0, cur_file_ofs;
     mz_zip_archive_file_stat file_stat;
-    mz_zip_internal_state *pState;
-    const mz_uint8 *pCentral_dir_header;
-    mz_bool found_zip64_ext_data_in_cdir = MZ_FALSE;
-    mz_bool found_zip64_ext_data_in_ldir = MZ_FALSE;
+    void *pRead_buf = NULL;
+    void *pWrite_buf = NULL;
     mz_uint32 local_header_u32[(MZ_ZIP_LOCAL_DIR_HEADER_SIZE + sizeof(mz_uint32) - 1) / sizeof(mz_uint32)];
     mz_uint8 *pLocal_header = (mz_uint8 *)local_header_u32;
-    mz_uint64 local_header_ofs = 0;
-    mz_uint32 local_header_filename_len, local_header_extra_len, local_header_crc32;
-    mz_uint64 local_header_comp_size, local_header_uncomp_size;
-    mz_uint32 uncomp_crc32 = MZ_CRC32_INIT;
-    mz_bool has_data_descriptor;
-    mz_uint32 local_header_bit_flags;
-
-    mz_zip_array file_data_array;
-    mz_zip_array_init(&file_data_array, 1);
 
-    if ((!pZip) || (!pZip->m_pState) || (!pZip->m_pAlloc) || (!pZip->m_pFree) || (!pZip->m_pRead))
+    if ((!pZip) || (!pZip->m_pState) || (!pCallback) || (!pZip->m_pRead))
         return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
 
-    if (file_index > pZip->m_total_files)
-        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+    if (!mz_zip_reader_file_stat(pZip, file_index, &file_stat))
+        return MZ_FALSE;
 
-    pState = pZip->m_pState;
-
-    pCentral_dir_header = mz_zip_get_cdh(pZip, file_index);
-
-    if (!mz_zip_file_stat_internal(pZip, file_index, pCentral_dir_header, &file_stat, &found_zip64_ext_data_in_cdir))
-        return MZ_FALSE;
-
-    /* A directory or zero length file */
-    if ((file_stat.m_is_directory) || (!file_stat.m_uncomp_size))
-        return MZ_TRUE;
+    /* A directory or zero length file */
+    if ((file_stat.m_is_directory) || (!file_stat.m_comp_size))
+        return MZ_TRUE;
 
     /* Encryption and patch files are not supported. */
-    if (file_stat.m_is_encrypted)
+    if (file_stat.m_bit_flag & (MZ_ZIP_GENERAL_PURPOSE_BIT_FLAG_IS_ENCRYPTED | MZ_ZIP_GENERAL_PURPOSE_BIT_FLAG_USES_STRONG_ENCRYPTION | MZ_ZIP_GENERAL_PURPOSE_BIT_FLAG_COMPRESSED_PATCH_FLAG))
         return mz_zip_set_error(pZip, MZ_ZIP_UNSUPPORTED_ENCRYPTION);
 
-    /* This function only supports stored and deflate. */
-    if ((file_stat.m_method != 0) && (file_stat.m_method != MZ_DEFLATED))
+    /* This function only supports decompressing stored and deflate. */
+    if ((!(flags & MZ_ZIP_FLAG_COMPRESSED_DATA)) && (file_stat.m_method != 0) && (file_stat.m_method != MZ_DEFLATED))
         return mz_zip_set_error(pZip, MZ_ZIP_UNSUPPORTED_METHOD);
 
-    if (!file_stat.m_is_supported)
-        return mz_zip_set_error(pZip, MZ_ZIP_UNSUPPORTED_FEATURE);
-
-    /* Read and parse the local directory entry. */
-    local_header_ofs = file_stat.m_local_header_ofs;
-    if (pZip->m_pRead(pZip->m_pIO_opaque, local_header_ofs, pLocal_header, MZ_ZIP_LOCAL_DIR_HEADER_SIZE) != MZ_ZIP_LOCAL_DIR_HEADER_SIZE)
+    /* Read and do some minimal validation of the local directory entry (this doesn't crack the zip64 stuff, which we already have from the central dir) */
+    cur_file_ofs = file_stat.m_local_header_ofs;
+    if (MZ_ZIP_READ(pZip, cur_file_ofs, pLocal_header, MZ_ZIP_LOCAL_DIR_HEADER_SIZE) != MZ_ZIP_LOCAL_DIR_HEADER_SIZE)
         return mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
 
     if (MZ_READ_LE32(pLocal_header) != MZ_ZIP_LOCAL_DIR_HEADER_SIG)
         return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
 
-    local_header_filename_len = MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_FILENAME_LEN_OFS);
-    local_header_extra_len = MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_EXTRA_LEN_OFS);
-    local_header_comp_size = MZ_READ_LE32(pLocal_header + MZ_ZIP_LDH_COMPRESSED_SIZE_OFS);
-    local_header_uncomp_size = MZ_READ_LE32(pLocal_header + MZ_ZIP_LDH_DECOMPRESSED_SIZE_OFS);
-    local_header_crc32 = MZ_READ_LE32(pLocal_header + MZ_ZIP_LDH_CRC32_OFS);
-    local_header_bit_flags = MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_BIT_FLAG_OFS);
-    has_data_descriptor = (local_header_bit_flags & 8) != 0;
-
-    if (local_header_filename_len != strlen(file_stat.m_filename))
-        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
-
-    if ((local_header_ofs + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + local_header_filename_len + local_header_extra_len + file_stat.m_comp_size) > pZip->m_archive_size)
+    cur_file_ofs += MZ_ZIP_LOCAL_DIR_HEADER_SIZE + MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_FILENAME_LEN_OFS) + MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_EXTRA_LEN_OFS);
+    if ((cur_file_ofs + file_stat.m_comp_size) > pZip->m_archive_size)
         return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
 
-    if (!mz_zip_array_resize(pZip, &file_data_array, MZ_MAX(local_header_filename_len, local_header_extra_len), MZ_FALSE))
+    /* Decompress the file either directly from memory or from a file input buffer. */
+    if (pZip->m_pState->m_pMem)
     {
-        mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
-        goto handle_failure;
+        pRead_buf = (mz_uint8 *)pZip->m_pState->m_pMem + cur_file_ofs;
+        read_buf_size = read_buf_avail = file_stat.m_comp_size;
+        comp_remaining = 0;
     }
-
-    if (local_header_filename_len)
+    else
     {
-        if (pZip->m_pRead(pZip->m_pIO_opaque, local_header_ofs + MZ_ZIP_LOCAL_DIR_HEADER_SIZE, file_data_array.m_p, local_header_filename_len) != local_header_filename_len)
-        {
-            mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
-            goto handle_failure;
-        }
+        read_buf_size = MZ_MIN(file_stat.m_comp_size, (mz_uint64)MZ_ZIP_MAX_IO_BUF_SIZE);
+        if (NULL == (pRead_buf = MZ_ZIP_ALLOC(pZip, 1, (size_t)read_buf_size)))
+            return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
 
-        /* I've seen 1 archive that had the same pathname, but used backslashes in the local dir and forward slashes in the central dir. Do we care about this? For now, this case will fail validation. */
-        if (memcmp(file_stat.m_filename, file_data_array.m_p, local_header_filename_len) != 0)
-        {
-            mz_zip_set_error(pZip, MZ_ZIP_VALIDATION_FAILED);
-            goto handle_failure;
-        }
+        read_buf_avail = 0;
+        comp_remaining = file_stat.m_comp_size;
     }
 
-    if ((local_header_extra_len) && ((local_header_comp_size == MZ_UINT32_MAX) || (local_header_uncomp_size == MZ_UINT32_MAX)))
+    if ((flags & MZ_ZIP_FLAG_COMPRESSED_DATA) || (!file_stat.m_method))
     {
-        mz_uint32 extra_size_remaining = local_header_extra_len;
-        const mz_uint8 *pExtra_data = (const mz_uint8 *)file_data_array.m_p;
-
-        if (pZip->m_pRead(pZip->m_pIO_opaque, local_header_ofs + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + local_header_filename_len, file_data_array.m_p, local_header_extra_len) != local_header_extra_len)
-        {
-            mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
-            goto handle_failure;
-        }
-
-        do
+        /* The file is stored or the caller has requested the compressed data. */
+        if (pZip->m_pState->m_pMem)
         {
-            mz_uint32 field_id, field_data_size, field_total_size;
+            if (((sizeof(size_t) == sizeof(mz_uint32))) && (file_stat.m_comp_size > MZ_UINT32_MAX))
+                return mz_zip_set_error(pZip, MZ_ZIP_INTERNAL_ERROR);
 
-            if (extra_size_remaining < (sizeof(mz_uint16) * 2))
+            if (pCallback(pOpaque, out_buf_ofs, pRead_buf, (size_t)file_stat.m_comp_size) != file_stat.m_comp_size)
             {
-                mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
-                goto handle_failure;
+                mz_zip_set_error(pZip, MZ_ZIP_WRITE_CALLBACK_FAILED);
+                status = TINFL_STATUS_FAILED;
             }
-
-            field_id = MZ_READ_LE16(pExtra_data);
-            field_data_size = MZ_READ_LE16(pExtra_data + sizeof(mz_uint16));
-            field_total_size = field_data_size + sizeof(mz_uint16) * 2;
-
-            if (field_total_size > extra_size_remaining)
+            else if (!(flags & MZ_ZIP_FLAG_COMPRESSED_DATA))
             {
-                mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
-                goto handle_failure;
+#ifndef MINIZ_DISABLE_ZIP_READER_CRC32_CHECKS
+                file_crc32 = (mz_uint32)MZ_ZIP_CRC32(pZip, file_crc32, (const mz_uint8 *)pRead_buf, (size_t)file_stat.m_comp_size);
+#endif
             }
 
-            if (field_id == MZ_ZIP64_EXTENDED_INFORMATION_FIELD_HEADER_ID)
+            cur_file_ofs += file_stat.m_comp_size;
+            out_buf_ofs += file_stat.m_comp_size;
+            comp_remaining = 0;
+        }
+        else
+        {
+            while (comp_remaining)
             {
-                const mz_uint8 *pSrc_field_data = pExtra_data + sizeof(mz_uint32);
+                read_buf_avail = MZ_MIN(read_buf_size, comp_remaining);
+                if (MZ_ZIP_READ(pZip, cur_file_ofs, pRead_buf, (size_t)read_buf_avail) != read_buf_avail)
+                {
+                    mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
+                    status = TINFL_STATUS_FAILED;
+                    break;
+                }
 
-                if (field_data_size < sizeof(mz_uint64) * 2)
+#ifndef MINIZ_DISABLE_ZIP_READER_CRC32_CHECKS
+                if (!(flags & MZ_ZIP_FLAG_COMPRESSED_DATA))
                 {
-                    mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
-                    goto handle_failure;
+                    file_crc32 = (mz_uint32)MZ_ZIP_CRC32(pZip, file_crc32, (const mz_uint8 *)pRead_buf, (size_t)read_buf_avail);
                 }
+#endif
 
-                local_header_uncomp_size = MZ_READ_LE64(pSrc_field_data);
-                local_header_comp_size = MZ_READ_LE64(pSrc_field_data + sizeof(mz_uint64));
+                if (pCallback(pOpaque, out_buf_ofs, pRead_buf, (size_t)read_buf_avail) != read_buf_avail)
+                {
+                    mz_zip_set_error(pZip, MZ_ZIP_WRITE_CALLBACK_FAILED);
+                    status = TINFL_STATUS_FAILED;
+                    break;
+                }
 
-                found_zip64_ext_data_in_ldir = MZ_TRUE;
-                break;
+                cur_file_ofs += read_buf_avail;
+                out_buf_ofs += read_buf_avail;
+                comp_remaining -= read_buf_avail;
             }
-
-            pExtra_data += field_total_size;
-            extra_size_remaining -= field_total_size;
-        } while (extra_size_remaining);
+        }
     }
-
-    /* TODO: parse local header extra data when local_header_comp_size is 0xFFFFFFFF! (big_descriptor.zip) */
-    /* I've seen zips in the wild with the data descriptor bit set, but proper local header values and bogus data descriptors */
-    if ((has_data_descriptor) && (!local_header_comp_size) && (!local_header_crc32))
+    else
     {
-        mz_uint8 descriptor_buf[32];
-        mz_bool has_id;
-        const mz_uint8 *pSrc;
-        mz_uint32 file_crc32;
-        mz_uint64 comp_size = 0, uncomp_size = 0;
-
-        mz_uint32 num_descriptor_uint32s = ((pState->m_zip64) || (found_zip64_ext_data_in_ldir)) ? 6 : 4;
+        tinfl_decompressor inflator;
+        tinfl_init(&inflator);
 
-        if (pZip->m_pRead(pZip->m_pIO_opaque, local_header_ofs + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + local_header_filename_len + local_header_extra_len + file_stat.m_comp_size, descriptor_buf, sizeof(mz_uint32) * num_descriptor_uint32s) != (sizeof(mz_uint32) * num_descriptor_uint32s))
+        if (NULL == (pWrite_buf = MZ_ZIP_ALLOC(pZip, 1, TINFL_LZ_DICT_SIZE)))
         {
-            mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
-            goto handle_failure;
+            mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+            status = TINFL_STATUS_FAILED;
         }
+        else
+        {
+            do
+            {
+                mz_uint8 *pWrite_buf_cur = (mz_uint8 *)pWrite_buf + (out_buf_ofs & (TINFL_LZ_DICT_SIZE - 1));
+                size_t in_buf_size, out_buf_size = TINFL_LZ_DICT_SIZE - (out_buf_ofs & (TINFL_LZ_DICT_SIZE - 1));
+                if ((!read_buf_avail) && (!pZip->m_pState->m_pMem))
+                {
+                    read_buf_avail = MZ_MIN(read_buf_size, comp_remaining);
+                    if (MZ_ZIP_READ(pZip, cur_file_ofs, pRead_buf, (size_t)read_buf_avail) != read_buf_avail)
+                    {
+                        mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
+                        status = TINFL_STATUS_FAILED;
+                        break;
+                    }
+                    cur_file_ofs += read_buf_avail;
+                    comp_remaining -= read_buf_avail;
+                    read_buf_ofs = 0;
+                }
 
-        has_id = (MZ_READ_LE32(descriptor_buf) == MZ_ZIP_DATA_DESCRIPTOR_ID);
-        pSrc = has_id ? (descriptor_buf + sizeof(mz_uint32)) : descriptor_buf;
+                in_buf_size = (size_t)read_buf_avail;
+                status = MZ_ZIP_INFLATE(pZip, &inflator, (const mz_uint8 *)pRead_buf + read_buf_ofs, &in_buf_size, (mz_uint8 *)pWrite_buf, pWrite_buf_cur, &out_buf_size, comp_remaining ? TINFL_FLAG_HAS_MORE_INPUT : 0);
+                read_buf_avail -= in_buf_size;
+                read_buf_ofs += in_buf_size;
 
-        file_crc32 = MZ_READ_LE32(pSrc);
+                if (out_buf_size)
+                {
+                    if (pCallback(pOpaque, out_buf_ofs, pWrite_buf_cur, out_buf_size) != out_buf_size)
+                    {
+                        mz_zip_set_error(pZip, MZ_ZIP_WRITE_CALLBACK_FAILED);
+                        status = TINFL_STATUS_FAILED;
+                        break;
+                    }
 
-        if ((pState->m_zip64) || (found_zip64_ext_data_in_ldir))
-        {
-            comp_size = MZ_READ_LE64(pSrc + sizeof(mz_uint32));
-            uncomp_size = MZ_READ_LE64(pSrc + sizeof(mz_uint32) + sizeof(mz_uint64));
-        }
-        else
-        {
-            comp_size = MZ_READ_LE32(pSrc + sizeof(mz_uint32));
-            uncomp_size = MZ_READ_LE32(pSrc + sizeof(mz_uint32) + sizeof(mz_uint32));
+#ifndef MINIZ_DISABLE_ZIP_READER_CRC32_CHECKS
+                    file_crc32 = (mz_uint32)MZ_ZIP_CRC32(pZip, file_crc32, pWrite_buf_cur, out_buf_size);
+#endif
+                    if ((out_buf_ofs += out_buf_size) > file_stat.m_uncomp_size)
+                    {
+                        mz_zip_set_error(pZip, MZ_ZIP_DECOMPRESSION_FAILED);
+                        status = TINFL_STATUS_FAILED;
+                        break;
+                    }
+                }
+            } while ((status == TINFL_STATUS_NEEDS_MORE_INPUT) || (status == TINFL_STATUS_HAS_MORE_OUTPUT));
         }
+    }
 
-        if ((file_crc32 != file_stat.m_crc32) || (comp_size != file_stat.m_comp_size) || (uncomp_size != file_stat.m_uncomp_size))
+    if ((status == TINFL_STATUS_DONE) && (!(flags & MZ_ZIP_FLAG_COMPRESSED_DATA)))
+    {
+        /* Make sure the entire file was decompressed, and check its CRC. */
+        if (out_buf_ofs != file_stat.m_uncomp_size)
         {
-            mz_zip_set_error(pZip, MZ_ZIP_VALIDATION_FAILED);
-            goto handle_failure;
+            mz_zip_set_error(pZip, MZ_ZIP_UNEXPECTED_DECOMPRESSED_SIZE);
+            status = TINFL_STATUS_FAILED;
         }
-    }
-    else
-    {
-        if ((local_header_crc32 != file_stat.m_crc32) || (local_header_comp_size != file_stat.m_comp_size) || (local_header_uncomp_size != file_stat.m_uncomp_size))
+#ifndef MINIZ_DISABLE_ZIP_READER_CRC32_CHECKS
+        else if (file_crc32 != file_stat.m_crc32)
         {
-            mz_zip_set_error(pZip, MZ_ZIP_VALIDATION_FAILED);
-            goto handle_failure;
+            mz_zip_set_error(pZip, MZ_ZIP_DECOMPRESSION_FAILED);
+            status = TINFL_STATUS_FAILED;
         }
+#endif
     }
 
-    mz_zip_array_clear(pZip, &file_data_array);
+    if (!pZip->m_pState->m_pMem)
+        MZ_ZIP_FREE(pZip, pRead_buf, (size_t)read_buf_size);
 
-    if ((flags & MZ_ZIP_FLAG_VALIDATE_HEADERS_ONLY) == 0)
-    {
-        if (!mz_zip_reader_extract_to_callback(pZip, file_index, mz_zip_compute_crc32_callback, &uncomp_crc32, 0))
-            return MZ_FALSE;
+    if (pWrite_buf)
+        MZ_ZIP_FREE(pZip, pWrite_buf, TINFL_LZ_DICT_SIZE);
 
-        /* 1 more check to be sure, although the extract checks too. */
-        if (uncomp_crc32 != file_stat.m_crc32)
-        {
-            mz_zip_set_error(pZip, MZ_ZIP_VALIDATION_FAILED);
-            return MZ_FALSE;
-        }
-    }
+    return status == TINFL_STATUS_DONE;
+}
 
-    return MZ_TRUE;
+mz_bool mz_zip_reader_extract_file_to_callback(mz_zip_archive *pZip, const char *pFilename, mz_file_write_func pCallback, void *pOpaque, mz_uint flags)
+{
+    mz_uint32 file_index;
+    if (!mz_zip_reader_locate_file_v2(pZip, pFilename, NULL, flags, &file_index))
+        return MZ_FALSE;
 
-handle_failure:
-    mz_zip_array_clear(pZip, &file_data_array);
-    return MZ_FALSE;
+    return mz_zip_reader_extract_to_callback(pZip, file_index, pCallback, pOpaque, flags);
 }
 
-mz_bool mz_zip_validate_archive(mz_zip_archive *pZip, mz_uint flags)
+mz_zip_reader_extract_iter_state* mz_zip_reader_extract_iter_new(mz_zip_archive *pZip, mz_uint file_index, mz_uint flags)
 {
-    mz_zip_internal_state *pState;
-    mz_uint32 i;
+    mz_zip_reader_extract_iter_state *pState;
+    mz_uint32 local_header_u32[(MZ_ZIP_LOCAL_DIR_HEADER_SIZE + sizeof(mz_uint32) - 1) / sizeof(mz_uint32)];
+    mz_uint8 *pLocal_header = (mz_uint8 *)local_header_u32;
 
-    if ((!pZip) || (!pZip->m_pState) || (!pZip->m_pAlloc) || (!pZip->m_pFree) || (!pZip->m_pRead))
-        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
-
-    pState = pZip->m_pState;
+    /* Argument sanity check */
+    if ((!pZip) || (!pZip->m_pState))
+        return NULL;
 
-    /* Basic sanity checks */
-    if (!pState->m_zip64)
+    /* Allocate an iterator status structure */
+    pState = (mz_zip_reader_extract_iter_state*)MZ_ZIP_ALLOC(pZip, 1, sizeof(mz_zip_reader_extract_iter_state));
+    if (!pState)
     {
-        if (pZip->m_total_files > MZ_UINT16_MAX)
-            return mz_zip_set_error(pZip, MZ_ZIP_ARCHIVE_TOO_LARGE);
-
-        if (pZip->m_archive_size > MZ_UINT32_MAX)
-            return mz_zip_set_error(pZip, MZ_ZIP_ARCHIVE_TOO_LARGE);
+        mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+        return NULL;
     }
-    else
+
+    /* Fetch file details */
+    if (!mz_zip_reader_file_stat(pZip, file_index, &pState->file_stat))
     {
-        if (pState->m_central_dir.m_size >= MZ_UINT32_MAX)
-            return mz_zip_set_error(pZip, MZ_ZIP_ARCHIVE_TOO_LARGE);
+        MZ_ZIP_FREE(pZip, pState, sizeof(mz_zip_reader_extract_iter_state));
+        return NULL;
     }
 
-    for (i = 0; i < pZip->m_total_files; i++)
+    /* Encryption and patch files are not supported. */
+    if (pState->file_stat.m_bit_flag & (MZ_ZIP_GENERAL_PURPOSE_BIT_FLAG_IS_ENCRYPTED | MZ_ZIP_GENERAL_PURPOSE_BIT_FLAG_USES_STRONG_ENCRYPTION | MZ_ZIP_GENERAL_PURPOSE_BIT_FLAG_COMPRESSED_PATCH_FLAG))
     {
-        if (MZ_ZIP_FLAG_VALIDATE_LOCATE_FILE_FLAG & flags)
-        {
-            mz_uint32 found_index;
-            mz_zip_archive_file_stat stat;
-
-            if (!mz_zip_reader_file_stat(pZip, i, &stat))
-                return MZ_FALSE;
-
-            if (!mz_zip_reader_locate_file_v2(pZip, stat.m_filename, NULL, 0, &found_index))
-                return MZ_FALSE;
-
-            /* This check can fail if there are duplicate filenames in the archive (which we don't check for when writing - that's up to the user) */
-            if (found_index != i)
-                return mz_zip_set_error(pZip, MZ_ZIP_VALIDATION_FAILED);
-        }
-
-        if (!mz_zip_validate_file(pZip, i, flags))
-            return MZ_FALSE;
+        mz_zip_set_error(pZip, MZ_ZIP_UNSUPPORTED_ENCRYPTION);
+        MZ_ZIP_FREE(pZip, pState, sizeof(mz_zip_reader_extract_iter_state));
+        return NULL;
     }
 
-    return MZ_TRUE;
-}
-
-mz_bool mz_zip_validate_mem_archive(const void *pMem, size_t size, mz_uint flags, mz_zip_error *pErr)
-{
-    mz_bool success = MZ_TRUE;
-    mz_zip_archive zip;
-    mz_zip_error actual_err = MZ_ZIP_NO_ERROR;
-
-    if ((!pMem) || (!size))
+    /* This function only supports decompressing stored and deflate. */
+    if ((!(flags & MZ_ZIP_FLAG_COMPRESSED_DATA)) && (pState->file_stat.m_method != 0) && (pState->file_stat.m_method != MZ_DEFLATED))
     {
-        if (pErr)
-            *pErr = MZ_ZIP_INVALID_PARAMETER;
-        return MZ_FALSE;
+        mz_zip_set_error(pZip, MZ_ZIP_UNSUPPORTED_METHOD);
+        MZ_ZIP_FREE(pZip, pState, sizeof(mz_zip_reader_extract_iter_state));
+        return NULL;
     }
 
-    mz_zip_zero_struct(&zip);
+    /* Init state - save args */
+    pState->pZip = pZip;
+    pState->flags = flags;
 
-    if (!mz_zip_reader_init_mem(&zip, pMem, size, flags))
-    {
-        if (pErr)
-            *pErr = zip.m_last_error;
-        return MZ_FALSE;
-    }
+    /* Init state - reset variables to defaults */
+    pState->status = TINFL_STATUS_DONE;
+#ifndef MINIZ_DISABLE_ZIP_READER_CRC32_CHECKS
+    pState->file_crc32 = MZ_CRC32_INIT;
+#endif
+    pState->read_buf_ofs = 0;
+    pState->out_buf_ofs = 0;
+    pState->pRead_buf = NULL;
+    pState->pWrite_buf = NULL;
+    pState->out_blk_remain = 0;
 
-    if (!mz_zip_validate_archive(&zip, flags))
+    /* Read and parse the local directory entry. */
+    pState->cur_file_ofs = pState->file_stat.m_local_header_ofs;
+    if (MZ_ZIP_READ(pZip, pState->cur_file_ofs, pLocal_header, MZ_ZIP_LOCAL_DIR_HEADER_SIZE) != MZ_ZIP_LOCAL_DIR_HEADER_SIZE)
     {
-        actual_err = zip.m_last_error;
-        success = MZ_FALSE;
+        mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
+        MZ_ZIP_FREE(pZip, pState, sizeof(mz_zip_reader_extract_iter_state));
+        return NULL;
     }
 
-    if (!mz_zip_reader_end_internal(&zip, success))
+    if (MZ_READ_LE32(pLocal_header) != MZ_ZIP_LOCAL_DIR_HEADER_SIG)
     {
-        if (!actual_err)
-            actual_err = zip.m_last_error;
-        success = MZ_FALSE;
+        mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
+        MZ_ZIP_FREE(pZip, pState, sizeof(mz_zip_reader_extract_iter_state));
+        return NULL;
     }
 
-    if (pErr)
-        *pErr = actual_err;
-
-    return success;
-}
-
-#ifndef MINIZ_NO_STDIO
-mz_bool mz_zip_validate_file_archive(const char *pFilename, mz_uint flags, mz_zip_error *pErr)
-{
-    mz_bool success = MZ_TRUE;
-    mz_zip_archive zip;
-    mz_zip_error actual_err = MZ_ZIP_NO_ERROR;
-
-    if (!pFilename)
+    pState->cur_file_ofs += MZ_ZIP_LOCAL_DIR_HEADER_SIZE + MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_FILENAME_LEN_OFS) + MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_EXTRA_LEN_OFS);
+    if ((pState->cur_file_ofs + pState->file_stat.m_comp_size) > pZip->m_archive_size)
     {
-        if (pErr)
-            *pErr = MZ_ZIP_INVALID_PARAMETER;
-        return MZ_FALSE;
+        mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
+        MZ_ZIP_FREE(pZip, pState, sizeof(mz_zip_reader_extract_iter_state));
+        return NULL;
     }
 
-    mz_zip_zero_struct(&zip);
-
-    if (!mz_zip_reader_init_file_v2(&zip, pFilename, flags, 0, 0))
+    /* Decompress the file either directly from memory or from a file input buffer. */
+    if (pZip->m_pState->m_pMem)
     {
-        if (pErr)
-            *pErr = zip.m_last_error;
-        return MZ_FALSE;
+        pState->pRead_buf = (mz_uint8 *)pZip->m_pState->m_pMem + pState->cur_file_ofs;
+        pState->read_buf_size = pState->read_buf_avail = pState->file_stat.m_comp_size;
+        pState->comp_remaining = pState->file_stat.m_comp_size;
     }
-
-    if (!mz_zip_validate_archive(&zip, flags))
+    else
     {
-        actual_err = zip.m_last_error;
-        success = MZ_FALSE;
+        if (!((flags & MZ_ZIP_FLAG_COMPRESSED_DATA) || (!pState->file_stat.m_method)))
+        {
+            /* Decompression required, therefore intermediate read buffer required */
+            pState->read_buf_size = MZ_MIN(pState->file_stat.m_comp_size, (mz_uint64)MZ_ZIP_MAX_IO_BUF_SIZE);
+            if (NULL == (pState->pRead_buf = MZ_ZIP_ALLOC(pZip, 1, (size_t)pState->read_buf_size)))
+            {
+                mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+                MZ_ZIP_FREE(pZip, pState, sizeof(mz_zip_reader_extract_iter_state));
+                return NULL;
+            }
+        }
+        else
+        {
+            /* Decompression not required - we will be reading directly into user buffer, no temp buf required */
+            pState->read_buf_size = 0;
+        }
+        pState->read_buf_avail = 0;
+        pState->comp_remaining = pState->file_stat.m_comp_size;
     }
 
-    if (!mz_zip_reader_end_internal(&zip, success))
+    if (!((flags & MZ_ZIP_FLAG_COMPRESSED_DATA) || (!pState->file_stat.m_method)))
     {
-        if (!actual_err)
-            actual_err = zip.m_last_error;
-        success = MZ_FALSE;
-    }
+        /* Decompression required, init decompressor */
+        tinfl_init( &pState->inflator );
 
-    if (pErr)
-        *pErr = actual_err;
+        /* Allocate write buffer */
+        if (NULL == (pState->pWrite_buf = MZ_ZIP_ALLOC(pZip, 1, TINFL_LZ_DICT_SIZE)))
+        {
+            mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+            if (pState->pRead_buf)
+                MZ_ZIP_FREE(pZip, pState->pRead_buf, (size_t)pState->read_buf_size);
+            MZ_ZIP_FREE(pZip, pState, sizeof(mz_zip_reader_extract_iter_state));
+            return NULL;
+        }
+    }
 
-    return success;
+    return pState;
 }
-#endif /* #ifndef MINIZ_NO_STDIO */
 
-/* ------------------- .ZIP archive writing */
+mz_zip_reader_extract_iter_state* mz_zip_reader_extract_file_iter_new(mz_zip_archive *pZip, const char *pFilename, mz_uint flags)
+{
+    mz_uint32 file_index;
 
-#ifndef MINIZ_NO_ARCHIVE_WRITING_APIS
+    /* Locate file index by name */
+    if (!mz_zip_reader_locate_file_v2(pZip, pFilename, NULL, flags, &file_index))
+        return NULL;
 
-static MZ_FORCEINLINE void mz_write_le16(mz_uint8 *p, mz_uint16 v)
-{
-    p[0] = (mz_uint8)v;
-    p[1] = (mz_uint8)(v >> 8);
-}
-static MZ_FORCEINLINE void mz_write_le32(mz_uint8 *p, mz_uint32 v)
-{
-    p[0] = (mz_uint8)v;
-    p[1] = (mz_uint8)(v >> 8);
-    p[2] = (mz_uint8)(v >> 16);
-    p[3] = (mz_uint8)(v >> 24);
-}
-static MZ_FORCEINLINE void mz_write_le64(mz_uint8 *p, mz_uint64 v)
-{
-    mz_write_le32(p, (mz_uint32)v);
-    mz_write_le32(p + sizeof(mz_uint32), (mz_uint32)(v >> 32));
+    /* Construct iterator */
+    return mz_zip_reader_extract_iter_new(pZip, file_index, flags);
 }
 
-#define MZ_WRITE_LE16(p, v) mz_write_le16((mz_uint8 *)(p), (mz_uint16)(v))
-#define MZ_WRITE_LE32(p, v) mz_write_le32((mz_uint8 *)(p), (mz_uint32)(v))
-#define MZ_WRITE_LE64(p, v) mz_write_le64((mz_uint8 *)(p), (mz_uint64)(v))
-
-static size_t mz_zip_heap_write_func(void *pOpaque, mz_uint64 file_ofs, const void *pBuf, size_t n)
+size_t mz_zip_reader_extract_iter_read(mz_zip_reader_extract_iter_state* pState, void* pvBuf, size_t buf_size)
 {
-    mz_zip_archive *pZip = (mz_zip_archive *)pOpaque;
-    mz_zip_internal_state *pState = pZip->m_pState;
-    mz_uint64 new_size = MZ_MAX(file_ofs + n, pState->m_mem_size);
-
-    if (!n)
-        return 0;
+    size_t copied_to_caller = 0;
 
-    /* An allocation this big is likely to just fail on 32-bit systems, so don't even go there. */
-    if ((sizeof(size_t) == sizeof(mz_uint32)) && (new_size > 0x7FFFFFFF))
-    {
-        mz_zip_set_error(pZip, MZ_ZIP_FILE_TOO_LARGE);
+    /* Argument sanity check */
+    if ((!pState) || (!pState->pZip) || (!pState->pZip->m_pState) || (!pvBuf))
         return 0;
-    }
 
-    if (new_size > pState->m_mem_capacity)
+    if ((pState->flags & MZ_ZIP_FLAG_COMPRESSED_DATA) || (!pState->file_stat.m_method))
     {
-        void *pNew_block;
-        size_t new_capacity = MZ_MAX(64, pState->m_mem_capacity);
-
-        while (new_capacity < new_size)
-            new_capacity *= 2;
+        /* The file is stored or the caller has requested the compressed data, calc amount to return. */
+        copied_to_caller = (size_t)MZ_MIN( buf_size, pState->comp_remaining );
 
-        if (NULL == (pNew_block = pZip->m_pRealloc(pZip->m_pAlloc_opaque, pState->m_pMem, 1, new_capacity)))
+        /* Zip is in memory....or requires reading from a file? */
+        if (pState->pZip->m_pState->m_pMem)
         {
-            mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
-            return 0;
+            /* Copy data to caller's buffer */
+            memcpy( pvBuf, pState->pRead_buf, copied_to_caller );
+            pState->pRead_buf = ((mz_uint8*)pState->pRead_buf) + copied_to_caller;
+        }
+        else
+        {
+            /* Read directly into caller's buffer */
+            if (MZ_ZIP_READ(pState->pZip, pState->cur_file_ofs, pvBuf, copied_to_caller) != copied_to_caller)
+            {
+                /* Failed to read all that was asked for, flag failure and alert user */
+                mz_zip_set_error(pState->pZip, MZ_ZIP_FILE_READ_FAILED);
+                pState->status = TINFL_STATUS_FAILED;
+                copied_to_caller = 0;
+            }
         }
 
-        pState->m_pMem = pNew_block;
-        pState->m_mem_capacity = new_capacity;
+#ifndef MINIZ_DISABLE_ZIP_READER_CRC32_CHECKS
+        /* Compute CRC if not returning compressed data only */
+        if (!(pState->flags & MZ_ZIP_FLAG_COMPRESSED_DATA))
+            pState->file_crc32 = (mz_uint32)MZ_ZIP_CRC32(pState->pZip, pState->file_crc32, (const mz_uint8 *)pvBuf, copied_to_caller);
+#endif
+
+        /* Advance offsets, dec counters */
+        pState->cur_file_ofs += copied_to_caller;
+        pState->out_buf_ofs += copied_to_caller;
+        pState->comp_remaining -= copied_to_caller;
     }
-    memcpy((mz_uint8 *)pState->m_pMem + file_ofs, pBuf, n);
-    pState->m_mem_size = (size_t)new_size;
-    return n;
-}
+    else
+    {
+        do
+        {
+            /* Calc ptr to write buffer - given current output pos and block size */
+            mz_uint8 *pWrite_buf_cur = (mz_uint8 *)pState->pWrite_buf + (pState->out_buf_ofs & (TINFL_LZ_DICT_SIZE - 1));
 
-static mz_bool mz_zip_writer_end_internal(mz_zip_archive *pZip, mz_bool set_last_error)
-{
-    mz_zip_internal_state *pState;
-    mz_bool status = MZ_TRUE;
+            /* Calc max output size - given current output pos and block size */
+            size_t in_buf_size, out_buf_size = TINFL_LZ_DICT_SIZE - (pState->out_buf_ofs & (TINFL_LZ_DICT_SIZE - 1));
 
-    if ((!pZip) || (!pZip->m_pState) || (!pZip->m_pAlloc) || (!pZip->m_pFree) || ((pZip->m_zip_mode != MZ_ZIP_MODE_WRITING) && (pZip->m_zip_mode != MZ_ZIP_MODE_WRITING_HAS_BEEN_FINALIZED)))
-    {
-        if (set_last_error)
-            mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
-        return MZ_FALSE;
-    }
+            if (!pState->out_blk_remain)
+            {
+                /* Read more data from file if none available (and reading from file) */
+                if ((!pState->read_buf_avail) && (!pState->pZip->m_pState->m_pMem))
+                {
+                    /* Calc read size */
+                    pState->read_buf_avail = MZ_MIN(pState->read_buf_size, pState->comp_remaining);
+                    if (MZ_ZIP_READ(pState->pZip, pState->cur_file_ofs, pState->pRead_buf, (size_t)pState->read_buf_avail) != pState->read_buf_avail)
+                    {
+                        mz_zip_set_error(pState->pZip, MZ_ZIP_FILE_READ_FAILED);
+                        pState->status = TINFL_STATUS_FAILED;
+                        break;
+                    }
 
-    pState = pZip->m_pState;
-    pZip->m_pState = NULL;
-    mz_zip_array_clear(pZip, &pState->m_central_dir);
-    mz_zip_array_clear(pZip, &pState->m_central_dir_offsets);
-    mz_zip_array_clear(pZip, &pState->m_sorted_central_dir_offsets);
+                    /* Advance offsets, dec counters */
+                    pState->cur_file_ofs += pState->read_buf_avail;
+                    pState->comp_remaining -= pState->read_buf_avail;
+                    pState->read_buf_ofs = 0;
+                }
 
-#ifndef MINIZ_NO_STDIO
-    if (pState->m_pFile)
-    {
-        if (pZip->m_zip_type == MZ_ZIP_TYPE_FILE)
-        {
-            if (MZ_FCLOSE(pState->m_pFile) == EOF)
-            {
-                if (set_last_error)
-                    mz_zip_set_error(pZip, MZ_ZIP_FILE_CLOSE_FAILED);
-                status = MZ_FALSE;
-            }
-        }
+                /* Perform decompression */
+                in_buf_size = (size_t)pState->read_buf_avail;
+                pState->status = MZ_ZIP_INFLATE(pState->pZip, &pState->inflator, (const mz_uint8 *)pState->pRead_buf + pState->read_buf_ofs, &in_buf_size, (mz_uint8 *)pState->pWrite_buf, pWrite_buf_cur, &out_buf_size, pState->comp_remaining ? TINFL_FLAG_HAS_MORE_INPUT : 0);
+                pState->read_buf_avail -= in_buf_size;
+                pState->read_buf_ofs += in_buf_size;
 
-        pState->m_pFile = NULL;
-    }
-#endif /* #ifndef MINIZ_NO_STDIO */
+                /* Update current output block size remaining */
+                pState->out_blk_remain = out_buf_size;
+            }
 
-    if ((pZip->m_pWrite == mz_zip_heap_write_func) && (pState->m_pMem))
-    {
-        pZip->m_pFree(pZip->m_pAlloc_opaque, pState->m_pMem);
-        pState->m_pMem = NULL;
-    }
+            if (pState->out_blk_remain)
+            {
+                /* Calc amount to return. */
+                size_t to_copy = MZ_MIN( (buf_size - copied_to_caller), pState->out_blk_remain );
 
-    pZip->m_pFree(pZip->m_pAlloc_opaque, pState);
-    pZip->m_zip_mode = MZ_ZIP_MODE_INVALID;
-    return status;
-}
+                /* Copy data to caller's buffer */
+                memcpy( (mz_uint8*)pvBuf + copied_to_caller, pWrite_buf_cur, to_copy );
 
-mz_bool mz_zip_writer_init_v2(mz_zip_archive *pZip, mz_uint64 existing_size, mz_uint flags)
-{
-    mz_bool zip64 = (flags & MZ_ZIP_FLAG_WRITE_ZIP64) != 0;
+#ifndef MINIZ_DISABLE_ZIP_READER_CRC32_CHECKS
+                /* Perform CRC */
+                pState->file_crc32 = (mz_uint32)MZ_ZIP_CRC32(pState->pZip, pState->file_crc32, pWrite_buf_cur, to_copy);
+#endif
 
-    if ((!pZip) || (pZip->m_pState) || (!pZip->m_pWrite) || (pZip->m_zip_mode != MZ_ZIP_MODE_INVALID))
-        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+                /* Decrement data consumed from block */
+                pState->out_blk_remain -= to_copy;
 
-    if (flags & MZ_ZIP_FLAG_WRITE_ALLOW_READING)
-    {
-        if (!pZip->m_pRead)
-            return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
-    }
+                /* Inc output offset, while performing sanity check */
+                if ((pState->out_buf_ofs += to_copy) > pState->file_stat.m_uncomp_size)
+                {
+                    mz_zip_set_error(pState->pZip, MZ_ZIP_DECOMPRESSION_FAILED);
+                    pState->status = TINFL_STATUS_FAILED;
+                    break;
+                }
 
-    if (pZip->m_file_offset_alignment)
-    {
-        /* Ensure user specified file offset alignment is a power of 2. */
-        if (pZip->m_file_offset_alignment & (pZip->m_file_offset_alignment - 1))
-            return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+                /* Increment counter of data copied to caller */
+                copied_to_caller += to_copy;
+            }
+        } while ( (copied_to_caller < buf_size) && ((pState->status == TINFL_STATUS_NEEDS_MORE_INPUT) || (pState->status == TINFL_STATUS_HAS_MORE_OUTPUT)) );
     }
 
-    if (!pZip->m_pAlloc)
-        pZip->m_pAlloc = miniz_def_alloc_func;
-    if (!pZip->m_pFree)
-        pZip->m_pFree = miniz_def_free_func;
-    if (!pZip->m_pRealloc)
-        pZip->m_pRealloc = miniz_def_realloc_func;
+    /* Return how many bytes were copied into user buffer */
+    return copied_to_caller;
+}
 
-    pZip->m_archive_size = existing_size;
-    pZip->m_central_directory_file_ofs = 0;
-    pZip->m_total_files = 0;
+mz_bool mz_zip_reader_extract_iter_free(mz_zip_reader_extract_iter_state* pState)
+{
+    int status;
 
-    if (NULL == (pZip->m_pState = (mz_zip_internal_state *)pZip->m_pAlloc(pZip->m_pAlloc_opaque, 1, sizeof(mz_zip_internal_state))))
-        return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+    /* Argument sanity check */
+    if ((!pState) || (!pState->pZip) || (!pState->pZip->m_pState))
+        return MZ_FALSE;
 
-    memset(pZip->m_pState, 0, sizeof(mz_zip_internal_state));
+    /* Was decompression completed and requested? */
+    if ((pState->status == TINFL_STATUS_DONE) && (!(pState->flags & MZ_ZIP_FLAG_COMPRESSED_DATA)))
+    {
+        /* Make sure the entire file was decompressed, and check its CRC. */
+        if (pState->out_buf_ofs != pState->file_stat.m_uncomp_size)
+        {
+            mz_zip_set_error(pState->pZip, MZ_ZIP_UNEXPECTED_DECOMPRESSED_SIZE);
+            pState->status = TINFL_STATUS_FAILED;
+        }
+#ifndef MINIZ_DISABLE_ZIP_READER_CRC32_CHECKS
+        else if (pState->file_crc32 != pState->file_stat.m_crc32)
+        {
+            mz_zip_set_error(pState->pZip, MZ_ZIP_DECOMPRESSION_FAILED);
+            pState->status = TINFL_STATUS_FAILED;
+        }
+#endif
+    }
 
-    MZ_ZIP_ARRAY_SET_ELEMENT_SIZE(&pZip->m_pState->m_central_dir, sizeof(mz_uint8));
-    MZ_ZIP_ARRAY_SET_ELEMENT_SIZE(&pZip->m_pState->m_central_dir_offsets, sizeof(mz_uint32));
-    MZ_ZIP_ARRAY_SET_ELEMENT_SIZE(&pZip->m_pState->m_sorted_central_dir_offsets, sizeof(mz_uint32));
+    /* Free buffers */
+    if (!pState->pZip->m_pState->m_pMem)
+        MZ_ZIP_FREE(pState->pZip, pState->pRead_buf, (size_t)pState->read_buf_size);
+    if (pState->pWrite_buf)
+        MZ_ZIP_FREE(pState->pZip, pState->pWrite_buf, TINFL_LZ_DICT_SIZE);
 
-    pZip->m_pState->m_zip64 = zip64;
-    pZip->m_pState->m_zip64_has_extended_info_fields = zip64;
+    /* Save status */
+    status = pState->status;
 
-    pZip->m_zip_type = MZ_ZIP_TYPE_USER;
-    pZip->m_zip_mode = MZ_ZIP_MODE_WRITING;
+    /* Free context */
+    MZ_ZIP_FREE(pState->pZip, pState, sizeof(mz_zip_reader_extract_iter_state));
 
-    return MZ_TRUE;
+    return status == TINFL_STATUS_DONE;
 }
 
-mz_bool mz_zip_writer_init(mz_zip_archive *pZip, mz_uint64 existing_size)
+#ifndef MINIZ_NO_STDIO
+static size_t mz_zip_file_write_callback(void *pOpaque, mz_uint64 ofs, const void *pBuf, size_t n)
 {
-    return mz_zip_writer_init_v2(pZip, existing_size, 0);
+    (void)ofs;
+
+    return MZ_FWRITE(pBuf, 1, n, (MZ_FILE *)pOpaque);
 }
 
-mz_bool mz_zip_writer_init_heap_v2(mz_zip_archive *pZip, size_t size_to_reserve_at_beginning, size_t initial_allocation_size, mz_uint flags)
+mz_bool mz_zip_reader_extract_to_file(mz_zip_archive *pZip, mz_uint file_index, const char *pDst_filename, mz_uint flags)
 {
-    pZip->m_pWrite = mz_zip_heap_write_func;
-    pZip->m_pNeeds_keepalive = NULL;
+    mz_bool status;
+    mz_zip_archive_file_stat file_stat;
+    MZ_FILE *pFile;
 
-    if (flags & MZ_ZIP_FLAG_WRITE_ALLOW_READING)
-        pZip->m_pRead = mz_zip_mem_read_func;
+    if (!mz_zip_reader_file_stat(pZip, file_index, &file_stat))
+        return MZ_FALSE;
 
-    pZip->m_pIO_opaque = pZip;
+    if ((file_stat.m_is_directory) || (!file_stat.m_is_supported))
+        return mz_zip_set_error(pZip, MZ_ZIP_UNSUPPORTED_FEATURE);
 
-    if (!mz_zip_writer_init_v2(pZip, size_to_reserve_at_beginning, flags))
-        return MZ_FALSE;
+    pFile = MZ_FOPEN(pDst_filename, "wb");
+    if (!pFile)
+        return mz_zip_set_error(pZip, MZ_ZIP_FILE_OPEN_FAILED);
 
-    pZip->m_zip_type = MZ_ZIP_TYPE_HEAP;
+    status = mz_zip_reader_extract_to_callback(pZip, file_index, mz_zip_file_write_callback, pFile, flags);
 
-    if (0 != (initial_allocation_size = MZ_MAX(initial_allocation_size, size_to_reserve_at_beginning)))
+    if (MZ_FCLOSE(pFile) == EOF)
     {
-        if (NULL == (pZip->m_pState->m_pMem = pZip->m_pAlloc(pZip->m_pAlloc_opaque, 1, initial_allocation_size)))
-        {
-            mz_zip_writer_end_internal(pZip, MZ_FALSE);
-            return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
-        }
-        pZip->m_pState->m_mem_capacity = initial_allocation_size;
+        if (status)
+            mz_zip_set_error(pZip, MZ_ZIP_FILE_CLOSE_FAILED);
+
+        status = MZ_FALSE;
     }
 
-    return MZ_TRUE;
+#if !defined(MINIZ_NO_TIME) && !defined(MINIZ_NO_STDIO)
+    if (status)
+        mz_zip_set_file_times(pDst_filename, file_stat.m_time, file_stat.m_time);
+#endif
+
+    return status;
 }
 
-mz_bool mz_zip_writer_init_heap(mz_zip_archive *pZip, size_t size_to_reserve_at_beginning, size_t initial_allocation_size)
+mz_bool mz_zip_reader_extract_file_to_file(mz_zip_archive *pZip, const char *pArchive_filename, const char *pDst_filename, mz_uint flags)
 {
-    return mz_zip_writer_init_heap_v2(pZip, size_to_reserve_at_beginning, initial_allocation_size, 0);
+    mz_uint32 file_index;
+    if (!mz_zip_reader_locate_file_v2(pZip, pArchive_filename, NULL, flags, &file_index))
+        return MZ_FALSE;
+
+    return mz_zip_reader_extract_to_file(pZip, file_index, pDst_filename, flags);
 }
 
-#ifndef MINIZ_NO_STDIO
-static size_t mz_zip_file_write_func(void *pOpaque, mz_uint64 file_ofs, const void *pBuf, size_t n)
+mz_bool mz_zip_reader_extract_to_cfile(mz_zip_archive *pZip, mz_uint file_index, MZ_FILE *pFile, mz_uint flags)
 {
-    mz_zip_archive *pZip = (mz_zip_archive *)pOpaque;
-    mz_int64 cur_ofs = MZ_FTELL64(pZip->m_pState->m_pFile);
+    mz_zip_archive_file_stat file_stat;
 
-    file_ofs += pZip->m_pState->m_file_archive_start_ofs;
+    if (!mz_zip_reader_file_stat(pZip, file_index, &file_stat))
+        return MZ_FALSE;
 
-    if (((mz_int64)file_ofs < 0) || (((cur_ofs != (mz_int64)file_ofs)) && (MZ_FSEEK64(pZip->m_pState->m_pFile, (mz_int64)file_ofs, SEEK_SET))))
-    {
-        mz_zip_set_error(pZip, MZ_ZIP_FILE_SEEK_FAILED);
-        return 0;
-    }
+    if ((file_stat.m_is_directory) || (!file_stat.m_is_supported))
+        return mz_zip_set_error(pZip, MZ_ZIP_UNSUPPORTED_FEATURE);
 
-    return MZ_FWRITE(pBuf, 1, n, pZip->m_pState->m_pFile);
+    return mz_zip_reader_extract_to_callback(pZip, file_index, mz_zip_file_write_callback, pFile, flags);
 }
 
-mz_bool mz_zip_writer_init_file(mz_zip_archive *pZip, const char *pFilename, mz_uint64 size_to_reserve_at_beginning)
+mz_bool mz_zip_reader_extract_file_to_cfile(mz_zip_archive *pZip, const char *pArchive_filename, MZ_FILE *pFile, mz_uint flags)
 {
-    return mz_zip_writer_init_file_v2(pZip, pFilename, size_to_reserve_at_beginning, 0);
+    mz_uint32 file_index;
+    if (!mz_zip_reader_locate_file_v2(pZip, pArchive_filename, NULL, flags, &file_index))
+        return MZ_FALSE;
+
+    return mz_zip_reader_extract_to_cfile(pZip, file_index, pFile, flags);
 }
+#endif /* #ifndef MINIZ_NO_STDIO */
 
-mz_bool mz_zip_writer_init_file_v2(mz_zip_archive *pZip, const char *pFilename, mz_uint64 size_to_reserve_at_beginning, mz_uint flags)
+static size_t mz_zip_compute_crc32_callback(void *pOpaque, mz_uint64 file_ofs, const void *pBuf, size_t n)
 {
-    MZ_FILE *pFile;
-
-    pZip->m_pWrite = mz_zip_file_write_func;
-    pZip->m_pNeeds_keepalive = NULL;
-
-    if (flags & MZ_ZIP_FLAG_WRITE_ALLOW_READING)
-        pZip->m_pRead = mz_zip_file_read_func;
-
-    pZip->m_pIO_opaque = pZip;
-
-    if (!mz_zip_writer_init_v2(pZip, size_to_reserve_at_beginning, flags))
-        return MZ_FALSE;
-
-    if (NULL == (pFile = MZ_FOPEN(pFilename, (flags & MZ_ZIP_FLAG_WRITE_ALLOW_READING) ? "w+b" : "wb")))
-    {
-        mz_zip_writer_end(pZip);
-        return mz_zip_set_error(pZip, MZ_ZIP_FILE_OPEN_FAILED);
-    }
+    mz_uint32 *p = (mz_uint32 *)pOpaque;
+    (void)file_ofs;
+    *p = (mz_uint32)mz_crc32(*p, (const mz_uint8 *)pBuf, n);
+    return n;
+}
 
-    pZip->m_pState->m_pFile = pFile;
-    pZip->m_zip_type = MZ_ZIP_TYPE_FILE;
+mz_bool mz_zip_validate_file(mz_zip_archive *pZip, mz_uint file_index, mz_uint flags)
+{
+    mz_zip_archive_file_stat file_stat;
+    mz_zip_internal_state *pState;
+    const mz_uint8 *pCentral_dir_header;
+    mz_bool found_zip64_ext_data_in_cdir = MZ_FALSE;
+    mz_bool found_zip64_ext_data_in_ldir = MZ_FALSE;
+    mz_uint32 local_header_u32[(MZ_ZIP_LOCAL_DIR_HEADER_SIZE + sizeof(mz_uint32) - 1) / sizeof(mz_uint32)];
+    mz_uint8 *pLocal_header = (mz_uint8 *)local_header_u32;
+    mz_uint64 local_header_ofs = 0;
+    mz_uint32 local_header_filename_len, local_header_extra_len, local_header_crc32;
+    mz_uint64 local_header_comp_size, local_header_uncomp_size;
+    mz_uint32 uncomp_crc32 = MZ_CRC32_INIT;
+    mz_bool has_data_descriptor;
+    mz_uint32 local_header_bit_flags;
 
-    if (size_to_reserve_at_beginning)
-    {
-        mz_uint64 cur_ofs = 0;
-        char buf[4096];
+    mz_zip_array file_data_array;
+    mz_zip_array_init(&file_data_array, 1);
 
-        MZ_CLEAR_ARR(buf);
+    if ((!pZip) || (!pZip->m_pState) || (!pZip->m_pAlloc) || (!pZip->m_pFree) || (!pZip->m_pRead))
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
 
-        do
-        {
-            size_t n = (size_t)MZ_MIN(sizeof(buf), size_to_reserve_at_beginning);
-            if (pZip->m_pWrite(pZip->m_pIO_opaque, cur_ofs, buf, n) != n)
-            {
-                mz_zip_writer_end(pZip);
-                return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
-            }
-            cur_ofs += n;
-            size_to_reserve_at_beginning -= n;
-        } while (size_to_reserve_at_beginning);
-    }
+    if (file_index > pZip->m_total_files)
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
 
-    return MZ_TRUE;
-}
+    pState = pZip->m_pState;
 
-mz_bool mz_zip_writer_init_cfile(mz_zip_archive *pZip, MZ_FILE *pFile, mz_uint flags)
-{
-    pZip->m_pWrite = mz_zip_file_write_func;
-    pZip->m_pNeeds_keepalive = NULL;
+    pCentral_dir_header = mz_zip_get_cdh(pZip, file_index);
 
-    if (flags & MZ_ZIP_FLAG_WRITE_ALLOW_READING)
-        pZip->m_pRead = mz_zip_file_read_func;
+    if (!mz_zip_file_stat_internal(pZip, file_index, pCentral_dir_header, &file_stat, &found_zip64_ext_data_in_cdir))
+        return MZ_FALSE;
 
-    pZip->m_pIO_opaque = pZip;
+    /* A directory or zero length file */
+    if ((file_stat.m_is_directory) || (!file_stat.m_uncomp_size))
+        return MZ_TRUE;
 
-    if (!mz_zip_writer_init_v2(pZip, 0, flags))
-        return MZ_FALSE;
+    /* Encryption and patch files are not supported. */
+    if (file_stat.m_is_encrypted)
+        return mz_zip_set_error(pZip, MZ_ZIP_UNSUPPORTED_ENCRYPTION);
 
-    pZip->m_pState->m_pFile = pFile;
-    pZip->m_pState->m_file_archive_start_ofs = MZ_FTELL64(pZip->m_pState->m_pFile);
-    pZip->m_zip_type = MZ_ZIP_TYPE_CFILE;
+    /* This function only supports stored and deflate. */
+    if ((file_stat.m_method != 0) && (file_stat.m_method != MZ_DEFLATED))
+        return mz_zip_set_error(pZip, MZ_ZIP_UNSUPPORTED_METHOD);
 
-    return MZ_TRUE;
-}
-#endif /* #ifndef MINIZ_NO_STDIO */
+    if (!file_stat.m_is_supported)
+        return mz_zip_set_error(pZip, MZ_ZIP_UNSUPPORTED_FEATURE);
 
-mz_bool mz_zip_writer_init_from_reader_v2(mz_zip_archive *pZip, const char *pFilename, mz_uint flags)
-{
-    mz_zip_internal_state *pState;
+    /* Read and parse the local directory entry. */
+    local_header_ofs = file_stat.m_local_header_ofs;
+    if (MZ_ZIP_READ(pZip, local_header_ofs, pLocal_header, MZ_ZIP_LOCAL_DIR_HEADER_SIZE) != MZ_ZIP_LOCAL_DIR_HEADER_SIZE)
+        return mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
 
-    if ((!pZip) || (!pZip->m_pState) || (pZip->m_zip_mode != MZ_ZIP_MODE_READING))
-        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+    if (MZ_READ_LE32(pLocal_header) != MZ_ZIP_LOCAL_DIR_HEADER_SIG)
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
 
-    if (flags & MZ_ZIP_FLAG_WRITE_ZIP64)
-    {
-        /* We don't support converting a non-zip64 file to zip64 - this seems like more trouble than it's worth. (What about the existing 32-bit data descriptors that could follow the compressed data?) */
-        if (!pZip->m_pState->m_zip64)
-            return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
-    }
+    local_header_filename_len = MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_FILENAME_LEN_OFS);
+    local_header_extra_len = MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_EXTRA_LEN_OFS);
+    local_header_comp_size = MZ_READ_LE32(pLocal_header + MZ_ZIP_LDH_COMPRESSED_SIZE_OFS);
+    local_header_uncomp_size = MZ_READ_LE32(pLocal_header + MZ_ZIP_LDH_DECOMPRESSED_SIZE_OFS);
+    local_header_crc32 = MZ_READ_LE32(pLocal_header + MZ_ZIP_LDH_CRC32_OFS);
+    local_header_bit_flags = MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_BIT_FLAG_OFS);
+    has_data_descriptor = (local_header_bit_flags & 8) != 0;
 
-    /* No sense in trying to write to an archive that's already at the support max size */
-    if (pZip->m_pState->m_zip64)
+    if (local_header_filename_len != strlen(file_stat.m_filename))
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
+
+    if ((local_header_ofs + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + local_header_filename_len + local_header_extra_len + file_stat.m_comp_size) > pZip->m_archive_size)
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
+
+    if (!mz_zip_array_resize(pZip, &file_data_array, MZ_MAX(local_header_filename_len, local_header_extra_len), MZ_FALSE))
     {
-        if (pZip->m_total_files == MZ_UINT32_MAX)
-            return mz_zip_set_error(pZip, MZ_ZIP_TOO_MANY_FILES);
+        mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+        goto handle_failure;
     }
-    else
+
+    if (local_header_filename_len)
     {
-        if (pZip->m_total_files == MZ_UINT16_MAX)
-            return mz_zip_set_error(pZip, MZ_ZIP_TOO_MANY_FILES);
+        if (MZ_ZIP_READ(pZip, local_header_ofs + MZ_ZIP_LOCAL_DIR_HEADER_SIZE, file_data_array.m_p, local_header_filename_len) != local_header_filename_len)
+        {
+            mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
+            goto handle_failure;
+        }
 
-        if ((pZip->m_archive_size + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + MZ_ZIP_LOCAL_DIR_HEADER_SIZE) > MZ_UINT32_MAX)
-            return mz_zip_set_error(pZip, MZ_ZIP_FILE_TOO_LARGE);
+        /* I've seen 1 archive that had the same pathname, but used backslashes in the local dir and forward slashes in the central dir. Do we care about this? For now, this case will fail validation. */
+        if (memcmp(file_stat.m_filename, file_data_array.m_p, local_header_filename_len) != 0)
+        {
+            mz_zip_set_error(pZip, MZ_ZIP_VALIDATION_FAILED);
+            goto handle_failure;
+        }
     }
 
-    pState = pZip->m_pState;
-
-    if (pState->m_pFile)
+    if ((local_header_extra_len) && ((local_header_comp_size == MZ_UINT32_MAX) || (local_header_uncomp_size == MZ_UINT32_MAX)))
     {
-#ifdef MINIZ_NO_STDIO
-        (void)pFilename;
-        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
-#else
-        if (pZip->m_pIO_opaque != pZip)
-            return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+        mz_uint32 extra_size_remaining = local_header_extra_len;
+        const mz_uint8 *pExtra_data = (const mz_uint8 *)file_data_array.m_p;
 
-        if (pZip->m_zip_type == MZ_ZIP_TYPE_FILE)
+        if (MZ_ZIP_READ(pZip, local_header_ofs + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + local_header_filename_len, file_data_array.m_p, local_header_extra_len) != local_header_extra_len)
         {
-            if (!pFilename)
-                return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+            mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
+            goto handle_failure;
+        }
 
-            /* Archive is being read from stdio and was originally opened only for reading. Try to reopen as writable. */
-            if (NULL == (pState->m_pFile = MZ_FREOPEN(pFilename, "r+b", pState->m_pFile)))
+        do
+        {
+            mz_uint32 field_id, field_data_size, field_total_size;
+
+            if (extra_size_remaining < (sizeof(mz_uint16) * 2))
             {
-                /* The mz_zip_archive is now in a bogus state because pState->m_pFile is NULL, so just close it. */
-                mz_zip_reader_end_internal(pZip, MZ_FALSE);
-                return mz_zip_set_error(pZip, MZ_ZIP_FILE_OPEN_FAILED);
+                mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
+                goto handle_failure;
             }
-        }
 
-        pZip->m_pWrite = mz_zip_file_write_func;
-        pZip->m_pNeeds_keepalive = NULL;
-#endif /* #ifdef MINIZ_NO_STDIO */
-    }
-    else if (pState->m_pMem)
-    {
-        /* Archive lives in a memory block. Assume it's from the heap that we can resize using the realloc callback. */
-        if (pZip->m_pIO_opaque != pZip)
-            return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+            field_id = MZ_READ_LE16(pExtra_data);
+            field_data_size = MZ_READ_LE16(pExtra_data + sizeof(mz_uint16));
+            field_total_size = field_data_size + sizeof(mz_uint16) * 2;
 
-        pState->m_mem_capacity = pState->m_mem_size;
-        pZip->m_pWrite = mz_zip_heap_write_func;
-        pZip->m_pNeeds_keepalive = NULL;
-    }
-    /* Archive is being read via a user provided read function - make sure the user has specified a write function too. */
-    else if (!pZip->m_pWrite)
-        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+            if (field_total_size > extra_size_remaining)
+            {
+                mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
+                goto handle_failure;
+            }
 
-    /* Start writing new files at the archive's current central directory location. */
-    /* TODO: We could add a flag that lets the user start writing immediately AFTER the existing central dir - this would be safer. */
-    pZip->m_archive_size = pZip->m_central_directory_file_ofs;
-    pZip->m_central_directory_file_ofs = 0;
+            if (field_id == MZ_ZIP64_EXTENDED_INFORMATION_FIELD_HEADER_ID)
+            {
+                const mz_uint8 *pSrc_field_data = pExtra_data + sizeof(mz_uint32);
 
-    /* Clear the sorted central dir offsets, they aren't useful or maintained now. */
-    /* Even though we're now in write mode, files can still be extracted and verified, but file locates will be slow. */
-    /* TODO: We could easily maintain the sorted central directory offsets. */
-    mz_zip_array_clear(pZip, &pZip->m_pState->m_sorted_central_dir_offsets);
+                if (field_data_size < sizeof(mz_uint64) * 2)
+                {
+                    mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
+                    goto handle_failure;
+                }
 
-    pZip->m_zip_mode = MZ_ZIP_MODE_WRITING;
+                local_header_uncomp_size = MZ_READ_LE64(pSrc_field_data);
+                local_header_comp_size = MZ_READ_LE64(pSrc_field_data + sizeof(mz_uint64));
 
-    return MZ_TRUE;
-}
+                found_zip64_ext_data_in_ldir = MZ_TRUE;
+                break;
+            }
 
-mz_bool mz_zip_writer_init_from_reader(mz_zip_archive *pZip, const char *pFilename)
-{
-    return mz_zip_writer_init_from_reader_v2(pZip, pFilename, 0);
-}
+            pExtra_data += field_total_size;
+            extra_size_remaining -= field_total_size;
+        } while (extra_size_remaining);
+    }
 
-/* TODO: pArchive_name is a terrible name here! */
-mz_bool mz_zip_writer_add_mem(mz_zip_archive *pZip, const char *pArchive_name, const void *pBuf, size_t buf_size, mz_uint level_and_flags)
-{
-    return mz_zip_writer_add_mem_ex(pZip, pArchive_name, pBuf, buf_size, NULL, 0, level_and_flags, 0, 0);
-}
+    /* TODO: parse local header extra data when local_header_comp_size is 0xFFFFFFFF! (big_descriptor.zip) */
+    /* I've seen zips in the wild with the data descriptor bit set, but proper local header values and bogus data descriptors */
+    if ((has_data_descriptor) && (!local_header_comp_size) && (!local_header_crc32))
+    {
+        mz_uint8 descriptor_buf[32];
+        mz_bool has_id;
+        const mz_uint8 *pSrc;
+        mz_uint32 file_crc32;
+        mz_uint64 comp_size = 0, uncomp_size = 0;
 
-typedef struct
-{
-    mz_zip_archive *m_pZip;
-    mz_uint64 m_cur_archive_file_ofs;
-    mz_uint64 m_comp_size;
-} mz_zip_writer_add_state;
+        mz_uint32 num_descriptor_uint32s = ((pState->m_zip64) || (found_zip64_ext_data_in_ldir)) ? 6 : 4;
 
-static mz_bool mz_zip_writer_add_put_buf_callback(const void *pBuf, int len, void *pUser)
-{
-    mz_zip_writer_add_state *pState = (mz_zip_writer_add_state *)pUser;
-    if ((int)pState->m_pZip->m_pWrite(pState->m_pZip->m_pIO_opaque, pState->m_cur_archive_file_ofs, pBuf, len) != len)
-        return MZ_FALSE;
+        if (MZ_ZIP_READ(pZip, local_header_ofs + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + local_header_filename_len + local_header_extra_len + file_stat.m_comp_size, descriptor_buf, sizeof(mz_uint32) * num_descriptor_uint32s) != (sizeof(mz_uint32) * num_descriptor_uint32s))
+        {
+            mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
+            goto handle_failure;
+        }
 
-    pState->m_cur_archive_file_ofs += len;
-    pState->m_comp_size += len;
-    return MZ_TRUE;
-}
+        has_id = (MZ_READ_LE32(descriptor_buf) == MZ_ZIP_DATA_DESCRIPTOR_ID);
+        pSrc = has_id ? (descriptor_buf + sizeof(mz_uint32)) : descriptor_buf;
 
-#define MZ_ZIP64_MAX_LOCAL_EXTRA_FIELD_SIZE (sizeof(mz_uint16) * 2 + sizeof(mz_uint64) * 2)
-#define MZ_ZIP64_MAX_CENTRAL_EXTRA_FIELD_SIZE (sizeof(mz_uint16) * 2 + sizeof(mz_uint64) * 3)
-static mz_uint32 mz_zip_writer_create_zip64_extra_data(mz_uint8 *pBuf, mz_uint64 *pUncomp_size, mz_uint64 *pComp_size, mz_uint64 *pLocal_header_ofs)
-{
-    mz_uint8 *pDst = pBuf;
-    mz_uint32 field_size = 0;
+        file_crc32 = MZ_READ_LE32(pSrc);
 
-    MZ_WRITE_LE16(pDst + 0, MZ_ZIP64_EXTENDED_INFORMATION_FIELD_HEADER_ID);
-    MZ_WRITE_LE16(pDst + 2, 0);
-    pDst += sizeof(mz_uint16) * 2;
+        if ((pState->m_zip64) || (found_zip64_ext_data_in_ldir))
+        {
+            comp_size = MZ_READ_LE64(pSrc + sizeof(mz_uint32));
+            uncomp_size = MZ_READ_LE64(pSrc + sizeof(mz_uint32) + sizeof(mz_uint64));
+        }
+        else
+        {
+            comp_size = MZ_READ_LE32(pSrc + sizeof(mz_uint32));
+            uncomp_size = MZ_READ_LE32(pSrc + sizeof(mz_uint32) + sizeof(mz_uint32));
+        }
 
-    if (pUncomp_size)
+        if ((file_crc32 != file_stat.m_crc32) || (comp_size != file_stat.m_comp_size) || (uncomp_size != file_stat.m_uncomp_size))
+        {
+            mz_zip_set_error(pZip, MZ_ZIP_VALIDATION_FAILED);
+            goto handle_failure;
+        }
+    }
+    else
     {
-        MZ_WRITE_LE64(pDst, *pUncomp_size);
-        pDst += sizeof(mz_uint64);
-        field_size += sizeof(mz_uint64);
+        if ((local_header_crc32 != file_stat.m_crc32) || (local_header_comp_size != file_stat.m_comp_size) || (local_header_uncomp_size != file_stat.m_uncomp_size))
+        {
+            mz_zip_set_error(pZip, MZ_ZIP_VALIDATION_FAILED);
+            goto handle_failure;
+        }
     }
 
-    if (pComp_size)
+    mz_zip_array_clear(pZip, &file_data_array);
+
+    if ((flags & MZ_ZIP_FLAG_VALIDATE_HEADERS_ONLY) == 0)
     {
-        MZ_WRITE_LE64(pDst, *pComp_size);
-        pDst += sizeof(mz_uint64);
-        field_size += sizeof(mz_uint64);
+        if (!mz_zip_reader_extract_to_callback(pZip, file_index, mz_zip_compute_crc32_callback, &uncomp_crc32, 0))
+            return MZ_FALSE;
+
+        /* 1 more check to be sure, although the extract checks too. */
+        if (uncomp_crc32 != file_stat.m_crc32)
+        {
+            mz_zip_set_error(pZip, MZ_ZIP_VALIDATION_FAILED);
+            return MZ_FALSE;
+        }
     }
 
-    if (pLocal_header_ofs)
+    return MZ_TRUE;
+
+handle_failure:
+    mz_zip_array_clear(pZip, &file_data_array);
+    return MZ_FALSE;
+}
+
+/* The archive level checks done before any file is validated. */
+static mz_bool mz_zip_validate_archive_size(mz_zip_archive *pZip)
+{
+    mz_zip_internal_state *pState;
+
+    if ((!pZip) || (!pZip->m_pState) || (!pZip->m_pAlloc) || (!pZip->m_pFree) || (!pZip->m_pRead))
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+
+    pState = pZip->m_pState;
+
+    /* Basic sanity checks */
+    if (!pState->m_zip64)
     {
-        MZ_WRITE_LE64(pDst, *pLocal_header_ofs);
-        pDst += sizeof(mz_uint64);
-        field_size += sizeof(mz_uint64);
+        if (pZip->m_total_files > MZ_UINT16_MAX)
+            return mz_zip_set_error(pZip, MZ_ZIP_ARCHIVE_TOO_LARGE);
+
+        if (pZip->m_archive_size > MZ_UINT32_MAX)
+            return mz_zip_set_error(pZip, MZ_ZIP_ARCHIVE_TOO_LARGE);
+    }
+    else
+    {
+        if (pState->m_central_dir.m_size >= MZ_UINT32_MAX)
+            return mz_zip_set_error(pZip, MZ_ZIP_ARCHIVE_TOO_LARGE);
     }
 
-    MZ_WRITE_LE16(pBuf + 2, field_size);
+    return MZ_TRUE;
+}
 
-    return (mz_uint32)(pDst - pBuf);
+static mz_bool mz_zip_validate_archive_file(mz_zip_archive *pZip, mz_uint32 file_index, mz_uint flags)
+{
+    if (MZ_ZIP_FLAG_VALIDATE_LOCATE_FILE_FLAG & flags)
+    {
+        mz_uint32 found_index;
+        mz_zip_archive_file_stat stat;
+
+        if (!mz_zip_reader_file_stat(pZip, file_index, &stat))
+            return MZ_FALSE;
+
+        if (!mz_zip_reader_locate_file_v2(pZip, stat.m_filename, NULL, 0, &found_index))
+            return MZ_FALSE;
+
+        /* This check can fail if there are duplicate filenames in the archive (which we don't check for when writing - that's up to the user) */
+        if (found_index != file_index)
+            return mz_zip_set_error(pZip, MZ_ZIP_VALIDATION_FAILED);
+    }
+
+    return mz_zip_validate_file(pZip, file_index, flags);
 }
 
-static mz_bool mz_zip_writer_create_local_dir_header(mz_zip_archive *pZip, mz_uint8 *pDst, mz_uint16 filename_size, mz_uint16 extra_size, mz_uint64 uncomp_size, mz_uint64 comp_size, mz_uint32 uncomp_crc32, mz_uint16 method, mz_uint16 bit_flags, mz_uint16 dos_time, mz_uint16 dos_date)
+/* The progress of an archive validation, shared by the workers of mz_zip_validate_archive_parallel(). Failing entries are marked in the optional m_pFailed bitmap, so they can be reported in index order. */
+typedef struct
 {
-    (void)pZip;
-    memset(pDst, 0, MZ_ZIP_LOCAL_DIR_HEADER_SIZE);
-    MZ_WRITE_LE32(pDst + MZ_ZIP_LDH_SIG_OFS, MZ_ZIP_LOCAL_DIR_HEADER_SIG);
-    MZ_WRITE_LE16(pDst + MZ_ZIP_LDH_VERSION_NEEDED_OFS, method ? 20 : 0);
-    MZ_WRITE_LE16(pDst + MZ_ZIP_LDH_BIT_FLAG_OFS, bit_flags);
-    MZ_WRITE_LE16(pDst + MZ_ZIP_LDH_METHOD_OFS, method);
-    MZ_WRITE_LE16(pDst + MZ_ZIP_LDH_FILE_TIME_OFS, dos_time);
-    MZ_WRITE_LE16(pDst + MZ_ZIP_LDH_FILE_DATE_OFS, dos_date);
-    MZ_WRITE_LE32(pDst + MZ_ZIP_LDH_CRC32_OFS, uncomp_crc32);
-    MZ_WRITE_LE32(pDst + MZ_ZIP_LDH_COMPRESSED_SIZE_OFS, MZ_MIN(comp_size, MZ_UINT32_MAX));
-    MZ_WRITE_LE32(pDst + MZ_ZIP_LDH_DECOMPRESSED_SIZE_OFS, MZ_MIN(uncomp_size, MZ_UINT32_MAX));
-    MZ_WRITE_LE16(pDst + MZ_ZIP_LDH_FILENAME_LEN_OFS, filename_size);
-    MZ_WRITE_LE16(pDst + MZ_ZIP_LDH_EXTRA_LEN_OFS, extra_size);
-    return MZ_TRUE;
+    mz_zip_archive *m_pZip;
+    mz_uint m_flags;
+    mz_uint32 m_next_file;
+    mz_bool m_stop;
+    mz_uint8 *m_pFailed;
+    mz_uint32 m_num_failed;
+    mz_uint32 m_first_failed;
+    mz_zip_error m_first_error;
+#ifdef MINIZ_ZIP_THREADS
+    pthread_mutex_t m_mutex;
+    int m_fd;
+#endif
+} mz_zip_validate_job;
+
+static void mz_zip_validate_job_fail(mz_zip_validate_job *pJob, mz_uint32 file_index, mz_zip_error err)
+{
+    if (pJob->m_pFailed)
+        pJob->m_pFailed[file_index >> 3] |= (mz_uint8)(1 << (file_index & 7));
+    if ((!pJob->m_num_failed++) || (file_index < pJob->m_first_failed))
+    {
+        pJob->m_first_failed = file_index;
+        pJob->m_first_error = err;
+    }
+    if ((pJob->m_flags & MZ_ZIP_FLAG_VALIDATE_CONTINUE_ON_FAILURE) == 0)
+        pJob->m_stop = MZ_TRUE;
 }
 
-static mz_bool mz_zip_writer_create_central_dir_header(mz_zip_archive *pZip, mz_uint8 *pDst,
-                                                       mz_uint16 filename_size, mz_uint16 extra_size, mz_uint16 comment_size,
-                                                       mz_uint64 uncomp_size, mz_uint64 comp_size, mz_uint32 uncomp_crc32,
-                                                       mz_uint16 method, mz_uint16 bit_flags, mz_uint16 dos_time, mz_uint16 dos_date,
-                                                       mz_uint64 local_header_ofs, mz_uint32 ext_attributes)
+/* Memory archives can have every local header checked in one pass over the archive, in offset order, without copying anything. */
+static mz_bool mz_zip_validate_can_check_mem_headers(mz_zip_archive *pZip, mz_uint flags)
 {
-    (void)pZip;
-    memset(pDst, 0, MZ_ZIP_CENTRAL_DIR_HEADER_SIZE);
-    MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_SIG_OFS, MZ_ZIP_CENTRAL_DIR_HEADER_SIG);
-    MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_VERSION_NEEDED_OFS, method ? 20 : 0);
-    MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_BIT_FLAG_OFS, bit_flags);
-    MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_METHOD_OFS, method);
-    MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_FILE_TIME_OFS, dos_time);
-    MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_FILE_DATE_OFS, dos_date);
-    MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_CRC32_OFS, uncomp_crc32);
-    MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_COMPRESSED_SIZE_OFS, MZ_MIN(comp_size, MZ_UINT32_MAX));
-    MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_DECOMPRESSED_SIZE_OFS, MZ_MIN(uncomp_size, MZ_UINT32_MAX));
-    MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_FILENAME_LEN_OFS, filename_size);
-    MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_EXTRA_LEN_OFS, extra_size);
-    MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_COMMENT_LEN_OFS, comment_size);
-    MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_EXTERNAL_ATTR_OFS, ext_attributes);
-    MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_LOCAL_HEADER_OFS, MZ_MIN(local_header_ofs, MZ_UINT32_MAX));
-    return MZ_TRUE;
+    return ((flags & (MZ_ZIP_FLAG_VALIDATE_HEADERS_ONLY | MZ_ZIP_FLAG_VALIDATE_LOCATE_FILE_FLAG)) == MZ_ZIP_FLAG_VALIDATE_HEADERS_ONLY) &&
+           (pZip->m_zip_mode == MZ_ZIP_MODE_READING) && (pZip->m_pState->m_pMem) && (pZip->m_pRead == mz_zip_mem_read_func);
 }
 
-static mz_bool mz_zip_writer_add_to_central_dir(mz_zip_archive *pZip, const char *pFilename, mz_uint16 filename_size,
-                                                const void *pExtra, mz_uint16 extra_size, const void *pComment, mz_uint16 comment_size,
-                                                mz_uint64 uncomp_size, mz_uint64 comp_size, mz_uint32 uncomp_crc32,
-                                                mz_uint16 method, mz_uint16 bit_flags, mz_uint16 dos_time, mz_uint16 dos_date,
-                                                mz_uint64 local_header_ofs, mz_uint32 ext_attributes,
-                                                const char *user_extra_data, mz_uint user_extra_data_len)
+/* Does the checks mz_zip_validate_file() does with MZ_ZIP_FLAG_VALIDATE_HEADERS_ONLY for every file of a memory archive, and also rejects entries whose data overlaps another entry's local header or data, or the central directory (as in zip bombs that reference the same data many times). */
+/* Entries sharing a local header (MZ_ZIP_FLAG_WRITE_DEDUPLICATE) are fine. Failures are recorded in the job, MZ_FALSE is only returned if the check couldn't be done. */
+static mz_bool mz_zip_validate_mem_headers(mz_zip_validate_job *pJob)
 {
+    mz_zip_archive *pZip = pJob->m_pZip;
     mz_zip_internal_state *pState = pZip->m_pState;
-    mz_uint32 central_dir_ofs = (mz_uint32)pState->m_central_dir.m_size;
-    size_t orig_central_dir_size = pState->m_central_dir.m_size;
-    mz_uint8 central_dir_header[MZ_ZIP_CENTRAL_DIR_HEADER_SIZE];
+    const mz_uint8 *pMem = (const mz_uint8 *)pState->m_pMem;
+    const mz_uint64 cdir_start = pZip->m_central_directory_file_ofs, cdir_end = cdir_start + pState->m_central_dir.m_size;
+    mz_zip_array entries;
+    mz_zip_local_header_entry *pEntries;
+    mz_uint64 prev_end = 0;
+    mz_uint32 i, num_entries = 0;
+    mz_bool sorted = MZ_TRUE;
+
+    if ((pState->m_lazy_central_dir) && (!mz_zip_reader_index_central_dir(pZip, pZip->m_total_files)))
+        return MZ_FALSE;
 
-    if (!pZip->m_pState->m_zip64)
+    mz_zip_array_init(&entries, sizeof(mz_zip_local_header_entry));
+    if (!mz_zip_array_resize(pZip, &entries, pZip->m_total_files, MZ_FALSE))
+        return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+    pEntries = (mz_zip_local_header_entry *)entries.m_p;
+
+    /* Central dir checks, and the entries that have a local header to check */
+    for (i = 0; (i < pZip->m_total_files) && (!pJob->m_stop); i++)
     {
-        if (local_header_ofs > 0xFFFFFFFF)
-            return mz_zip_set_error(pZip, MZ_ZIP_FILE_TOO_LARGE);
+        const mz_uint8 *p = mz_zip_get_cdh(pZip, i);
+        mz_uint64 comp_size = MZ_READ_LE32(p + MZ_ZIP_CDH_COMPRESSED_SIZE_OFS), uncomp_size = MZ_READ_LE32(p + MZ_ZIP_CDH_DECOMPRESSED_SIZE_OFS), local_header_ofs = MZ_READ_LE32(p + MZ_ZIP_CDH_LOCAL_HEADER_OFS);
+        mz_uint method = MZ_READ_LE16(p + MZ_ZIP_CDH_METHOD_OFS);
+
+        if (!mz_zip_reader_read_zip64_extra(pZip, p, &comp_size, &uncomp_size, &local_header_ofs, NULL))
+        {
+            mz_zip_validate_job_fail(pJob, i, pZip->m_last_error);
+            continue;
+        }
+
+        /* A directory or zero length file */
+        if ((mz_zip_reader_is_file_a_directory(pZip, i)) || (!uncomp_size))
+            continue;
+
+        if (mz_zip_reader_is_file_encrypted(pZip, i))
+            mz_zip_validate_job_fail(pJob, i, MZ_ZIP_UNSUPPORTED_ENCRYPTION);
+        else if ((method != 0) && (method != MZ_DEFLATED))
+            mz_zip_validate_job_fail(pJob, i, MZ_ZIP_UNSUPPORTED_METHOD);
+        else if (!mz_zip_reader_is_file_supported(pZip, i))
+            mz_zip_validate_job_fail(pJob, i, MZ_ZIP_UNSUPPORTED_FEATURE);
+        else
+        {
+            /* Writers almost always store the central dir in local header order */
+            if ((num_entries) && (local_header_ofs < pEntries[num_entries - 1].m_local_header_ofs))
+                sorted = MZ_FALSE;
+            pEntries[num_entries].m_local_header_ofs = local_header_ofs;
+            pEntries[num_entries].m_file_index = i;
+            num_entries++;
+        }
     }
 
-    /* miniz doesn't support central dirs >= MZ_UINT32_MAX bytes yet */
-    if (((mz_uint64)pState->m_central_dir.m_size + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + filename_size + extra_size + user_extra_data_len + comment_size) >= MZ_UINT32_MAX)
-        return mz_zip_set_error(pZip, MZ_ZIP_UNSUPPORTED_CDIR_SIZE);
+    if (!sorted)
+        mz_zip_sort_by_local_header_ofs(pEntries, num_entries);
 
-    if (!mz_zip_writer_create_central_dir_header(pZip, central_dir_header, filename_size, (mz_uint16)(extra_size + user_extra_data_len), comment_size, uncomp_size, comp_size, uncomp_crc32, method, bit_flags, dos_time, dos_date, local_header_ofs, ext_attributes))
-        return mz_zip_set_error(pZip, MZ_ZIP_INTERNAL_ERROR);
+    /* Walk the local headers in archive order */
+    for (i = 0; (i < num_entries) && (!pJob->m_stop); i++)
+    {
+        const mz_uint32 file_index = pEntries[i].m_file_index;
+        const mz_uint64 local_header_ofs = pEntries[i].m_local_header_ofs;
+        const mz_uint8 *pCentral_header = mz_zip_get_cdh(pZip, file_index), *pLocal_header = pMem + local_header_ofs;
+        const mz_uint32 central_filename_len = MZ_READ_LE16(pCentral_header + MZ_ZIP_CDH_FILENAME_LEN_OFS);
+        mz_uint64 comp_size = MZ_READ_LE32(pCentral_header + MZ_ZIP_CDH_COMPRESSED_SIZE_OFS), uncomp_size = MZ_READ_LE32(pCentral_header + MZ_ZIP_CDH_DECOMPRESSED_SIZE_OFS), central_local_header_ofs = local_header_ofs;
+        mz_uint64 local_header_comp_size, local_header_uncomp_size, data_end;
+        mz_uint32 local_header_filename_len, local_header_extra_len, local_header_crc32, local_header_bit_flags;
+        mz_bool found_zip64_ext_data_in_ldir = MZ_FALSE;
 
-    if ((!mz_zip_array_push_back(pZip, &pState->m_central_dir, central_dir_header, MZ_ZIP_CENTRAL_DIR_HEADER_SIZE)) ||
-        (!mz_zip_array_push_back(pZip, &pState->m_central_dir, pFilename, filename_size)) ||
-        (!mz_zip_array_push_back(pZip, &pState->m_central_dir, pExtra, extra_size)) ||
-        (!mz_zip_array_push_back(pZip, &pState->m_central_dir, user_extra_data, user_extra_data_len)) ||
-        (!mz_zip_array_push_back(pZip, &pState->m_central_dir, pComment, comment_size)) ||
-        (!mz_zip_array_push_back(pZip, &pState->m_central_dir_offsets, &central_dir_ofs, 1)))
+        mz_zip_reader_read_zip64_extra(pZip, pCentral_header, &comp_size, &uncomp_size, &central_local_header_ofs, NULL);
+
+        if (local_header_ofs + MZ_ZIP_LOCAL_DIR_HEADER_SIZE > pZip->m_archive_size)
+        {
+            mz_zip_validate_job_fail(pJob, file_index, MZ_ZIP_FILE_READ_FAILED);
+            continue;
+        }
+
+        if (MZ_READ_LE32(pLocal_header) != MZ_ZIP_LOCAL_DIR_HEADER_SIG)
+        {
+            mz_zip_validate_job_fail(pJob, file_index, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
+            continue;
+        }
+
+        local_header_filename_len = MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_FILENAME_LEN_OFS);
+        local_header_extra_len = MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_EXTRA_LEN_OFS);
+        local_header_comp_size = MZ_READ_LE32(pLocal_header + MZ_ZIP_LDH_COMPRESSED_SIZE_OFS);
+        local_header_uncomp_size = MZ_READ_LE32(pLocal_header + MZ_ZIP_LDH_DECOMPRESSED_SIZE_OFS);
+        local_header_crc32 = MZ_READ_LE32(pLocal_header + MZ_ZIP_LDH_CRC32_OFS);
+        local_header_bit_flags = MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_BIT_FLAG_OFS);
+
+        data_end = local_header_ofs + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + local_header_filename_len + local_header_extra_len + comp_size;
+        if (data_end > pZip->m_archive_size)
+        {
+            mz_zip_validate_job_fail(pJob, file_index, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
+            continue;
+        }
+
+        /* Entries may not overlap each other or the central directory */
+        if (((i) && (local_header_ofs < prev_end)) || ((data_end > cdir_start) && (local_header_ofs < cdir_end)))
+        {
+            mz_zip_validate_job_fail(pJob, file_index, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
+            continue;
+        }
+        prev_end = MZ_MAX(prev_end, data_end);
+
+        if (local_header_filename_len != central_filename_len)
+        {
+            mz_zip_validate_job_fail(pJob, file_index, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
+            continue;
+        }
+
+        if (memcmp(pCentral_header + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE, pLocal_header + MZ_ZIP_LOCAL_DIR_HEADER_SIZE, local_header_filename_len) != 0)
+        {
+            mz_zip_validate_job_fail(pJob, file_index, MZ_ZIP_VALIDATION_FAILED);
+            continue;
+        }
+
+        if ((local_header_extra_len) && ((local_header_comp_size == MZ_UINT32_MAX) || (local_header_uncomp_size == MZ_UINT32_MAX)))
+        {
+            const mz_uint8 *pExtra_data = pLocal_header + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + local_header_filename_len;
+            mz_uint32 extra_size_remaining = local_header_extra_len;
+            mz_zip_error err = MZ_ZIP_NO_ERROR;
+
+            do
+            {
+                mz_uint32 field_id, field_data_size, field_total_size;
+
+                if (extra_size_remaining < (sizeof(mz_uint16) * 2))
+                {
+                    err = MZ_ZIP_INVALID_HEADER_OR_CORRUPTED;
+                    break;
+                }
+
+                field_id = MZ_READ_LE16(pExtra_data);
+                field_data_size = MZ_READ_LE16(pExtra_data + sizeof(mz_uint16));
+                field_total_size = field_data_size + sizeof(mz_uint16) * 2;
+
+                if (field_total_size > extra_size_remaining)
+                {
+                    err = MZ_ZIP_INVALID_HEADER_OR_CORRUPTED;
+                    break;
+                }
+
+                if (field_id == MZ_ZIP64_EXTENDED_INFORMATION_FIELD_HEADER_ID)
+                {
+                    if (field_data_size < sizeof(mz_uint64) * 2)
+                    {
+                        err = MZ_ZIP_INVALID_HEADER_OR_CORRUPTED;
+                        break;
+                    }
+
+                    local_header_uncomp_size = MZ_READ_LE64(pExtra_data + sizeof(mz_uint32));
+                    local_header_comp_size = MZ_READ_LE64(pExtra_data + sizeof(mz_uint32) + sizeof(mz_uint64));
+                    found_zip64_ext_data_in_ldir = MZ_TRUE;
+                    break;
+                }
+
+                pExtra_data += field_total_size;
+                extra_size_remaining -= field_total_size;
+            } while (extra_size_remaining);
+
+            if (err != MZ_ZIP_NO_ERROR)
+            {
+                mz_zip_validate_job_fail(pJob, file_index, err);
+                continue;
+            }
+        }
+
+        if ((local_header_bit_flags & 8) && (!local_header_comp_size) && (!local_header_crc32))
+        {
+            /* Check the data descriptor instead */
+            const mz_bool zip64_descriptor = (pState->m_zip64) || (found_zip64_ext_data_in_ldir);
+            const mz_uint32 descriptor_size = sizeof(mz_uint32) * (zip64_descriptor ? 6 : 4);
+            const mz_uint8 *pSrc = pMem + data_end;
+
+            if (data_end + descriptor_size > pZip->m_archive_size)
+            {
+                mz_zip_validate_job_fail(pJob, file_index, MZ_ZIP_FILE_READ_FAILED);
+                continue;
+            }
+
+            if (MZ_READ_LE32(pSrc) == MZ_ZIP_DATA_DESCRIPTOR_ID)
+                pSrc += sizeof(mz_uint32);
+
+            local_header_crc32 = MZ_READ_LE32(pSrc);
+            local_header_comp_size = zip64_descriptor ? MZ_READ_LE64(pSrc + sizeof(mz_uint32)) : MZ_READ_LE32(pSrc + sizeof(mz_uint32));
+            local_header_uncomp_size = zip64_descriptor ? MZ_READ_LE64(pSrc + sizeof(mz_uint32) + sizeof(mz_uint64)) : MZ_READ_LE32(pSrc + sizeof(mz_uint32) + sizeof(mz_uint32));
+        }
+
+        if ((local_header_crc32 != MZ_READ_LE32(pCentral_header + MZ_ZIP_CDH_CRC32_OFS)) || (local_header_comp_size != comp_size) || (local_header_uncomp_size != uncomp_size))
+            mz_zip_validate_job_fail(pJob, file_index, MZ_ZIP_VALIDATION_FAILED);
+    }
+
+    mz_zip_array_clear(pZip, &entries);
+    return MZ_TRUE;
+}
+
+mz_bool mz_zip_validate_archive(mz_zip_archive *pZip, mz_uint flags)
+{
+    mz_uint32 i;
+
+    if (!mz_zip_validate_archive_size(pZip))
+        return MZ_FALSE;
+
+    if (mz_zip_validate_can_check_mem_headers(pZip, flags))
     {
-        /* Try to resize the central directory array back into its original state. */
-        mz_zip_array_resize(pZip, &pState->m_central_dir, orig_central_dir_size, MZ_FALSE);
-        return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+        mz_zip_validate_job job;
+
+        memset(&job, 0, sizeof(job));
+        job.m_pZip = pZip;
+        job.m_flags = flags;
+        if (!mz_zip_validate_mem_headers(&job))
+            return MZ_FALSE;
+
+        return job.m_num_failed ? mz_zip_set_error(pZip, job.m_first_error) : MZ_TRUE;
+    }
+
+    for (i = 0; i < pZip->m_total_files; i++)
+    {
+        if (!mz_zip_validate_archive_file(pZip, i, flags))
+            return MZ_FALSE;
+    }
+
+    return MZ_TRUE;
+}
+
+#ifdef MINIZ_ZIP_THREADS
+/* Each worker validates through its own shallow copy of the archive and its state: they share the (fully indexed) central dir, but not the last error, the stat time cache or the stdio file position. */
+typedef struct
+{
+    mz_zip_validate_job *m_pJob;
+    mz_zip_archive m_zip;
+    mz_zip_internal_state m_state;
+    pthread_t m_thread;
+} mz_zip_validate_worker;
+
+static size_t mz_zip_validate_pread_func(void *pOpaque, mz_uint64 file_ofs, void *pBuf, size_t n)
+{
+    mz_zip_validate_worker *pWorker = (mz_zip_validate_worker *)pOpaque;
+    mz_int64 r = mz_zip_pread(pWorker->m_pJob->m_fd, pBuf, n, pWorker->m_state.m_file_archive_start_ofs + file_ofs);
+    return (r < 0) ? 0 : (size_t)r;
+}
+
+static void *mz_zip_validate_thread_func(void *pArg)
+{
+    mz_zip_validate_worker *pWorker = (mz_zip_validate_worker *)pArg;
+    mz_zip_validate_job *pJob = pWorker->m_pJob;
+
+    for (;;)
+    {
+        mz_uint32 file_index;
+
+        pthread_mutex_lock(&pJob->m_mutex);
+        if ((pJob->m_stop) || (pJob->m_next_file >= pJob->m_pZip->m_total_files))
+        {
+            pthread_mutex_unlock(&pJob->m_mutex);
+            break;
+        }
+        file_index = pJob->m_next_file++;
+        pthread_mutex_unlock(&pJob->m_mutex);
+
+        if (!mz_zip_validate_archive_file(&pWorker->m_zip, file_index, pJob->m_flags))
+        {
+            pthread_mutex_lock(&pJob->m_mutex);
+            mz_zip_validate_job_fail(pJob, file_index, pWorker->m_zip.m_last_error);
+            pthread_mutex_unlock(&pJob->m_mutex);
+        }
+    }
+
+    return NULL;
+}
+
+/* Runs the job on up to num_threads threads. Returns MZ_FALSE without validating anything if the archive can't safely be read from several threads at once. */
+static mz_bool mz_zip_validate_archive_threaded(mz_zip_validate_job *pJob, mz_uint num_threads)
+{
+    mz_zip_archive *pZip = pJob->m_pZip;
+    mz_zip_internal_state *pState = pZip->m_pState;
+    mz_zip_validate_worker *pWorkers;
+    mz_uint i, num_started = 0;
+
+    if (!num_threads)
+    {
+        long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = (num_cpus > 0) ? (mz_uint)num_cpus : 1;
+    }
+    if (num_threads > pZip->m_total_files)
+        num_threads = pZip->m_total_files;
+    if (num_threads < 2)
+        return MZ_FALSE;
+
+    /* Memory archives are read in place, stdio archives through pread() on their descriptor. Other read callbacks, and arena allocators, aren't thread safe. */
+    if ((pZip->m_zip_mode != MZ_ZIP_MODE_READING) || (pZip->m_pAlloc == mz_zip_arena_alloc_func))
+        return MZ_FALSE;
+    pJob->m_fd = -1;
+    if (pZip->m_pRead != mz_zip_mem_read_func)
+    {
+#ifndef MINIZ_NO_STDIO
+        if ((pZip->m_pRead != mz_zip_file_read_func) || (!pState->m_pFile))
+            return MZ_FALSE;
+        pJob->m_fd = fileno(pState->m_pFile);
+#else
+        return MZ_FALSE;
+#endif
+    }
+
+    /* The workers must only read the central dir state, so finish any lazy indexing and sorting first */
+    if ((pState->m_lazy_central_dir) && (!mz_zip_reader_index_central_dir(pZip, pZip->m_total_files)))
+        return MZ_FALSE;
+    if ((pState->m_sort_pending) && (!mz_zip_reader_sort_central_dir(pZip)))
+        return MZ_FALSE;
+
+    if (NULL == (pWorkers = (mz_zip_validate_worker *)MZ_ZIP_ALLOC(pZip, num_threads, sizeof(mz_zip_validate_worker))))
+        return MZ_FALSE;
+
+    if (pthread_mutex_init(&pJob->m_mutex, NULL) != 0)
+    {
+        MZ_ZIP_FREE(pZip, pWorkers, num_threads * sizeof(mz_zip_validate_worker));
+        return MZ_FALSE;
+    }
+
+    for (i = 0; i < num_threads; i++)
+    {
+        mz_zip_validate_worker *pWorker = &pWorkers[i];
+
+        pWorker->m_pJob = pJob;
+        pWorker->m_zip = *pZip;
+        pWorker->m_state = *pState;
+        pWorker->m_zip.m_pState = &pWorker->m_state;
+        MZ_ZIP_STATS(memset(&pWorker->m_state.m_stats, 0, sizeof(mz_zip_stats)));
+        if (pJob->m_fd >= 0)
+        {
+            pWorker->m_zip.m_pRead = mz_zip_validate_pread_func;
+            pWorker->m_zip.m_pIO_opaque = pWorker;
+        }
+        else
+            pWorker->m_zip.m_pIO_opaque = &pWorker->m_zip;
+
+        if (pthread_create(&pWorker->m_thread, NULL, mz_zip_validate_thread_func, pWorker) != 0)
+            break;
+        num_started++;
+    }
+
+    for (i = 0; i < num_started; i++)
+        pthread_join(pWorkers[i].m_thread, NULL);
+
+#ifdef MINIZ_STATS
+    /* Fold the workers' counters into the archive's, their heaps were in use at the same time */
+    {
+        mz_zip_stats *pStats = &pState->m_stats;
+        mz_uint64 workers_peak_heap_size = 0;
+        for (i = 0; i < num_started; i++)
+        {
+            const mz_zip_stats *pWorker_stats = &pWorkers[i].m_state.m_stats;
+            pStats->m_num_reads += pWorker_stats->m_num_reads;
+            pStats->m_bytes_read += pWorker_stats->m_bytes_read;
+            pStats->m_num_read_seeks += pWorker_stats->m_num_read_seeks;
+            pStats->m_num_allocs += pWorker_stats->m_num_allocs;
+            pStats->m_bytes_allocated += pWorker_stats->m_bytes_allocated;
+            pStats->m_inflate_clocks += pWorker_stats->m_inflate_clocks;
+            pStats->m_crc32_clocks += pWorker_stats->m_crc32_clocks;
+            pStats->m_io_clocks += pWorker_stats->m_io_clocks;
+            workers_peak_heap_size += pWorker_stats->m_peak_heap_size;
+        }
+        pStats->m_peak_heap_size = MZ_MAX(pStats->m_peak_heap_size, pStats->m_cur_heap_size + workers_peak_heap_size);
+    }
+#endif
+
+    pthread_mutex_destroy(&pJob->m_mutex);
+    MZ_ZIP_FREE(pZip, pWorkers, num_threads * sizeof(mz_zip_validate_worker));
+
+    /* If no thread could be started, the caller validates on its own thread */
+    return num_started != 0;
+}
+#endif
+
+mz_bool mz_zip_validate_archive_parallel(mz_zip_archive *pZip, mz_uint flags, mz_uint num_threads, mz_uint32 *pFailed_indices, mz_uint32 max_failed, mz_uint32 *pNum_failed)
+{
+    mz_zip_validate_job job;
+    mz_uint32 i, n;
+
+#ifndef MINIZ_ZIP_THREADS
+    (void)num_threads;
+#endif
+
+    if (pNum_failed)
+        *pNum_failed = 0;
+
+    if (!mz_zip_validate_archive_size(pZip))
+        return MZ_FALSE;
+
+    if ((max_failed) && (!pFailed_indices))
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+
+    if (!pZip->m_total_files)
+        return MZ_TRUE;
+
+    memset(&job, 0, sizeof(job));
+    job.m_pZip = pZip;
+    job.m_flags = flags;
+    if (NULL == (job.m_pFailed = (mz_uint8 *)MZ_ZIP_ALLOC(pZip, 1, (pZip->m_total_files + 7) >> 3)))
+        return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+    memset(job.m_pFailed, 0, (pZip->m_total_files + 7) >> 3);
+
+    if (mz_zip_validate_can_check_mem_headers(pZip, flags))
+    {
+        if (!mz_zip_validate_mem_headers(&job))
+        {
+            MZ_ZIP_FREE(pZip, job.m_pFailed, (pZip->m_total_files + 7) >> 3);
+            return MZ_FALSE;
+        }
+    }
+#ifdef MINIZ_ZIP_THREADS
+    else if (!mz_zip_validate_archive_threaded(&job, num_threads))
+#else
+    else
+#endif
+    {
+        for (i = 0; (i < pZip->m_total_files) && (!job.m_stop); i++)
+        {
+            if (!mz_zip_validate_archive_file(pZip, i, flags))
+                mz_zip_validate_job_fail(&job, i, pZip->m_last_error);
+        }
+    }
+
+    if (pNum_failed)
+        *pNum_failed = job.m_num_failed;
+
+    for (i = 0, n = 0; (i < pZip->m_total_files) && (n < MZ_MIN(max_failed, job.m_num_failed)); i++)
+    {
+        if (job.m_pFailed[i >> 3] & (1 << (i & 7)))
+            pFailed_indices[n++] = i;
+    }
+
+    MZ_ZIP_FREE(pZip, job.m_pFailed, (pZip->m_total_files + 7) >> 3);
+
+    if (job.m_num_failed)
+        return mz_zip_set_error(pZip, job.m_first_error);
+
+    return MZ_TRUE;
+}
+
+mz_bool mz_zip_validate_mem_archive(const void *pMem, size_t size, mz_uint flags, mz_zip_error *pErr)
+{
+    mz_bool success = MZ_TRUE;
+    mz_zip_archive zip;
+    mz_zip_error actual_err = MZ_ZIP_NO_ERROR;
+
+    if ((!pMem) || (!size))
+    {
+        if (pErr)
+            *pErr = MZ_ZIP_INVALID_PARAMETER;
+        return MZ_FALSE;
+    }
+
+    mz_zip_zero_struct(&zip);
+
+    if (!mz_zip_reader_init_mem(&zip, pMem, size, flags))
+    {
+        if (pErr)
+            *pErr = zip.m_last_error;
+        return MZ_FALSE;
+    }
+
+    if (!mz_zip_validate_archive(&zip, flags))
+    {
+        actual_err = zip.m_last_error;
+        success = MZ_FALSE;
+    }
+
+    if (!mz_zip_reader_end_internal(&zip, success))
+    {
+        if (!actual_err)
+            actual_err = zip.m_last_error;
+        success = MZ_FALSE;
+    }
+
+    if (pErr)
+        *pErr = actual_err;
+
+    return success;
+}
+
+#ifndef MINIZ_NO_STDIO
+mz_bool mz_zip_validate_file_archive(const char *pFilename, mz_uint flags, mz_zip_error *pErr)
+{
+    mz_bool success = MZ_TRUE;
+    mz_zip_archive zip;
+    mz_zip_error actual_err = MZ_ZIP_NO_ERROR;
+
+    if (!pFilename)
+    {
+        if (pErr)
+            *pErr = MZ_ZIP_INVALID_PARAMETER;
+        return MZ_FALSE;
+    }
+
+    mz_zip_zero_struct(&zip);
+
+    if (!mz_zip_reader_init_file_v2(&zip, pFilename, flags, 0, 0))
+    {
+        if (pErr)
+            *pErr = zip.m_last_error;
+        return MZ_FALSE;
+    }
+
+    if (!mz_zip_validate_archive(&zip, flags))
+    {
+        actual_err = zip.m_last_error;
+        success = MZ_FALSE;
+    }
+
+    if (!mz_zip_reader_end_internal(&zip, success))
+    {
+        if (!actual_err)
+            actual_err = zip.m_last_error;
+        success = MZ_FALSE;
+    }
+
+    if (pErr)
+        *pErr = actual_err;
+
+    return success;
+}
+#endif /* #ifndef MINIZ_NO_STDIO */
+
+/* ------------------- .ZIP archive writing */
+
+#ifndef MINIZ_NO_ARCHIVE_WRITING_APIS
+
+static MZ_FORCEINLINE void mz_write_le16(mz_uint8 *p, mz_uint16 v)
+{
+    p[0] = (mz_uint8)v;
+    p[1] = (mz_uint8)(v >> 8);
+}
+static MZ_FORCEINLINE void mz_write_le32(mz_uint8 *p, mz_uint32 v)
+{
+    p[0] = (mz_uint8)v;
+    p[1] = (mz_uint8)(v >> 8);
+    p[2] = (mz_uint8)(v >> 16);
+    p[3] = (mz_uint8)(v >> 24);
+}
+static MZ_FORCEINLINE void mz_write_le64(mz_uint8 *p, mz_uint64 v)
+{
+    mz_write_le32(p, (mz_uint32)v);
+    mz_write_le32(p + sizeof(mz_uint32), (mz_uint32)(v >> 32));
+}
+
+#define MZ_WRITE_LE16(p, v) mz_write_le16((mz_uint8 *)(p), (mz_uint16)(v))
+#define MZ_WRITE_LE32(p, v) mz_write_le32((mz_uint8 *)(p), (mz_uint32)(v))
+#define MZ_WRITE_LE64(p, v) mz_write_le64((mz_uint8 *)(p), (mz_uint64)(v))
+
+static size_t mz_zip_heap_write_func(void *pOpaque, mz_uint64 file_ofs, const void *pBuf, size_t n)
+{
+    mz_zip_archive *pZip = (mz_zip_archive *)pOpaque;
+    mz_zip_internal_state *pState = pZip->m_pState;
+    mz_uint64 new_size = MZ_MAX(file_ofs + n, pState->m_mem_size);
+
+    if (!n)
+        return 0;
+
+    /* An allocation this big is likely to just fail on 32-bit systems, so don't even go there. */
+    if ((sizeof(size_t) == sizeof(mz_uint32)) && (new_size > 0x7FFFFFFF))
+    {
+        mz_zip_set_error(pZip, MZ_ZIP_FILE_TOO_LARGE);
+        return 0;
+    }
+
+    if (new_size > pState->m_mem_capacity)
+    {
+        void *pNew_block;
+        size_t new_capacity = MZ_MAX(64, pState->m_mem_capacity);
+
+        while (new_capacity < new_size)
+            new_capacity *= 2;
+
+        if (NULL == (pNew_block = MZ_ZIP_REALLOC(pZip, pState->m_pMem, pState->m_mem_capacity, 1, new_capacity)))
+        {
+            mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+            return 0;
+        }
+
+        pState->m_pMem = pNew_block;
+        pState->m_mem_capacity = new_capacity;
+    }
+    memcpy((mz_uint8 *)pState->m_pMem + file_ofs, pBuf, n);
+    pState->m_mem_size = (size_t)new_size;
+    return n;
+}
+
+/* Chunked variant of mz_zip_heap_write_func(): the archive lives in fixed size MZ_ZIP_HEAP_CHUNK_SIZE blocks, so growing it never copies previously written data. */
+static size_t mz_zip_heap_chunked_write_func(void *pOpaque, mz_uint64 file_ofs, const void *pBuf, size_t n)
+{
+    mz_zip_archive *pZip = (mz_zip_archive *)pOpaque;
+    mz_zip_internal_state *pState = pZip->m_pState;
+    mz_zip_array *pChunks = &pState->m_heap_chunks;
+    mz_uint64 new_size = MZ_MAX(file_ofs + n, pState->m_mem_size);
+    const mz_uint8 *pSrc = (const mz_uint8 *)pBuf;
+    size_t chunk_index, chunk_ofs, num_chunks, remaining = n;
+
+    if (!n)
+        return 0;
+
+    /* An allocation this big is likely to just fail on 32-bit systems, so don't even go there. */
+    if ((sizeof(size_t) == sizeof(mz_uint32)) && (new_size > 0x7FFFFFFF))
+    {
+        mz_zip_set_error(pZip, MZ_ZIP_FILE_TOO_LARGE);
+        return 0;
+    }
+
+    num_chunks = (size_t)((new_size + MZ_ZIP_HEAP_CHUNK_SIZE - 1) / MZ_ZIP_HEAP_CHUNK_SIZE);
+    if (num_chunks > pChunks->m_size)
+    {
+        size_t i = pChunks->m_size;
+
+        if (!mz_zip_array_resize(pZip, pChunks, num_chunks, MZ_TRUE))
+        {
+            mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+            return 0;
+        }
+
+        for (; i < num_chunks; i++)
+        {
+            if (NULL == (MZ_ZIP_ARRAY_ELEMENT(pChunks, void *, i) = MZ_ZIP_ALLOC(pZip, 1, MZ_ZIP_HEAP_CHUNK_SIZE)))
+            {
+                /* Keep the blocks we did get, they'll be freed by mz_zip_writer_end(). */
+                pChunks->m_size = i;
+                mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+                return 0;
+            }
+        }
+    }
+
+    chunk_index = (size_t)(file_ofs / MZ_ZIP_HEAP_CHUNK_SIZE);
+    chunk_ofs = (size_t)(file_ofs % MZ_ZIP_HEAP_CHUNK_SIZE);
+    while (remaining)
+    {
+        size_t s = MZ_MIN(MZ_ZIP_HEAP_CHUNK_SIZE - chunk_ofs, remaining);
+        memcpy((mz_uint8 *)MZ_ZIP_ARRAY_ELEMENT(pChunks, void *, chunk_index) + chunk_ofs, pSrc, s);
+        pSrc += s;
+        remaining -= s;
+        chunk_index++;
+        chunk_ofs = 0;
+    }
+
+    pState->m_mem_size = (size_t)new_size;
+    return n;
+}
+
+static size_t mz_zip_heap_chunked_read_func(void *pOpaque, mz_uint64 file_ofs, void *pBuf, size_t n)
+{
+    mz_zip_archive *pZip = (mz_zip_archive *)pOpaque;
+    mz_zip_internal_state *pState = pZip->m_pState;
+    mz_uint64 avail = MZ_MIN(pZip->m_archive_size, (mz_uint64)pState->m_mem_size);
+    mz_uint8 *pDst = (mz_uint8 *)pBuf;
+    size_t s = (file_ofs >= avail) ? 0 : (size_t)MZ_MIN(avail - file_ofs, n);
+    size_t chunk_index = (size_t)(file_ofs / MZ_ZIP_HEAP_CHUNK_SIZE), chunk_ofs = (size_t)(file_ofs % MZ_ZIP_HEAP_CHUNK_SIZE), remaining = s;
+
+    while (remaining)
+    {
+        size_t t = MZ_MIN(MZ_ZIP_HEAP_CHUNK_SIZE - chunk_ofs, remaining);
+        memcpy(pDst, (const mz_uint8 *)MZ_ZIP_ARRAY_ELEMENT(&pState->m_heap_chunks, void *, chunk_index) + chunk_ofs, t);
+        pDst += t;
+        remaining -= t;
+        chunk_index++;
+        chunk_ofs = 0;
+    }
+
+    return s;
+}
+
+static void mz_zip_heap_chunks_clear(mz_zip_archive *pZip, mz_zip_internal_state *pState)
+{
+    size_t i;
+    for (i = 0; i < pState->m_heap_chunks.m_size; i++)
+        MZ_ZIP_FREE(pZip, MZ_ZIP_ARRAY_ELEMENT(&pState->m_heap_chunks, void *, i), MZ_ZIP_HEAP_CHUNK_SIZE);
+    mz_zip_array_clear(pZip, &pState->m_heap_chunks);
+}
+
+static mz_bool mz_zip_writer_end_internal(mz_zip_archive *pZip, mz_bool set_last_error)
+{
+    mz_zip_internal_state *pState;
+    mz_bool status = MZ_TRUE;
+
+    if ((!pZip) || (!pZip->m_pState) || (!pZip->m_pAlloc) || (!pZip->m_pFree) || ((pZip->m_zip_mode != MZ_ZIP_MODE_WRITING) && (pZip->m_zip_mode != MZ_ZIP_MODE_WRITING_HAS_BEEN_FINALIZED)))
+    {
+        if (set_last_error)
+            mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+        return MZ_FALSE;
+    }
+
+    pState = pZip->m_pState;
+    pZip->m_pState = NULL;
+    mz_zip_array_clear(pZip, &pState->m_central_dir);
+    mz_zip_array_clear(pZip, &pState->m_central_dir_offsets);
+    mz_zip_array_clear(pZip, &pState->m_sorted_central_dir_offsets);
+    mz_zip_array_clear(pZip, &pState->m_validated_files);
+
+#ifndef MINIZ_NO_STDIO
+    if (pState->m_pFile)
+    {
+        if (pZip->m_zip_type == MZ_ZIP_TYPE_FILE)
+        {
+            if (MZ_FCLOSE(pState->m_pFile) == EOF)
+            {
+                if (set_last_error)
+                    mz_zip_set_error(pZip, MZ_ZIP_FILE_CLOSE_FAILED);
+                status = MZ_FALSE;
+            }
+        }
+
+        pState->m_pFile = NULL;
+    }
+#endif /* #ifndef MINIZ_NO_STDIO */
+
+    if ((pZip->m_pWrite == mz_zip_heap_write_func) && (pState->m_pMem))
+    {
+        MZ_ZIP_FREE(pZip, pState->m_pMem, pState->m_mem_capacity);
+        pState->m_pMem = NULL;
+    }
+
+    if (pState->m_heap_chunks.m_p)
+        mz_zip_heap_chunks_clear(pZip, pState);
+
+    mz_zip_array_clear(pZip, &pState->m_dedup_entries);
+    mz_zip_array_clear(pZip, &pState->m_dedup_table);
+
+    pZip->m_pFree(pZip->m_pAlloc_opaque, pState);
+    pZip->m_zip_mode = MZ_ZIP_MODE_INVALID;
+    return status;
+}
+
+mz_bool mz_zip_writer_init_v2(mz_zip_archive *pZip, mz_uint64 existing_size, mz_uint flags)
+{
+    mz_bool zip64 = (flags & MZ_ZIP_FLAG_WRITE_ZIP64) != 0;
+
+    if ((!pZip) || (pZip->m_pState) || (!pZip->m_pWrite) || (pZip->m_zip_mode != MZ_ZIP_MODE_INVALID))
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+
+    if (flags & MZ_ZIP_FLAG_WRITE_ALLOW_READING)
+    {
+        if (!pZip->m_pRead)
+            return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+    }
+
+    if (pZip->m_file_offset_alignment)
+    {
+        /* Ensure user specified file offset alignment is a power of 2. */
+        if (pZip->m_file_offset_alignment & (pZip->m_file_offset_alignment - 1))
+            return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+    }
+
+    if (!pZip->m_pAlloc)
+        pZip->m_pAlloc = miniz_def_alloc_func;
+    if (!pZip->m_pFree)
+        pZip->m_pFree = miniz_def_free_func;
+    if (!pZip->m_pRealloc)
+        pZip->m_pRealloc = miniz_def_realloc_func;
+
+    pZip->m_archive_size = existing_size;
+    pZip->m_central_directory_file_ofs = 0;
+    pZip->m_total_files = 0;
+
+    if (NULL == (pZip->m_pState = (mz_zip_internal_state *)pZip->m_pAlloc(pZip->m_pAlloc_opaque, 1, sizeof(mz_zip_internal_state))))
+        return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+
+    memset(pZip->m_pState, 0, sizeof(mz_zip_internal_state));
+    MZ_ZIP_STATS(mz_zip_stats_count_alloc(pZip->m_pState, 0, sizeof(mz_zip_internal_state)));
+
+    MZ_ZIP_ARRAY_SET_ELEMENT_SIZE(&pZip->m_pState->m_central_dir, sizeof(mz_uint8));
+    MZ_ZIP_ARRAY_SET_ELEMENT_SIZE(&pZip->m_pState->m_central_dir_offsets, sizeof(mz_uint32));
+    MZ_ZIP_ARRAY_SET_ELEMENT_SIZE(&pZip->m_pState->m_sorted_central_dir_offsets, sizeof(mz_uint32));
+    MZ_ZIP_ARRAY_SET_ELEMENT_SIZE(&pZip->m_pState->m_heap_chunks, sizeof(void *));
+    MZ_ZIP_ARRAY_SET_ELEMENT_SIZE(&pZip->m_pState->m_dedup_entries, sizeof(mz_zip_writer_dedup_entry));
+    MZ_ZIP_ARRAY_SET_ELEMENT_SIZE(&pZip->m_pState->m_dedup_table, sizeof(mz_uint32));
+    pZip->m_pState->m_compact_threshold = MZ_ZIP_DEFAULT_COMPACT_THRESHOLD;
+    pZip->m_pState->m_dedup = (flags & MZ_ZIP_FLAG_WRITE_DEDUPLICATE) != 0;
+    pZip->m_pState->m_write_index = (flags & MZ_ZIP_FLAG_WRITE_INDEX) != 0;
+
+    pZip->m_pState->m_zip64 = zip64;
+    pZip->m_pState->m_zip64_has_extended_info_fields = zip64;
+
+    pZip->m_zip_type = MZ_ZIP_TYPE_USER;
+    pZip->m_zip_mode = MZ_ZIP_MODE_WRITING;
+
+    return MZ_TRUE;
+}
+
+mz_bool mz_zip_writer_init(mz_zip_archive *pZip, mz_uint64 existing_size)
+{
+    return mz_zip_writer_init_v2(pZip, existing_size, 0);
+}
+
+mz_bool mz_zip_writer_init_heap_v2(mz_zip_archive *pZip, size_t size_to_reserve_at_beginning, size_t initial_allocation_size, mz_uint flags)
+{
+    mz_bool chunked = (flags & MZ_ZIP_FLAG_WRITE_HEAP_CHUNKED) != 0;
+
+    pZip->m_pWrite = chunked ? mz_zip_heap_chunked_write_func : mz_zip_heap_write_func;
+    pZip->m_pNeeds_keepalive = NULL;
+
+    /* Deduplication reads earlier entries back */
+    if (flags & (MZ_ZIP_FLAG_WRITE_ALLOW_READING | MZ_ZIP_FLAG_WRITE_DEDUPLICATE))
+        pZip->m_pRead = chunked ? mz_zip_heap_chunked_read_func : mz_zip_mem_read_func;
+
+    pZip->m_pIO_opaque = pZip;
+
+    if (!mz_zip_writer_init_v2(pZip, size_to_reserve_at_beginning, flags))
+        return MZ_FALSE;
+
+    pZip->m_zip_type = MZ_ZIP_TYPE_HEAP;
+
+    if (chunked)
+    {
+        /* Only size the block pointer array up front, the blocks themselves are allocated as the archive grows. */
+        initial_allocation_size = MZ_MAX(initial_allocation_size, size_to_reserve_at_beginning);
+        if (!mz_zip_array_reserve(pZip, &pZip->m_pState->m_heap_chunks, (initial_allocation_size + MZ_ZIP_HEAP_CHUNK_SIZE - 1) / MZ_ZIP_HEAP_CHUNK_SIZE, MZ_FALSE))
+        {
+            mz_zip_writer_end_internal(pZip, MZ_FALSE);
+            return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+        }
+    }
+    else if (0 != (initial_allocation_size = MZ_MAX(initial_allocation_size, size_to_reserve_at_beginning)))
+    {
+        if (NULL == (pZip->m_pState->m_pMem = MZ_ZIP_ALLOC(pZip, 1, initial_allocation_size)))
+        {
+            mz_zip_writer_end_internal(pZip, MZ_FALSE);
+            return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+        }
+        pZip->m_pState->m_mem_capacity = initial_allocation_size;
+    }
+
+    return MZ_TRUE;
+}
+
+mz_bool mz_zip_writer_init_heap(mz_zip_archive *pZip, size_t size_to_reserve_at_beginning, size_t initial_allocation_size)
+{
+    return mz_zip_writer_init_heap_v2(pZip, size_to_reserve_at_beginning, initial_allocation_size, 0);
+}
+
+#ifndef MINIZ_NO_STDIO
+static size_t mz_zip_file_write_func(void *pOpaque, mz_uint64 file_ofs, const void *pBuf, size_t n)
+{
+    mz_zip_archive *pZip = (mz_zip_archive *)pOpaque;
+    mz_int64 cur_ofs = MZ_FTELL64(pZip->m_pState->m_pFile);
+
+    file_ofs += pZip->m_pState->m_file_archive_start_ofs;
+
+    if (((mz_int64)file_ofs < 0) || (((cur_ofs != (mz_int64)file_ofs)) && (MZ_FSEEK64(pZip->m_pState->m_pFile, (mz_int64)file_ofs, SEEK_SET))))
+    {
+        mz_zip_set_error(pZip, MZ_ZIP_FILE_SEEK_FAILED);
+        return 0;
+    }
+
+    return MZ_FWRITE(pBuf, 1, n, pZip->m_pState->m_pFile);
+}
+
+mz_bool mz_zip_writer_init_file(mz_zip_archive *pZip, const char *pFilename, mz_uint64 size_to_reserve_at_beginning)
+{
+    return mz_zip_writer_init_file_v2(pZip, pFilename, size_to_reserve_at_beginning, 0);
+}
+
+mz_bool mz_zip_writer_init_file_v2(mz_zip_archive *pZip, const char *pFilename, mz_uint64 size_to_reserve_at_beginning, mz_uint flags)
+{
+    MZ_FILE *pFile;
+
+    pZip->m_pWrite = mz_zip_file_write_func;
+    pZip->m_pNeeds_keepalive = NULL;
+
+    /* Deduplication reads earlier entries back */
+    if (flags & (MZ_ZIP_FLAG_WRITE_ALLOW_READING | MZ_ZIP_FLAG_WRITE_DEDUPLICATE))
+        pZip->m_pRead = mz_zip_file_read_func;
+
+    pZip->m_pIO_opaque = pZip;
+
+    if (!mz_zip_writer_init_v2(pZip, size_to_reserve_at_beginning, flags))
+        return MZ_FALSE;
+
+    if (NULL == (pFile = MZ_FOPEN(pFilename, (flags & (MZ_ZIP_FLAG_WRITE_ALLOW_READING | MZ_ZIP_FLAG_WRITE_DEDUPLICATE)) ? "w+b" : "wb")))
+    {
+        mz_zip_writer_end(pZip);
+        return mz_zip_set_error(pZip, MZ_ZIP_FILE_OPEN_FAILED);
+    }
+
+    pZip->m_pState->m_pFile = pFile;
+    pZip->m_zip_type = MZ_ZIP_TYPE_FILE;
+
+    if (size_to_reserve_at_beginning)
+    {
+        mz_uint64 cur_ofs = 0;
+        char buf[4096];
+
+        MZ_CLEAR_ARR(buf);
+
+        do
+        {
+            size_t n = (size_t)MZ_MIN(sizeof(buf), size_to_reserve_at_beginning);
+            if (MZ_ZIP_WRITE(pZip, cur_ofs, buf, n) != n)
+            {
+                mz_zip_writer_end(pZip);
+                return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
+            }
+            cur_ofs += n;
+            size_to_reserve_at_beginning -= n;
+        } while (size_to_reserve_at_beginning);
+    }
+
+    return MZ_TRUE;
+}
+
+mz_bool mz_zip_writer_init_cfile(mz_zip_archive *pZip, MZ_FILE *pFile, mz_uint flags)
+{
+    pZip->m_pWrite = mz_zip_file_write_func;
+    pZip->m_pNeeds_keepalive = NULL;
+
+    if (flags & MZ_ZIP_FLAG_WRITE_ALLOW_READING)
+        pZip->m_pRead = mz_zip_file_read_func;
+
+    pZip->m_pIO_opaque = pZip;
+
+    if (!mz_zip_writer_init_v2(pZip, 0, flags))
+        return MZ_FALSE;
+
+    pZip->m_pState->m_pFile = pFile;
+    pZip->m_pState->m_file_archive_start_ofs = MZ_FTELL64(pZip->m_pState->m_pFile);
+    pZip->m_zip_type = MZ_ZIP_TYPE_CFILE;
+
+    return MZ_TRUE;
+}
+#endif /* #ifndef MINIZ_NO_STDIO */
+
+mz_bool mz_zip_writer_init_from_reader_v2(mz_zip_archive *pZip, const char *pFilename, mz_uint flags)
+{
+    mz_zip_internal_state *pState;
+
+    if ((!pZip) || (!pZip->m_pState) || (pZip->m_zip_mode != MZ_ZIP_MODE_READING))
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+
+    /* The writer needs every record indexed (and knowing if any uses zip64 extended info) */
+    if (pZip->m_pState->m_lazy_central_dir)
+    {
+        if (!mz_zip_reader_index_central_dir(pZip, pZip->m_total_files))
+            return MZ_FALSE;
+        pZip->m_pState->m_lazy_central_dir = MZ_FALSE;
+        pZip->m_pState->m_sort_pending = MZ_FALSE;
+    }
+    mz_zip_array_clear(pZip, &pZip->m_pState->m_validated_files);
+    pZip->m_pState->m_index_loaded = MZ_FALSE;
+    mz_zip_reader_clear_decoded_central_dir(pZip, pZip->m_pState);
+
+    if (flags & MZ_ZIP_FLAG_WRITE_ZIP64)
+    {
+        /* We don't support converting a non-zip64 file to zip64 - this seems like more trouble than it's worth. (What about the existing 32-bit data descriptors that could follow the compressed data?) */
+        if (!pZip->m_pState->m_zip64)
+            return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+    }
+
+    /* No sense in trying to write to an archive that's already at the support max size */
+    if (pZip->m_pState->m_zip64)
+    {
+        if (pZip->m_total_files == MZ_UINT32_MAX)
+            return mz_zip_set_error(pZip, MZ_ZIP_TOO_MANY_FILES);
+    }
+    else
+    {
+        if (pZip->m_total_files == MZ_UINT16_MAX)
+            return mz_zip_set_error(pZip, MZ_ZIP_TOO_MANY_FILES);
+
+        if ((pZip->m_archive_size + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + MZ_ZIP_LOCAL_DIR_HEADER_SIZE) > MZ_UINT32_MAX)
+            return mz_zip_set_error(pZip, MZ_ZIP_FILE_TOO_LARGE);
+    }
+
+    pState = pZip->m_pState;
+
+    if (pState->m_pFile)
+    {
+#ifdef MINIZ_NO_STDIO
+        (void)pFilename;
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+#else
+        if (pZip->m_pIO_opaque != pZip)
+            return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+
+        if (pZip->m_zip_type == MZ_ZIP_TYPE_FILE)
+        {
+            if (!pFilename)
+                return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+
+            /* Archive is being read from stdio and was originally opened only for reading. Try to reopen as writable. */
+            if (NULL == (pState->m_pFile = MZ_FREOPEN(pFilename, "r+b", pState->m_pFile)))
+            {
+                /* The mz_zip_archive is now in a bogus state because pState->m_pFile is NULL, so just close it. */
+                mz_zip_reader_end_internal(pZip, MZ_FALSE);
+                return mz_zip_set_error(pZip, MZ_ZIP_FILE_OPEN_FAILED);
+            }
+        }
+
+        pZip->m_pWrite = mz_zip_file_write_func;
+        pZip->m_pNeeds_keepalive = NULL;
+#endif /* #ifdef MINIZ_NO_STDIO */
+    }
+    else if (pState->m_pMem)
+    {
+        /* Archive lives in a memory block. Assume it's from the heap that we can resize using the realloc callback. */
+        if (pZip->m_pIO_opaque != pZip)
+            return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+
+        pState->m_mem_capacity = pState->m_mem_size;
+        pZip->m_pWrite = mz_zip_heap_write_func;
+        pZip->m_pNeeds_keepalive = NULL;
+    }
+    /* Archive is being read via a user provided read function - make sure the user has specified a write function too. */
+    else if (!pZip->m_pWrite)
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+
+    pState->m_num_deleted_files = 0;
+    pState->m_compact_threshold = MZ_ZIP_DEFAULT_COMPACT_THRESHOLD;
+    pState->m_truncate_on_finalize = MZ_FALSE;
+    MZ_ZIP_ARRAY_SET_ELEMENT_SIZE(&pState->m_dedup_entries, sizeof(mz_zip_writer_dedup_entry));
+    MZ_ZIP_ARRAY_SET_ELEMENT_SIZE(&pState->m_dedup_table, sizeof(mz_uint32));
+    pState->m_dedup = (flags & MZ_ZIP_FLAG_WRITE_DEDUPLICATE) != 0;
+    pState->m_write_index = (flags & MZ_ZIP_FLAG_WRITE_INDEX) != 0;
+
+    /* Start writing new files at the archive's current central directory location. */
+    /* TODO: We could add a flag that lets the user start writing immediately AFTER the existing central dir - this would be safer. */
+    pZip->m_archive_size = pZip->m_central_directory_file_ofs;
+    pZip->m_central_directory_file_ofs = 0;
+
+    /* Clear the sorted central dir offsets, they aren't useful or maintained now. */
+    /* Even though we're now in write mode, files can still be extracted and verified, but file locates will be slow. */
+    /* TODO: We could easily maintain the sorted central directory offsets. */
+    mz_zip_array_clear(pZip, &pZip->m_pState->m_sorted_central_dir_offsets);
+
+    pZip->m_zip_mode = MZ_ZIP_MODE_WRITING;
+
+    return MZ_TRUE;
+}
+
+mz_bool mz_zip_writer_init_from_reader(mz_zip_archive *pZip, const char *pFilename)
+{
+    return mz_zip_writer_init_from_reader_v2(pZip, pFilename, 0);
+}
+
+/* TODO: pArchive_name is a terrible name here! */
+mz_bool mz_zip_writer_add_mem(mz_zip_archive *pZip, const char *pArchive_name, const void *pBuf, size_t buf_size, mz_uint level_and_flags)
+{
+    return mz_zip_writer_add_mem_ex(pZip, pArchive_name, pBuf, buf_size, NULL, 0, level_and_flags, 0, 0);
+}
+
+typedef struct
+{
+    mz_zip_archive *m_pZip;
+    mz_uint64 m_cur_archive_file_ofs;
+    mz_uint64 m_comp_size;
+} mz_zip_writer_add_state;
+
+static mz_bool mz_zip_writer_add_put_buf_callback(const void *pBuf, int len, void *pUser)
+{
+    mz_zip_writer_add_state *pState = (mz_zip_writer_add_state *)pUser;
+    if ((int)MZ_ZIP_WRITE(pState->m_pZip, pState->m_cur_archive_file_ofs, pBuf, len) != len)
+        return MZ_FALSE;
+
+    pState->m_cur_archive_file_ofs += len;
+    pState->m_comp_size += len;
+    return MZ_TRUE;
+}
+
+#define MZ_ZIP64_MAX_LOCAL_EXTRA_FIELD_SIZE (sizeof(mz_uint16) * 2 + sizeof(mz_uint64) * 2)
+#define MZ_ZIP64_MAX_CENTRAL_EXTRA_FIELD_SIZE (sizeof(mz_uint16) * 2 + sizeof(mz_uint64) * 3)
+static mz_uint32 mz_zip_writer_create_zip64_extra_data(mz_uint8 *pBuf, mz_uint64 *pUncomp_size, mz_uint64 *pComp_size, mz_uint64 *pLocal_header_ofs)
+{
+    mz_uint8 *pDst = pBuf;
+    mz_uint32 field_size = 0;
+
+    MZ_WRITE_LE16(pDst + 0, MZ_ZIP64_EXTENDED_INFORMATION_FIELD_HEADER_ID);
+    MZ_WRITE_LE16(pDst + 2, 0);
+    pDst += sizeof(mz_uint16) * 2;
+
+    if (pUncomp_size)
+    {
+        MZ_WRITE_LE64(pDst, *pUncomp_size);
+        pDst += sizeof(mz_uint64);
+        field_size += sizeof(mz_uint64);
+    }
+
+    if (pComp_size)
+    {
+        MZ_WRITE_LE64(pDst, *pComp_size);
+        pDst += sizeof(mz_uint64);
+        field_size += sizeof(mz_uint64);
+    }
+
+    if (pLocal_header_ofs)
+    {
+        MZ_WRITE_LE64(pDst, *pLocal_header_ofs);
+        pDst += sizeof(mz_uint64);
+        field_size += sizeof(mz_uint64);
+    }
+
+    MZ_WRITE_LE16(pBuf + 2, field_size);
+
+    return (mz_uint32)(pDst - pBuf);
+}
+
+static mz_bool mz_zip_writer_create_local_dir_header(mz_zip_archive *pZip, mz_uint8 *pDst, mz_uint16 filename_size, mz_uint16 extra_size, mz_uint64 uncomp_size, mz_uint64 comp_size, mz_uint32 uncomp_crc32, mz_uint16 method, mz_uint16 bit_flags, mz_uint16 dos_time, mz_uint16 dos_date)
+{
+    (void)pZip;
+    memset(pDst, 0, MZ_ZIP_LOCAL_DIR_HEADER_SIZE);
+    MZ_WRITE_LE32(pDst + MZ_ZIP_LDH_SIG_OFS, MZ_ZIP_LOCAL_DIR_HEADER_SIG);
+    MZ_WRITE_LE16(pDst + MZ_ZIP_LDH_VERSION_NEEDED_OFS, method ? 20 : 0);
+    MZ_WRITE_LE16(pDst + MZ_ZIP_LDH_BIT_FLAG_OFS, bit_flags);
+    MZ_WRITE_LE16(pDst + MZ_ZIP_LDH_METHOD_OFS, method);
+    MZ_WRITE_LE16(pDst + MZ_ZIP_LDH_FILE_TIME_OFS, dos_time);
+    MZ_WRITE_LE16(pDst + MZ_ZIP_LDH_FILE_DATE_OFS, dos_date);
+    MZ_WRITE_LE32(pDst + MZ_ZIP_LDH_CRC32_OFS, uncomp_crc32);
+    MZ_WRITE_LE32(pDst + MZ_ZIP_LDH_COMPRESSED_SIZE_OFS, MZ_MIN(comp_size, MZ_UINT32_MAX));
+    MZ_WRITE_LE32(pDst + MZ_ZIP_LDH_DECOMPRESSED_SIZE_OFS, MZ_MIN(uncomp_size, MZ_UINT32_MAX));
+    MZ_WRITE_LE16(pDst + MZ_ZIP_LDH_FILENAME_LEN_OFS, filename_size);
+    MZ_WRITE_LE16(pDst + MZ_ZIP_LDH_EXTRA_LEN_OFS, extra_size);
+    return MZ_TRUE;
+}
+
+static mz_bool mz_zip_writer_create_central_dir_header(mz_zip_archive *pZip, mz_uint8 *pDst,
+                                                       mz_uint16 filename_size, mz_uint16 extra_size, mz_uint16 comment_size,
+                                                       mz_uint64 uncomp_size, mz_uint64 comp_size, mz_uint32 uncomp_crc32,
+                                                       mz_uint16 method, mz_uint16 bit_flags, mz_uint16 dos_time, mz_uint16 dos_date,
+                                                       mz_uint64 local_header_ofs, mz_uint32 ext_attributes)
+{
+    (void)pZip;
+    memset(pDst, 0, MZ_ZIP_CENTRAL_DIR_HEADER_SIZE);
+    MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_SIG_OFS, MZ_ZIP_CENTRAL_DIR_HEADER_SIG);
+    MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_VERSION_NEEDED_OFS, method ? 20 : 0);
+    MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_BIT_FLAG_OFS, bit_flags);
+    MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_METHOD_OFS, method);
+    MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_FILE_TIME_OFS, dos_time);
+    MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_FILE_DATE_OFS, dos_date);
+    MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_CRC32_OFS, uncomp_crc32);
+    MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_COMPRESSED_SIZE_OFS, MZ_MIN(comp_size, MZ_UINT32_MAX));
+    MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_DECOMPRESSED_SIZE_OFS, MZ_MIN(uncomp_size, MZ_UINT32_MAX));
+    MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_FILENAME_LEN_OFS, filename_size);
+    MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_EXTRA_LEN_OFS, extra_size);
+    MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_COMMENT_LEN_OFS, comment_size);
+    MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_EXTERNAL_ATTR_OFS, ext_attributes);
+    MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_LOCAL_HEADER_OFS, MZ_MIN(local_header_ofs, MZ_UINT32_MAX));
+    return MZ_TRUE;
+}
+
+static mz_bool mz_zip_writer_add_to_central_dir(mz_zip_archive *pZip, const char *pFilename, mz_uint16 filename_size,
+                                                const void *pExtra, mz_uint16 extra_size, const void *pComment, mz_uint16 comment_size,
+                                                mz_uint64 uncomp_size, mz_uint64 comp_size, mz_uint32 uncomp_crc32,
+                                                mz_uint16 method, mz_uint16 bit_flags, mz_uint16 dos_time, mz_uint16 dos_date,
+                                                mz_uint64 local_header_ofs, mz_uint32 ext_attributes,
+                                                const char *user_extra_data, mz_uint user_extra_data_len)
+{
+    mz_zip_internal_state *pState = pZip->m_pState;
+    mz_uint32 central_dir_ofs = (mz_uint32)pState->m_central_dir.m_size;
+    size_t orig_central_dir_size = pState->m_central_dir.m_size;
+    mz_uint8 central_dir_header[MZ_ZIP_CENTRAL_DIR_HEADER_SIZE];
+
+    if (!pZip->m_pState->m_zip64)
+    {
+        if (local_header_ofs > 0xFFFFFFFF)
+            return mz_zip_set_error(pZip, MZ_ZIP_FILE_TOO_LARGE);
+    }
+
+    /* miniz doesn't support central dirs >= MZ_UINT32_MAX bytes yet */
+    if (((mz_uint64)pState->m_central_dir.m_size + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + filename_size + extra_size + user_extra_data_len + comment_size) >= MZ_UINT32_MAX)
+        return mz_zip_set_error(pZip, MZ_ZIP_UNSUPPORTED_CDIR_SIZE);
+
+    if (!mz_zip_writer_create_central_dir_header(pZip, central_dir_header, filename_size, (mz_uint16)(extra_size + user_extra_data_len), comment_size, uncomp_size, comp_size, uncomp_crc32, method, bit_flags, dos_time, dos_date, local_header_ofs, ext_attributes))
+        return mz_zip_set_error(pZip, MZ_ZIP_INTERNAL_ERROR);
+
+    if ((!mz_zip_array_push_back(pZip, &pState->m_central_dir, central_dir_header, MZ_ZIP_CENTRAL_DIR_HEADER_SIZE)) ||
+        (!mz_zip_array_push_back(pZip, &pState->m_central_dir, pFilename, filename_size)) ||
+        (!mz_zip_array_push_back(pZip, &pState->m_central_dir, pExtra, extra_size)) ||
+        (!mz_zip_array_push_back(pZip, &pState->m_central_dir, user_extra_data, user_extra_data_len)) ||
+        (!mz_zip_array_push_back(pZip, &pState->m_central_dir, pComment, comment_size)) ||
+        (!mz_zip_array_push_back(pZip, &pState->m_central_dir_offsets, &central_dir_ofs, 1)))
+    {
+        /* Try to resize the central directory array back into its original state. */
+        mz_zip_array_resize(pZip, &pState->m_central_dir, orig_central_dir_size, MZ_FALSE);
+        return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+    }
+
+    return MZ_TRUE;
+}
+
+static mz_bool mz_zip_writer_validate_archive_name(const char *pArchive_name)
+{
+    /* Basic ZIP archive filename validity checks: Valid filenames cannot start with a forward slash, cannot contain a drive letter, and cannot use DOS-style backward slashes. */
+    if (*pArchive_name == '/')
+        return MZ_FALSE;
+
+    /* Making sure the name does not contain drive letters or DOS style backward slashes is the responsibility of the program using miniz*/
+
+    return MZ_TRUE;
+}
+
+static mz_uint mz_zip_writer_compute_padding_needed_for_file_alignment(mz_zip_archive *pZip)
+{
+    mz_uint32 n;
+    if (!pZip->m_file_offset_alignment)
+        return 0;
+    n = (mz_uint32)(pZip->m_archive_size & (pZip->m_file_offset_alignment - 1));
+    return (mz_uint)((pZip->m_file_offset_alignment - n) & (pZip->m_file_offset_alignment - 1));
+}
+
+static mz_bool mz_zip_writer_write_zeros(mz_zip_archive *pZip, mz_uint64 cur_file_ofs, mz_uint32 n)
+{
+    char buf[4096];
+    memset(buf, 0, MZ_MIN(sizeof(buf), n));
+    while (n)
+    {
+        mz_uint32 s = MZ_MIN(sizeof(buf), n);
+        if (MZ_ZIP_WRITE(pZip, cur_file_ofs, buf, s) != s)
+            return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
+
+        cur_file_ofs += s;
+        n -= s;
+    }
+    return MZ_TRUE;
+}
+
+mz_bool mz_zip_writer_add_mem_ex(mz_zip_archive *pZip, const char *pArchive_name, const void *pBuf, size_t buf_size, const void *pComment, mz_uint16 comment_size, mz_uint level_and_flags,
+                                 mz_uint64 uncomp_size, mz_uint32 uncomp_crc32)
+{
+    return mz_zip_writer_add_mem_ex_v2(pZip, pArchive_name, pBuf, buf_size, pComment, comment_size, level_and_flags, uncomp_size, uncomp_crc32, NULL, NULL, 0, NULL, 0);
+}
+
+/* 64-bit hash of an entry's uncompressed data. Together with the CRC-32 and size it picks the candidates for MZ_ZIP_FLAG_WRITE_DEDUPLICATE, which are then compared byte for byte. */
+static mz_uint64 mz_zip_writer_hash_data(const mz_uint8 *pBuf, size_t buf_size)
+{
+    const mz_uint64 k = ((mz_uint64)0x9E3779B9 << 32) | 0x7F4A7C15;
+    mz_uint64 h = (mz_uint64)buf_size * k, t = 0;
+    size_t i;
+
+    for (; buf_size >= 8; pBuf += 8, buf_size -= 8)
+    {
+        h = (h ^ MZ_READ_LE64(pBuf)) * k;
+        h ^= h >> 29;
+    }
+
+    for (i = 0; i < buf_size; i++)
+        t |= (mz_uint64)pBuf[i] << (i * 8);
+    h = (h ^ t) * k;
+
+    h ^= h >> 32;
+    h *= k;
+    h ^= h >> 29;
+    return h;
+}
+
+static void mz_zip_writer_dedup_reset(mz_zip_archive *pZip)
+{
+    mz_zip_array_resize(pZip, &pZip->m_pState->m_dedup_entries, 0, MZ_FALSE);
+    mz_zip_array_resize(pZip, &pZip->m_pState->m_dedup_table, 0, MZ_FALSE);
+}
+
+/* Returns MZ_TRUE if the data recorded in pDup really is pBuf, by reading it back (and decompressing it) from the archive. */
+static mz_bool mz_zip_writer_dedup_verify(mz_zip_archive *pZip, const mz_zip_writer_dedup_entry *pDup, const mz_uint8 *pBuf, size_t buf_size)
+{
+    mz_uint64 cur_file_ofs = pDup->m_data_ofs, comp_remaining = pDup->m_comp_size;
+    size_t read_buf_size = (size_t)MZ_MIN(pDup->m_comp_size, (mz_uint64)MZ_ZIP_MAX_IO_BUF_SIZE), read_buf_avail = 0, read_buf_ofs = 0, out_buf_ofs = 0;
+    mz_uint8 *pRead_buf, *pWrite_buf = NULL;
+    tinfl_status status = TINFL_STATUS_FAILED;
+    tinfl_decompressor inflator;
+
+    if ((pDup->m_method) && (pDup->m_method != MZ_DEFLATED))
+        return MZ_FALSE;
+
+    if (NULL == (pRead_buf = (mz_uint8 *)MZ_ZIP_ALLOC(pZip, 1, MZ_MAX(read_buf_size, 1))))
+        return MZ_FALSE;
+
+    if (!pDup->m_method)
+    {
+        while (comp_remaining)
+        {
+            read_buf_avail = (size_t)MZ_MIN((mz_uint64)read_buf_size, comp_remaining);
+            if ((MZ_ZIP_READ(pZip, cur_file_ofs, pRead_buf, read_buf_avail) != read_buf_avail) || (out_buf_ofs + read_buf_avail > buf_size) || (memcmp(pBuf + out_buf_ofs, pRead_buf, read_buf_avail) != 0))
+                break;
+            cur_file_ofs += read_buf_avail;
+            comp_remaining -= read_buf_avail;
+            out_buf_ofs += read_buf_avail;
+        }
+        if (!comp_remaining)
+            status = TINFL_STATUS_DONE;
+    }
+    else if (NULL != (pWrite_buf = (mz_uint8 *)MZ_ZIP_ALLOC(pZip, 1, TINFL_LZ_DICT_SIZE)))
+    {
+        tinfl_init(&inflator);
+
+        do
+        {
+            mz_uint8 *pWrite_buf_cur = pWrite_buf + (out_buf_ofs & (TINFL_LZ_DICT_SIZE - 1));
+            size_t in_buf_size, out_buf_size = TINFL_LZ_DICT_SIZE - (out_buf_ofs & (TINFL_LZ_DICT_SIZE - 1));
+
+            if ((!read_buf_avail) && (comp_remaining))
+            {
+                read_buf_avail = (size_t)MZ_MIN((mz_uint64)read_buf_size, comp_remaining);
+                if (MZ_ZIP_READ(pZip, cur_file_ofs, pRead_buf, read_buf_avail) != read_buf_avail)
+                {
+                    status = TINFL_STATUS_FAILED;
+                    break;
+                }
+                cur_file_ofs += read_buf_avail;
+                comp_remaining -= read_buf_avail;
+                read_buf_ofs = 0;
+            }
+
+            in_buf_size = read_buf_avail;
+            status = MZ_ZIP_INFLATE(pZip, &inflator, pRead_buf + read_buf_ofs, &in_buf_size, pWrite_buf, pWrite_buf_cur, &out_buf_size, comp_remaining ? TINFL_FLAG_HAS_MORE_INPUT : 0);
+            read_buf_avail -= in_buf_size;
+            read_buf_ofs += in_buf_size;
+
+            if ((out_buf_ofs + out_buf_size > buf_size) || (memcmp(pBuf + out_buf_ofs, pWrite_buf_cur, out_buf_size) != 0))
+            {
+                status = TINFL_STATUS_FAILED;
+                break;
+            }
+            out_buf_ofs += out_buf_size;
+        } while ((status == TINFL_STATUS_NEEDS_MORE_INPUT) || (status == TINFL_STATUS_HAS_MORE_OUTPUT));
+    }
+
+    MZ_ZIP_FREE(pZip, pRead_buf, MZ_MAX(read_buf_size, 1));
+    if (pWrite_buf)
+        MZ_ZIP_FREE(pZip, pWrite_buf, TINFL_LZ_DICT_SIZE);
+
+    return (status == TINFL_STATUS_DONE) && (out_buf_ofs == buf_size);
+}
+
+/* Returns the earlier entry whose data is identical to pBuf, or NULL. */
+static const mz_zip_writer_dedup_entry *mz_zip_writer_dedup_find(mz_zip_archive *pZip, mz_uint32 crc32, mz_uint64 hash, const mz_uint8 *pBuf, size_t buf_size)
+{
+    mz_zip_internal_state *pState = pZip->m_pState;
+    mz_uint32 mask, slot, entry;
+
+    if (!pState->m_dedup_table.m_size)
+        return NULL;
+
+    mask = (mz_uint32)pState->m_dedup_table.m_size - 1;
+    for (slot = crc32 & mask; (entry = MZ_ZIP_ARRAY_ELEMENT(&pState->m_dedup_table, mz_uint32, slot)) != 0; slot = (slot + 1) & mask)
+    {
+        const mz_zip_writer_dedup_entry *pEntry = &MZ_ZIP_ARRAY_ELEMENT(&pState->m_dedup_entries, mz_zip_writer_dedup_entry, entry - 1);
+        if ((pEntry->m_crc32 == crc32) && (pEntry->m_uncomp_size == buf_size) && (pEntry->m_hash == hash) && (mz_zip_writer_dedup_verify(pZip, pEntry, pBuf, buf_size)))
+            return pEntry;
+    }
+
+    return NULL;
+}
+
+/* Copies the compressed data of a verified duplicate to the end of the archive, where it gets its own local header. */
+static mz_bool mz_zip_writer_dedup_copy(mz_zip_archive *pZip, const mz_zip_writer_dedup_entry *pDup, mz_uint64 dst_file_ofs)
+{
+    mz_uint64 src_file_ofs = pDup->m_data_ofs, remaining = pDup->m_comp_size;
+    size_t buf_size = (size_t)MZ_MIN(remaining, (mz_uint64)MZ_ZIP_MAX_IO_BUF_SIZE);
+    void *pBuf;
+
+    if (NULL == (pBuf = MZ_ZIP_ALLOC(pZip, 1, MZ_MAX(buf_size, 1))))
+        return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+
+    while (remaining)
+    {
+        size_t n = (size_t)MZ_MIN((mz_uint64)buf_size, remaining);
+
+        if (MZ_ZIP_READ(pZip, src_file_ofs, pBuf, n) != n)
+        {
+            MZ_ZIP_FREE(pZip, pBuf, MZ_MAX(buf_size, 1));
+            return mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
+        }
+
+        if (MZ_ZIP_WRITE(pZip, dst_file_ofs, pBuf, n) != n)
+        {
+            MZ_ZIP_FREE(pZip, pBuf, MZ_MAX(buf_size, 1));
+            return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
+        }
+
+        src_file_ofs += n;
+        dst_file_ofs += n;
+        remaining -= n;
+    }
+
+    MZ_ZIP_FREE(pZip, pBuf, MZ_MAX(buf_size, 1));
+    return MZ_TRUE;
+}
+
+/* Remembers where an entry's data was written. Failing to do so just means later duplicates aren't detected, so this never fails the add. */
+static void mz_zip_writer_dedup_add(mz_zip_archive *pZip, const mz_zip_writer_dedup_entry *pNew_entry)
+{
+    mz_zip_internal_state *pState = pZip->m_pState;
+    mz_uint32 i, mask, num_entries = (mz_uint32)pState->m_dedup_entries.m_size + 1;
+
+    if (num_entries >= MZ_UINT32_MAX / 4)
+        return;
+
+    if (!mz_zip_array_push_back(pZip, &pState->m_dedup_entries, pNew_entry, 1))
+        return;
+
+    /* Keep the table at most half full, rebuilding it when it grows */
+    if (num_entries * 2 > pState->m_dedup_table.m_size)
+    {
+        mz_uint32 table_size = MZ_MAX(64U, (mz_uint32)pState->m_dedup_table.m_size * 2);
+        if (!mz_zip_array_resize(pZip, &pState->m_dedup_table, table_size, MZ_FALSE))
+        {
+            mz_zip_writer_dedup_reset(pZip);
+            return;
+        }
+        memset(pState->m_dedup_table.m_p, 0, table_size * sizeof(mz_uint32));
+        i = 0;
+    }
+    else
+        i = num_entries - 1;
+
+    mask = (mz_uint32)pState->m_dedup_table.m_size - 1;
+    for (; i < num_entries; i++)
+    {
+        mz_uint32 slot = MZ_ZIP_ARRAY_ELEMENT(&pState->m_dedup_entries, mz_zip_writer_dedup_entry, i).m_crc32 & mask;
+        while (MZ_ZIP_ARRAY_ELEMENT(&pState->m_dedup_table, mz_uint32, slot))
+            slot = (slot + 1) & mask;
+        MZ_ZIP_ARRAY_ELEMENT(&pState->m_dedup_table, mz_uint32, slot) = i + 1;
+    }
+}
+
+mz_bool mz_zip_writer_add_mem_ex_v2(mz_zip_archive *pZip, const char *pArchive_name, const void *pBuf, size_t buf_size, const void *pComment, mz_uint16 comment_size,
+                                    mz_uint level_and_flags, mz_uint64 uncomp_size, mz_uint32 uncomp_crc32, MZ_TIME_T *last_modified,
+                                    const char *user_extra_data, mz_uint user_extra_data_len, const char *user_extra_data_central, mz_uint user_extra_data_central_len)
+{
+    mz_uint16 method = 0, dos_time = 0, dos_date = 0;
+    mz_uint level, ext_attributes = 0, num_alignment_padding_bytes;
+    mz_uint64 local_dir_header_ofs = pZip->m_archive_size, cur_archive_file_ofs = pZip->m_archive_size, comp_size = 0;
+    size_t archive_name_size;
+    mz_uint8 local_dir_header[MZ_ZIP_LOCAL_DIR_HEADER_SIZE];
+    tdefl_compressor *pComp = NULL;
+    mz_bool store_data_uncompressed;
+    mz_zip_internal_state *pState;
+    mz_uint8 *pExtra_data = NULL;
+    mz_uint32 extra_size = 0;
+    mz_uint8 extra_data[MZ_ZIP64_MAX_CENTRAL_EXTRA_FIELD_SIZE];
+    mz_uint16 bit_flags = 0;
+    mz_bool dedup;
+    mz_zip_writer_dedup_entry dedup_entry;
+    const mz_zip_writer_dedup_entry *pDup = NULL;
+
+    if ((int)level_and_flags < 0)
+        level_and_flags = MZ_DEFAULT_LEVEL;
+
+    if (uncomp_size || (buf_size && !(level_and_flags & MZ_ZIP_FLAG_COMPRESSED_DATA)))
+        bit_flags |= MZ_ZIP_LDH_BIT_FLAG_HAS_LOCATOR;
+
+    if (!(level_and_flags & MZ_ZIP_FLAG_ASCII_FILENAME))
+        bit_flags |= MZ_ZIP_GENERAL_PURPOSE_BIT_FLAG_UTF8;
+
+    level = level_and_flags & 0xF;
+    store_data_uncompressed = ((!level) || (level_and_flags & MZ_ZIP_FLAG_COMPRESSED_DATA));
+
+    if ((!pZip) || (!pZip->m_pState) || (pZip->m_zip_mode != MZ_ZIP_MODE_WRITING) || ((buf_size) && (!pBuf)) || (!pArchive_name) || ((comment_size) && (!pComment)) || (level > MZ_UBER_COMPRESSION))
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+
+    pState = pZip->m_pState;
+
+    if (pState->m_zip64)
+    {
+        if (pZip->m_total_files == MZ_UINT32_MAX)
+            return mz_zip_set_error(pZip, MZ_ZIP_TOO_MANY_FILES);
+    }
+    else
+    {
+        if (pZip->m_total_files == MZ_UINT16_MAX)
+        {
+            pState->m_zip64 = MZ_TRUE;
+            /*return mz_zip_set_error(pZip, MZ_ZIP_TOO_MANY_FILES); */
+        }
+        if (((mz_uint64)buf_size > 0xFFFFFFFF) || (uncomp_size > 0xFFFFFFFF))
+        {
+            pState->m_zip64 = MZ_TRUE;
+            /*return mz_zip_set_error(pZip, MZ_ZIP_ARCHIVE_TOO_LARGE); */
+        }
+    }
+
+    if ((!(level_and_flags & MZ_ZIP_FLAG_COMPRESSED_DATA)) && (uncomp_size))
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+
+    if (!mz_zip_writer_validate_archive_name(pArchive_name))
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_FILENAME);
+
+#ifndef MINIZ_NO_TIME
+    if (last_modified != NULL)
+    {
+        mz_zip_time_t_to_dos_time(*last_modified, &dos_time, &dos_date);
+    }
+    else
+    {
+        MZ_TIME_T cur_time;
+        time(&cur_time);
+        mz_zip_time_t_to_dos_time(cur_time, &dos_time, &dos_date);
+    }
+#endif /* #ifndef MINIZ_NO_TIME */
+
+	if (!(level_and_flags & MZ_ZIP_FLAG_COMPRESSED_DATA))
+	{
+		uncomp_crc32 = (mz_uint32)MZ_ZIP_CRC32(pZip, MZ_CRC32_INIT, (const mz_uint8 *)pBuf, buf_size);
+		uncomp_size = buf_size;
+		if (uncomp_size <= 3)
+		{
+			level = 0;
+			store_data_uncompressed = MZ_TRUE;
+		}
+	}
+
+    archive_name_size = strlen(pArchive_name);
+    if (archive_name_size > MZ_UINT16_MAX)
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_FILENAME);
+
+    num_alignment_padding_bytes = mz_zip_writer_compute_padding_needed_for_file_alignment(pZip);
+
+    /* miniz doesn't support central dirs >= MZ_UINT32_MAX bytes yet */
+    if (((mz_uint64)pState->m_central_dir.m_size + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + archive_name_size + MZ_ZIP64_MAX_CENTRAL_EXTRA_FIELD_SIZE + comment_size) >= MZ_UINT32_MAX)
+        return mz_zip_set_error(pZip, MZ_ZIP_UNSUPPORTED_CDIR_SIZE);
+
+    if (!pState->m_zip64)
+    {
+        /* Bail early if the archive would obviously become too large */
+        if ((pZip->m_archive_size + num_alignment_padding_bytes + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + archive_name_size
+			+ MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + archive_name_size + comment_size + user_extra_data_len +
+			pState->m_central_dir.m_size + MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIZE + user_extra_data_central_len
+			+ MZ_ZIP_DATA_DESCRIPTER_SIZE32) > 0xFFFFFFFF)
+        {
+            pState->m_zip64 = MZ_TRUE;
+            /*return mz_zip_set_error(pZip, MZ_ZIP_ARCHIVE_TOO_LARGE); */
+        }
+    }
+
+    if ((archive_name_size) && (pArchive_name[archive_name_size - 1] == '/'))
+    {
+        /* Set DOS Subdirectory attribute bit. */
+        ext_attributes |= MZ_ZIP_DOS_DIR_ATTRIBUTE_BITFLAG;
+
+        /* Subdirectories cannot contain data. */
+        if ((buf_size) || (uncomp_size))
+            return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+    }
+
+    /* Try to do any allocations before writing to the archive, so if an allocation fails the file remains unmodified. (A good idea if we're doing an in-place modification.) */
+    if ((!mz_zip_array_ensure_room(pZip, &pState->m_central_dir, MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + archive_name_size + comment_size + (pState->m_zip64 ? MZ_ZIP64_MAX_CENTRAL_EXTRA_FIELD_SIZE : 0))) || (!mz_zip_array_ensure_room(pZip, &pState->m_central_dir_offsets, 1)))
+        return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+
+    /* Duplicates get their own local header and only reuse the earlier entry's compressed data, which must be read back, so this needs a readable archive */
+    dedup = ((pState->m_dedup) || (level_and_flags & MZ_ZIP_FLAG_WRITE_DEDUPLICATE)) && (!(level_and_flags & MZ_ZIP_FLAG_COMPRESSED_DATA)) && (buf_size) && (pZip->m_pRead);
+    if (dedup)
+    {
+        dedup_entry.m_hash = mz_zip_writer_hash_data((const mz_uint8 *)pBuf, buf_size);
+        dedup_entry.m_crc32 = uncomp_crc32;
+        dedup_entry.m_uncomp_size = uncomp_size;
+
+        pDup = mz_zip_writer_dedup_find(pZip, uncomp_crc32, dedup_entry.m_hash, (const mz_uint8 *)pBuf, buf_size);
+    }
+
+    if ((!store_data_uncompressed) && (buf_size) && (!pDup))
+    {
+        if (NULL == (pComp = (tdefl_compressor *)MZ_ZIP_ALLOC(pZip, 1, sizeof(tdefl_compressor))))
+            return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+    }
+
+    if (!mz_zip_writer_write_zeros(pZip, cur_archive_file_ofs, num_alignment_padding_bytes))
+    {
+        MZ_ZIP_FREE(pZip, pComp, sizeof(tdefl_compressor));
+        return MZ_FALSE;
+    }
+
+    local_dir_header_ofs += num_alignment_padding_bytes;
+    if (pZip->m_file_offset_alignment)
+    {
+        MZ_ASSERT((local_dir_header_ofs & (pZip->m_file_offset_alignment - 1)) == 0);
+    }
+    cur_archive_file_ofs += num_alignment_padding_bytes;
+
+    MZ_CLEAR_ARR(local_dir_header);
+
+    if (pDup)
+        method = pDup->m_method;
+    else if (!store_data_uncompressed || (level_and_flags & MZ_ZIP_FLAG_COMPRESSED_DATA))
+    {
+        method = MZ_DEFLATED;
+    }
+
+    if (pState->m_zip64)
+    {
+        if (uncomp_size >= MZ_UINT32_MAX || local_dir_header_ofs >= MZ_UINT32_MAX)
+        {
+            pExtra_data = extra_data;
+            extra_size = mz_zip_writer_create_zip64_extra_data(extra_data, (uncomp_size >= MZ_UINT32_MAX) ? &uncomp_size : NULL,
+                                                               (uncomp_size >= MZ_UINT32_MAX) ? &comp_size : NULL, (local_dir_header_ofs >= MZ_UINT32_MAX) ? &local_dir_header_ofs : NULL);
+        }
+
+        if (!mz_zip_writer_create_local_dir_header(pZip, local_dir_header, (mz_uint16)archive_name_size, (mz_uint16)(extra_size + user_extra_data_len), 0, 0, 0, method, bit_flags, dos_time, dos_date))
+            return mz_zip_set_error(pZip, MZ_ZIP_INTERNAL_ERROR);
+
+        if (MZ_ZIP_WRITE(pZip, local_dir_header_ofs, local_dir_header, sizeof(local_dir_header)) != sizeof(local_dir_header))
+            return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
+
+        cur_archive_file_ofs += sizeof(local_dir_header);
+
+        if (MZ_ZIP_WRITE(pZip, cur_archive_file_ofs, pArchive_name, archive_name_size) != archive_name_size)
+        {
+            MZ_ZIP_FREE(pZip, pComp, sizeof(tdefl_compressor));
+            return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
+        }
+        cur_archive_file_ofs += archive_name_size;
+
+        if (pExtra_data != NULL)
+        {
+            if (MZ_ZIP_WRITE(pZip, cur_archive_file_ofs, extra_data, extra_size) != extra_size)
+                return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
+
+            cur_archive_file_ofs += extra_size;
+        }
+    }
+    else
+    {
+        if ((comp_size > MZ_UINT32_MAX) || (cur_archive_file_ofs > MZ_UINT32_MAX))
+            return mz_zip_set_error(pZip, MZ_ZIP_ARCHIVE_TOO_LARGE);
+        if (!mz_zip_writer_create_local_dir_header(pZip, local_dir_header, (mz_uint16)archive_name_size, (mz_uint16)user_extra_data_len, 0, 0, 0, method, bit_flags, dos_time, dos_date))
+            return mz_zip_set_error(pZip, MZ_ZIP_INTERNAL_ERROR);
+
+        if (MZ_ZIP_WRITE(pZip, local_dir_header_ofs, local_dir_header, sizeof(local_dir_header)) != sizeof(local_dir_header))
+            return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
+
+        cur_archive_file_ofs += sizeof(local_dir_header);
+
+        if (MZ_ZIP_WRITE(pZip, cur_archive_file_ofs, pArchive_name, archive_name_size) != archive_name_size)
+        {
+            MZ_ZIP_FREE(pZip, pComp, sizeof(tdefl_compressor));
+            return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
+        }
+        cur_archive_file_ofs += archive_name_size;
+    }
+
+	if (user_extra_data_len > 0)
+	{
+		if (MZ_ZIP_WRITE(pZip, cur_archive_file_ofs, user_extra_data, user_extra_data_len) != user_extra_data_len)
+			return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
+
+		cur_archive_file_ofs += user_extra_data_len;
+	}
+
+    dedup_entry.m_data_ofs = cur_archive_file_ofs;
+
+    if (pDup)
+    {
+        if (!mz_zip_writer_dedup_copy(pZip, pDup, cur_archive_file_ofs))
+            return MZ_FALSE;
+
+        comp_size = pDup->m_comp_size;
+        cur_archive_file_ofs += comp_size;
+    }
+    else if (store_data_uncompressed)
+    {
+        if (MZ_ZIP_WRITE(pZip, cur_archive_file_ofs, pBuf, buf_size) != buf_size)
+        {
+            MZ_ZIP_FREE(pZip, pComp, sizeof(tdefl_compressor));
+            return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
+        }
+
+        cur_archive_file_ofs += buf_size;
+        comp_size = buf_size;
+    }
+    else if (buf_size)
+    {
+        mz_zip_writer_add_state state;
+
+        state.m_pZip = pZip;
+        state.m_cur_archive_file_ofs = cur_archive_file_ofs;
+        state.m_comp_size = 0;
+
+        if ((tdefl_init(pComp, mz_zip_writer_add_put_buf_callback, &state, tdefl_create_comp_flags_from_zip_params(level, -15, MZ_DEFAULT_STRATEGY)) != TDEFL_STATUS_OKAY) ||
+            (MZ_ZIP_DEFLATE(pZip, pComp, pBuf, buf_size, TDEFL_FINISH) != TDEFL_STATUS_DONE))
+        {
+            MZ_ZIP_FREE(pZip, pComp, sizeof(tdefl_compressor));
+            return mz_zip_set_error(pZip, MZ_ZIP_COMPRESSION_FAILED);
+        }
+
+        comp_size = state.m_comp_size;
+        cur_archive_file_ofs = state.m_cur_archive_file_ofs;
+    }
+
+    MZ_ZIP_FREE(pZip, pComp, sizeof(tdefl_compressor));
+    pComp = NULL;
+
+    if (uncomp_size)
+    {
+        mz_uint8 local_dir_footer[MZ_ZIP_DATA_DESCRIPTER_SIZE64];
+        mz_uint32 local_dir_footer_size = MZ_ZIP_DATA_DESCRIPTER_SIZE32;
+
+        MZ_ASSERT(bit_flags & MZ_ZIP_LDH_BIT_FLAG_HAS_LOCATOR);
+
+        MZ_WRITE_LE32(local_dir_footer + 0, MZ_ZIP_DATA_DESCRIPTOR_ID);
+        MZ_WRITE_LE32(local_dir_footer + 4, uncomp_crc32);
+        if (pExtra_data == NULL)
+        {
+            if (comp_size > MZ_UINT32_MAX)
+                return mz_zip_set_error(pZip, MZ_ZIP_ARCHIVE_TOO_LARGE);
+
+            MZ_WRITE_LE32(local_dir_footer + 8, comp_size);
+            MZ_WRITE_LE32(local_dir_footer + 12, uncomp_size);
+        }
+        else
+        {
+            MZ_WRITE_LE64(local_dir_footer + 8, comp_size);
+            MZ_WRITE_LE64(local_dir_footer + 16, uncomp_size);
+            local_dir_footer_size = MZ_ZIP_DATA_DESCRIPTER_SIZE64;
+        }
+
+        if (MZ_ZIP_WRITE(pZip, cur_archive_file_ofs, local_dir_footer, local_dir_footer_size) != local_dir_footer_size)
+            return MZ_FALSE;
+
+        cur_archive_file_ofs += local_dir_footer_size;
+    }
+
+    if (pExtra_data != NULL)
+    {
+        extra_size = mz_zip_writer_create_zip64_extra_data(extra_data, (uncomp_size >= MZ_UINT32_MAX) ? &uncomp_size : NULL,
+                                                           (uncomp_size >= MZ_UINT32_MAX) ? &comp_size : NULL, (local_dir_header_ofs >= MZ_UINT32_MAX) ? &local_dir_header_ofs : NULL);
     }
 
-    return MZ_TRUE;
-}
-
-static mz_bool mz_zip_writer_validate_archive_name(const char *pArchive_name)
-{
-    /* Basic ZIP archive filename validity checks: Valid filenames cannot start with a forward slash, cannot contain a drive letter, and cannot use DOS-style backward slashes. */
-    if (*pArchive_name == '/')
+    if (!mz_zip_writer_add_to_central_dir(pZip, pArchive_name, (mz_uint16)archive_name_size, pExtra_data, (mz_uint16)extra_size, pComment,
+                                          comment_size, uncomp_size, comp_size, uncomp_crc32, method, bit_flags, dos_time, dos_date, local_dir_header_ofs, ext_attributes,
+                                          user_extra_data_central, user_extra_data_central_len))
         return MZ_FALSE;
 
-    /* Making sure the name does not contain drive letters or DOS style backward slashes is the responsibility of the program using miniz*/
-
-    return MZ_TRUE;
-}
-
-static mz_uint mz_zip_writer_compute_padding_needed_for_file_alignment(mz_zip_archive *pZip)
-{
-    mz_uint32 n;
-    if (!pZip->m_file_offset_alignment)
-        return 0;
-    n = (mz_uint32)(pZip->m_archive_size & (pZip->m_file_offset_alignment - 1));
-    return (mz_uint)((pZip->m_file_offset_alignment - n) & (pZip->m_file_offset_alignment - 1));
-}
+    pZip->m_total_files++;
+    pZip->m_archive_size = cur_archive_file_ofs;
 
-static mz_bool mz_zip_writer_write_zeros(mz_zip_archive *pZip, mz_uint64 cur_file_ofs, mz_uint32 n)
-{
-    char buf[4096];
-    memset(buf, 0, MZ_MIN(sizeof(buf), n));
-    while (n)
+    /* Only the first copy of some data needs remembering */
+    if ((dedup) && (!pDup))
     {
-        mz_uint32 s = MZ_MIN(sizeof(buf), n);
-        if (pZip->m_pWrite(pZip->m_pIO_opaque, cur_file_ofs, buf, s) != s)
-            return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
-
-        cur_file_ofs += s;
-        n -= s;
+        dedup_entry.m_comp_size = comp_size;
+        dedup_entry.m_method = method;
+        mz_zip_writer_dedup_add(pZip, &dedup_entry);
     }
-    return MZ_TRUE;
-}
 
-mz_bool mz_zip_writer_add_mem_ex(mz_zip_archive *pZip, const char *pArchive_name, const void *pBuf, size_t buf_size, const void *pComment, mz_uint16 comment_size, mz_uint level_and_flags,
-                                 mz_uint64 uncomp_size, mz_uint32 uncomp_crc32)
-{
-    return mz_zip_writer_add_mem_ex_v2(pZip, pArchive_name, pBuf, buf_size, pComment, comment_size, level_and_flags, uncomp_size, uncomp_crc32, NULL, NULL, 0, NULL, 0);
+    return MZ_TRUE;
 }
 
-mz_bool mz_zip_writer_add_mem_ex_v2(mz_zip_archive *pZip, const char *pArchive_name, const void *pBuf, size_t buf_size, const void *pComment, mz_uint16 comment_size,
-                                    mz_uint level_and_flags, mz_uint64 uncomp_size, mz_uint32 uncomp_crc32, MZ_TIME_T *last_modified,
-                                    const char *user_extra_data, mz_uint user_extra_data_len, const char *user_extra_data_central, mz_uint user_extra_data_central_len)
+mz_bool mz_zip_writer_add_read_buf_callback(mz_zip_archive *pZip, const char *pArchive_name, mz_file_read_func read_callback, void* callback_opaque, mz_uint64 max_size, const MZ_TIME_T *pFile_time, const void *pComment, mz_uint16 comment_size, mz_uint level_and_flags,
+                                const char *user_extra_data, mz_uint user_extra_data_len, const char *user_extra_data_central, mz_uint user_extra_data_central_len)
 {
-    mz_uint16 method = 0, dos_time = 0, dos_date = 0;
-    mz_uint level, ext_attributes = 0, num_alignment_padding_bytes;
-    mz_uint64 local_dir_header_ofs = pZip->m_archive_size, cur_archive_file_ofs = pZip->m_archive_size, comp_size = 0;
+    mz_uint16 gen_flags;
+    mz_uint uncomp_crc32 = MZ_CRC32_INIT, level, num_alignment_padding_bytes;
+    mz_uint16 method = 0, dos_time = 0, dos_date = 0, ext_attributes = 0;
+    mz_uint64 local_dir_header_ofs, cur_archive_file_ofs = pZip->m_archive_size, uncomp_size = 0, comp_size = 0;
     size_t archive_name_size;
     mz_uint8 local_dir_header[MZ_ZIP_LOCAL_DIR_HEADER_SIZE];
-    tdefl_compressor *pComp = NULL;
-    mz_bool store_data_uncompressed;
-    mz_zip_internal_state *pState;
     mz_uint8 *pExtra_data = NULL;
     mz_uint32 extra_size = 0;
     mz_uint8 extra_data[MZ_ZIP64_MAX_CENTRAL_EXTRA_FIELD_SIZE];
-    mz_uint16 bit_flags = 0;
+    mz_zip_internal_state *pState;
+    mz_uint64 file_ofs = 0, cur_archive_header_file_ofs;
 
     if ((int)level_and_flags < 0)
         level_and_flags = MZ_DEFAULT_LEVEL;
+    level = level_and_flags & 0xF;
 
-    if (uncomp_size || (buf_size && !(level_and_flags & MZ_ZIP_FLAG_COMPRESSED_DATA)))
-        bit_flags |= MZ_ZIP_LDH_BIT_FLAG_HAS_LOCATOR;
+    gen_flags = (level_and_flags & MZ_ZIP_FLAG_WRITE_HEADER_SET_SIZE) ? 0 : MZ_ZIP_LDH_BIT_FLAG_HAS_LOCATOR;
 
     if (!(level_and_flags & MZ_ZIP_FLAG_ASCII_FILENAME))
-        bit_flags |= MZ_ZIP_GENERAL_PURPOSE_BIT_FLAG_UTF8;
-
-    level = level_and_flags & 0xF;
-    store_data_uncompressed = ((!level) || (level_and_flags & MZ_ZIP_FLAG_COMPRESSED_DATA));
+        gen_flags |= MZ_ZIP_GENERAL_PURPOSE_BIT_FLAG_UTF8;
 
-    if ((!pZip) || (!pZip->m_pState) || (pZip->m_zip_mode != MZ_ZIP_MODE_WRITING) || ((buf_size) && (!pBuf)) || (!pArchive_name) || ((comment_size) && (!pComment)) || (level > MZ_UBER_COMPRESSION))
+    /* Sanity checks */
+    if ((!pZip) || (!pZip->m_pState) || (pZip->m_zip_mode != MZ_ZIP_MODE_WRITING) || (!pArchive_name) || ((comment_size) && (!pComment)) || (level > MZ_UBER_COMPRESSION))
         return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
 
     pState = pZip->m_pState;
 
-    if (pState->m_zip64)
-    {
-        if (pZip->m_total_files == MZ_UINT32_MAX)
-            return mz_zip_set_error(pZip, MZ_ZIP_TOO_MANY_FILES);
-    }
-    else
+    if ((!pState->m_zip64) && (max_size > MZ_UINT32_MAX))
     {
-        if (pZip->m_total_files == MZ_UINT16_MAX)
-        {
-            pState->m_zip64 = MZ_TRUE;
-            /*return mz_zip_set_error(pZip, MZ_ZIP_TOO_MANY_FILES); */
-        }
-        if (((mz_uint64)buf_size > 0xFFFFFFFF) || (uncomp_size > 0xFFFFFFFF))
-        {
-            pState->m_zip64 = MZ_TRUE;
-            /*return mz_zip_set_error(pZip, MZ_ZIP_ARCHIVE_TOO_LARGE); */
-        }
+        /* Source file is too large for non-zip64 */
+        /*return mz_zip_set_error(pZip, MZ_ZIP_ARCHIVE_TOO_LARGE); */
+        pState->m_zip64 = MZ_TRUE;
     }
 
-    if ((!(level_and_flags & MZ_ZIP_FLAG_COMPRESSED_DATA)) && (uncomp_size))
+    /* We could support this, but why? */
+    if (level_and_flags & MZ_ZIP_FLAG_COMPRESSED_DATA)
         return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
 
     if (!mz_zip_writer_validate_archive_name(pArchive_name))
         return mz_zip_set_error(pZip, MZ_ZIP_INVALID_FILENAME);
 
-#ifndef MINIZ_NO_TIME
-    if (last_modified != NULL)
+    if (pState->m_zip64)
     {
-        mz_zip_time_t_to_dos_time(*last_modified, &dos_time, &dos_date);
+        if (pZip->m_total_files == MZ_UINT32_MAX)
+            return mz_zip_set_error(pZip, MZ_ZIP_TOO_MANY_FILES);
     }
     else
     {
-        MZ_TIME_T cur_time;
-        time(&cur_time);
-        mz_zip_time_t_to_dos_time(cur_time, &dos_time, &dos_date);
+        if (pZip->m_total_files == MZ_UINT16_MAX)
+        {
+            pState->m_zip64 = MZ_TRUE;
+            /*return mz_zip_set_error(pZip, MZ_ZIP_TOO_MANY_FILES); */
+        }
     }
-#endif /* #ifndef MINIZ_NO_TIME */
-
-	if (!(level_and_flags & MZ_ZIP_FLAG_COMPRESSED_DATA))
-	{
-		uncomp_crc32 = (mz_uint32)mz_crc32(MZ_CRC32_INIT, (const mz_uint8 *)pBuf, buf_size);
-		uncomp_size = buf_size;
-		if (uncomp_size <= 3)
-		{
-			level = 0;
-			store_data_uncompressed = MZ_TRUE;
-		}
-	}
 
     archive_name_size = strlen(pArchive_name);
     if (archive_name_size > MZ_UINT16_MAX)
@@ -6297,156 +10380,217 @@ mz_bool mz_zip_writer_add_mem_ex_v2(mz_zip_archive *pZip, const char *pArchive_n
     if (!pState->m_zip64)
     {
         /* Bail early if the archive would obviously become too large */
-        if ((pZip->m_archive_size + num_alignment_padding_bytes + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + archive_name_size
-			+ MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + archive_name_size + comment_size + user_extra_data_len +
-			pState->m_central_dir.m_size + MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIZE + user_extra_data_central_len
-			+ MZ_ZIP_DATA_DESCRIPTER_SIZE32) > 0xFFFFFFFF)
+        if ((pZip->m_archive_size + num_alignment_padding_bytes + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + archive_name_size + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE
+			+ archive_name_size + comment_size + user_extra_data_len + pState->m_central_dir.m_size + MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIZE + 1024
+			+ MZ_ZIP_DATA_DESCRIPTER_SIZE32 + user_extra_data_central_len) > 0xFFFFFFFF)
         {
             pState->m_zip64 = MZ_TRUE;
             /*return mz_zip_set_error(pZip, MZ_ZIP_ARCHIVE_TOO_LARGE); */
         }
     }
 
-    if ((archive_name_size) && (pArchive_name[archive_name_size - 1] == '/'))
+#ifndef MINIZ_NO_TIME
+    if (pFile_time)
     {
-        /* Set DOS Subdirectory attribute bit. */
-        ext_attributes |= MZ_ZIP_DOS_DIR_ATTRIBUTE_BITFLAG;
-
-        /* Subdirectories cannot contain data. */
-        if ((buf_size) || (uncomp_size))
-            return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+        mz_zip_time_t_to_dos_time(*pFile_time, &dos_time, &dos_date);
     }
+#endif
 
-    /* Try to do any allocations before writing to the archive, so if an allocation fails the file remains unmodified. (A good idea if we're doing an in-place modification.) */
-    if ((!mz_zip_array_ensure_room(pZip, &pState->m_central_dir, MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + archive_name_size + comment_size + (pState->m_zip64 ? MZ_ZIP64_MAX_CENTRAL_EXTRA_FIELD_SIZE : 0))) || (!mz_zip_array_ensure_room(pZip, &pState->m_central_dir_offsets, 1)))
-        return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
-
-    if ((!store_data_uncompressed) && (buf_size))
-    {
-        if (NULL == (pComp = (tdefl_compressor *)pZip->m_pAlloc(pZip->m_pAlloc_opaque, 1, sizeof(tdefl_compressor))))
-            return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
-    }
+    if (max_size <= 3)
+        level = 0;
 
     if (!mz_zip_writer_write_zeros(pZip, cur_archive_file_ofs, num_alignment_padding_bytes))
     {
-        pZip->m_pFree(pZip->m_pAlloc_opaque, pComp);
-        return MZ_FALSE;
+        return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
     }
 
-    local_dir_header_ofs += num_alignment_padding_bytes;
+    cur_archive_file_ofs += num_alignment_padding_bytes;
+    local_dir_header_ofs = cur_archive_file_ofs;
+
     if (pZip->m_file_offset_alignment)
     {
-        MZ_ASSERT((local_dir_header_ofs & (pZip->m_file_offset_alignment - 1)) == 0);
+        MZ_ASSERT((cur_archive_file_ofs & (pZip->m_file_offset_alignment - 1)) == 0);
     }
-    cur_archive_file_ofs += num_alignment_padding_bytes;
-
-    MZ_CLEAR_ARR(local_dir_header);
 
-    if (!store_data_uncompressed || (level_and_flags & MZ_ZIP_FLAG_COMPRESSED_DATA))
+    if (max_size && level)
     {
         method = MZ_DEFLATED;
     }
 
+    MZ_CLEAR_ARR(local_dir_header);
     if (pState->m_zip64)
     {
-        if (uncomp_size >= MZ_UINT32_MAX || local_dir_header_ofs >= MZ_UINT32_MAX)
+        if (max_size >= MZ_UINT32_MAX || local_dir_header_ofs >= MZ_UINT32_MAX)
         {
             pExtra_data = extra_data;
-            extra_size = mz_zip_writer_create_zip64_extra_data(extra_data, (uncomp_size >= MZ_UINT32_MAX) ? &uncomp_size : NULL,
-                                                               (uncomp_size >= MZ_UINT32_MAX) ? &comp_size : NULL, (local_dir_header_ofs >= MZ_UINT32_MAX) ? &local_dir_header_ofs : NULL);
+            if (level_and_flags & MZ_ZIP_FLAG_WRITE_HEADER_SET_SIZE)
+                extra_size = mz_zip_writer_create_zip64_extra_data(extra_data, (max_size >= MZ_UINT32_MAX) ? &uncomp_size : NULL,
+                                                               (max_size >= MZ_UINT32_MAX) ? &comp_size : NULL,
+                                                                (local_dir_header_ofs >= MZ_UINT32_MAX) ? &local_dir_header_ofs : NULL);
+            else
+                extra_size = mz_zip_writer_create_zip64_extra_data(extra_data, NULL,
+                                                                   NULL,
+                                                                   (local_dir_header_ofs >= MZ_UINT32_MAX) ? &local_dir_header_ofs : NULL);
         }
 
-        if (!mz_zip_writer_create_local_dir_header(pZip, local_dir_header, (mz_uint16)archive_name_size, (mz_uint16)(extra_size + user_extra_data_len), 0, 0, 0, method, bit_flags, dos_time, dos_date))
+        if (!mz_zip_writer_create_local_dir_header(pZip, local_dir_header, (mz_uint16)archive_name_size, (mz_uint16)(extra_size + user_extra_data_len), 0, 0, 0, method, gen_flags, dos_time, dos_date))
             return mz_zip_set_error(pZip, MZ_ZIP_INTERNAL_ERROR);
 
-        if (pZip->m_pWrite(pZip->m_pIO_opaque, local_dir_header_ofs, local_dir_header, sizeof(local_dir_header)) != sizeof(local_dir_header))
+        if (MZ_ZIP_WRITE(pZip, cur_archive_file_ofs, local_dir_header, sizeof(local_dir_header)) != sizeof(local_dir_header))
             return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
 
         cur_archive_file_ofs += sizeof(local_dir_header);
 
-        if (pZip->m_pWrite(pZip->m_pIO_opaque, cur_archive_file_ofs, pArchive_name, archive_name_size) != archive_name_size)
+        if (MZ_ZIP_WRITE(pZip, cur_archive_file_ofs, pArchive_name, archive_name_size) != archive_name_size)
         {
-            pZip->m_pFree(pZip->m_pAlloc_opaque, pComp);
             return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
         }
+
         cur_archive_file_ofs += archive_name_size;
 
-        if (pExtra_data != NULL)
-        {
-            if (pZip->m_pWrite(pZip->m_pIO_opaque, cur_archive_file_ofs, extra_data, extra_size) != extra_size)
-                return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
+        if (MZ_ZIP_WRITE(pZip, cur_archive_file_ofs, extra_data, extra_size) != extra_size)
+            return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
 
-            cur_archive_file_ofs += extra_size;
-        }
+        cur_archive_file_ofs += extra_size;
     }
     else
     {
         if ((comp_size > MZ_UINT32_MAX) || (cur_archive_file_ofs > MZ_UINT32_MAX))
             return mz_zip_set_error(pZip, MZ_ZIP_ARCHIVE_TOO_LARGE);
-        if (!mz_zip_writer_create_local_dir_header(pZip, local_dir_header, (mz_uint16)archive_name_size, (mz_uint16)user_extra_data_len, 0, 0, 0, method, bit_flags, dos_time, dos_date))
+        if (!mz_zip_writer_create_local_dir_header(pZip, local_dir_header, (mz_uint16)archive_name_size, (mz_uint16)user_extra_data_len, 0, 0, 0, method, gen_flags, dos_time, dos_date))
             return mz_zip_set_error(pZip, MZ_ZIP_INTERNAL_ERROR);
 
-        if (pZip->m_pWrite(pZip->m_pIO_opaque, local_dir_header_ofs, local_dir_header, sizeof(local_dir_header)) != sizeof(local_dir_header))
+        if (MZ_ZIP_WRITE(pZip, cur_archive_file_ofs, local_dir_header, sizeof(local_dir_header)) != sizeof(local_dir_header))
             return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
 
         cur_archive_file_ofs += sizeof(local_dir_header);
 
-        if (pZip->m_pWrite(pZip->m_pIO_opaque, cur_archive_file_ofs, pArchive_name, archive_name_size) != archive_name_size)
+        if (MZ_ZIP_WRITE(pZip, cur_archive_file_ofs, pArchive_name, archive_name_size) != archive_name_size)
         {
-            pZip->m_pFree(pZip->m_pAlloc_opaque, pComp);
             return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
         }
+
         cur_archive_file_ofs += archive_name_size;
     }
 
-	if (user_extra_data_len > 0)
-	{
-		if (pZip->m_pWrite(pZip->m_pIO_opaque, cur_archive_file_ofs, user_extra_data, user_extra_data_len) != user_extra_data_len)
-			return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
+    if (user_extra_data_len > 0)
+    {
+        if (MZ_ZIP_WRITE(pZip, cur_archive_file_ofs, user_extra_data, user_extra_data_len) != user_extra_data_len)
+            return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
+
+        cur_archive_file_ofs += user_extra_data_len;
+    }
+
+    if (max_size)
+    {
+        void *pRead_buf = MZ_ZIP_ALLOC(pZip, 1, MZ_ZIP_MAX_IO_BUF_SIZE);
+        if (!pRead_buf)
+        {
+            return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+        }
+
+        if (!level)
+        {
+            while (1)
+            {
+                size_t n = read_callback(callback_opaque, file_ofs, pRead_buf, MZ_ZIP_MAX_IO_BUF_SIZE);
+                if (n == 0)
+                    break;
+
+                if ((n > MZ_ZIP_MAX_IO_BUF_SIZE) || (file_ofs + n > max_size))
+                {
+                    MZ_ZIP_FREE(pZip, pRead_buf, MZ_ZIP_MAX_IO_BUF_SIZE);
+                    return mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
+                }
+                if (MZ_ZIP_WRITE(pZip, cur_archive_file_ofs, pRead_buf, n) != n)
+                {
+                    MZ_ZIP_FREE(pZip, pRead_buf, MZ_ZIP_MAX_IO_BUF_SIZE);
+                    return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
+                }
+                file_ofs += n;
+                uncomp_crc32 = (mz_uint32)MZ_ZIP_CRC32(pZip, uncomp_crc32, (const mz_uint8 *)pRead_buf, n);
+                cur_archive_file_ofs += n;
+            }
+            uncomp_size = file_ofs;
+            comp_size = uncomp_size;
+        }
+        else
+        {
+            mz_bool result = MZ_FALSE;
+            mz_zip_writer_add_state state;
+            tdefl_compressor *pComp = (tdefl_compressor *)MZ_ZIP_ALLOC(pZip, 1, sizeof(tdefl_compressor));
+            if (!pComp)
+            {
+                MZ_ZIP_FREE(pZip, pRead_buf, MZ_ZIP_MAX_IO_BUF_SIZE);
+                return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+            }
+
+            state.m_pZip = pZip;
+            state.m_cur_archive_file_ofs = cur_archive_file_ofs;
+            state.m_comp_size = 0;
+
+            if (tdefl_init(pComp, mz_zip_writer_add_put_buf_callback, &state, tdefl_create_comp_flags_from_zip_params(level, -15, MZ_DEFAULT_STRATEGY)) != TDEFL_STATUS_OKAY)
+            {
+                MZ_ZIP_FREE(pZip, pComp, sizeof(tdefl_compressor));
+                MZ_ZIP_FREE(pZip, pRead_buf, MZ_ZIP_MAX_IO_BUF_SIZE);
+                return mz_zip_set_error(pZip, MZ_ZIP_INTERNAL_ERROR);
+            }
+
+            for (;;)
+            {
+                tdefl_status status;
+                tdefl_flush flush = TDEFL_NO_FLUSH;
+
+                size_t n = read_callback(callback_opaque, file_ofs, pRead_buf, MZ_ZIP_MAX_IO_BUF_SIZE);
+                if ((n > MZ_ZIP_MAX_IO_BUF_SIZE) || (file_ofs + n > max_size))
+                {
+                    mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
+                    break;
+                }
+
+                file_ofs += n;
+                uncomp_crc32 = (mz_uint32)MZ_ZIP_CRC32(pZip, uncomp_crc32, (const mz_uint8 *)pRead_buf, n);
 
-		cur_archive_file_ofs += user_extra_data_len;
-	}
+                if (pZip->m_pNeeds_keepalive != NULL && pZip->m_pNeeds_keepalive(pZip->m_pIO_opaque))
+                    flush = TDEFL_FULL_FLUSH;
 
-    if (store_data_uncompressed)
-    {
-        if (pZip->m_pWrite(pZip->m_pIO_opaque, cur_archive_file_ofs, pBuf, buf_size) != buf_size)
-        {
-            pZip->m_pFree(pZip->m_pAlloc_opaque, pComp);
-            return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
-        }
+                if (n == 0)
+                    flush = TDEFL_FINISH;
 
-        cur_archive_file_ofs += buf_size;
-        comp_size = buf_size;
-    }
-    else if (buf_size)
-    {
-        mz_zip_writer_add_state state;
+                status = MZ_ZIP_DEFLATE(pZip, pComp, pRead_buf, n, flush);
+                if (status == TDEFL_STATUS_DONE)
+                {
+                    result = MZ_TRUE;
+                    break;
+                }
+                else if (status != TDEFL_STATUS_OKAY)
+                {
+                    mz_zip_set_error(pZip, MZ_ZIP_COMPRESSION_FAILED);
+                    break;
+                }
+            }
 
-        state.m_pZip = pZip;
-        state.m_cur_archive_file_ofs = cur_archive_file_ofs;
-        state.m_comp_size = 0;
+            MZ_ZIP_FREE(pZip, pComp, sizeof(tdefl_compressor));
 
-        if ((tdefl_init(pComp, mz_zip_writer_add_put_buf_callback, &state, tdefl_create_comp_flags_from_zip_params(level, -15, MZ_DEFAULT_STRATEGY)) != TDEFL_STATUS_OKAY) ||
-            (tdefl_compress_buffer(pComp, pBuf, buf_size, TDEFL_FINISH) != TDEFL_STATUS_DONE))
-        {
-            pZip->m_pFree(pZip->m_pAlloc_opaque, pComp);
-            return mz_zip_set_error(pZip, MZ_ZIP_COMPRESSION_FAILED);
+            if (!result)
+            {
+                MZ_ZIP_FREE(pZip, pRead_buf, MZ_ZIP_MAX_IO_BUF_SIZE);
+                return MZ_FALSE;
+            }
+
+            uncomp_size = file_ofs;
+            comp_size = state.m_comp_size;
+            cur_archive_file_ofs = state.m_cur_archive_file_ofs;
         }
 
-        comp_size = state.m_comp_size;
-        cur_archive_file_ofs = state.m_cur_archive_file_ofs;
+        MZ_ZIP_FREE(pZip, pRead_buf, MZ_ZIP_MAX_IO_BUF_SIZE);
     }
 
-    pZip->m_pFree(pZip->m_pAlloc_opaque, pComp);
-    pComp = NULL;
-
-    if (uncomp_size)
+    if (!(level_and_flags & MZ_ZIP_FLAG_WRITE_HEADER_SET_SIZE))
     {
         mz_uint8 local_dir_footer[MZ_ZIP_DATA_DESCRIPTER_SIZE64];
         mz_uint32 local_dir_footer_size = MZ_ZIP_DATA_DESCRIPTER_SIZE32;
 
-        MZ_ASSERT(bit_flags & MZ_ZIP_LDH_BIT_FLAG_HAS_LOCATOR);
-
         MZ_WRITE_LE32(local_dir_footer + 0, MZ_ZIP_DATA_DESCRIPTOR_ID);
         MZ_WRITE_LE32(local_dir_footer + 4, uncomp_crc32);
         if (pExtra_data == NULL)
@@ -6464,20 +10608,58 @@ mz_bool mz_zip_writer_add_mem_ex_v2(mz_zip_archive *pZip, const char *pArchive_n
             local_dir_footer_size = MZ_ZIP_DATA_DESCRIPTER_SIZE64;
         }
 
-        if (pZip->m_pWrite(pZip->m_pIO_opaque, cur_archive_file_ofs, local_dir_footer, local_dir_footer_size) != local_dir_footer_size)
+        if (MZ_ZIP_WRITE(pZip, cur_archive_file_ofs, local_dir_footer, local_dir_footer_size) != local_dir_footer_size)
             return MZ_FALSE;
 
         cur_archive_file_ofs += local_dir_footer_size;
     }
 
+    if (level_and_flags & MZ_ZIP_FLAG_WRITE_HEADER_SET_SIZE)
+    {
+        if (pExtra_data != NULL)
+        {
+            extra_size = mz_zip_writer_create_zip64_extra_data(extra_data, (max_size >= MZ_UINT32_MAX) ? &uncomp_size : NULL,
+                                                               (max_size >= MZ_UINT32_MAX) ? &comp_size : NULL, (local_dir_header_ofs >= MZ_UINT32_MAX) ? &local_dir_header_ofs : NULL);
+        }
+
+        if (!mz_zip_writer_create_local_dir_header(pZip, local_dir_header,
+                                                   (mz_uint16)archive_name_size, (mz_uint16)(extra_size + user_extra_data_len),
+                                                   (max_size >= MZ_UINT32_MAX) ? MZ_UINT32_MAX : uncomp_size, 
+                                                    (max_size >= MZ_UINT32_MAX) ? MZ_UINT32_MAX : comp_size,
+                                                   uncomp_crc32, method, gen_flags, dos_time, dos_date))
+            return mz_zip_set_error(pZip, MZ_ZIP_INTERNAL_ERROR);
+
+        cur_archive_header_file_ofs = local_dir_header_ofs;
+
+        if (MZ_ZIP_WRITE(pZip, cur_archive_header_file_ofs, local_dir_header, sizeof(local_dir_header)) != sizeof(local_dir_header))
+            return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
+
+        if (pExtra_data != NULL)
+        {
+            cur_archive_header_file_ofs += sizeof(local_dir_header);
+
+            if (MZ_ZIP_WRITE(pZip, cur_archive_header_file_ofs, pArchive_name, archive_name_size) != archive_name_size)
+            {
+                return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
+            }
+
+            cur_archive_header_file_ofs += archive_name_size;
+
+            if (MZ_ZIP_WRITE(pZip, cur_archive_header_file_ofs, extra_data, extra_size) != extra_size)
+                return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
+
+            cur_archive_header_file_ofs += extra_size;
+        }
+    }
+
     if (pExtra_data != NULL)
     {
         extra_size = mz_zip_writer_create_zip64_extra_data(extra_data, (uncomp_size >= MZ_UINT32_MAX) ? &uncomp_size : NULL,
                                                            (uncomp_size >= MZ_UINT32_MAX) ? &comp_size : NULL, (local_dir_header_ofs >= MZ_UINT32_MAX) ? &local_dir_header_ofs : NULL);
     }
 
-    if (!mz_zip_writer_add_to_central_dir(pZip, pArchive_name, (mz_uint16)archive_name_size, pExtra_data, (mz_uint16)extra_size, pComment,
-                                          comment_size, uncomp_size, comp_size, uncomp_crc32, method, bit_flags, dos_time, dos_date, local_dir_header_ofs, ext_attributes,
+    if (!mz_zip_writer_add_to_central_dir(pZip, pArchive_name, (mz_uint16)archive_name_size, pExtra_data, (mz_uint16)extra_size, pComment, comment_size,
+                                          uncomp_size, comp_size, uncomp_crc32, method, gen_flags, dos_time, dos_date, local_dir_header_ofs, ext_attributes,
                                           user_extra_data_central, user_extra_data_central_len))
         return MZ_FALSE;
 
@@ -6487,858 +10669,1041 @@ mz_bool mz_zip_writer_add_mem_ex_v2(mz_zip_archive *pZip, const char *pArchive_n
     return MZ_TRUE;
 }
 
-mz_bool mz_zip_writer_add_read_buf_callback(mz_zip_archive *pZip, const char *pArchive_name, mz_file_read_func read_callback, void* callback_opaque, mz_uint64 max_size, const MZ_TIME_T *pFile_time, const void *pComment, mz_uint16 comment_size, mz_uint level_and_flags,
-                                const char *user_extra_data, mz_uint user_extra_data_len, const char *user_extra_data_central, mz_uint user_extra_data_central_len)
+#ifndef MINIZ_NO_STDIO
+
+static size_t mz_file_read_func_stdio(void *pOpaque, mz_uint64 file_ofs, void *pBuf, size_t n)
 {
-    mz_uint16 gen_flags;
-    mz_uint uncomp_crc32 = MZ_CRC32_INIT, level, num_alignment_padding_bytes;
-    mz_uint16 method = 0, dos_time = 0, dos_date = 0, ext_attributes = 0;
-    mz_uint64 local_dir_header_ofs, cur_archive_file_ofs = pZip->m_archive_size, uncomp_size = 0, comp_size = 0;
-    size_t archive_name_size;
-    mz_uint8 local_dir_header[MZ_ZIP_LOCAL_DIR_HEADER_SIZE];
-    mz_uint8 *pExtra_data = NULL;
-    mz_uint32 extra_size = 0;
-    mz_uint8 extra_data[MZ_ZIP64_MAX_CENTRAL_EXTRA_FIELD_SIZE];
-    mz_zip_internal_state *pState;
-    mz_uint64 file_ofs = 0, cur_archive_header_file_ofs;
+	MZ_FILE *pSrc_file = (MZ_FILE *)pOpaque;
+	mz_int64 cur_ofs = MZ_FTELL64(pSrc_file);
 
-    if ((int)level_and_flags < 0)
-        level_and_flags = MZ_DEFAULT_LEVEL;
-    level = level_and_flags & 0xF;
+	if (((mz_int64)file_ofs < 0) || (((cur_ofs != (mz_int64)file_ofs)) && (MZ_FSEEK64(pSrc_file, (mz_int64)file_ofs, SEEK_SET))))
+		return 0;
 
-    gen_flags = (level_and_flags & MZ_ZIP_FLAG_WRITE_HEADER_SET_SIZE) ? 0 : MZ_ZIP_LDH_BIT_FLAG_HAS_LOCATOR;
+	return MZ_FREAD(pBuf, 1, n, pSrc_file);
+}
 
-    if (!(level_and_flags & MZ_ZIP_FLAG_ASCII_FILENAME))
-        gen_flags |= MZ_ZIP_GENERAL_PURPOSE_BIT_FLAG_UTF8;
+mz_bool mz_zip_writer_add_cfile(mz_zip_archive *pZip, const char *pArchive_name, MZ_FILE *pSrc_file, mz_uint64 max_size, const MZ_TIME_T *pFile_time, const void *pComment, mz_uint16 comment_size, mz_uint level_and_flags,
+	const char *user_extra_data, mz_uint user_extra_data_len, const char *user_extra_data_central, mz_uint user_extra_data_central_len)
+{
+	return mz_zip_writer_add_read_buf_callback(pZip, pArchive_name, mz_file_read_func_stdio, pSrc_file, max_size, pFile_time, pComment, comment_size, level_and_flags,
+		user_extra_data, user_extra_data_len, user_extra_data_central, user_extra_data_central_len);
+}
 
-    /* Sanity checks */
-    if ((!pZip) || (!pZip->m_pState) || (pZip->m_zip_mode != MZ_ZIP_MODE_WRITING) || (!pArchive_name) || ((comment_size) && (!pComment)) || (level > MZ_UBER_COMPRESSION))
-        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+mz_bool mz_zip_writer_add_file(mz_zip_archive *pZip, const char *pArchive_name, const char *pSrc_filename, const void *pComment, mz_uint16 comment_size, mz_uint level_and_flags)
+{
+    MZ_FILE *pSrc_file = NULL;
+    mz_uint64 uncomp_size = 0;
+    MZ_TIME_T file_modified_time;
+    MZ_TIME_T *pFile_time = NULL;
+    mz_bool status;
 
-    pState = pZip->m_pState;
+    memset(&file_modified_time, 0, sizeof(file_modified_time));
 
-    if ((!pState->m_zip64) && (max_size > MZ_UINT32_MAX))
-    {
-        /* Source file is too large for non-zip64 */
-        /*return mz_zip_set_error(pZip, MZ_ZIP_ARCHIVE_TOO_LARGE); */
-        pState->m_zip64 = MZ_TRUE;
-    }
+#if !defined(MINIZ_NO_TIME) && !defined(MINIZ_NO_STDIO)
+    pFile_time = &file_modified_time;
+    if (!mz_zip_get_file_modified_time(pSrc_filename, &file_modified_time))
+        return mz_zip_set_error(pZip, MZ_ZIP_FILE_STAT_FAILED);
+#endif
 
-    /* We could support this, but why? */
-    if (level_and_flags & MZ_ZIP_FLAG_COMPRESSED_DATA)
-        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+    pSrc_file = MZ_FOPEN(pSrc_filename, "rb");
+    if (!pSrc_file)
+        return mz_zip_set_error(pZip, MZ_ZIP_FILE_OPEN_FAILED);
 
-    if (!mz_zip_writer_validate_archive_name(pArchive_name))
-        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_FILENAME);
+    MZ_FSEEK64(pSrc_file, 0, SEEK_END);
+    uncomp_size = MZ_FTELL64(pSrc_file);
+    MZ_FSEEK64(pSrc_file, 0, SEEK_SET);
 
-    if (pState->m_zip64)
-    {
-        if (pZip->m_total_files == MZ_UINT32_MAX)
-            return mz_zip_set_error(pZip, MZ_ZIP_TOO_MANY_FILES);
-    }
-    else
+    status = mz_zip_writer_add_cfile(pZip, pArchive_name, pSrc_file, uncomp_size, pFile_time, pComment, comment_size, level_and_flags, NULL, 0, NULL, 0);
+
+    MZ_FCLOSE(pSrc_file);
+
+    return status;
+}
+#endif /* #ifndef MINIZ_NO_STDIO */
+
+static mz_bool mz_zip_writer_update_zip64_extension_block(mz_zip_array *pNew_ext, mz_zip_archive *pZip, const mz_uint8 *pExt, mz_uint32 ext_len, mz_uint64 *pComp_size, mz_uint64 *pUncomp_size, mz_uint64 *pLocal_header_ofs, mz_uint32 *pDisk_start)
+{
+    /* + 64 should be enough for any new zip64 data */
+    if (!mz_zip_array_reserve(pZip, pNew_ext, ext_len + 64, MZ_FALSE))
+        return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+
+    mz_zip_array_resize(pZip, pNew_ext, 0, MZ_FALSE);
+
+    if ((pUncomp_size) || (pComp_size) || (pLocal_header_ofs) || (pDisk_start))
     {
-        if (pZip->m_total_files == MZ_UINT16_MAX)
+        mz_uint8 new_ext_block[64];
+        mz_uint8 *pDst = new_ext_block;
+        mz_write_le16(pDst, MZ_ZIP64_EXTENDED_INFORMATION_FIELD_HEADER_ID);
+        mz_write_le16(pDst + sizeof(mz_uint16), 0);
+        pDst += sizeof(mz_uint16) * 2;
+
+        if (pUncomp_size)
         {
-            pState->m_zip64 = MZ_TRUE;
-            /*return mz_zip_set_error(pZip, MZ_ZIP_TOO_MANY_FILES); */
+            mz_write_le64(pDst, *pUncomp_size);
+            pDst += sizeof(mz_uint64);
         }
-    }
-
-    archive_name_size = strlen(pArchive_name);
-    if (archive_name_size > MZ_UINT16_MAX)
-        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_FILENAME);
 
-    num_alignment_padding_bytes = mz_zip_writer_compute_padding_needed_for_file_alignment(pZip);
+        if (pComp_size)
+        {
+            mz_write_le64(pDst, *pComp_size);
+            pDst += sizeof(mz_uint64);
+        }
 
-    /* miniz doesn't support central dirs >= MZ_UINT32_MAX bytes yet */
-    if (((mz_uint64)pState->m_central_dir.m_size + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + archive_name_size + MZ_ZIP64_MAX_CENTRAL_EXTRA_FIELD_SIZE + comment_size) >= MZ_UINT32_MAX)
-        return mz_zip_set_error(pZip, MZ_ZIP_UNSUPPORTED_CDIR_SIZE);
+        if (pLocal_header_ofs)
+        {
+            mz_write_le64(pDst, *pLocal_header_ofs);
+            pDst += sizeof(mz_uint64);
+        }
 
-    if (!pState->m_zip64)
-    {
-        /* Bail early if the archive would obviously become too large */
-        if ((pZip->m_archive_size + num_alignment_padding_bytes + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + archive_name_size + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE
-			+ archive_name_size + comment_size + user_extra_data_len + pState->m_central_dir.m_size + MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIZE + 1024
-			+ MZ_ZIP_DATA_DESCRIPTER_SIZE32 + user_extra_data_central_len) > 0xFFFFFFFF)
+        if (pDisk_start)
         {
-            pState->m_zip64 = MZ_TRUE;
-            /*return mz_zip_set_error(pZip, MZ_ZIP_ARCHIVE_TOO_LARGE); */
+            mz_write_le32(pDst, *pDisk_start);
+            pDst += sizeof(mz_uint32);
         }
+
+        mz_write_le16(new_ext_block + sizeof(mz_uint16), (mz_uint16)((pDst - new_ext_block) - sizeof(mz_uint16) * 2));
+
+        if (!mz_zip_array_push_back(pZip, pNew_ext, new_ext_block, pDst - new_ext_block))
+            return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
     }
 
-#ifndef MINIZ_NO_TIME
-    if (pFile_time)
+    if ((pExt) && (ext_len))
     {
-        mz_zip_time_t_to_dos_time(*pFile_time, &dos_time, &dos_date);
+        mz_uint32 extra_size_remaining = ext_len;
+        const mz_uint8 *pExtra_data = pExt;
+
+        do
+        {
+            mz_uint32 field_id, field_data_size, field_total_size;
+
+            if (extra_size_remaining < (sizeof(mz_uint16) * 2))
+                return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
+
+            field_id = MZ_READ_LE16(pExtra_data);
+            field_data_size = MZ_READ_LE16(pExtra_data + sizeof(mz_uint16));
+            field_total_size = field_data_size + sizeof(mz_uint16) * 2;
+
+            if (field_total_size > extra_size_remaining)
+                return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
+
+            if (field_id != MZ_ZIP64_EXTENDED_INFORMATION_FIELD_HEADER_ID)
+            {
+                if (!mz_zip_array_push_back(pZip, pNew_ext, pExtra_data, field_total_size))
+                    return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+            }
+
+            pExtra_data += field_total_size;
+            extra_size_remaining -= field_total_size;
+        } while (extra_size_remaining);
     }
-#endif
 
-    if (max_size <= 3)
-        level = 0;
+    return MZ_TRUE;
+}
 
-    if (!mz_zip_writer_write_zeros(pZip, cur_archive_file_ofs, num_alignment_padding_bytes))
-    {
-        return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
-    }
+/* A run of source archive bytes waiting to be copied verbatim to the dest archive. Runs of consecutive entries are merged so they can be copied with a single (possibly kernel side) copy. */
+typedef struct
+{
+    mz_uint64 m_src_ofs;
+    mz_uint64 m_dst_ofs;
+    mz_uint64 m_size;
+} mz_zip_writer_raw_copy_range;
 
-    cur_archive_file_ofs += num_alignment_padding_bytes;
-    local_dir_header_ofs = cur_archive_file_ofs;
+#ifdef MINIZ_ZIP_KERNEL_COPY
+/* Copies as much of the range as possible inside the kernel when both archives are plain stdio files. Returns the number of bytes copied, the caller copies any remainder through a buffer. */
+static mz_uint64 mz_zip_writer_kernel_copy(mz_zip_archive *pZip, mz_zip_archive *pSource_zip, mz_uint64 src_ofs, mz_uint64 dst_ofs, mz_uint64 size)
+{
+    MZ_FILE *pSrc_file = pSource_zip->m_pState->m_pFile, *pDst_file = pZip->m_pState->m_pFile;
+    mz_uint64 copied = 0;
+    mz_bool use_sendfile = MZ_FALSE;
+    mz_int64 in_ofs, out_ofs;
+    int in_fd, out_fd;
 
-    if (pZip->m_file_offset_alignment)
-    {
-        MZ_ASSERT((cur_archive_file_ofs & (pZip->m_file_offset_alignment - 1)) == 0);
-    }
+    if ((pSource_zip->m_pRead != mz_zip_file_read_func) || (pSource_zip->m_pIO_opaque != pSource_zip) || (!pSrc_file) ||
+        (pZip->m_pWrite != mz_zip_file_write_func) || (pZip->m_pIO_opaque != pZip) || (!pDst_file))
+        return 0;
 
-    if (max_size && level)
-    {
-        method = MZ_DEFLATED;
-    }
+    /* Anything still sitting in the dest FILE's buffer must hit the fd before the kernel writes behind it */
+    if (MZ_FFLUSH(pDst_file) == EOF)
+        return 0;
 
-    MZ_CLEAR_ARR(local_dir_header);
-    if (pState->m_zip64)
+    in_fd = fileno(pSrc_file);
+    out_fd = fileno(pDst_file);
+    in_ofs = (mz_int64)(src_ofs + pSource_zip->m_pState->m_file_archive_start_ofs);
+    out_ofs = (mz_int64)(dst_ofs + pZip->m_pState->m_file_archive_start_ofs);
+
+    while (copied < size)
     {
-        if (max_size >= MZ_UINT32_MAX || local_dir_header_ofs >= MZ_UINT32_MAX)
+        size_t n = (size_t)MZ_MIN(size - copied, (mz_uint64)0x40000000);
+        ssize_t r = -1;
+
+#ifdef __NR_copy_file_range
+        if (!use_sendfile)
         {
-            pExtra_data = extra_data;
-            if (level_and_flags & MZ_ZIP_FLAG_WRITE_HEADER_SET_SIZE)
-                extra_size = mz_zip_writer_create_zip64_extra_data(extra_data, (max_size >= MZ_UINT32_MAX) ? &uncomp_size : NULL,
-                                                               (max_size >= MZ_UINT32_MAX) ? &comp_size : NULL,
-                                                                (local_dir_header_ofs >= MZ_UINT32_MAX) ? &local_dir_header_ofs : NULL);
-            else
-                extra_size = mz_zip_writer_create_zip64_extra_data(extra_data, NULL,
-                                                                   NULL,
-                                                                   (local_dir_header_ofs >= MZ_UINT32_MAX) ? &local_dir_header_ofs : NULL);
+            r = (ssize_t)syscall(__NR_copy_file_range, in_fd, &in_ofs, out_fd, &out_ofs, n, 0);
+            if ((r < 0) && (!copied) && ((errno == ENOSYS) || (errno == EXDEV) || (errno == EINVAL) || (errno == EOPNOTSUPP)))
+                use_sendfile = MZ_TRUE;
+        }
+#else
+        use_sendfile = MZ_TRUE;
+#endif
+        if (use_sendfile)
+        {
+            /* sendfile() writes at the output fd's file position */
+            off_t sendfile_ofs = (off_t)in_ofs;
+            if ((sendfile_ofs != in_ofs) || (lseek(out_fd, (off_t)out_ofs, SEEK_SET) != out_ofs))
+                break;
+            if ((r = sendfile(out_fd, in_fd, &sendfile_ofs, n)) > 0)
+            {
+                in_ofs += r;
+                out_ofs += r;
+            }
         }
 
-        if (!mz_zip_writer_create_local_dir_header(pZip, local_dir_header, (mz_uint16)archive_name_size, (mz_uint16)(extra_size + user_extra_data_len), 0, 0, 0, method, gen_flags, dos_time, dos_date))
-            return mz_zip_set_error(pZip, MZ_ZIP_INTERNAL_ERROR);
-
-        if (pZip->m_pWrite(pZip->m_pIO_opaque, cur_archive_file_ofs, local_dir_header, sizeof(local_dir_header)) != sizeof(local_dir_header))
-            return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
+        if (r <= 0)
+            break;
 
-        cur_archive_file_ofs += sizeof(local_dir_header);
+        copied += (mz_uint64)r;
+    }
 
-        if (pZip->m_pWrite(pZip->m_pIO_opaque, cur_archive_file_ofs, pArchive_name, archive_name_size) != archive_name_size)
-        {
-            return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
-        }
+    /* Resync the dest FILE with the bytes the kernel wrote behind its back. This is needed even if nothing was copied: the lseek() before a failed sendfile() still moved the fd, and */
+    /* stdio's cached position would otherwise let the buffered fallback skip its seek and write at the wrong offset. */
+    if (MZ_FSEEK64(pDst_file, (mz_int64)(dst_ofs + pZip->m_pState->m_file_archive_start_ofs + copied), SEEK_SET))
+        return 0;
 
-        cur_archive_file_ofs += archive_name_size;
+    return copied;
+}
+#endif /* #ifdef MINIZ_ZIP_KERNEL_COPY */
 
-        if (pZip->m_pWrite(pZip->m_pIO_opaque, cur_archive_file_ofs, extra_data, extra_size) != extra_size)
-            return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
+static mz_bool mz_zip_writer_copy_raw(mz_zip_archive *pZip, mz_zip_archive *pSource_zip, mz_uint64 src_ofs, mz_uint64 dst_ofs, mz_uint64 size)
+{
+    void *pBuf;
+    size_t buf_size;
 
-        cur_archive_file_ofs += extra_size;
-    }
-    else
+#ifdef MINIZ_ZIP_KERNEL_COPY
     {
-        if ((comp_size > MZ_UINT32_MAX) || (cur_archive_file_ofs > MZ_UINT32_MAX))
-            return mz_zip_set_error(pZip, MZ_ZIP_ARCHIVE_TOO_LARGE);
-        if (!mz_zip_writer_create_local_dir_header(pZip, local_dir_header, (mz_uint16)archive_name_size, (mz_uint16)user_extra_data_len, 0, 0, 0, method, gen_flags, dos_time, dos_date))
-            return mz_zip_set_error(pZip, MZ_ZIP_INTERNAL_ERROR);
+        mz_uint64 copied = mz_zip_writer_kernel_copy(pZip, pSource_zip, src_ofs, dst_ofs, size);
+        src_ofs += copied;
+        dst_ofs += copied;
+        size -= copied;
+    }
+#endif
 
-        if (pZip->m_pWrite(pZip->m_pIO_opaque, cur_archive_file_ofs, local_dir_header, sizeof(local_dir_header)) != sizeof(local_dir_header))
-            return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
+    if (!size)
+        return MZ_TRUE;
 
-        cur_archive_file_ofs += sizeof(local_dir_header);
+    buf_size = (size_t)MZ_MIN((mz_uint64)MZ_ZIP_MAX_IO_BUF_SIZE, size);
+    if (NULL == (pBuf = MZ_ZIP_ALLOC(pZip, 1, buf_size)))
+        return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+
+    while (size)
+    {
+        mz_uint n = (mz_uint)MZ_MIN((mz_uint64)MZ_ZIP_MAX_IO_BUF_SIZE, size);
+        if (MZ_ZIP_READ(pSource_zip, src_ofs, pBuf, n) != n)
+        {
+            MZ_ZIP_FREE(pZip, pBuf, buf_size);
+            return mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
+        }
+        src_ofs += n;
 
-        if (pZip->m_pWrite(pZip->m_pIO_opaque, cur_archive_file_ofs, pArchive_name, archive_name_size) != archive_name_size)
+        if (MZ_ZIP_WRITE(pZip, dst_ofs, pBuf, n) != n)
         {
+            MZ_ZIP_FREE(pZip, pBuf, buf_size);
             return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
         }
+        dst_ofs += n;
 
-        cur_archive_file_ofs += archive_name_size;
+        size -= n;
     }
 
-    if (user_extra_data_len > 0)
-    {
-        if (pZip->m_pWrite(pZip->m_pIO_opaque, cur_archive_file_ofs, user_extra_data, user_extra_data_len) != user_extra_data_len)
-            return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
+    MZ_ZIP_FREE(pZip, pBuf, buf_size);
+    return MZ_TRUE;
+}
 
-        cur_archive_file_ofs += user_extra_data_len;
-    }
+static mz_bool mz_zip_writer_flush_raw_copy(mz_zip_archive *pZip, mz_zip_archive *pSource_zip, mz_zip_writer_raw_copy_range *pRange)
+{
+    mz_uint64 size = pRange->m_size;
+    if (!size)
+        return MZ_TRUE;
+    pRange->m_size = 0;
+    return mz_zip_writer_copy_raw(pZip, pSource_zip, pRange->m_src_ofs, pRange->m_dst_ofs, size);
+}
 
-    if (max_size)
+static mz_bool mz_zip_writer_queue_raw_copy(mz_zip_archive *pZip, mz_zip_archive *pSource_zip, mz_zip_writer_raw_copy_range *pRange, mz_uint64 src_ofs, mz_uint64 dst_ofs, mz_uint64 size)
+{
+    if ((pRange->m_size) && (pRange->m_src_ofs + pRange->m_size == src_ofs) && (pRange->m_dst_ofs + pRange->m_size == dst_ofs))
     {
-        void *pRead_buf = pZip->m_pAlloc(pZip->m_pAlloc_opaque, 1, MZ_ZIP_MAX_IO_BUF_SIZE);
-        if (!pRead_buf)
-        {
-            return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
-        }
+        pRange->m_size += size;
+        return MZ_TRUE;
+    }
 
-        if (!level)
-        {
-            while (1)
-            {
-                size_t n = read_callback(callback_opaque, file_ofs, pRead_buf, MZ_ZIP_MAX_IO_BUF_SIZE);
-                if (n == 0)
-                    break;
+    if (!mz_zip_writer_flush_raw_copy(pZip, pSource_zip, pRange))
+        return MZ_FALSE;
 
-                if ((n > MZ_ZIP_MAX_IO_BUF_SIZE) || (file_ofs + n > max_size))
-                {
-                    pZip->m_pFree(pZip->m_pAlloc_opaque, pRead_buf);
-                    return mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
-                }
-                if (pZip->m_pWrite(pZip->m_pIO_opaque, cur_archive_file_ofs, pRead_buf, n) != n)
-                {
-                    pZip->m_pFree(pZip->m_pAlloc_opaque, pRead_buf);
-                    return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
-                }
-                file_ofs += n;
-                uncomp_crc32 = (mz_uint32)mz_crc32(uncomp_crc32, (const mz_uint8 *)pRead_buf, n);
-                cur_archive_file_ofs += n;
-            }
-            uncomp_size = file_ofs;
-            comp_size = uncomp_size;
-        }
-        else
-        {
-            mz_bool result = MZ_FALSE;
-            mz_zip_writer_add_state state;
-            tdefl_compressor *pComp = (tdefl_compressor *)pZip->m_pAlloc(pZip->m_pAlloc_opaque, 1, sizeof(tdefl_compressor));
-            if (!pComp)
-            {
-                pZip->m_pFree(pZip->m_pAlloc_opaque, pRead_buf);
-                return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
-            }
+    pRange->m_src_ofs = src_ofs;
+    pRange->m_dst_ofs = dst_ofs;
+    pRange->m_size = size;
+    return MZ_TRUE;
+}
 
-            state.m_pZip = pZip;
-            state.m_cur_archive_file_ofs = cur_archive_file_ofs;
-            state.m_comp_size = 0;
+/* TODO: This func is now pretty freakin complex due to zip64, split it up? */
+/* Raw bytes are queued in pPending rather than written, the caller must flush it with mz_zip_writer_flush_raw_copy(). */
+static mz_bool mz_zip_writer_add_from_zip_reader_internal(mz_zip_archive *pZip, mz_zip_archive *pSource_zip, mz_uint src_file_index, mz_zip_writer_raw_copy_range *pPending)
+{
+    mz_uint n, bit_flags, num_alignment_padding_bytes, src_central_dir_following_data_size;
+    mz_uint64 src_archive_bytes_remaining, local_dir_header_ofs;
+    mz_uint64 cur_src_file_ofs, cur_dst_file_ofs;
+    mz_uint32 local_header_u32[(MZ_ZIP_LOCAL_DIR_HEADER_SIZE + sizeof(mz_uint32) - 1) / sizeof(mz_uint32)];
+    mz_uint8 *pLocal_header = (mz_uint8 *)local_header_u32;
+    mz_uint8 new_central_header[MZ_ZIP_CENTRAL_DIR_HEADER_SIZE];
+    mz_uint32 descriptor_u32[8];
+    mz_uint8 *pBuf = (mz_uint8 *)descriptor_u32;
+    size_t orig_central_dir_size;
+    mz_zip_internal_state *pState;
+    const mz_uint8 *pSrc_central_header;
+    mz_zip_archive_file_stat src_file_stat;
+    mz_uint32 src_filename_len, src_comment_len, src_ext_len;
+    mz_uint32 local_header_filename_size, local_header_extra_len;
+    mz_uint64 local_header_comp_size, local_header_uncomp_size;
+    mz_bool found_zip64_ext_data_in_ldir = MZ_FALSE;
 
-            if (tdefl_init(pComp, mz_zip_writer_add_put_buf_callback, &state, tdefl_create_comp_flags_from_zip_params(level, -15, MZ_DEFAULT_STRATEGY)) != TDEFL_STATUS_OKAY)
-            {
-                pZip->m_pFree(pZip->m_pAlloc_opaque, pComp);
-                pZip->m_pFree(pZip->m_pAlloc_opaque, pRead_buf);
-                return mz_zip_set_error(pZip, MZ_ZIP_INTERNAL_ERROR);
-            }
+    /* Sanity checks */
+    if ((!pZip) || (!pZip->m_pState) || (pZip->m_zip_mode != MZ_ZIP_MODE_WRITING) || (!pSource_zip->m_pRead))
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
 
-            for (;;)
-            {
-                tdefl_status status;
-                tdefl_flush flush = TDEFL_NO_FLUSH;
+    pState = pZip->m_pState;
 
-                size_t n = read_callback(callback_opaque, file_ofs, pRead_buf, MZ_ZIP_MAX_IO_BUF_SIZE);
-                if ((n > MZ_ZIP_MAX_IO_BUF_SIZE) || (file_ofs + n > max_size))
-                {
-                    mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
-                    break;
-                }
+    /* Don't support copying files from zip64 archives to non-zip64, even though in some cases this is possible */
+    if ((pSource_zip->m_pState->m_zip64) && (!pZip->m_pState->m_zip64))
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
 
-                file_ofs += n;
-                uncomp_crc32 = (mz_uint32)mz_crc32(uncomp_crc32, (const mz_uint8 *)pRead_buf, n);
+    /* Get pointer to the source central dir header and crack it */
+    if (NULL == (pSrc_central_header = mz_zip_get_cdh(pSource_zip, src_file_index)))
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
 
-                if (pZip->m_pNeeds_keepalive != NULL && pZip->m_pNeeds_keepalive(pZip->m_pIO_opaque))
-                    flush = TDEFL_FULL_FLUSH;
+    if (MZ_READ_LE32(pSrc_central_header + MZ_ZIP_CDH_SIG_OFS) != MZ_ZIP_CENTRAL_DIR_HEADER_SIG)
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
 
-                if (n == 0)
-                    flush = TDEFL_FINISH;
+    src_filename_len = MZ_READ_LE16(pSrc_central_header + MZ_ZIP_CDH_FILENAME_LEN_OFS);
+    src_comment_len = MZ_READ_LE16(pSrc_central_header + MZ_ZIP_CDH_COMMENT_LEN_OFS);
+    src_ext_len = MZ_READ_LE16(pSrc_central_header + MZ_ZIP_CDH_EXTRA_LEN_OFS);
+    src_central_dir_following_data_size = src_filename_len + src_ext_len + src_comment_len;
 
-                status = tdefl_compress_buffer(pComp, pRead_buf, n, flush);
-                if (status == TDEFL_STATUS_DONE)
-                {
-                    result = MZ_TRUE;
-                    break;
-                }
-                else if (status != TDEFL_STATUS_OKAY)
-                {
-                    mz_zip_set_error(pZip, MZ_ZIP_COMPRESSION_FAILED);
-                    break;
-                }
-            }
+    /* TODO: We don't support central dir's >= MZ_UINT32_MAX bytes right now (+32 fudge factor in case we need to add more extra data) */
+    if ((pState->m_central_dir.m_size + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + src_central_dir_following_data_size + 32) >= MZ_UINT32_MAX)
+        return mz_zip_set_error(pZip, MZ_ZIP_UNSUPPORTED_CDIR_SIZE);
 
-            pZip->m_pFree(pZip->m_pAlloc_opaque, pComp);
+    num_alignment_padding_bytes = mz_zip_writer_compute_padding_needed_for_file_alignment(pZip);
 
-            if (!result)
-            {
-                pZip->m_pFree(pZip->m_pAlloc_opaque, pRead_buf);
-                return MZ_FALSE;
-            }
+    if (!pState->m_zip64)
+    {
+        if (pZip->m_total_files == MZ_UINT16_MAX)
+            return mz_zip_set_error(pZip, MZ_ZIP_TOO_MANY_FILES);
+    }
+    else
+    {
+        /* TODO: Our zip64 support still has some 32-bit limits that may not be worth fixing. */
+        if (pZip->m_total_files == MZ_UINT32_MAX)
+            return mz_zip_set_error(pZip, MZ_ZIP_TOO_MANY_FILES);
+    }
 
-            uncomp_size = file_ofs;
-            comp_size = state.m_comp_size;
-            cur_archive_file_ofs = state.m_cur_archive_file_ofs;
-        }
+    if (!mz_zip_file_stat_internal(pSource_zip, src_file_index, pSrc_central_header, &src_file_stat, NULL))
+        return MZ_FALSE;
 
-        pZip->m_pFree(pZip->m_pAlloc_opaque, pRead_buf);
-    }
+    cur_src_file_ofs = src_file_stat.m_local_header_ofs;
+    cur_dst_file_ofs = pZip->m_archive_size;
 
-    if (!(level_and_flags & MZ_ZIP_FLAG_WRITE_HEADER_SET_SIZE))
-    {
-        mz_uint8 local_dir_footer[MZ_ZIP_DATA_DESCRIPTER_SIZE64];
-        mz_uint32 local_dir_footer_size = MZ_ZIP_DATA_DESCRIPTER_SIZE32;
+    /* Read the source archive's local dir header */
+    if (MZ_ZIP_READ(pSource_zip, cur_src_file_ofs, pLocal_header, MZ_ZIP_LOCAL_DIR_HEADER_SIZE) != MZ_ZIP_LOCAL_DIR_HEADER_SIZE)
+        return mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
 
-        MZ_WRITE_LE32(local_dir_footer + 0, MZ_ZIP_DATA_DESCRIPTOR_ID);
-        MZ_WRITE_LE32(local_dir_footer + 4, uncomp_crc32);
-        if (pExtra_data == NULL)
-        {
-            if (comp_size > MZ_UINT32_MAX)
-                return mz_zip_set_error(pZip, MZ_ZIP_ARCHIVE_TOO_LARGE);
+    if (MZ_READ_LE32(pLocal_header) != MZ_ZIP_LOCAL_DIR_HEADER_SIG)
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
 
-            MZ_WRITE_LE32(local_dir_footer + 8, comp_size);
-            MZ_WRITE_LE32(local_dir_footer + 12, uncomp_size);
-        }
-        else
+    cur_src_file_ofs += MZ_ZIP_LOCAL_DIR_HEADER_SIZE;
+
+    /* Compute the total size we need to copy (filename+extra data+compressed data) */
+    local_header_filename_size = MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_FILENAME_LEN_OFS);
+    local_header_extra_len = MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_EXTRA_LEN_OFS);
+    local_header_comp_size = MZ_READ_LE32(pLocal_header + MZ_ZIP_LDH_COMPRESSED_SIZE_OFS);
+    local_header_uncomp_size = MZ_READ_LE32(pLocal_header + MZ_ZIP_LDH_DECOMPRESSED_SIZE_OFS);
+    src_archive_bytes_remaining = local_header_filename_size + local_header_extra_len + src_file_stat.m_comp_size;
+
+    /* Try to find a zip64 extended information field */
+    if ((local_header_extra_len) && ((local_header_comp_size == MZ_UINT32_MAX) || (local_header_uncomp_size == MZ_UINT32_MAX)))
+    {
+        mz_zip_array file_data_array;
+        const mz_uint8 *pExtra_data;
+        mz_uint32 extra_size_remaining = local_header_extra_len;
+
+        mz_zip_array_init(&file_data_array, 1);
+        if (!mz_zip_array_resize(pZip, &file_data_array, local_header_extra_len, MZ_FALSE))
         {
-            MZ_WRITE_LE64(local_dir_footer + 8, comp_size);
-            MZ_WRITE_LE64(local_dir_footer + 16, uncomp_size);
-            local_dir_footer_size = MZ_ZIP_DATA_DESCRIPTER_SIZE64;
+            return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
         }
 
-        if (pZip->m_pWrite(pZip->m_pIO_opaque, cur_archive_file_ofs, local_dir_footer, local_dir_footer_size) != local_dir_footer_size)
-            return MZ_FALSE;
-
-        cur_archive_file_ofs += local_dir_footer_size;
-    }
-
-    if (level_and_flags & MZ_ZIP_FLAG_WRITE_HEADER_SET_SIZE)
-    {
-        if (pExtra_data != NULL)
+        if (MZ_ZIP_READ(pSource_zip, src_file_stat.m_local_header_ofs + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + local_header_filename_size, file_data_array.m_p, local_header_extra_len) != local_header_extra_len)
         {
-            extra_size = mz_zip_writer_create_zip64_extra_data(extra_data, (max_size >= MZ_UINT32_MAX) ? &uncomp_size : NULL,
-                                                               (max_size >= MZ_UINT32_MAX) ? &comp_size : NULL, (local_dir_header_ofs >= MZ_UINT32_MAX) ? &local_dir_header_ofs : NULL);
+            mz_zip_array_clear(pZip, &file_data_array);
+            return mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
         }
 
-        if (!mz_zip_writer_create_local_dir_header(pZip, local_dir_header,
-                                                   (mz_uint16)archive_name_size, (mz_uint16)(extra_size + user_extra_data_len),
-                                                   (max_size >= MZ_UINT32_MAX) ? MZ_UINT32_MAX : uncomp_size, 
-                                                    (max_size >= MZ_UINT32_MAX) ? MZ_UINT32_MAX : comp_size,
-                                                   uncomp_crc32, method, gen_flags, dos_time, dos_date))
-            return mz_zip_set_error(pZip, MZ_ZIP_INTERNAL_ERROR);
+        pExtra_data = (const mz_uint8 *)file_data_array.m_p;
 
-        cur_archive_header_file_ofs = local_dir_header_ofs;
+        do
+        {
+            mz_uint32 field_id, field_data_size, field_total_size;
 
-        if (pZip->m_pWrite(pZip->m_pIO_opaque, cur_archive_header_file_ofs, local_dir_header, sizeof(local_dir_header)) != sizeof(local_dir_header))
-            return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
+            if (extra_size_remaining < (sizeof(mz_uint16) * 2))
+            {
+                mz_zip_array_clear(pZip, &file_data_array);
+                return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
+            }
 
-        if (pExtra_data != NULL)
-        {
-            cur_archive_header_file_ofs += sizeof(local_dir_header);
+            field_id = MZ_READ_LE16(pExtra_data);
+            field_data_size = MZ_READ_LE16(pExtra_data + sizeof(mz_uint16));
+            field_total_size = field_data_size + sizeof(mz_uint16) * 2;
 
-            if (pZip->m_pWrite(pZip->m_pIO_opaque, cur_archive_header_file_ofs, pArchive_name, archive_name_size) != archive_name_size)
+            if (field_total_size > extra_size_remaining)
             {
-                return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
+                mz_zip_array_clear(pZip, &file_data_array);
+                return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
             }
 
-            cur_archive_header_file_ofs += archive_name_size;
+            if (field_id == MZ_ZIP64_EXTENDED_INFORMATION_FIELD_HEADER_ID)
+            {
+                const mz_uint8 *pSrc_field_data = pExtra_data + sizeof(mz_uint32);
 
-            if (pZip->m_pWrite(pZip->m_pIO_opaque, cur_archive_header_file_ofs, extra_data, extra_size) != extra_size)
-                return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
+                if (field_data_size < sizeof(mz_uint64) * 2)
+                {
+                    mz_zip_array_clear(pZip, &file_data_array);
+                    return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
+                }
 
-            cur_archive_header_file_ofs += extra_size;
-        }
+                local_header_uncomp_size = MZ_READ_LE64(pSrc_field_data);
+                local_header_comp_size = MZ_READ_LE64(pSrc_field_data + sizeof(mz_uint64)); /* may be 0 if there's a descriptor */
+
+                found_zip64_ext_data_in_ldir = MZ_TRUE;
+                break;
+            }
+
+            pExtra_data += field_total_size;
+            extra_size_remaining -= field_total_size;
+        } while (extra_size_remaining);
+
+        mz_zip_array_clear(pZip, &file_data_array);
     }
 
-    if (pExtra_data != NULL)
+    if (!pState->m_zip64)
     {
-        extra_size = mz_zip_writer_create_zip64_extra_data(extra_data, (uncomp_size >= MZ_UINT32_MAX) ? &uncomp_size : NULL,
-                                                           (uncomp_size >= MZ_UINT32_MAX) ? &comp_size : NULL, (local_dir_header_ofs >= MZ_UINT32_MAX) ? &local_dir_header_ofs : NULL);
+        /* Try to detect if the new archive will most likely wind up too big and bail early (+(sizeof(mz_uint32) * 4) is for the optional descriptor which could be present, +64 is a fudge factor). */
+        /* We also check when the archive is finalized so this doesn't need to be perfect. */
+        mz_uint64 approx_new_archive_size = cur_dst_file_ofs + num_alignment_padding_bytes + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + src_archive_bytes_remaining + (sizeof(mz_uint32) * 4) +
+                                            pState->m_central_dir.m_size + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + src_central_dir_following_data_size + MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIZE + 64;
+
+        if (approx_new_archive_size >= MZ_UINT32_MAX)
+            return mz_zip_set_error(pZip, MZ_ZIP_ARCHIVE_TOO_LARGE);
     }
 
-    if (!mz_zip_writer_add_to_central_dir(pZip, pArchive_name, (mz_uint16)archive_name_size, pExtra_data, (mz_uint16)extra_size, pComment, comment_size,
-                                          uncomp_size, comp_size, uncomp_crc32, method, gen_flags, dos_time, dos_date, local_dir_header_ofs, ext_attributes,
-                                          user_extra_data_central, user_extra_data_central_len))
-        return MZ_FALSE;
+    /* Write dest archive padding */
+    if (num_alignment_padding_bytes)
+    {
+        if (!mz_zip_writer_flush_raw_copy(pZip, pSource_zip, pPending))
+            return MZ_FALSE;
 
-    pZip->m_total_files++;
-    pZip->m_archive_size = cur_archive_file_ofs;
+        if (!mz_zip_writer_write_zeros(pZip, cur_dst_file_ofs, num_alignment_padding_bytes))
+            return MZ_FALSE;
+    }
 
-    return MZ_TRUE;
-}
+    cur_dst_file_ofs += num_alignment_padding_bytes;
 
-#ifndef MINIZ_NO_STDIO
+    local_dir_header_ofs = cur_dst_file_ofs;
+    if (pZip->m_file_offset_alignment)
+    {
+        MZ_ASSERT((local_dir_header_ofs & (pZip->m_file_offset_alignment - 1)) == 0);
+    }
 
-static size_t mz_file_read_func_stdio(void *pOpaque, mz_uint64 file_ofs, void *pBuf, size_t n)
-{
-	MZ_FILE *pSrc_file = (MZ_FILE *)pOpaque;
-	mz_int64 cur_ofs = MZ_FTELL64(pSrc_file);
+    /* The original zip's local header+ext block doesn't change, even with zip64, so the local header, filename, extra data and compressed data are copied over to the dest zip as one raw range */
+    if (!mz_zip_writer_queue_raw_copy(pZip, pSource_zip, pPending, src_file_stat.m_local_header_ofs, cur_dst_file_ofs, MZ_ZIP_LOCAL_DIR_HEADER_SIZE + src_archive_bytes_remaining))
+        return MZ_FALSE;
 
-	if (((mz_int64)file_ofs < 0) || (((cur_ofs != (mz_int64)file_ofs)) && (MZ_FSEEK64(pSrc_file, (mz_int64)file_ofs, SEEK_SET))))
-		return 0;
+    cur_src_file_ofs += src_archive_bytes_remaining;
+    cur_dst_file_ofs += MZ_ZIP_LOCAL_DIR_HEADER_SIZE + src_archive_bytes_remaining;
 
-	return MZ_FREAD(pBuf, 1, n, pSrc_file);
-}
+    /* Now deal with the optional data descriptor */
+    bit_flags = MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_BIT_FLAG_OFS);
+    if (bit_flags & 8)
+    {
+        mz_bool upgraded_descriptor = MZ_FALSE;
 
-mz_bool mz_zip_writer_add_cfile(mz_zip_archive *pZip, const char *pArchive_name, MZ_FILE *pSrc_file, mz_uint64 max_size, const MZ_TIME_T *pFile_time, const void *pComment, mz_uint16 comment_size, mz_uint level_and_flags,
-	const char *user_extra_data, mz_uint user_extra_data_len, const char *user_extra_data_central, mz_uint user_extra_data_central_len)
-{
-	return mz_zip_writer_add_read_buf_callback(pZip, pArchive_name, mz_file_read_func_stdio, pSrc_file, max_size, pFile_time, pComment, comment_size, level_and_flags,
-		user_extra_data, user_extra_data_len, user_extra_data_central, user_extra_data_central_len);
-}
+        /* Copy data descriptor */
+        if ((pSource_zip->m_pState->m_zip64) || (found_zip64_ext_data_in_ldir))
+        {
+            /* src is zip64, dest must be zip64 */
 
-mz_bool mz_zip_writer_add_file(mz_zip_archive *pZip, const char *pArchive_name, const char *pSrc_filename, const void *pComment, mz_uint16 comment_size, mz_uint level_and_flags)
-{
-    MZ_FILE *pSrc_file = NULL;
-    mz_uint64 uncomp_size = 0;
-    MZ_TIME_T file_modified_time;
-    MZ_TIME_T *pFile_time = NULL;
-    mz_bool status;
+            /* name			uint32_t's */
+            /* id				1 (optional in zip64?) */
+            /* crc			1 */
+            /* comp_size	2 */
+            /* uncomp_size 2 */
+            if (MZ_ZIP_READ(pSource_zip, cur_src_file_ofs, pBuf, (sizeof(mz_uint32) * 6)) != (sizeof(mz_uint32) * 6))
+                return mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
 
-    memset(&file_modified_time, 0, sizeof(file_modified_time));
+            n = sizeof(mz_uint32) * ((MZ_READ_LE32(pBuf) == MZ_ZIP_DATA_DESCRIPTOR_ID) ? 6 : 5);
+        }
+        else
+        {
+            /* src is NOT zip64 */
+            mz_bool has_id;
 
-#if !defined(MINIZ_NO_TIME) && !defined(MINIZ_NO_STDIO)
-    pFile_time = &file_modified_time;
-    if (!mz_zip_get_file_modified_time(pSrc_filename, &file_modified_time))
-        return mz_zip_set_error(pZip, MZ_ZIP_FILE_STAT_FAILED);
-#endif
+            if (MZ_ZIP_READ(pSource_zip, cur_src_file_ofs, pBuf, sizeof(mz_uint32) * 4) != sizeof(mz_uint32) * 4)
+                return mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
 
-    pSrc_file = MZ_FOPEN(pSrc_filename, "rb");
-    if (!pSrc_file)
-        return mz_zip_set_error(pZip, MZ_ZIP_FILE_OPEN_FAILED);
+            has_id = (MZ_READ_LE32(pBuf) == MZ_ZIP_DATA_DESCRIPTOR_ID);
 
-    MZ_FSEEK64(pSrc_file, 0, SEEK_END);
-    uncomp_size = MZ_FTELL64(pSrc_file);
-    MZ_FSEEK64(pSrc_file, 0, SEEK_SET);
+            if (pZip->m_pState->m_zip64)
+            {
+                /* dest is zip64, so upgrade the data descriptor */
+                const mz_uint8 *pSrc_descriptor = (const mz_uint8 *)pBuf + (has_id ? sizeof(mz_uint32) : 0);
+                const mz_uint32 src_crc32 = MZ_READ_LE32(pSrc_descriptor);
+                const mz_uint64 src_comp_size = MZ_READ_LE32(pSrc_descriptor + sizeof(mz_uint32));
+                const mz_uint64 src_uncomp_size = MZ_READ_LE32(pSrc_descriptor + 2*sizeof(mz_uint32));
 
-    status = mz_zip_writer_add_cfile(pZip, pArchive_name, pSrc_file, uncomp_size, pFile_time, pComment, comment_size, level_and_flags, NULL, 0, NULL, 0);
+                mz_write_le32((mz_uint8 *)pBuf, MZ_ZIP_DATA_DESCRIPTOR_ID);
+                mz_write_le32((mz_uint8 *)pBuf + sizeof(mz_uint32) * 1, src_crc32);
+                mz_write_le64((mz_uint8 *)pBuf + sizeof(mz_uint32) * 2, src_comp_size);
+                mz_write_le64((mz_uint8 *)pBuf + sizeof(mz_uint32) * 4, src_uncomp_size);
 
-    MZ_FCLOSE(pSrc_file);
+                n = sizeof(mz_uint32) * 6;
+                upgraded_descriptor = MZ_TRUE;
+            }
+            else
+            {
+                /* dest is NOT zip64, just copy it as-is */
+                n = sizeof(mz_uint32) * (has_id ? 4 : 3);
+            }
+        }
 
-    return status;
-}
-#endif /* #ifndef MINIZ_NO_STDIO */
+        if (upgraded_descriptor)
+        {
+            /* The descriptor no longer matches the source bytes, so it has to be written directly (in order) */
+            if (!mz_zip_writer_flush_raw_copy(pZip, pSource_zip, pPending))
+                return MZ_FALSE;
 
-static mz_bool mz_zip_writer_update_zip64_extension_block(mz_zip_array *pNew_ext, mz_zip_archive *pZip, const mz_uint8 *pExt, mz_uint32 ext_len, mz_uint64 *pComp_size, mz_uint64 *pUncomp_size, mz_uint64 *pLocal_header_ofs, mz_uint32 *pDisk_start)
-{
-    /* + 64 should be enough for any new zip64 data */
-    if (!mz_zip_array_reserve(pZip, pNew_ext, ext_len + 64, MZ_FALSE))
-        return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+            if (MZ_ZIP_WRITE(pZip, cur_dst_file_ofs, pBuf, n) != n)
+                return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
+        }
+        else if (!mz_zip_writer_queue_raw_copy(pZip, pSource_zip, pPending, cur_src_file_ofs, cur_dst_file_ofs, n))
+            return MZ_FALSE;
 
-    mz_zip_array_resize(pZip, pNew_ext, 0, MZ_FALSE);
+        cur_src_file_ofs += n;
+        cur_dst_file_ofs += n;
+    }
 
-    if ((pUncomp_size) || (pComp_size) || (pLocal_header_ofs) || (pDisk_start))
+    /* Finally, add the new central dir header */
+    orig_central_dir_size = pState->m_central_dir.m_size;
+
+    memcpy(new_central_header, pSrc_central_header, MZ_ZIP_CENTRAL_DIR_HEADER_SIZE);
+
+    if (pState->m_zip64)
     {
-        mz_uint8 new_ext_block[64];
-        mz_uint8 *pDst = new_ext_block;
-        mz_write_le16(pDst, MZ_ZIP64_EXTENDED_INFORMATION_FIELD_HEADER_ID);
-        mz_write_le16(pDst + sizeof(mz_uint16), 0);
-        pDst += sizeof(mz_uint16) * 2;
+        /* This is the painful part: We need to write a new central dir header + ext block with updated zip64 fields, and ensure the old fields (if any) are not included. */
+        const mz_uint8 *pSrc_ext = pSrc_central_header + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + src_filename_len;
+        mz_zip_array new_ext_block;
 
-        if (pUncomp_size)
+        mz_zip_array_init(&new_ext_block, sizeof(mz_uint8));
+
+        MZ_WRITE_LE32(new_central_header + MZ_ZIP_CDH_COMPRESSED_SIZE_OFS, MZ_UINT32_MAX);
+        MZ_WRITE_LE32(new_central_header + MZ_ZIP_CDH_DECOMPRESSED_SIZE_OFS, MZ_UINT32_MAX);
+        MZ_WRITE_LE32(new_central_header + MZ_ZIP_CDH_LOCAL_HEADER_OFS, MZ_UINT32_MAX);
+
+        if (!mz_zip_writer_update_zip64_extension_block(&new_ext_block, pZip, pSrc_ext, src_ext_len, &src_file_stat.m_comp_size, &src_file_stat.m_uncomp_size, &local_dir_header_ofs, NULL))
         {
-            mz_write_le64(pDst, *pUncomp_size);
-            pDst += sizeof(mz_uint64);
+            mz_zip_array_clear(pZip, &new_ext_block);
+            return MZ_FALSE;
         }
 
-        if (pComp_size)
+        MZ_WRITE_LE16(new_central_header + MZ_ZIP_CDH_EXTRA_LEN_OFS, new_ext_block.m_size);
+
+        if (!mz_zip_array_push_back(pZip, &pState->m_central_dir, new_central_header, MZ_ZIP_CENTRAL_DIR_HEADER_SIZE))
         {
-            mz_write_le64(pDst, *pComp_size);
-            pDst += sizeof(mz_uint64);
+            mz_zip_array_clear(pZip, &new_ext_block);
+            return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
         }
 
-        if (pLocal_header_ofs)
+        if (!mz_zip_array_push_back(pZip, &pState->m_central_dir, pSrc_central_header + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE, src_filename_len))
         {
-            mz_write_le64(pDst, *pLocal_header_ofs);
-            pDst += sizeof(mz_uint64);
+            mz_zip_array_clear(pZip, &new_ext_block);
+            mz_zip_array_resize(pZip, &pState->m_central_dir, orig_central_dir_size, MZ_FALSE);
+            return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
         }
 
-        if (pDisk_start)
+        if (!mz_zip_array_push_back(pZip, &pState->m_central_dir, new_ext_block.m_p, new_ext_block.m_size))
         {
-            mz_write_le32(pDst, *pDisk_start);
-            pDst += sizeof(mz_uint32);
+            mz_zip_array_clear(pZip, &new_ext_block);
+            mz_zip_array_resize(pZip, &pState->m_central_dir, orig_central_dir_size, MZ_FALSE);
+            return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
         }
 
-        mz_write_le16(new_ext_block + sizeof(mz_uint16), (mz_uint16)((pDst - new_ext_block) - sizeof(mz_uint16) * 2));
-
-        if (!mz_zip_array_push_back(pZip, pNew_ext, new_ext_block, pDst - new_ext_block))
+        if (!mz_zip_array_push_back(pZip, &pState->m_central_dir, pSrc_central_header + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + src_filename_len + src_ext_len, src_comment_len))
+        {
+            mz_zip_array_clear(pZip, &new_ext_block);
+            mz_zip_array_resize(pZip, &pState->m_central_dir, orig_central_dir_size, MZ_FALSE);
             return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
-    }
+        }
 
-    if ((pExt) && (ext_len))
+        mz_zip_array_clear(pZip, &new_ext_block);
+    }
+    else
     {
-        mz_uint32 extra_size_remaining = ext_len;
-        const mz_uint8 *pExtra_data = pExt;
+        /* sanity checks */
+        if (cur_dst_file_ofs > MZ_UINT32_MAX)
+            return mz_zip_set_error(pZip, MZ_ZIP_ARCHIVE_TOO_LARGE);
 
-        do
-        {
-            mz_uint32 field_id, field_data_size, field_total_size;
+        if (local_dir_header_ofs >= MZ_UINT32_MAX)
+            return mz_zip_set_error(pZip, MZ_ZIP_ARCHIVE_TOO_LARGE);
 
-            if (extra_size_remaining < (sizeof(mz_uint16) * 2))
-                return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
+        MZ_WRITE_LE32(new_central_header + MZ_ZIP_CDH_LOCAL_HEADER_OFS, local_dir_header_ofs);
 
-            field_id = MZ_READ_LE16(pExtra_data);
-            field_data_size = MZ_READ_LE16(pExtra_data + sizeof(mz_uint16));
-            field_total_size = field_data_size + sizeof(mz_uint16) * 2;
+        if (!mz_zip_array_push_back(pZip, &pState->m_central_dir, new_central_header, MZ_ZIP_CENTRAL_DIR_HEADER_SIZE))
+            return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
 
-            if (field_total_size > extra_size_remaining)
-                return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
+        if (!mz_zip_array_push_back(pZip, &pState->m_central_dir, pSrc_central_header + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE, src_central_dir_following_data_size))
+        {
+            mz_zip_array_resize(pZip, &pState->m_central_dir, orig_central_dir_size, MZ_FALSE);
+            return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+        }
+    }
 
-            if (field_id != MZ_ZIP64_EXTENDED_INFORMATION_FIELD_HEADER_ID)
-            {
-                if (!mz_zip_array_push_back(pZip, pNew_ext, pExtra_data, field_total_size))
-                    return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
-            }
+    /* This shouldn't trigger unless we screwed up during the initial sanity checks */
+    if (pState->m_central_dir.m_size >= MZ_UINT32_MAX)
+    {
+        /* TODO: Support central dirs >= 32-bits in size */
+        mz_zip_array_resize(pZip, &pState->m_central_dir, orig_central_dir_size, MZ_FALSE);
+        return mz_zip_set_error(pZip, MZ_ZIP_UNSUPPORTED_CDIR_SIZE);
+    }
 
-            pExtra_data += field_total_size;
-            extra_size_remaining -= field_total_size;
-        } while (extra_size_remaining);
+    n = (mz_uint32)orig_central_dir_size;
+    if (!mz_zip_array_push_back(pZip, &pState->m_central_dir_offsets, &n, 1))
+    {
+        mz_zip_array_resize(pZip, &pState->m_central_dir, orig_central_dir_size, MZ_FALSE);
+        return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
     }
 
+    pZip->m_total_files++;
+    pZip->m_archive_size = cur_dst_file_ofs;
+
     return MZ_TRUE;
 }
 
-/* TODO: This func is now pretty freakin complex due to zip64, split it up? */
 mz_bool mz_zip_writer_add_from_zip_reader(mz_zip_archive *pZip, mz_zip_archive *pSource_zip, mz_uint src_file_index)
 {
-    mz_uint n, bit_flags, num_alignment_padding_bytes, src_central_dir_following_data_size;
-    mz_uint64 src_archive_bytes_remaining, local_dir_header_ofs;
-    mz_uint64 cur_src_file_ofs, cur_dst_file_ofs;
-    mz_uint32 local_header_u32[(MZ_ZIP_LOCAL_DIR_HEADER_SIZE + sizeof(mz_uint32) - 1) / sizeof(mz_uint32)];
-    mz_uint8 *pLocal_header = (mz_uint8 *)local_header_u32;
-    mz_uint8 new_central_header[MZ_ZIP_CENTRAL_DIR_HEADER_SIZE];
-    size_t orig_central_dir_size;
-    mz_zip_internal_state *pState;
-    void *pBuf;
-    const mz_uint8 *pSrc_central_header;
-    mz_zip_archive_file_stat src_file_stat;
-    mz_uint32 src_filename_len, src_comment_len, src_ext_len;
-    mz_uint32 local_header_filename_size, local_header_extra_len;
-    mz_uint64 local_header_comp_size, local_header_uncomp_size;
-    mz_bool found_zip64_ext_data_in_ldir = MZ_FALSE;
-
-    /* Sanity checks */
-    if ((!pZip) || (!pZip->m_pState) || (pZip->m_zip_mode != MZ_ZIP_MODE_WRITING) || (!pSource_zip->m_pRead))
-        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+    return mz_zip_writer_add_range_from_zip_reader(pZip, pSource_zip, src_file_index, 1);
+}
 
-    pState = pZip->m_pState;
+mz_bool mz_zip_writer_add_range_from_zip_reader(mz_zip_archive *pZip, mz_zip_archive *pSource_zip, mz_uint first_src_file_index, mz_uint num_files)
+{
+    mz_zip_writer_raw_copy_range pending;
+    mz_uint64 orig_archive_size;
+    size_t orig_central_dir_size, orig_central_dir_offsets_size;
+    mz_uint32 orig_total_files;
+    mz_uint i;
 
-    /* Don't support copying files from zip64 archives to non-zip64, even though in some cases this is possible */
-    if ((pSource_zip->m_pState->m_zip64) && (!pZip->m_pState->m_zip64))
+    if ((!pZip) || (!pZip->m_pState) || (pZip->m_zip_mode != MZ_ZIP_MODE_WRITING) || (!pSource_zip) || (!pSource_zip->m_pState) || (!pSource_zip->m_pRead))
         return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
 
-    /* Get pointer to the source central dir header and crack it */
-    if (NULL == (pSrc_central_header = mz_zip_get_cdh(pSource_zip, src_file_index)))
+    if (((mz_uint64)first_src_file_index + num_files) > pSource_zip->m_total_files)
         return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
 
-    if (MZ_READ_LE32(pSrc_central_header + MZ_ZIP_CDH_SIG_OFS) != MZ_ZIP_CENTRAL_DIR_HEADER_SIG)
-        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
-
-    src_filename_len = MZ_READ_LE16(pSrc_central_header + MZ_ZIP_CDH_FILENAME_LEN_OFS);
-    src_comment_len = MZ_READ_LE16(pSrc_central_header + MZ_ZIP_CDH_COMMENT_LEN_OFS);
-    src_ext_len = MZ_READ_LE16(pSrc_central_header + MZ_ZIP_CDH_EXTRA_LEN_OFS);
-    src_central_dir_following_data_size = src_filename_len + src_ext_len + src_comment_len;
-
-    /* TODO: We don't support central dir's >= MZ_UINT32_MAX bytes right now (+32 fudge factor in case we need to add more extra data) */
-    if ((pState->m_central_dir.m_size + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + src_central_dir_following_data_size + 32) >= MZ_UINT32_MAX)
-        return mz_zip_set_error(pZip, MZ_ZIP_UNSUPPORTED_CDIR_SIZE);
+    orig_archive_size = pZip->m_archive_size;
+    orig_central_dir_size = pZip->m_pState->m_central_dir.m_size;
+    orig_central_dir_offsets_size = pZip->m_pState->m_central_dir_offsets.m_size;
+    orig_total_files = pZip->m_total_files;
 
-    num_alignment_padding_bytes = mz_zip_writer_compute_padding_needed_for_file_alignment(pZip);
+    MZ_CLEAR_OBJ(pending);
 
-    if (!pState->m_zip64)
-    {
-        if (pZip->m_total_files == MZ_UINT16_MAX)
-            return mz_zip_set_error(pZip, MZ_ZIP_TOO_MANY_FILES);
-    }
-    else
+    for (i = 0; i < num_files; i++)
     {
-        /* TODO: Our zip64 support still has some 32-bit limits that may not be worth fixing. */
-        if (pZip->m_total_files == MZ_UINT32_MAX)
-            return mz_zip_set_error(pZip, MZ_ZIP_TOO_MANY_FILES);
+        if (!mz_zip_writer_add_from_zip_reader_internal(pZip, pSource_zip, first_src_file_index + i, &pending))
+            break;
     }
 
-    if (!mz_zip_file_stat_internal(pSource_zip, src_file_index, pSrc_central_header, &src_file_stat, NULL))
-        return MZ_FALSE;
+    if ((i == num_files) && (mz_zip_writer_flush_raw_copy(pZip, pSource_zip, &pending)))
+        return MZ_TRUE;
 
-    cur_src_file_ofs = src_file_stat.m_local_header_ofs;
-    cur_dst_file_ofs = pZip->m_archive_size;
+    /* Entries whose data may never have been written must not make it into the central directory. */
+    pZip->m_archive_size = orig_archive_size;
+    pZip->m_total_files = orig_total_files;
+    mz_zip_array_resize(pZip, &pZip->m_pState->m_central_dir, orig_central_dir_size, MZ_FALSE);
+    mz_zip_array_resize(pZip, &pZip->m_pState->m_central_dir_offsets, orig_central_dir_offsets_size, MZ_FALSE);
+    return MZ_FALSE;
+}
 
-    /* Read the source archive's local dir header */
-    if (pSource_zip->m_pRead(pSource_zip->m_pIO_opaque, cur_src_file_ofs, pLocal_header, MZ_ZIP_LOCAL_DIR_HEADER_SIZE) != MZ_ZIP_LOCAL_DIR_HEADER_SIZE)
+/* Computes the number of bytes used by an entry's local header, filename, extra data, compressed data and optional data descriptor. pBuf must hold MZ_ZIP_MAX_IO_BUF_SIZE bytes. */
+static mz_bool mz_zip_writer_get_local_entry_span(mz_zip_archive *pZip, mz_uint file_index, mz_uint8 *pBuf, mz_uint64 *pLocal_header_ofs, mz_uint64 *pSpan)
+{
+    mz_zip_archive_file_stat file_stat;
+    mz_uint32 local_header_u32[(MZ_ZIP_LOCAL_DIR_HEADER_SIZE + sizeof(mz_uint32) - 1) / sizeof(mz_uint32)];
+    mz_uint8 *pLocal_header = (mz_uint8 *)local_header_u32;
+    mz_uint32 filename_len, extra_len;
+    mz_uint64 span;
+
+    if (!mz_zip_file_stat_internal(pZip, file_index, mz_zip_get_cdh(pZip, file_index), &file_stat, NULL))
+        return MZ_FALSE;
+
+    if (MZ_ZIP_READ(pZip, file_stat.m_local_header_ofs, pLocal_header, MZ_ZIP_LOCAL_DIR_HEADER_SIZE) != MZ_ZIP_LOCAL_DIR_HEADER_SIZE)
         return mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
 
     if (MZ_READ_LE32(pLocal_header) != MZ_ZIP_LOCAL_DIR_HEADER_SIG)
         return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
 
-    cur_src_file_ofs += MZ_ZIP_LOCAL_DIR_HEADER_SIZE;
-
-    /* Compute the total size we need to copy (filename+extra data+compressed data) */
-    local_header_filename_size = MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_FILENAME_LEN_OFS);
-    local_header_extra_len = MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_EXTRA_LEN_OFS);
-    local_header_comp_size = MZ_READ_LE32(pLocal_header + MZ_ZIP_LDH_COMPRESSED_SIZE_OFS);
-    local_header_uncomp_size = MZ_READ_LE32(pLocal_header + MZ_ZIP_LDH_DECOMPRESSED_SIZE_OFS);
-    src_archive_bytes_remaining = local_header_filename_size + local_header_extra_len + src_file_stat.m_comp_size;
+    filename_len = MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_FILENAME_LEN_OFS);
+    extra_len = MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_EXTRA_LEN_OFS);
+    span = MZ_ZIP_LOCAL_DIR_HEADER_SIZE + filename_len + extra_len + file_stat.m_comp_size;
 
-    /* Try to find a zip64 extended information field */
-    if ((local_header_extra_len) && ((local_header_comp_size == MZ_UINT32_MAX) || (local_header_uncomp_size == MZ_UINT32_MAX)))
+    if (MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_BIT_FLAG_OFS) & 8)
     {
-        mz_zip_array file_data_array;
-        const mz_uint8 *pExtra_data;
-        mz_uint32 extra_size_remaining = local_header_extra_len;
+        /* The descriptor's sizes are 64-bit if the local header has a zip64 extended information field */
+        mz_bool has_zip64_field = MZ_FALSE;
+        const mz_uint8 *pExtra_data = pBuf;
+        mz_uint32 extra_size_remaining = extra_len;
 
-        mz_zip_array_init(&file_data_array, 1);
-        if (!mz_zip_array_resize(pZip, &file_data_array, local_header_extra_len, MZ_FALSE))
-        {
-            return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
-        }
-
-        if (pSource_zip->m_pRead(pSource_zip->m_pIO_opaque, src_file_stat.m_local_header_ofs + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + local_header_filename_size, file_data_array.m_p, local_header_extra_len) != local_header_extra_len)
-        {
-            mz_zip_array_clear(pZip, &file_data_array);
+        if ((extra_len) && (MZ_ZIP_READ(pZip, file_stat.m_local_header_ofs + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + filename_len, pBuf, extra_len) != extra_len))
             return mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
-        }
-
-        pExtra_data = (const mz_uint8 *)file_data_array.m_p;
 
-        do
+        while (extra_size_remaining >= sizeof(mz_uint16) * 2)
         {
-            mz_uint32 field_id, field_data_size, field_total_size;
+            mz_uint32 field_total_size = MZ_READ_LE16(pExtra_data + sizeof(mz_uint16)) + sizeof(mz_uint16) * 2;
 
-            if (extra_size_remaining < (sizeof(mz_uint16) * 2))
+            if (MZ_READ_LE16(pExtra_data) == MZ_ZIP64_EXTENDED_INFORMATION_FIELD_HEADER_ID)
             {
-                mz_zip_array_clear(pZip, &file_data_array);
-                return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
+                has_zip64_field = MZ_TRUE;
+                break;
             }
 
-            field_id = MZ_READ_LE16(pExtra_data);
-            field_data_size = MZ_READ_LE16(pExtra_data + sizeof(mz_uint16));
-            field_total_size = field_data_size + sizeof(mz_uint16) * 2;
-
             if (field_total_size > extra_size_remaining)
-            {
-                mz_zip_array_clear(pZip, &file_data_array);
-                return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
-            }
-
-            if (field_id == MZ_ZIP64_EXTENDED_INFORMATION_FIELD_HEADER_ID)
-            {
-                const mz_uint8 *pSrc_field_data = pExtra_data + sizeof(mz_uint32);
-
-                if (field_data_size < sizeof(mz_uint64) * 2)
-                {
-                    mz_zip_array_clear(pZip, &file_data_array);
-                    return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
-                }
-
-                local_header_uncomp_size = MZ_READ_LE64(pSrc_field_data);
-                local_header_comp_size = MZ_READ_LE64(pSrc_field_data + sizeof(mz_uint64)); /* may be 0 if there's a descriptor */
-
-                found_zip64_ext_data_in_ldir = MZ_TRUE;
                 break;
-            }
 
             pExtra_data += field_total_size;
             extra_size_remaining -= field_total_size;
-        } while (extra_size_remaining);
-
-        mz_zip_array_clear(pZip, &file_data_array);
-    }
+        }
 
-    if (!pState->m_zip64)
-    {
-        /* Try to detect if the new archive will most likely wind up too big and bail early (+(sizeof(mz_uint32) * 4) is for the optional descriptor which could be present, +64 is a fudge factor). */
-        /* We also check when the archive is finalized so this doesn't need to be perfect. */
-        mz_uint64 approx_new_archive_size = cur_dst_file_ofs + num_alignment_padding_bytes + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + src_archive_bytes_remaining + (sizeof(mz_uint32) * 4) +
-                                            pState->m_central_dir.m_size + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + src_central_dir_following_data_size + MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIZE + 64;
+        if (MZ_ZIP_READ(pZip, file_stat.m_local_header_ofs + span, pBuf, sizeof(mz_uint32)) != sizeof(mz_uint32))
+            return mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
 
-        if (approx_new_archive_size >= MZ_UINT32_MAX)
-            return mz_zip_set_error(pZip, MZ_ZIP_ARCHIVE_TOO_LARGE);
+        span += ((MZ_READ_LE32(pBuf) == MZ_ZIP_DATA_DESCRIPTOR_ID) ? sizeof(mz_uint32) : 0) + sizeof(mz_uint32) + (has_zip64_field ? sizeof(mz_uint64) * 2 : sizeof(mz_uint32) * 2);
     }
 
-    /* Write dest archive padding */
-    if (!mz_zip_writer_write_zeros(pZip, cur_dst_file_ofs, num_alignment_padding_bytes))
-        return MZ_FALSE;
+    *pLocal_header_ofs = file_stat.m_local_header_ofs;
+    *pSpan = span;
+    return MZ_TRUE;
+}
 
-    cur_dst_file_ofs += num_alignment_padding_bytes;
+/* Rewrites the local header offset of an entry's central directory record, either in the record itself or in its zip64 extended information field. */
+static mz_bool mz_zip_writer_set_local_header_ofs(mz_zip_archive *pZip, mz_uint file_index, mz_uint64 local_header_ofs)
+{
+    mz_uint8 *pCentral_header = (mz_uint8 *)mz_zip_get_cdh(pZip, file_index);
+    mz_uint8 *pExtra_data;
+    mz_uint32 extra_size_remaining;
 
-    local_dir_header_ofs = cur_dst_file_ofs;
-    if (pZip->m_file_offset_alignment)
+    if (MZ_READ_LE32(pCentral_header + MZ_ZIP_CDH_LOCAL_HEADER_OFS) != MZ_UINT32_MAX)
     {
-        MZ_ASSERT((local_dir_header_ofs & (pZip->m_file_offset_alignment - 1)) == 0);
+        if (local_header_ofs >= MZ_UINT32_MAX)
+            return mz_zip_set_error(pZip, MZ_ZIP_ARCHIVE_TOO_LARGE);
+
+        MZ_WRITE_LE32(pCentral_header + MZ_ZIP_CDH_LOCAL_HEADER_OFS, local_header_ofs);
+        return MZ_TRUE;
     }
 
-    /* The original zip's local header+ext block doesn't change, even with zip64, so we can just copy it over to the dest zip */
-    if (pZip->m_pWrite(pZip->m_pIO_opaque, cur_dst_file_ofs, pLocal_header, MZ_ZIP_LOCAL_DIR_HEADER_SIZE) != MZ_ZIP_LOCAL_DIR_HEADER_SIZE)
-        return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
+    pExtra_data = pCentral_header + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + MZ_READ_LE16(pCentral_header + MZ_ZIP_CDH_FILENAME_LEN_OFS);
+    extra_size_remaining = MZ_READ_LE16(pCentral_header + MZ_ZIP_CDH_EXTRA_LEN_OFS);
 
-    cur_dst_file_ofs += MZ_ZIP_LOCAL_DIR_HEADER_SIZE;
+    while (extra_size_remaining >= sizeof(mz_uint16) * 2)
+    {
+        mz_uint32 field_data_size = MZ_READ_LE16(pExtra_data + sizeof(mz_uint16));
 
-    /* Copy over the source archive bytes to the dest archive, also ensure we have enough buf space to handle optional data descriptor */
-    if (NULL == (pBuf = pZip->m_pAlloc(pZip->m_pAlloc_opaque, 1, (size_t)MZ_MAX(32U, MZ_MIN((mz_uint64)MZ_ZIP_MAX_IO_BUF_SIZE, src_archive_bytes_remaining)))))
-        return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+        if (field_data_size + sizeof(mz_uint16) * 2 > extra_size_remaining)
+            break;
 
-    while (src_archive_bytes_remaining)
-    {
-        n = (mz_uint)MZ_MIN((mz_uint64)MZ_ZIP_MAX_IO_BUF_SIZE, src_archive_bytes_remaining);
-        if (pSource_zip->m_pRead(pSource_zip->m_pIO_opaque, cur_src_file_ofs, pBuf, n) != n)
+        if (MZ_READ_LE16(pExtra_data) == MZ_ZIP64_EXTENDED_INFORMATION_FIELD_HEADER_ID)
         {
-            pZip->m_pFree(pZip->m_pAlloc_opaque, pBuf);
-            return mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
-        }
-        cur_src_file_ofs += n;
+            mz_uint8 *pField_data = pExtra_data + sizeof(mz_uint16) * 2;
+            mz_uint32 field_ofs = 0;
 
-        if (pZip->m_pWrite(pZip->m_pIO_opaque, cur_dst_file_ofs, pBuf, n) != n)
-        {
-            pZip->m_pFree(pZip->m_pAlloc_opaque, pBuf);
-            return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
+            if (MZ_READ_LE32(pCentral_header + MZ_ZIP_CDH_DECOMPRESSED_SIZE_OFS) == MZ_UINT32_MAX)
+                field_ofs += sizeof(mz_uint64);
+            if (MZ_READ_LE32(pCentral_header + MZ_ZIP_CDH_COMPRESSED_SIZE_OFS) == MZ_UINT32_MAX)
+                field_ofs += sizeof(mz_uint64);
+
+            if (field_ofs + sizeof(mz_uint64) > field_data_size)
+                break;
+
+            MZ_WRITE_LE64(pField_data + field_ofs, local_header_ofs);
+            return MZ_TRUE;
         }
-        cur_dst_file_ofs += n;
 
-        src_archive_bytes_remaining -= n;
+        pExtra_data += field_data_size + sizeof(mz_uint16) * 2;
+        extra_size_remaining -= field_data_size + sizeof(mz_uint16) * 2;
     }
 
-    /* Now deal with the optional data descriptor */
-    bit_flags = MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_BIT_FLAG_OFS);
-    if (bit_flags & 8)
-    {
-        /* Copy data descriptor */
-        if ((pSource_zip->m_pState->m_zip64) || (found_zip64_ext_data_in_ldir))
-        {
-            /* src is zip64, dest must be zip64 */
+    return mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
+}
 
-            /* name			uint32_t's */
-            /* id				1 (optional in zip64?) */
-            /* crc			1 */
-            /* comp_size	2 */
-            /* uncomp_size 2 */
-            if (pSource_zip->m_pRead(pSource_zip->m_pIO_opaque, cur_src_file_ofs, pBuf, (sizeof(mz_uint32) * 6)) != (sizeof(mz_uint32) * 6))
-            {
-                pZip->m_pFree(pZip->m_pAlloc_opaque, pBuf);
-                return mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
-            }
+/* Deleting or compacting entries makes the finalized archive end before the old one did, so the output must be cut to the new size or the old end of central directory record stays behind */
+/* at its end. That's only possible for heap archives and for files opened by filename on platforms with MZ_FTRUNCATE(). Checked before anything is changed. */
+static mz_bool mz_zip_writer_can_truncate(mz_zip_archive *pZip)
+{
+    if ((pZip->m_pWrite == mz_zip_heap_write_func) || (pZip->m_pWrite == mz_zip_heap_chunked_write_func))
+        return MZ_TRUE;
+#if !defined(MINIZ_NO_STDIO) && defined(MZ_FTRUNCATE)
+    if ((pZip->m_pWrite == mz_zip_file_write_func) && (pZip->m_zip_type == MZ_ZIP_TYPE_FILE) && (pZip->m_pState->m_pFile))
+        return MZ_TRUE;
+#endif
+    return MZ_FALSE;
+}
 
-            n = sizeof(mz_uint32) * ((MZ_READ_LE32(pBuf) == MZ_ZIP_DATA_DESCRIPTOR_ID) ? 6 : 5);
-        }
-        else
-        {
-            /* src is NOT zip64 */
-            mz_bool has_id;
+mz_bool mz_zip_writer_delete_file(mz_zip_archive *pZip, mz_uint file_index)
+{
+    mz_zip_internal_state *pState;
+    mz_uint32 record_ofs, record_size;
+    mz_uint i;
 
-            if (pSource_zip->m_pRead(pSource_zip->m_pIO_opaque, cur_src_file_ofs, pBuf, sizeof(mz_uint32) * 4) != sizeof(mz_uint32) * 4)
-            {
-                pZip->m_pFree(pZip->m_pAlloc_opaque, pBuf);
-                return mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
-            }
+    if ((!pZip) || (!pZip->m_pState) || (pZip->m_zip_mode != MZ_ZIP_MODE_WRITING) || (file_index >= pZip->m_total_files))
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+
+    if (!mz_zip_writer_can_truncate(pZip))
+        return mz_zip_set_error(pZip, MZ_ZIP_UNSUPPORTED_FEATURE);
+
+    pState = pZip->m_pState;
+
+    record_ofs = MZ_ZIP_ARRAY_ELEMENT(&pState->m_central_dir_offsets, mz_uint32, file_index);
+    if (file_index + 1 < pZip->m_total_files)
+        record_size = MZ_ZIP_ARRAY_ELEMENT(&pState->m_central_dir_offsets, mz_uint32, file_index + 1) - record_ofs;
+    else
+        record_size = (mz_uint32)pState->m_central_dir.m_size - record_ofs;
+
+    /* Drop the central dir record, the local header and data become dead space */
+    memmove((mz_uint8 *)pState->m_central_dir.m_p + record_ofs, (mz_uint8 *)pState->m_central_dir.m_p + record_ofs + record_size, pState->m_central_dir.m_size - record_ofs - record_size);
+    pState->m_central_dir.m_size -= record_size;
+
+    for (i = file_index + 1; i < pZip->m_total_files; i++)
+        MZ_ZIP_ARRAY_ELEMENT(&pState->m_central_dir_offsets, mz_uint32, i - 1) = MZ_ZIP_ARRAY_ELEMENT(&pState->m_central_dir_offsets, mz_uint32, i) - record_size;
+    pState->m_central_dir_offsets.m_size--;
+
+    pZip->m_total_files--;
+    pState->m_num_deleted_files++;
+    pState->m_truncate_on_finalize = MZ_TRUE;
+
+    /* The deleted entry's data may be compacted away, so it can't be shared anymore */
+    mz_zip_writer_dedup_reset(pZip);
 
-            has_id = (MZ_READ_LE32(pBuf) == MZ_ZIP_DATA_DESCRIPTOR_ID);
+    return MZ_TRUE;
+}
 
-            if (pZip->m_pState->m_zip64)
-            {
-                /* dest is zip64, so upgrade the data descriptor */
-                const mz_uint8 *pSrc_descriptor = (const mz_uint8 *)pBuf + (has_id ? sizeof(mz_uint32) : 0);
-                const mz_uint32 src_crc32 = MZ_READ_LE32(pSrc_descriptor);
-                const mz_uint64 src_comp_size = MZ_READ_LE32(pSrc_descriptor + sizeof(mz_uint32));
-                const mz_uint64 src_uncomp_size = MZ_READ_LE32(pSrc_descriptor + 2*sizeof(mz_uint32));
+mz_uint64 mz_zip_writer_get_dead_space(mz_zip_archive *pZip)
+{
+    mz_uint64 live_size = 0;
+    mz_uint i;
 
-                mz_write_le32((mz_uint8 *)pBuf, MZ_ZIP_DATA_DESCRIPTOR_ID);
-                mz_write_le32((mz_uint8 *)pBuf + sizeof(mz_uint32) * 1, src_crc32);
-                mz_write_le64((mz_uint8 *)pBuf + sizeof(mz_uint32) * 2, src_comp_size);
-                mz_write_le64((mz_uint8 *)pBuf + sizeof(mz_uint32) * 4, src_uncomp_size);
+    if ((!pZip) || (!pZip->m_pState) || (pZip->m_zip_mode != MZ_ZIP_MODE_WRITING))
+        return 0;
 
-                n = sizeof(mz_uint32) * 6;
-            }
-            else
-            {
-                /* dest is NOT zip64, just copy it as-is */
-                n = sizeof(mz_uint32) * (has_id ? 4 : 3);
-            }
-        }
+    for (i = 0; i < pZip->m_total_files; i++)
+    {
+        const mz_uint8 *pCentral_header = mz_zip_get_cdh(pZip, i);
+        mz_zip_archive_file_stat file_stat;
 
-        if (pZip->m_pWrite(pZip->m_pIO_opaque, cur_dst_file_ofs, pBuf, n) != n)
-        {
-            pZip->m_pFree(pZip->m_pAlloc_opaque, pBuf);
-            return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
-        }
+        if (!mz_zip_file_stat_internal(pZip, i, pCentral_header, &file_stat, NULL))
+            return 0;
 
-        cur_src_file_ofs += n;
-        cur_dst_file_ofs += n;
+        /* The local extra data is assumed to be the same size as the central one */
+        live_size += MZ_ZIP_LOCAL_DIR_HEADER_SIZE + MZ_READ_LE16(pCentral_header + MZ_ZIP_CDH_FILENAME_LEN_OFS) + MZ_READ_LE16(pCentral_header + MZ_ZIP_CDH_EXTRA_LEN_OFS) + file_stat.m_comp_size;
+        if (file_stat.m_bit_flag & 8)
+            live_size += MZ_ZIP_DATA_DESCRIPTER_SIZE32;
     }
-    pZip->m_pFree(pZip->m_pAlloc_opaque, pBuf);
 
-    /* Finally, add the new central dir header */
-    orig_central_dir_size = pState->m_central_dir.m_size;
+    return (pZip->m_archive_size > live_size) ? (pZip->m_archive_size - live_size) : 0;
+}
 
-    memcpy(new_central_header, pSrc_central_header, MZ_ZIP_CENTRAL_DIR_HEADER_SIZE);
+mz_bool mz_zip_writer_set_compact_threshold(mz_zip_archive *pZip, mz_uint percent)
+{
+    if ((!pZip) || (!pZip->m_pState) || (pZip->m_zip_mode != MZ_ZIP_MODE_WRITING))
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
 
-    if (pState->m_zip64)
-    {
-        /* This is the painful part: We need to write a new central dir header + ext block with updated zip64 fields, and ensure the old fields (if any) are not included. */
-        const mz_uint8 *pSrc_ext = pSrc_central_header + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + src_filename_len;
-        mz_zip_array new_ext_block;
+    pZip->m_pState->m_compact_threshold = percent;
+    return MZ_TRUE;
+}
 
-        mz_zip_array_init(&new_ext_block, sizeof(mz_uint8));
+mz_bool mz_zip_writer_compact(mz_zip_archive *pZip)
+{
+    mz_zip_array entries;
+    mz_zip_local_header_entry *pEntries;
+    mz_uint8 *pBuf;
+    mz_uint64 cur_dst_file_ofs = 0;
+    mz_bool status = MZ_TRUE;
+    mz_uint32 i;
 
-        MZ_WRITE_LE32(new_central_header + MZ_ZIP_CDH_COMPRESSED_SIZE_OFS, MZ_UINT32_MAX);
-        MZ_WRITE_LE32(new_central_header + MZ_ZIP_CDH_DECOMPRESSED_SIZE_OFS, MZ_UINT32_MAX);
-        MZ_WRITE_LE32(new_central_header + MZ_ZIP_CDH_LOCAL_HEADER_OFS, MZ_UINT32_MAX);
+    if ((!pZip) || (!pZip->m_pState) || (pZip->m_zip_mode != MZ_ZIP_MODE_WRITING) || (!pZip->m_pRead) || (!pZip->m_pWrite))
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
 
-        if (!mz_zip_writer_update_zip64_extension_block(&new_ext_block, pZip, pSrc_ext, src_ext_len, &src_file_stat.m_comp_size, &src_file_stat.m_uncomp_size, &local_dir_header_ofs, NULL))
+    if (!mz_zip_writer_can_truncate(pZip))
+        return mz_zip_set_error(pZip, MZ_ZIP_UNSUPPORTED_FEATURE);
+
+    mz_zip_array_init(&entries, sizeof(mz_zip_local_header_entry));
+    if (!mz_zip_array_resize(pZip, &entries, pZip->m_total_files, MZ_FALSE))
+        return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+    pEntries = (mz_zip_local_header_entry *)entries.m_p;
+
+    if (NULL == (pBuf = (mz_uint8 *)MZ_ZIP_ALLOC(pZip, 1, MZ_ZIP_MAX_IO_BUF_SIZE)))
+    {
+        mz_zip_array_clear(pZip, &entries);
+        return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+    }
+
+    for (i = 0; i < pZip->m_total_files; i++)
+    {
+        mz_zip_archive_file_stat file_stat;
+        if (!mz_zip_file_stat_internal(pZip, i, mz_zip_get_cdh(pZip, i), &file_stat, NULL))
         {
-            mz_zip_array_clear(pZip, &new_ext_block);
-            return MZ_FALSE;
+            status = MZ_FALSE;
+            break;
         }
+        pEntries[i].m_local_header_ofs = file_stat.m_local_header_ofs;
+        pEntries[i].m_file_index = i;
+    }
 
-        MZ_WRITE_LE16(new_central_header + MZ_ZIP_CDH_EXTRA_LEN_OFS, new_ext_block.m_size);
+    if (status)
+        mz_zip_sort_by_local_header_ofs(pEntries, pZip->m_total_files);
 
-        if (!mz_zip_array_push_back(pZip, &pState->m_central_dir, new_central_header, MZ_ZIP_CENTRAL_DIR_HEADER_SIZE))
+    /* Entries only ever move towards the start of the archive, so each one can be copied front to back in place */
+    for (i = 0; (status) && (i < pZip->m_total_files); i++)
+    {
+        mz_uint64 cur_src_file_ofs, span, n;
+
+        if (!mz_zip_writer_get_local_entry_span(pZip, pEntries[i].m_file_index, pBuf, &cur_src_file_ofs, &span))
         {
-            mz_zip_array_clear(pZip, &new_ext_block);
-            return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+            status = MZ_FALSE;
+            break;
         }
 
-        if (!mz_zip_array_push_back(pZip, &pState->m_central_dir, pSrc_central_header + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE, src_filename_len))
+        if (cur_src_file_ofs < cur_dst_file_ofs)
         {
-            mz_zip_array_clear(pZip, &new_ext_block);
-            mz_zip_array_resize(pZip, &pState->m_central_dir, orig_central_dir_size, MZ_FALSE);
-            return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+            /* Overlapping entries */
+            status = mz_zip_set_error(pZip, MZ_ZIP_INVALID_HEADER_OR_CORRUPTED);
+            break;
         }
 
-        if (!mz_zip_array_push_back(pZip, &pState->m_central_dir, new_ext_block.m_p, new_ext_block.m_size))
+        /* Keep the requested file alignment whenever there's room for it */
+        if (pZip->m_file_offset_alignment)
         {
-            mz_zip_array_clear(pZip, &new_ext_block);
-            mz_zip_array_resize(pZip, &pState->m_central_dir, orig_central_dir_size, MZ_FALSE);
-            return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+            mz_uint64 aligned_ofs = (cur_dst_file_ofs + pZip->m_file_offset_alignment - 1) & ~((mz_uint64)pZip->m_file_offset_alignment - 1);
+            if (aligned_ofs <= cur_src_file_ofs)
+            {
+                if (!mz_zip_writer_write_zeros(pZip, cur_dst_file_ofs, (mz_uint32)(aligned_ofs - cur_dst_file_ofs)))
+                {
+                    status = MZ_FALSE;
+                    break;
+                }
+                cur_dst_file_ofs = aligned_ofs;
+            }
         }
 
-        if (!mz_zip_array_push_back(pZip, &pState->m_central_dir, pSrc_central_header + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + src_filename_len + src_ext_len, src_comment_len))
+        if (cur_src_file_ofs != cur_dst_file_ofs)
         {
-            mz_zip_array_clear(pZip, &new_ext_block);
-            mz_zip_array_resize(pZip, &pState->m_central_dir, orig_central_dir_size, MZ_FALSE);
-            return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+            if (!mz_zip_writer_set_local_header_ofs(pZip, pEntries[i].m_file_index, cur_dst_file_ofs))
+            {
+                status = MZ_FALSE;
+                break;
+            }
+
+            for (n = 0; n < span;)
+            {
+                mz_uint32 len = (mz_uint32)MZ_MIN((mz_uint64)MZ_ZIP_MAX_IO_BUF_SIZE, span - n);
+
+                if (MZ_ZIP_READ(pZip, cur_src_file_ofs + n, pBuf, len) != len)
+                {
+                    status = mz_zip_set_error(pZip, MZ_ZIP_FILE_READ_FAILED);
+                    break;
+                }
+
+                if (MZ_ZIP_WRITE(pZip, cur_dst_file_ofs + n, pBuf, len) != len)
+                {
+                    status = mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
+                    break;
+                }
+
+                n += len;
+            }
         }
 
-        mz_zip_array_clear(pZip, &new_ext_block);
+        cur_dst_file_ofs += span;
     }
-    else
-    {
-        /* sanity checks */
-        if (cur_dst_file_ofs > MZ_UINT32_MAX)
-            return mz_zip_set_error(pZip, MZ_ZIP_ARCHIVE_TOO_LARGE);
 
-        if (local_dir_header_ofs >= MZ_UINT32_MAX)
-            return mz_zip_set_error(pZip, MZ_ZIP_ARCHIVE_TOO_LARGE);
+    MZ_ZIP_FREE(pZip, pBuf, MZ_ZIP_MAX_IO_BUF_SIZE);
+    mz_zip_array_clear(pZip, &entries);
 
-        MZ_WRITE_LE32(new_central_header + MZ_ZIP_CDH_LOCAL_HEADER_OFS, local_dir_header_ofs);
+    if (!status)
+        return MZ_FALSE;
 
-        if (!mz_zip_array_push_back(pZip, &pState->m_central_dir, new_central_header, MZ_ZIP_CENTRAL_DIR_HEADER_SIZE))
-            return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+    pZip->m_archive_size = cur_dst_file_ofs;
+    pZip->m_pState->m_truncate_on_finalize = MZ_TRUE;
+    mz_zip_writer_dedup_reset(pZip);
+    return MZ_TRUE;
+}
 
-        if (!mz_zip_array_push_back(pZip, &pState->m_central_dir, pSrc_central_header + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE, src_central_dir_following_data_size))
-        {
-            mz_zip_array_resize(pZip, &pState->m_central_dir, orig_central_dir_size, MZ_FALSE);
-            return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
-        }
-    }
+/* Writes the lookup index read by mz_zip_reader_load_index(): the central dir record offsets, the offsets sorted by filename, and a trailer. */
+/* It sits between the last entry and the central directory, where other zip readers just see some unreferenced bytes. */
+static mz_bool mz_zip_writer_write_index(mz_zip_archive *pZip)
+{
+    mz_zip_internal_state *pState = pZip->m_pState;
+    const mz_uint32 total_files = pZip->m_total_files;
+    const size_t table_size = total_files * sizeof(mz_uint32);
+    mz_uint8 trailer[MZ_ZIP_INDEX_TRAILER_SIZE];
+    mz_uint32 index_crc32, i;
+    mz_bool status = MZ_TRUE;
 
-    /* This shouldn't trigger unless we screwed up during the initial sanity checks */
-    if (pState->m_central_dir.m_size >= MZ_UINT32_MAX)
-    {
-        /* TODO: Support central dirs >= 32-bits in size */
-        mz_zip_array_resize(pZip, &pState->m_central_dir, orig_central_dir_size, MZ_FALSE);
-        return mz_zip_set_error(pZip, MZ_ZIP_UNSUPPORTED_CDIR_SIZE);
-    }
+    if (!mz_zip_array_resize(pZip, &pState->m_sorted_central_dir_offsets, total_files, MZ_FALSE))
+        return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
 
-    n = (mz_uint32)orig_central_dir_size;
-    if (!mz_zip_array_push_back(pZip, &pState->m_central_dir_offsets, &n, 1))
+    for (i = 0; i < total_files; i++)
+        MZ_ZIP_ARRAY_ELEMENT(&pState->m_sorted_central_dir_offsets, mz_uint32, i) = i;
+
+    mz_zip_reader_sort_central_dir_offsets_by_filename(pZip);
+
+#if !MINIZ_LITTLE_ENDIAN
+    for (i = 0; i < total_files; i++)
     {
-        mz_zip_array_resize(pZip, &pState->m_central_dir, orig_central_dir_size, MZ_FALSE);
-        return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+        MZ_WRITE_LE32((mz_uint8 *)&MZ_ZIP_ARRAY_ELEMENT(&pState->m_central_dir_offsets, mz_uint32, i), MZ_ZIP_ARRAY_ELEMENT(&pState->m_central_dir_offsets, mz_uint32, i));
+        MZ_WRITE_LE32((mz_uint8 *)&MZ_ZIP_ARRAY_ELEMENT(&pState->m_sorted_central_dir_offsets, mz_uint32, i), MZ_ZIP_ARRAY_ELEMENT(&pState->m_sorted_central_dir_offsets, mz_uint32, i));
     }
+#endif
 
-    pZip->m_total_files++;
-    pZip->m_archive_size = cur_dst_file_ofs;
+    index_crc32 = (mz_uint32)MZ_ZIP_CRC32(pZip, MZ_CRC32_INIT, (const mz_uint8 *)pState->m_central_dir_offsets.m_p, table_size);
+    index_crc32 = (mz_uint32)MZ_ZIP_CRC32(pZip, index_crc32, (const mz_uint8 *)pState->m_sorted_central_dir_offsets.m_p, table_size);
 
-    return MZ_TRUE;
+    MZ_CLEAR_ARR(trailer);
+    MZ_WRITE_LE32(trailer + MZ_ZIP_INDEX_SIG_OFS, MZ_ZIP_INDEX_TRAILER_SIG);
+    MZ_WRITE_LE16(trailer + MZ_ZIP_INDEX_VERSION_OFS, MZ_ZIP_INDEX_VERSION);
+    MZ_WRITE_LE32(trailer + MZ_ZIP_INDEX_TOTAL_ENTRIES_OFS, total_files);
+    MZ_WRITE_LE32(trailer + MZ_ZIP_INDEX_CDIR_SIZE_OFS, pState->m_central_dir.m_size);
+    MZ_WRITE_LE32(trailer + MZ_ZIP_INDEX_CRC32_OFS, index_crc32);
+
+    if ((MZ_ZIP_WRITE(pZip, pZip->m_archive_size, pState->m_central_dir_offsets.m_p, table_size) != table_size) ||
+        (MZ_ZIP_WRITE(pZip, pZip->m_archive_size + table_size, pState->m_sorted_central_dir_offsets.m_p, table_size) != table_size) ||
+        (MZ_ZIP_WRITE(pZip, pZip->m_archive_size + table_size * 2, trailer, MZ_ZIP_INDEX_TRAILER_SIZE) != MZ_ZIP_INDEX_TRAILER_SIZE))
+        status = mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
+
+#if !MINIZ_LITTLE_ENDIAN
+    for (i = 0; i < total_files; i++)
+        MZ_ZIP_ARRAY_ELEMENT(&pState->m_central_dir_offsets, mz_uint32, i) = MZ_READ_LE32(&MZ_ZIP_ARRAY_ELEMENT(&pState->m_central_dir_offsets, mz_uint32, i));
+#endif
+
+    /* The sorted offsets aren't maintained while writing */
+    mz_zip_array_clear(pZip, &pState->m_sorted_central_dir_offsets);
+
+    if (status)
+        pZip->m_archive_size += table_size * 2 + MZ_ZIP_INDEX_TRAILER_SIZE;
+
+    return status;
 }
 
 mz_bool mz_zip_writer_finalize_archive(mz_zip_archive *pZip)
@@ -7352,6 +11717,17 @@ mz_bool mz_zip_writer_finalize_archive(mz_zip_archive *pZip)
 
     pState = pZip->m_pState;
 
+    /* Compact the archive if deleted entries left too much dead space behind */
+    if ((pState->m_num_deleted_files) && (pState->m_compact_threshold < 100) && (pZip->m_pRead))
+    {
+        mz_uint64 dead_space = mz_zip_writer_get_dead_space(pZip);
+        if ((dead_space) && (dead_space * 100 >= (mz_uint64)pState->m_compact_threshold * pZip->m_archive_size))
+        {
+            if (!mz_zip_writer_compact(pZip))
+                return MZ_FALSE;
+        }
+    }
+
     if (pState->m_zip64)
     {
         if ((mz_uint64)pState->m_central_dir.m_size >= MZ_UINT32_MAX)
@@ -7359,19 +11735,27 @@ mz_bool mz_zip_writer_finalize_archive(mz_zip_archive *pZip)
     }
     else
     {
-        if ((pZip->m_total_files > MZ_UINT16_MAX) || ((pZip->m_archive_size + pState->m_central_dir.m_size + MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIZE) > MZ_UINT32_MAX))
+        /* The index goes in front of the central directory, which must still start below 4 GB */
+        mz_uint64 index_size = ((pZip->m_total_files) && (pState->m_write_index)) ? (mz_uint64)pZip->m_total_files * sizeof(mz_uint32) * 2 + MZ_ZIP_INDEX_TRAILER_SIZE : 0;
+        if ((pZip->m_total_files > MZ_UINT16_MAX) || ((pZip->m_archive_size + index_size + pState->m_central_dir.m_size + MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIZE) > MZ_UINT32_MAX))
             return mz_zip_set_error(pZip, MZ_ZIP_TOO_MANY_FILES);
     }
 
     central_dir_ofs = 0;
     central_dir_size = 0;
+    if ((pZip->m_total_files) && (pState->m_write_index))
+    {
+        if (!mz_zip_writer_write_index(pZip))
+            return MZ_FALSE;
+    }
+
     if (pZip->m_total_files)
     {
         /* Write central directory */
         central_dir_ofs = pZip->m_archive_size;
         central_dir_size = pState->m_central_dir.m_size;
         pZip->m_central_directory_file_ofs = central_dir_ofs;
-        if (pZip->m_pWrite(pZip->m_pIO_opaque, central_dir_ofs, pState->m_central_dir.m_p, (size_t)central_dir_size) != central_dir_size)
+        if (MZ_ZIP_WRITE(pZip, central_dir_ofs, pState->m_central_dir.m_p, (size_t)central_dir_size) != central_dir_size)
             return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
 
         pZip->m_archive_size += central_dir_size;
@@ -7391,7 +11775,7 @@ mz_bool mz_zip_writer_finalize_archive(mz_zip_archive *pZip)
         MZ_WRITE_LE64(hdr + MZ_ZIP64_ECDH_CDIR_TOTAL_ENTRIES_OFS, pZip->m_total_files);
         MZ_WRITE_LE64(hdr + MZ_ZIP64_ECDH_CDIR_SIZE_OFS, central_dir_size);
         MZ_WRITE_LE64(hdr + MZ_ZIP64_ECDH_CDIR_OFS_OFS, central_dir_ofs);
-        if (pZip->m_pWrite(pZip->m_pIO_opaque, pZip->m_archive_size, hdr, MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE) != MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE)
+        if (MZ_ZIP_WRITE(pZip, pZip->m_archive_size, hdr, MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE) != MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE)
             return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
 
         pZip->m_archive_size += MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE;
@@ -7401,7 +11785,7 @@ mz_bool mz_zip_writer_finalize_archive(mz_zip_archive *pZip)
         MZ_WRITE_LE32(hdr + MZ_ZIP64_ECDL_SIG_OFS, MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIG);
         MZ_WRITE_LE64(hdr + MZ_ZIP64_ECDL_REL_OFS_TO_ZIP64_ECDR_OFS, rel_ofs_to_zip64_ecdr);
         MZ_WRITE_LE32(hdr + MZ_ZIP64_ECDL_TOTAL_NUMBER_OF_DISKS_OFS, 1);
-        if (pZip->m_pWrite(pZip->m_pIO_opaque, pZip->m_archive_size, hdr, MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE) != MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE)
+        if (MZ_ZIP_WRITE(pZip, pZip->m_archive_size, hdr, MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE) != MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE)
             return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
 
         pZip->m_archive_size += MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE;
@@ -7415,7 +11799,7 @@ mz_bool mz_zip_writer_finalize_archive(mz_zip_archive *pZip)
     MZ_WRITE_LE32(hdr + MZ_ZIP_ECDH_CDIR_SIZE_OFS, MZ_MIN(MZ_UINT32_MAX, central_dir_size));
     MZ_WRITE_LE32(hdr + MZ_ZIP_ECDH_CDIR_OFS_OFS, MZ_MIN(MZ_UINT32_MAX, central_dir_ofs));
 
-    if (pZip->m_pWrite(pZip->m_pIO_opaque, pZip->m_archive_size, hdr, MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIZE) != MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIZE)
+    if (MZ_ZIP_WRITE(pZip, pZip->m_archive_size, hdr, MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIZE) != MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIZE)
         return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
 
 #ifndef MINIZ_NO_STDIO
@@ -7425,6 +11809,33 @@ mz_bool mz_zip_writer_finalize_archive(mz_zip_archive *pZip)
 
     pZip->m_archive_size += MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIZE;
 
+#if !defined(MINIZ_NO_STDIO) && defined(MZ_FTRUNCATE)
+    /* An archive that shrank (entries deleted or compacted away) still has the old central directory at its end, which readers would find first. */
+    /* mz_zip_writer_can_truncate() kept every other kind of archive from getting here. */
+    if ((pState->m_pFile) && (pZip->m_zip_type == MZ_ZIP_TYPE_FILE) && (pState->m_truncate_on_finalize))
+    {
+        if (!MZ_FTRUNCATE(pState->m_pFile, pState->m_file_archive_start_ofs + pZip->m_archive_size))
+            return mz_zip_set_error(pZip, MZ_ZIP_FILE_WRITE_FAILED);
+    }
+#endif
+
+    if ((pState->m_truncate_on_finalize) && ((pZip->m_pWrite == mz_zip_heap_write_func) || (pZip->m_pWrite == mz_zip_heap_chunked_write_func)))
+    {
+        pState->m_mem_size = (size_t)MZ_MIN((mz_uint64)pState->m_mem_size, pZip->m_archive_size);
+
+        /* Release the chunks that now lie entirely past the end, so every remaining chunk holds part of the archive. */
+        if (pZip->m_pWrite == mz_zip_heap_chunked_write_func)
+        {
+            size_t i, num_chunks = MZ_MAX((size_t)1, (pState->m_mem_size + MZ_ZIP_HEAP_CHUNK_SIZE - 1) / MZ_ZIP_HEAP_CHUNK_SIZE);
+            if (pState->m_heap_chunks.m_size > num_chunks)
+            {
+                for (i = num_chunks; i < pState->m_heap_chunks.m_size; i++)
+                    MZ_ZIP_FREE(pZip, MZ_ZIP_ARRAY_ELEMENT(&pState->m_heap_chunks, void *, i), MZ_ZIP_HEAP_CHUNK_SIZE);
+                pState->m_heap_chunks.m_size = num_chunks;
+            }
+        }
+    }
+
     pZip->m_zip_mode = MZ_ZIP_MODE_WRITING_HAS_BEEN_FINALIZED;
     return MZ_TRUE;
 }
@@ -7440,12 +11851,47 @@ mz_bool mz_zip_writer_finalize_heap_archive(mz_zip_archive *pZip, void **ppBuf,
     if ((!pZip) || (!pZip->m_pState))
         return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
 
-    if (pZip->m_pWrite != mz_zip_heap_write_func)
+    if ((pZip->m_pWrite != mz_zip_heap_write_func) && (pZip->m_pWrite != mz_zip_heap_chunked_write_func))
         return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
 
     if (!mz_zip_writer_finalize_archive(pZip))
         return MZ_FALSE;
 
+    if (pZip->m_pWrite == mz_zip_heap_chunked_write_func)
+    {
+        /* Consolidate the blocks exactly once: the first block is grown to the archive size and every later block is freed right after it has been copied. */
+        /* The result is still reserved while the blocks are live, so address space peaks at about twice the archive size; only the touched pages of the result add to resident memory as the blocks are released. */
+        mz_zip_internal_state *pState = pZip->m_pState;
+        size_t i, ofs, size = pState->m_mem_size;
+        mz_uint8 *pDst;
+
+        if (!pState->m_heap_chunks.m_size)
+            return mz_zip_set_error(pZip, MZ_ZIP_INTERNAL_ERROR);
+
+        if (NULL == (pDst = (mz_uint8 *)MZ_ZIP_REALLOC(pZip, MZ_ZIP_ARRAY_ELEMENT(&pState->m_heap_chunks, void *, 0), MZ_ZIP_HEAP_CHUNK_SIZE, 1, MZ_MAX(size, (size_t)MZ_ZIP_HEAP_CHUNK_SIZE))))
+            return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+        MZ_ZIP_ARRAY_ELEMENT(&pState->m_heap_chunks, void *, 0) = pDst;
+
+        ofs = MZ_MIN((size_t)MZ_ZIP_HEAP_CHUNK_SIZE, size);
+        for (i = 1; i < pState->m_heap_chunks.m_size; i++)
+        {
+            void *pChunk = MZ_ZIP_ARRAY_ELEMENT(&pState->m_heap_chunks, void *, i);
+            if (ofs < size)
+            {
+                size_t n = MZ_MIN((size_t)MZ_ZIP_HEAP_CHUNK_SIZE, size - ofs);
+                memcpy(pDst + ofs, pChunk, n);
+                ofs += n;
+            }
+            MZ_ZIP_FREE(pZip, pChunk, MZ_ZIP_HEAP_CHUNK_SIZE);
+        }
+        mz_zip_array_clear(pZip, &pState->m_heap_chunks);
+
+        *ppBuf = pDst;
+        *pSize = size;
+        pState->m_mem_size = 0;
+        return MZ_TRUE;
+    }
+
     *ppBuf = pZip->m_pState->m_pMem;
     *pSize = pZip->m_pState->m_mem_size;
     pZip->m_pState->m_pMem = NULL;
@@ -7454,6 +11900,29 @@ mz_bool mz_zip_writer_finalize_heap_archive(mz_zip_archive *pZip, void **ppBuf,
     return MZ_TRUE;
 }
 
+mz_uint mz_zip_writer_get_heap_chunks(mz_zip_archive *pZip, mz_zip_heap_chunk *pChunks, mz_uint max_chunks)
+{
+    mz_zip_internal_state *pState;
+    mz_uint i, num_chunks;
+
+    if ((!pZip) || (!pZip->m_pState) || (pZip->m_pWrite != mz_zip_heap_chunked_write_func) || ((max_chunks) && (!pChunks)))
+    {
+        mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+        return 0;
+    }
+
+    pState = pZip->m_pState;
+    num_chunks = (mz_uint)MZ_MIN((size_t)pState->m_heap_chunks.m_size, (pState->m_mem_size + MZ_ZIP_HEAP_CHUNK_SIZE - 1) / MZ_ZIP_HEAP_CHUNK_SIZE);
+
+    for (i = 0; i < MZ_MIN(num_chunks, max_chunks); i++)
+    {
+        pChunks[i].m_pBuf = MZ_ZIP_ARRAY_ELEMENT(&pState->m_heap_chunks, void *, i);
+        pChunks[i].m_size = MZ_MIN((size_t)MZ_ZIP_HEAP_CHUNK_SIZE, pState->m_mem_size - (size_t)i * MZ_ZIP_HEAP_CHUNK_SIZE);
+    }
+
+    return num_chunks;
+}
+
 mz_bool mz_zip_writer_end(mz_zip_archive *pZip)
 {
     return mz_zip_writer_end_internal(pZip, MZ_TRUE);
@@ -7465,7 +11934,7 @@ mz_bool mz_zip_add_mem_to_archive_file_in_place(const char *pZip_filename, const
     return mz_zip_add_mem_to_archive_file_in_place_v2(pZip_filename, pArchive_name, pBuf, buf_size, pComment, comment_size, level_and_flags, NULL);
 }
 
-mz_bool mz_zip_add_mem_to_archive_file_in_place_v2(const char *pZip_filename, const char *pArchive_name, const void *pBuf, size_t buf_size, const void *pComment, mz_uint16 comment_size, mz_uint level_and_flags, mz_zip_error *pErr)
+static mz_bool mz_zip_add_mem_to_archive_file_in_place_internal(const char *pZip_filename, const char *pArchive_name, const void *pBuf, size_t buf_size, const void *pComment, mz_uint16 comment_size, mz_uint level_and_flags, mz_bool replace_existing, mz_zip_error *pErr)
 {
     mz_bool status, created_new_archive = MZ_FALSE;
     mz_zip_archive zip_archive;
@@ -7525,7 +11994,27 @@ mz_bool mz_zip_add_mem_to_archive_file_in_place_v2(const char *pZip_filename, co
         }
     }
 
-    status = mz_zip_writer_add_mem_ex(&zip_archive, pArchive_name, pBuf, buf_size, pComment, comment_size, level_and_flags, 0, 0);
+    status = MZ_TRUE;
+    if ((replace_existing) && (!created_new_archive))
+    {
+        mz_uint32 file_index;
+
+        /* Tombstone every existing entry with exactly this name, their data is left behind as dead space */
+        while (mz_zip_reader_locate_file_v2(&zip_archive, pArchive_name, NULL, MZ_ZIP_FLAG_CASE_SENSITIVE, &file_index))
+        {
+            if (!mz_zip_writer_delete_file(&zip_archive, file_index))
+            {
+                status = MZ_FALSE;
+                break;
+            }
+        }
+
+        if (status)
+            mz_zip_clear_last_error(&zip_archive);
+    }
+
+    if (status)
+        status = mz_zip_writer_add_mem_ex(&zip_archive, pArchive_name, pBuf, buf_size, pComment, comment_size, level_and_flags, 0, 0);
     actual_err = zip_archive.m_last_error;
 
     /* Always finalize, even if adding failed for some reason, so we have a valid central directory. (This may not always succeed, but we can try.) */
@@ -7558,6 +12047,16 @@ mz_bool mz_zip_add_mem_to_archive_file_in_place_v2(const char *pZip_filename, co
     return status;
 }
 
+mz_bool mz_zip_add_mem_to_archive_file_in_place_v2(const char *pZip_filename, const char *pArchive_name, const void *pBuf, size_t buf_size, const void *pComment, mz_uint16 comment_size, mz_uint level_and_flags, mz_zip_error *pErr)
+{
+    return mz_zip_add_mem_to_archive_file_in_place_internal(pZip_filename, pArchive_name, pBuf, buf_size, pComment, comment_size, level_and_flags, MZ_FALSE, pErr);
+}
+
+mz_bool mz_zip_replace_mem_in_archive_file_in_place(const char *pZip_filename, const char *pArchive_name, const void *pBuf, size_t buf_size, const void *pComment, mz_uint16 comment_size, mz_uint level_and_flags, mz_zip_error *pErr)
+{
+    return mz_zip_add_mem_to_archive_file_in_place_internal(pZip_filename, pArchive_name, pBuf, buf_size, pComment, comment_size, level_and_flags, MZ_TRUE, pErr);
+}
+
 void *mz_zip_extract_archive_file_to_heap_v2(const char *pZip_filename, const char *pArchive_name, const char *pComment, size_t *pSize, mz_uint flags, mz_zip_error *pErr)
 {
     mz_uint32 file_index;
@@ -7657,6 +12156,32 @@ mz_zip_error mz_zip_get_last_error(mz_zip_archive *pZip)
     return prev_err;
 }
 
+#ifdef MINIZ_STATS
+mz_bool mz_zip_get_stats(mz_zip_archive *pZip, mz_zip_stats *pStats)
+{
+    if ((!pZip) || (!pZip->m_pState) || (!pStats))
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+
+    *pStats = pZip->m_pState->m_stats;
+    return MZ_TRUE;
+}
+
+mz_bool mz_zip_reset_stats(mz_zip_archive *pZip)
+{
+    mz_zip_stats *pStats;
+    mz_uint64 cur_heap_size;
+
+    if ((!pZip) || (!pZip->m_pState))
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+
+    pStats = &pZip->m_pState->m_stats;
+    cur_heap_size = pStats->m_cur_heap_size;
+    memset(pStats, 0, sizeof(mz_zip_stats));
+    pStats->m_cur_heap_size = pStats->m_peak_heap_size = cur_heap_size;
+    return MZ_TRUE;
+}
+#endif
+
 const char *mz_zip_get_error_string(mz_zip_error mz_err)
 {
     switch (mz_err)
@@ -7740,6 +12265,10 @@ mz_bool mz_zip_is_zip64(mz_zip_archive *pZip)
     if ((!pZip) || (!pZip->m_pState))
         return MZ_FALSE;
 
+    /* Records that haven't been indexed yet may still use zip64 extended info */
+    if ((pZip->m_pState->m_lazy_central_dir) && (!mz_zip_reader_index_central_dir(pZip, pZip->m_total_files)))
+        return MZ_FALSE;
+
     return pZip->m_pState->m_zip64;
 }
 
@@ -7782,7 +12311,7 @@ size_t mz_zip_read_archive_data(mz_zip_archive *pZip, mz_uint64 file_ofs, void *
     if ((!pZip) || (!pZip->m_pState) || (!pBuf) || (!pZip->m_pRead))
         return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
 
-    return pZip->m_pRead(pZip->m_pIO_opaque, file_ofs, pBuf, n);
+    return MZ_ZIP_READ(pZip, file_ofs, pBuf, n);
 }
 
 mz_uint mz_zip_reader_get_filename(mz_zip_archive *pZip, mz_uint file_index, char *pFilename, mz_uint filename_buf_size)
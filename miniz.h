@@ -26,14 +26,15 @@
      miniz.c implements a fairly large subset of zlib. There's enough functionality present for it to be a drop-in
      zlib replacement in many apps:
         The z_stream struct, optional memory allocation callbacks
-        deflateInit/deflateInit2/deflate/deflateReset/deflateEnd/deflateBound
-        inflateInit/inflateInit2/inflate/inflateReset/inflateEnd
+        deflateInit/deflateInit2/deflate/deflateParams/deflatePrime/deflateReset/deflateEnd/deflateBound
+        inflateInit/inflateInit2/inflate/inflateSync/inflateReset/inflateEnd
         compress, compress2, compressBound, uncompress
         CRC-32, Adler-32 - Using modern, minimal code size, CPU cache friendly routines.
-        Supports raw deflate streams or standard zlib streams with adler-32 checking.
+        Supports raw deflate streams, standard zlib streams with adler-32 checking, or gzip members with crc-32 checking.
 
      Limitations:
-      The callback API's are not implemented yet. No support for gzip headers or zlib static dictionaries.
+      The callback API's are not implemented yet. No gzip file (gzopen) API or zlib static dictionaries.
+      inflate() doesn't support the Z_BLOCK/Z_TREES flush values (deflate() does support Z_BLOCK).
       I've tried to closely emulate zlib's various flavors of stream flushing and return status codes, but
       there are no guarantees that miniz.c pulls this off perfectly.
 
@@ -152,6 +153,10 @@
    functions (such as tdefl_compress_mem_to_heap() and tinfl_decompress_mem_to_heap()) won't work. */
 /*#define MINIZ_NO_MALLOC */
 
+/* Define MINIZ_STATS to have tdefl_compressor and tinfl_decompressor keep counters of what they did, see tdefl_get_stats() and tinfl_get_stats(), and zip archives count their I/O, allocations and time, see mz_zip_get_stats(). */
+/* This changes the size of both structures, so it must be defined for every file that includes miniz.h, not just miniz.c. */
+/*#define MINIZ_STATS */
+
 #ifdef MINIZ_NO_INFLATE_APIS
 #define MINIZ_NO_ARCHIVE_APIS
 #endif
@@ -361,7 +366,7 @@ MINIZ_EXPORT int mz_deflateInit(mz_streamp pStream, int level);
 /* mz_deflateInit2() is like mz_deflate(), except with more control: */
 /* Additional parameters: */
 /*   method must be MZ_DEFLATED */
-/*   window_bits must be MZ_DEFAULT_WINDOW_BITS (to wrap the deflate stream with zlib header/adler-32 footer) or -MZ_DEFAULT_WINDOW_BITS (raw deflate/no header or footer) */
+/*   window_bits must be MZ_DEFAULT_WINDOW_BITS (to wrap the deflate stream with zlib header/adler-32 footer), MZ_DEFAULT_WINDOW_BITS + 16 (gzip header/crc-32 and size footer, adler then holds the crc-32) or -MZ_DEFAULT_WINDOW_BITS (raw deflate/no header or footer) */
 /*   mem_level must be between [1, 9] (it's checked but ignored by miniz.c) */
 MINIZ_EXPORT int mz_deflateInit2(mz_streamp pStream, int level, int method, int window_bits, int mem_level, int strategy);
 
@@ -371,7 +376,8 @@ MINIZ_EXPORT int mz_deflateReset(mz_streamp pStream);
 /* mz_deflate() compresses the input to output, consuming as much of the input and producing as much output as possible. */
 /* Parameters: */
 /*   pStream is the stream to read from and write to. You must initialize/update the next_in, avail_in, next_out, and avail_out members. */
-/*   flush may be MZ_NO_FLUSH, MZ_PARTIAL_FLUSH/MZ_SYNC_FLUSH, MZ_FULL_FLUSH, or MZ_FINISH. */
+/*   flush may be MZ_NO_FLUSH, MZ_PARTIAL_FLUSH, MZ_SYNC_FLUSH, MZ_FULL_FLUSH, MZ_FINISH, or MZ_BLOCK (ends the current block without the byte aligning empty stored block, so up to 7 bits may be held back). */
+/*   MZ_PARTIAL_FLUSH makes all the output so far decodable like MZ_SYNC_FLUSH but isn't byte aligned, which makes it the cheapest flush for streaming small writes. */
 /* Return values: */
 /*   MZ_OK on success (when flushing, or if more input is needed but not available, and/or there's more output to be written but the output buffer is full). */
 /*   MZ_STREAM_END if all input has been consumed and all output bytes have been written. Don't call mz_deflate() on the stream anymore. */
@@ -380,13 +386,26 @@ MINIZ_EXPORT int mz_deflateReset(mz_streamp pStream);
 /*   MZ_BUF_ERROR if no forward progress is possible because the input and/or output buffers are empty. (Fill up the input buffer or free up some output space and try again.) */
 MINIZ_EXPORT int mz_deflate(mz_streamp pStream, int flush);
 
+/* mz_deflateParams() changes the compression level and strategy of a stream mid-stream. */
+/* If input has already been passed to mz_deflate(), everything so far (including the current avail_in) is first compressed with the old parameters and ended with an MZ_BLOCK flush. */
+/* Return values: */
+/*   MZ_OK on success. */
+/*   MZ_STREAM_ERROR if the stream is bogus or level/strategy are out of range. */
+/*   MZ_BUF_ERROR if there wasn't enough output space to finish that flush, the old parameters stay in effect: free up some output space and call mz_deflateParams() again. */
+MINIZ_EXPORT int mz_deflateParams(mz_streamp pStream, int level, int strategy);
+
+/* mz_deflatePrime() inserts the low bits (0-16) of value into the output in front of the next block, up to 32 bits may be pending at once. */
+/* Meant for appending to a raw deflate stream that ended with a partial byte, like zlib's deflatePrime(). Returns MZ_BUF_ERROR if too many bits are pending. */
+MINIZ_EXPORT int mz_deflatePrime(mz_streamp pStream, int bits, int value);
+
 /* mz_deflateEnd() deinitializes a compressor: */
 /* Return values: */
 /*  MZ_OK on success. */
 /*  MZ_STREAM_ERROR if the stream is bogus. */
 MINIZ_EXPORT int mz_deflateEnd(mz_streamp pStream);
 
-/* mz_deflateBound() returns a (very) conservative upper bound on the amount of data that could be generated by deflate(), assuming flush is set to only MZ_NO_FLUSH or MZ_FINISH. */
+/* mz_deflateBound() returns an upper bound on the amount of data that could be generated by deflate(), assuming flush is set to only MZ_NO_FLUSH or MZ_FINISH. */
+/* It allows for incompressible data (stored blocks, which tdefl never makes smaller than ~21KB) plus the largest (gzip) header and footer. */
 MINIZ_EXPORT mz_ulong mz_deflateBound(mz_streamp pStream, mz_ulong source_len);
 
 /* Single-call compression functions mz_compress() and mz_compress2(): */
@@ -394,7 +413,7 @@ MINIZ_EXPORT mz_ulong mz_deflateBound(mz_streamp pStream, mz_ulong source_len);
 MINIZ_EXPORT int mz_compress(unsigned char *pDest, mz_ulong *pDest_len, const unsigned char *pSource, mz_ulong source_len);
 MINIZ_EXPORT int mz_compress2(unsigned char *pDest, mz_ulong *pDest_len, const unsigned char *pSource, mz_ulong source_len, int level);
 
-/* mz_compressBound() returns a (very) conservative upper bound on the amount of data that could be generated by calling mz_compress(). */
+/* mz_compressBound() returns an upper bound on the amount of data that could be generated by calling mz_compress(). */
 MINIZ_EXPORT mz_ulong mz_compressBound(mz_ulong source_len);
 
 #endif /*#ifndef MINIZ_NO_DEFLATE_APIS*/
@@ -405,7 +424,8 @@ MINIZ_EXPORT mz_ulong mz_compressBound(mz_ulong source_len);
 MINIZ_EXPORT int mz_inflateInit(mz_streamp pStream);
 
 /* mz_inflateInit2() is like mz_inflateInit() with an additional option that controls the window size and whether or not the stream has been wrapped with a zlib header/footer: */
-/* window_bits must be MZ_DEFAULT_WINDOW_BITS (to parse zlib header/footer) or -MZ_DEFAULT_WINDOW_BITS (raw deflate). */
+/* window_bits must be MZ_DEFAULT_WINDOW_BITS (to parse zlib header/footer), MZ_DEFAULT_WINDOW_BITS + 16 (gzip), MZ_DEFAULT_WINDOW_BITS + 32 (zlib or gzip, whichever the stream starts with) or -MZ_DEFAULT_WINDOW_BITS (raw deflate). */
+/* Concatenated gzip members are inflated as one stream. A member that ends exactly at the end of the input returns MZ_OK unless flush is MZ_FINISH; the next call continues with the next member if its input starts with one, else returns MZ_STREAM_END. */
 MINIZ_EXPORT int mz_inflateInit2(mz_streamp pStream, int window_bits);
 
 /* Quickly resets a compressor without having to reallocate anything. Same as calling mz_inflateEnd() followed by mz_inflateInit()/mz_inflateInit2(). */
@@ -427,6 +447,15 @@ MINIZ_EXPORT int mz_inflateReset(mz_streamp pStream);
 /*   with more input data, or with more room in the output buffer (except when using single call decompression, described above). */
 MINIZ_EXPORT int mz_inflate(mz_streamp pStream, int flush);
 
+/* mz_inflateSync() skips input up to and including the next 00 00 FF FF marker left by an MZ_SYNC_FLUSH/MZ_FULL_FLUSH, so inflating can resume after corrupt data. */
+/* Decompression then continues as raw deflate from that point, so the zlib/gzip footer isn't checked. The output is only reliable if the marker came from an MZ_FULL_FLUSH, as later matches may reach back past a sync flush. */
+/* Return values: */
+/*   MZ_OK once a marker has been found (next_in points just past it). */
+/*   MZ_BUF_ERROR if no input was provided. */
+/*   MZ_DATA_ERROR if all the input was consumed without finding a marker, call mz_inflateSync() again with more input. */
+/*   MZ_STREAM_ERROR if the stream is bogus. */
+MINIZ_EXPORT int mz_inflateSync(mz_streamp pStream);
+
 /* Deinitializes a decompressor. */
 MINIZ_EXPORT int mz_inflateEnd(mz_streamp pStream);
 
@@ -491,6 +520,8 @@ typedef void *const voidpc;
 #define deflateInit2 mz_deflateInit2
 #define deflateReset mz_deflateReset
 #define deflate mz_deflate
+#define deflateParams mz_deflateParams
+#define deflatePrime mz_deflatePrime
 #define deflateEnd mz_deflateEnd
 #define deflateBound mz_deflateBound
 #define compress mz_compress
@@ -503,6 +534,7 @@ typedef void *const voidpc;
 #define inflateInit2 mz_inflateInit2
 #define inflateReset mz_inflateReset
 #define inflate mz_inflate
+#define inflateSync mz_inflateSync
 #define inflateEnd mz_inflateEnd
 #define uncompress mz_uncompress
 #define uncompress2 mz_uncompress2
@@ -652,6 +684,7 @@ enum
 };
 
 /* TDEFL_WRITE_ZLIB_HEADER: If set, the compressor outputs a zlib header before the deflate data, and the Adler-32 of the source data at the end. Otherwise, you'll get raw deflate data. */
+/* TDEFL_WRITE_GZIP_HEADER: If set, the compressor outputs a gzip (RFC 1952) member instead: a header, the deflate data, then the CRC-32 and size of the source data. tdefl_get_adler32() returns the CRC-32. */
 /* TDEFL_COMPUTE_ADLER32: Always compute the adler-32 of the input data (even when not writing zlib headers). */
 /* TDEFL_GREEDY_PARSING_FLAG: Set to use faster greedy parsing, instead of more efficient lazy parsing. */
 /* TDEFL_NONDETERMINISTIC_PARSING_FLAG: Enable to decrease the compressor's initialization time to the minimum, but the output may vary from run to run given the same input (depending on the contents of memory). */
@@ -669,7 +702,8 @@ enum
     TDEFL_RLE_MATCHES = 0x10000,
     TDEFL_FILTER_MATCHES = 0x20000,
     TDEFL_FORCE_ALL_STATIC_BLOCKS = 0x40000,
-    TDEFL_FORCE_ALL_RAW_BLOCKS = 0x80000
+    TDEFL_FORCE_ALL_RAW_BLOCKS = 0x80000,
+    TDEFL_WRITE_GZIP_HEADER = 0x100000
 };
 
 /* High level compression functions: */
@@ -693,6 +727,8 @@ MINIZ_EXPORT size_t tdefl_compress_mem_to_mem(void *pOut_buf, size_t out_buf_len
 /*  The image pitch in bytes per scanline will be w*num_chans. The leftmost pixel on the top scanline is stored first in memory. */
 /*  level may range from [0,10], use MZ_NO_COMPRESSION, MZ_BEST_SPEED, MZ_BEST_COMPRESSION, etc. or a decent default is MZ_DEFAULT_LEVEL */
 /*  If flip is true, the image will be flipped on the Y axis (useful for OpenGL apps). */
+/*  Levels 1-6 filter every scanline with Up, levels 7-10 give each the PNG filter (None, Sub, Up, Average or Paeth) with the smallest sum of absolute differences. */
+/*  With MINIZ_DEFLATE_THREADS large images are deflated on several threads, which takes a second image-sized buffer for the filtered scanlines. */
 /* On return: */
 /*  Function returns a pointer to the compressed data, or NULL on failure. */
 /*  *pLen_out will be set to the size of the PNG image file. */
@@ -706,6 +742,49 @@ typedef mz_bool (*tdefl_put_buf_func_ptr)(const void *pBuf, int len, void *pUser
 /* tdefl_compress_mem_to_output() compresses a block to an output stream. The above helpers use this function internally. */
 MINIZ_EXPORT mz_bool tdefl_compress_mem_to_output(const void *pBuf, size_t buf_len, tdefl_put_buf_func_ptr pPut_buf_func, void *pPut_buf_user, int flags);
 
+/* Like tdefl_compress_mem_to_output(), but when miniz is built with MINIZ_DEFLATE_THREADS the input is cut into block_size byte blocks (0 = 1 MB) that num_threads worker threads (0 = one per CPU) deflate independently. */
+/* Matches can't reach back into the previous block, so the output is slightly larger than tdefl_compress_mem_to_output()'s. Zlib and gzip headers and trailers are written as usual. */
+MINIZ_EXPORT mz_bool tdefl_compress_mem_to_output_parallel(const void *pBuf, size_t buf_len, tdefl_put_buf_func_ptr pPut_buf_func, void *pPut_buf_user, int flags, size_t block_size, mz_uint num_threads);
+
+/* Streaming PNG writer: the image is passed in a few scanlines at a time and written to pPut_buf_func as it's compressed, so only a couple of scanlines are ever held in memory. */
+struct tdefl_png_writer_tag;
+typedef struct tdefl_png_writer_tag tdefl_png_writer;
+
+/* Starts a PNG file by writing its signature and header chunks. Returns NULL on invalid parameters or failure. */
+/*  num_chans may be 1 (gray), 2 (gray+alpha), 3 (RGB) or 4 (RGBA), bit_depth 8 or 16, level is as for tdefl_write_image_to_png_file_in_memory_ex(). */
+/*  If pPalette isn't NULL this is a palette image instead: pPalette holds palette_size (1-256) entries of num_chans (3 = RGB, 4 = RGBA) bytes, and every pixel is a one byte index into it. bit_depth must be 8. */
+MINIZ_EXPORT tdefl_png_writer *tdefl_png_writer_begin(int w, int h, int num_chans, int bit_depth, const void *pPalette, int palette_size, mz_uint level, tdefl_put_buf_func_ptr pPut_buf_func, void *pPut_buf_user);
+
+/* Compresses the next num_rows scanlines, top to bottom. They follow each other in pRows, as 8-bit samples or (for bit_depth 16) mz_uint16 samples in native byte order. */
+MINIZ_EXPORT mz_bool tdefl_png_writer_add_rows(tdefl_png_writer *pWriter, const void *pRows, int num_rows);
+
+/* Writes the end of the file and frees pWriter. Returns MZ_FALSE if anything failed or not all the rows were added, the output is incomplete then. Must be called even after a failure. */
+MINIZ_EXPORT mz_bool tdefl_png_writer_end(tdefl_png_writer *pWriter);
+
+/* Low latency streaming compression (e.g. for server-sent events or chunked HTTP responses) */
+/* Small writes are coalesced into one buffer and compressed together, and the output is made decodable with a TDEFL_PARTIAL_FLUSH once the oldest unflushed byte has waited max_delay. */
+/* Times are in whatever monotonic unit the caller uses (microseconds, say): miniz never reads a clock, it only compares the now values it's given. */
+struct tdefl_stream_writer_tag;
+typedef struct tdefl_stream_writer_tag tdefl_stream_writer;
+
+/* flags are the same as for tdefl_init(). A max_delay of 0 flushes on every write. Returns NULL on invalid parameters or out of memory. */
+MINIZ_EXPORT tdefl_stream_writer *tdefl_stream_writer_begin(int flags, mz_uint64 max_delay, tdefl_put_buf_func_ptr pPut_buf_func, void *pPut_buf_user);
+
+/* Adds len bytes written at time now, then does a tdefl_stream_writer_poll(). */
+MINIZ_EXPORT mz_bool tdefl_stream_writer_write(tdefl_stream_writer *pWriter, const void *pBuf, size_t len, mz_uint64 now);
+
+/* Flushes if data is pending and its deadline has come at time now. */
+MINIZ_EXPORT mz_bool tdefl_stream_writer_poll(tdefl_stream_writer *pWriter, mz_uint64 now);
+
+/* Flushes any pending data right away. */
+MINIZ_EXPORT mz_bool tdefl_stream_writer_flush(tdefl_stream_writer *pWriter);
+
+/* Returns MZ_TRUE and the time tdefl_stream_writer_poll() should next be called at (to arm the caller's timer) if data is pending, MZ_FALSE otherwise. */
+MINIZ_EXPORT mz_bool tdefl_stream_writer_deadline(const tdefl_stream_writer *pWriter, mz_uint64 *pDeadline);
+
+/* Finishes the stream and frees pWriter. Returns MZ_FALSE if anything failed, the output is incomplete then. Must be called even after a failure. */
+MINIZ_EXPORT mz_bool tdefl_stream_writer_end(tdefl_stream_writer *pWriter);
+
 enum
 {
     TDEFL_MAX_HUFF_TABLES = 3,
@@ -754,11 +833,30 @@ typedef enum {
 /* Must map to MZ_NO_FLUSH, MZ_SYNC_FLUSH, etc. enums */
 typedef enum {
     TDEFL_NO_FLUSH = 0,
+    TDEFL_PARTIAL_FLUSH = 1, /* Makes everything so far decodable like TDEFL_SYNC_FLUSH, but without byte aligning the output: costs at most an empty static block (10 bits). */
     TDEFL_SYNC_FLUSH = 2,
     TDEFL_FULL_FLUSH = 3,
-    TDEFL_FINISH = 4
+    TDEFL_FINISH = 4,
+    TDEFL_BLOCK = 5 /* Ends the current block without byte aligning the output, up to 7 bits are held back until the next block. */
 } tdefl_flush;
 
+#ifdef MINIZ_STATS
+/* Counters kept by a tdefl_compressor when miniz is built with MINIZ_STATS. They're reset by tdefl_init(). */
+typedef struct
+{
+    mz_uint64 m_bytes_in, m_bytes_out;
+    /* Literals and matches the parser produced. m_match_len_histogram[len - TDEFL_MIN_MATCH_LEN] counts the matches of each length. */
+    mz_uint64 m_num_literals, m_num_matches;
+    mz_uint64 m_match_len_histogram[TDEFL_MAX_MATCH_LEN - TDEFL_MIN_MATCH_LEN + 1];
+    /* Match searches and the hash chain entries they visited, m_num_probes / m_num_find_match_calls is the average probes per search. The level 1 fast path doesn't search. */
+    mz_uint64 m_num_find_match_calls, m_num_probes;
+    /* Blocks written, indexed by the deflate block type: 0 stored, 1 static Huffman, 2 dynamic Huffman. */
+    mz_uint64 m_num_blocks[3];
+    /* Processor time spent building and writing the blocks, in clock() ticks (CLOCKS_PER_SEC per second). Always 0 with MINIZ_NO_TIME. */
+    mz_uint64 m_flush_block_clocks;
+} tdefl_stats;
+#endif
+
 /* tdefl's compression state structure. */
 typedef struct
 {
@@ -770,6 +868,7 @@ typedef struct
     mz_uint8 *m_pLZ_code_buf, *m_pLZ_flags, *m_pOutput_buf, *m_pOutput_buf_end;
     mz_uint m_num_flags_left, m_total_lz_bytes, m_lz_code_buf_dict_pos, m_bits_in, m_bit_buffer;
     mz_uint m_saved_match_dist, m_saved_match_len, m_saved_lit, m_output_flush_ofs, m_output_flush_remaining, m_finished, m_block_index, m_wants_to_finish;
+    mz_uint m_prime_bit_buf, m_num_prime_bits;
     tdefl_status m_prev_return_status;
     const void *m_pIn_buf;
     void *m_pOut_buf;
@@ -785,6 +884,9 @@ typedef struct
     mz_uint16 m_next[TDEFL_LZ_DICT_SIZE];
     mz_uint16 m_hash[TDEFL_LZ_HASH_SIZE];
     mz_uint8 m_output_buf[TDEFL_OUT_BUF_SIZE];
+#ifdef MINIZ_STATS
+    tdefl_stats m_stats;
+#endif
 } tdefl_compressor;
 
 /* Initializes the compressor. */
@@ -802,11 +904,16 @@ MINIZ_EXPORT tdefl_status tdefl_compress(tdefl_compressor *d, const void *pIn_bu
 MINIZ_EXPORT tdefl_status tdefl_compress_buffer(tdefl_compressor *d, const void *pIn_buf, size_t in_buf_size, tdefl_flush flush);
 
 MINIZ_EXPORT tdefl_status tdefl_get_prev_return_status(tdefl_compressor *d);
+
+#ifdef MINIZ_STATS
+/* Returns the compressor's counters, which may be read between tdefl_compress() calls. */
+MINIZ_EXPORT const tdefl_stats *tdefl_get_stats(const tdefl_compressor *d);
+#endif
 MINIZ_EXPORT mz_uint32 tdefl_get_adler32(tdefl_compressor *d);
 
 /* Create tdefl_compress() flags given zlib-style compression parameters. */
 /* level may range from [0,10] (where 10 is absolute max compression, but may be much slower on some files) */
-/* window_bits may be -15 (raw deflate) or 15 (zlib) */
+/* window_bits may be -15 (raw deflate), 15 (zlib) or 31 (gzip) */
 /* strategy may be either MZ_DEFAULT_STRATEGY, MZ_FILTERED, MZ_HUFFMAN_ONLY, MZ_RLE, or MZ_FIXED */
 MINIZ_EXPORT mz_uint tdefl_create_comp_flags_from_zip_params(int level, int window_bits, int strategy);
 
@@ -837,12 +944,15 @@ extern "C" {
 /* TINFL_FLAG_HAS_MORE_INPUT: If set, there are more input bytes available beyond the end of the supplied input buffer. If clear, the input buffer contains all remaining input. */
 /* TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF: If set, the output buffer is large enough to hold the entire decompressed stream. If clear, the output buffer is at least the size of the dictionary (typically 32KB). */
 /* TINFL_FLAG_COMPUTE_ADLER32: Force adler-32 checksum computation of the decompressed bytes. */
+/* TINFL_FLAG_PARSE_GZIP_HEADER: If set, the input is a gzip member and ends with its CRC-32 and size, which are checked (tinfl_get_adler32() returns the CRC-32). With TINFL_FLAG_PARSE_ZLIB_HEADER too, either format is accepted. */
+/* The tinfl_decompress_mem_to_*() helpers inflate concatenated gzip members as one stream, tinfl_decompress() stops after each member. */
 enum
 {
     TINFL_FLAG_PARSE_ZLIB_HEADER = 1,
     TINFL_FLAG_HAS_MORE_INPUT = 2,
     TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF = 4,
-    TINFL_FLAG_COMPUTE_ADLER32 = 8
+    TINFL_FLAG_COMPUTE_ADLER32 = 8,
+    TINFL_FLAG_PARSE_GZIP_HEADER = 16
 };
 
 /* High level decompression functions: */
@@ -889,7 +999,7 @@ typedef enum {
     /* This flag indicates that one or more of the input parameters was obviously bogus. (You can try calling it again, but if you get this error the calling code is wrong.) */
     TINFL_STATUS_BAD_PARAM = -3,
 
-    /* This flags indicate the inflator is finished but the adler32 check of the uncompressed data didn't match. If you call it again it'll return TINFL_STATUS_DONE. */
+    /* This flags indicate the inflator is finished but the adler32 check of the uncompressed data didn't match (or for gzip, its crc-32 or size). If you call it again it'll return TINFL_STATUS_DONE. */
     TINFL_STATUS_ADLER32_MISMATCH = -2,
 
     /* This flags indicate the inflator has somehow failed (bad code, corrupted input, etc.). If you call it again without resetting via tinfl_init() it it'll just keep on returning the same status failure code. */
@@ -951,6 +1061,20 @@ typedef mz_uint32 tinfl_bit_buf_t;
 #define TINFL_BITBUF_SIZE (32)
 #endif
 
+#ifdef MINIZ_STATS
+/* Counters kept by a tinfl_decompressor when miniz is built with MINIZ_STATS. They're reset when a new stream starts (after tinfl_init()). */
+typedef struct
+{
+    mz_uint64 m_bytes_in, m_bytes_out;
+    /* Symbols decoded: literals and matches (end of block codes are counted by m_num_blocks). */
+    mz_uint64 m_num_literals, m_num_matches;
+    /* Blocks read, indexed by the deflate block type: 0 stored, 1 static Huffman, 2 dynamic Huffman. */
+    mz_uint64 m_num_blocks[3];
+    /* Output of stored blocks, and of Huffman blocks split into bytes decoded by the fast loop, and bytes decoded one at a time near the end of the input or output buffer or copied from a wrapping output buffer. */
+    mz_uint64 m_stored_bytes, m_fast_path_bytes, m_slow_path_bytes;
+} tinfl_stats;
+#endif
+
 struct tinfl_decompressor_tag
 {
     mz_uint32 m_state, m_num_bits, m_zhdr0, m_zhdr1, m_z_adler32, m_final, m_type, m_check_adler32, m_dist, m_counter, m_num_extra, m_table_sizes[TINFL_MAX_HUFF_TABLES];
@@ -964,8 +1088,18 @@ struct tinfl_decompressor_tag
     mz_uint8 m_code_size_1[TINFL_MAX_HUFF_SYMBOLS_1];
     mz_uint8 m_code_size_2[TINFL_MAX_HUFF_SYMBOLS_2];
     mz_uint8 m_raw_header[4], m_len_codes[TINFL_MAX_HUFF_SYMBOLS_0 + TINFL_MAX_HUFF_SYMBOLS_1 + 137];
+    /* Gzip members: the low 32 bits of the output size, checked against the size in the trailer. */
+    mz_uint32 m_gzip_isize;
+#ifdef MINIZ_STATS
+    tinfl_stats m_stats;
+#endif
 };
 
+#ifdef MINIZ_STATS
+/* Returns the decompressor's counters, which may be read between tinfl_decompress() calls. */
+MINIZ_EXPORT const tinfl_stats *tinfl_get_stats(const tinfl_decompressor *r);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -987,6 +1121,12 @@ enum
 {
     /* Note: These enums can be reduced as needed to save memory or stack space - they are pretty conservative. */
     MZ_ZIP_MAX_IO_BUF_SIZE = 64 * 1024,
+    MZ_ZIP_HEAP_CHUNK_SIZE = 256 * 1024,
+    MZ_ZIP_MAX_BATCH_READ_SIZE = 1024 * 1024, /* largest single read mz_zip_reader_extract_batch_to_heap() coalesces neighbouring entries into */
+    MZ_ZIP_MAX_BATCH_READ_GAP = 16 * 1024,    /* unrequested bytes between entries it will read through rather than seek over */
+    MZ_ZIP_ASYNC_READ_DEPTH = 4,              /* reads kept in flight ahead of decompression when built with MINIZ_ZIP_ASYNC_IO */
+    MZ_ZIP_ARENA_BLOCK_SIZE = 256 * 1024,     /* default size of the blocks a mz_zip_arena allocates from */
+    MZ_ZIP_DEFAULT_COMPACT_THRESHOLD = 25, /* percent of the archive that may be dead space before the writer compacts it, see mz_zip_writer_delete_file() */
     MZ_ZIP_MAX_ARCHIVE_FILENAME_SIZE = 512,
     MZ_ZIP_MAX_ARCHIVE_FILE_COMMENT_SIZE = 512
 };
@@ -1074,7 +1214,13 @@ typedef enum {
     MZ_ZIP_FLAG_ASCII_FILENAME = 0x10000,
     /*After adding a compressed file, seek back
     to local file header and set the correct sizes*/
-    MZ_ZIP_FLAG_WRITE_HEADER_SET_SIZE = 0x20000
+    MZ_ZIP_FLAG_WRITE_HEADER_SET_SIZE = 0x20000,
+    MZ_ZIP_FLAG_WRITE_HEAP_CHUNKED = 0x40000,       /* mz_zip_writer_init_heap_v2() only: store the archive in MZ_ZIP_HEAP_CHUNK_SIZE blocks instead of one realloc'd block */
+    MZ_ZIP_FLAG_WRITE_DEDUPLICATE = 0x80000,        /* mz_zip_writer_init*_v2() or mz_zip_writer_add_mem*(): entries whose data is identical to an earlier mz_zip_writer_add_mem*() entry copy its compressed data instead of compressing again */
+    MZ_ZIP_FLAG_LAZY_CENTRAL_DIRECTORY = 0x100000,  /* mz_zip_reader_init*(): validate and index central dir records as they're first accessed, and only sort them once name lookups make it worthwhile */
+    MZ_ZIP_FLAG_WRITE_INDEX = 0x200000,             /* mz_zip_writer_init*_v2(): store a lookup index (record offsets and filename order) before the central directory, so readers can skip sorting, and lazy readers parsing */
+    MZ_ZIP_FLAG_DECODE_CENTRAL_DIRECTORY = 0x400000, /* mz_zip_reader_init*(): decode each entry's sizes, local header offset and flags into arrays at open, so stat and extraction don't reparse the central dir records (not with MZ_ZIP_FLAG_LAZY_CENTRAL_DIRECTORY) */
+    MZ_ZIP_FLAG_VALIDATE_CONTINUE_ON_FAILURE = 0x800000 /* mz_zip_validate_archive_parallel(): validate every file instead of stopping at the first one that fails */
 } mz_zip_flags;
 
 typedef enum {
@@ -1175,6 +1321,57 @@ typedef struct
 
 } mz_zip_reader_extract_iter_state;
 
+/* Bump allocator for mz_zip_archive's allocations, see mz_zip_arena_init(). */
+typedef struct
+{
+    void *m_pBlocks;
+    mz_uint8 *m_pCur;
+    size_t m_cur_ofs, m_cur_size;
+    void *m_pLast;
+    size_t m_block_size;
+} mz_zip_arena;
+
+/* One block of a chunked heap archive, see MZ_ZIP_FLAG_WRITE_HEAP_CHUNKED. */
+typedef struct
+{
+    const void *m_pBuf;
+    size_t m_size;
+} mz_zip_heap_chunk;
+
+typedef mz_bool (*mz_zip_batch_extract_func)(void *pOpaque, mz_uint32 batch_index, void *pBuf, size_t size);
+
+/* Where a file landed in the block filled by mz_zip_reader_extract_batch_to_block(). */
+typedef struct
+{
+    size_t m_ofs;
+    size_t m_size;
+} mz_zip_span;
+
+#ifdef MINIZ_STATS
+/* Counters kept by an open archive when miniz is built with MINIZ_STATS, see mz_zip_get_stats(). They start at 0 when the archive is opened. */
+typedef struct
+{
+    /* Calls to the m_pRead/m_pWrite callbacks (and the pread()s of MINIZ_ZIP_ASYNC_IO and the parallel validator), the bytes they moved, and how many didn't start where the previous one ended. */
+    mz_uint64 m_num_reads, m_bytes_read, m_num_read_seeks;
+    mz_uint64 m_num_writes, m_bytes_written, m_num_write_seeks;
+    /* Calls to m_pAlloc/m_pRealloc, the bytes they asked for, and the bytes held now and at most. Buffers handed to the caller, like the one mz_zip_reader_extract_to_heap() returns, stay in m_cur_heap_size. */
+    mz_uint64 m_num_allocs, m_bytes_allocated, m_cur_heap_size, m_peak_heap_size;
+    /* Processor time spent inflating, deflating, computing CRC-32s and in I/O, in clock() ticks (CLOCKS_PER_SEC per second). m_deflate_clocks excludes the writes done from inside the compressor. Always 0 with MINIZ_NO_TIME. */
+    mz_uint64 m_inflate_clocks, m_deflate_clocks, m_crc32_clocks, m_io_clocks;
+} mz_zip_stats;
+#endif
+
+/* Enumeration state for mz_zip_reader_find_first()/mz_zip_reader_find_next(). */
+typedef struct
+{
+    mz_zip_archive *m_pZip;
+    const char *m_pPattern;
+    mz_uint m_flags;
+    mz_uint m_prefix_len;
+    mz_uint32 m_next;
+    mz_bool m_sorted;
+} mz_zip_reader_find_state;
+
 /* -------- ZIP reading */
 
 /* Inits a ZIP archive reader. */
@@ -1205,6 +1402,18 @@ MINIZ_EXPORT mz_bool mz_zip_reader_end(mz_zip_archive *pZip);
 /* Important: This must be done before passing the struct to any mz_zip functions. */
 MINIZ_EXPORT void mz_zip_zero_struct(mz_zip_archive *pZip);
 
+/* Arena allocation: every allocation an archive makes (central directory arrays, internal state, extraction buffers and decompressors) is carved out of large blocks, */
+/* and released all at once by mz_zip_arena_reset() or mz_zip_arena_free() instead of one by one. Useful when opening and extracting lots of small archives. */
+/* block_size may be 0 for MZ_ZIP_ARENA_BLOCK_SIZE. Call mz_zip_arena_attach() after mz_zip_zero_struct() and before any init function. */
+/* Memory returned to you by the archive (mz_zip_reader_extract_to_heap() etc.) also lives in the arena, don't mz_free() it. */
+/* Arenas aren't thread safe, and must outlive every archive attached to them. */
+MINIZ_EXPORT void mz_zip_arena_init(mz_zip_arena *pArena, size_t block_size);
+MINIZ_EXPORT void mz_zip_arena_attach(mz_zip_arena *pArena, mz_zip_archive *pZip);
+
+/* Releases everything allocated from the arena, but keeps one block around for reuse. Only call this once the attached archives have been ended. */
+MINIZ_EXPORT void mz_zip_arena_reset(mz_zip_arena *pArena);
+MINIZ_EXPORT void mz_zip_arena_free(mz_zip_arena *pArena);
+
 MINIZ_EXPORT mz_zip_mode mz_zip_get_mode(mz_zip_archive *pZip);
 MINIZ_EXPORT mz_zip_type mz_zip_get_type(mz_zip_archive *pZip);
 
@@ -1226,6 +1435,13 @@ MINIZ_EXPORT mz_zip_error mz_zip_clear_last_error(mz_zip_archive *pZip);
 MINIZ_EXPORT mz_zip_error mz_zip_get_last_error(mz_zip_archive *pZip);
 MINIZ_EXPORT const char *mz_zip_get_error_string(mz_zip_error mz_err);
 
+#ifdef MINIZ_STATS
+/* Copies the archive's counters to pStats. They're lost when the archive is closed, so read them before mz_zip_end(). */
+MINIZ_EXPORT mz_bool mz_zip_get_stats(mz_zip_archive *pZip, mz_zip_stats *pStats);
+/* Zeroes the counters (the peak heap size restarts from the bytes currently held), to measure a single operation. */
+MINIZ_EXPORT mz_bool mz_zip_reset_stats(mz_zip_archive *pZip);
+#endif
+
 /* MZ_TRUE if the archive file entry is a directory entry. */
 MINIZ_EXPORT mz_bool mz_zip_reader_is_file_a_directory(mz_zip_archive *pZip, mz_uint file_index);
 
@@ -1245,6 +1461,14 @@ MINIZ_EXPORT mz_uint mz_zip_reader_get_filename(mz_zip_archive *pZip, mz_uint fi
 MINIZ_EXPORT int mz_zip_reader_locate_file(mz_zip_archive *pZip, const char *pName, const char *pComment, mz_uint flags);
 MINIZ_EXPORT mz_bool mz_zip_reader_locate_file_v2(mz_zip_archive *pZip, const char *pName, const char *pComment, mz_uint flags, mz_uint32 *file_index);
 
+/* Enumerates the files whose names match pPattern, which may contain '?' (any one character but '/'), '*' (any run of characters without a '/') and '**' (any run of characters). */
+/* e.g. "Chtholly.*" or "**.cmod". The literal part of the pattern before the first wildcard is found with a binary search over the sorted central dir, */
+/* so only the entries sharing that prefix are visited. Archives opened with MZ_ZIP_FLAG_DO_NOT_SORT_CENTRAL_DIRECTORY are scanned in full. */
+/* Valid flags: MZ_ZIP_FLAG_CASE_SENSITIVE. pPattern must stay valid until the enumeration is done. */
+/* Returns MZ_FALSE (with MZ_ZIP_FILE_NOT_FOUND) once there are no more matches. Files are returned in case-insensitive name order, unless the archive isn't sorted. */
+MINIZ_EXPORT mz_bool mz_zip_reader_find_first(mz_zip_archive *pZip, const char *pPattern, mz_uint flags, mz_zip_reader_find_state *pState, mz_uint32 *pIndex);
+MINIZ_EXPORT mz_bool mz_zip_reader_find_next(mz_zip_reader_find_state *pState, mz_uint32 *pIndex);
+
 /* Returns detailed information about an archive file entry. */
 MINIZ_EXPORT mz_bool mz_zip_reader_file_stat(mz_zip_archive *pZip, mz_uint file_index, mz_zip_archive_file_stat *pStat);
 
@@ -1271,6 +1495,22 @@ MINIZ_EXPORT mz_bool mz_zip_reader_extract_file_to_mem(mz_zip_archive *pZip, con
 MINIZ_EXPORT void *mz_zip_reader_extract_to_heap(mz_zip_archive *pZip, mz_uint file_index, size_t *pSize, mz_uint flags);
 MINIZ_EXPORT void *mz_zip_reader_extract_file_to_heap(mz_zip_archive *pZip, const char *pFilename, size_t *pSize, mz_uint flags);
 
+/* Extracts several files to heap blocks: ppBufs[i] and pSizes[i] (which may be NULL) receive file pFile_indices[i]. */
+/* The entries are visited in archive order and neighbouring ones are fetched with a single read, so extracting many small files costs a few large reads instead of a couple of reads per file. */
+/* On failure every block is freed and the pointers are set to NULL. Free the blocks with pZip->m_pFree (mz_free() for the default allocator). */
+MINIZ_EXPORT mz_bool mz_zip_reader_extract_batch_to_heap(mz_zip_archive *pZip, const mz_uint32 *pFile_indices, mz_uint32 num_files, void **ppBufs, size_t *pSizes, mz_uint flags);
+
+/* Same as mz_zip_reader_extract_batch_to_heap(), but hands each file to pCallback as soon as it's inflated, in archive order. pCallback owns pBuf (free it with pZip->m_pFree), */
+/* batch_index is the file's position in pFile_indices. Return MZ_FALSE from the callback to stop. */
+/* When miniz is built with MINIZ_ZIP_ASYNC_IO on Linux, stdio archives read the upcoming entries through io_uring (or pread() threads) while the current ones are being inflated. */
+MINIZ_EXPORT mz_bool mz_zip_reader_extract_batch_to_callback(mz_zip_archive *pZip, const mz_uint32 *pFile_indices, mz_uint32 num_files, mz_zip_batch_extract_func pCallback, void *pOpaque, mz_uint flags);
+
+/* Extracts several files into a single caller owned block, back to back in pFile_indices order: pSpans[i] receives the offset and size of file pFile_indices[i] within pBlock. */
+/* mz_zip_reader_get_batch_block_size() returns the block size needed, the sum of the files' uncompressed sizes (compressed sizes with MZ_ZIP_FLAG_COMPRESSED_DATA). */
+/* Reads are coalesced the same way as mz_zip_reader_extract_batch_to_heap(). Fails with MZ_ZIP_BUF_TOO_SMALL, before extracting anything, if block_size is too small. */
+MINIZ_EXPORT mz_bool mz_zip_reader_get_batch_block_size(mz_zip_archive *pZip, const mz_uint32 *pFile_indices, mz_uint32 num_files, size_t *pBlock_size, mz_uint flags);
+MINIZ_EXPORT mz_bool mz_zip_reader_extract_batch_to_block(mz_zip_archive *pZip, const mz_uint32 *pFile_indices, mz_uint32 num_files, void *pBlock, size_t block_size, mz_zip_span *pSpans, mz_uint flags);
+
 /* Extracts a archive file using a callback function to output the file's data. */
 MINIZ_EXPORT mz_bool mz_zip_reader_extract_to_callback(mz_zip_archive *pZip, mz_uint file_index, mz_file_write_func pCallback, void *pOpaque, mz_uint flags);
 MINIZ_EXPORT mz_bool mz_zip_reader_extract_file_to_callback(mz_zip_archive *pZip, const char *pFilename, mz_file_write_func pCallback, void *pOpaque, mz_uint flags);
@@ -1308,8 +1548,15 @@ MINIZ_EXPORT mz_bool mz_zip_reader_extract_file_to_cfile(mz_zip_archive *pZip, c
 MINIZ_EXPORT mz_bool mz_zip_validate_file(mz_zip_archive *pZip, mz_uint file_index, mz_uint flags);
 
 /* Validates an entire archive by calling mz_zip_validate_file() on each file. */
+/* With MZ_ZIP_FLAG_VALIDATE_HEADERS_ONLY, memory archives are checked in a single pass over their local headers, which also rejects entries whose data overlaps another entry or the central directory. */
 MINIZ_EXPORT mz_bool mz_zip_validate_archive(mz_zip_archive *pZip, mz_uint flags);
 
+/* Like mz_zip_validate_archive(), but when miniz is built with MINIZ_ZIP_THREADS the files are handed out to num_threads worker threads (0 = one per CPU), each with its own decompressor and, for stdio archives, reading with pread(). */
+/* Memory and stdio reader archives are validated in parallel, anything else (custom read callbacks, mz_zip_arena allocators) on the calling thread. The allocator must be thread safe. */
+/* Validation stops once a file fails, unless MZ_ZIP_FLAG_VALIDATE_CONTINUE_ON_FAILURE is set. Files that were already being validated are still finished, so several failures may be found. */
+/* *pNum_failed receives the number of failing files and pFailed_indices the first max_failed of them, in index order. On failure, the last error is the one of the lowest failing index. */
+MINIZ_EXPORT mz_bool mz_zip_validate_archive_parallel(mz_zip_archive *pZip, mz_uint flags, mz_uint num_threads, mz_uint32 *pFailed_indices, mz_uint32 max_failed, mz_uint32 *pNum_failed);
+
 /* Misc utils/helpers, valid for ZIP reading or writing */
 MINIZ_EXPORT mz_bool mz_zip_validate_mem_archive(const void *pMem, size_t size, mz_uint flags, mz_zip_error *pErr);
 #ifndef MINIZ_NO_STDIO
@@ -1357,6 +1604,10 @@ MINIZ_EXPORT mz_bool mz_zip_writer_add_mem(mz_zip_archive *pZip, const char *pAr
 MINIZ_EXPORT mz_bool mz_zip_writer_add_mem_ex(mz_zip_archive *pZip, const char *pArchive_name, const void *pBuf, size_t buf_size, const void *pComment, mz_uint16 comment_size, mz_uint level_and_flags,
                                               mz_uint64 uncomp_size, mz_uint32 uncomp_crc32);
 
+/* With MZ_ZIP_FLAG_WRITE_DEDUPLICATE, data identical to an earlier entry's (same CRC-32, size and 64-bit hash, then compared byte for byte) isn't compressed again: the entry gets its own local header */
+/* and a copy of the earlier entry's compressed data, so the archive stays an ordinary zip. This saves compression time, not space. */
+/* The earlier data is read back from the archive, so heap and file writers opened with the flag become readable; other writers need MZ_ZIP_FLAG_WRITE_ALLOW_READING or a read callback. */
+/* Entries with compressed data are never deduplicated. */
 MINIZ_EXPORT mz_bool mz_zip_writer_add_mem_ex_v2(mz_zip_archive *pZip, const char *pArchive_name, const void *pBuf, size_t buf_size, const void *pComment, mz_uint16 comment_size, mz_uint level_and_flags,
                                                  mz_uint64 uncomp_size, mz_uint32 uncomp_crc32, MZ_TIME_T *last_modified, const char *user_extra_data_local, mz_uint user_extra_data_local_len,
                                                  const char *user_extra_data_central, mz_uint user_extra_data_central_len);
@@ -1383,6 +1634,28 @@ MINIZ_EXPORT mz_bool mz_zip_writer_add_cfile(mz_zip_archive *pZip, const char *p
 /* This function fully clones the source file's compressed data (no recompression), along with its full filename, extra data (it may add or modify the zip64 local header extra data field), and the optional descriptor following the compressed data. */
 MINIZ_EXPORT mz_bool mz_zip_writer_add_from_zip_reader(mz_zip_archive *pZip, mz_zip_archive *pSource_zip, mz_uint src_file_index);
 
+/* Like mz_zip_writer_add_from_zip_reader(), except num_files consecutive entries starting at first_src_file_index are cloned. */
+/* Raw data of entries that are contiguous in both archives is copied in a single run (using copy_file_range()/sendfile() on Linux when both archives are stdio files). */
+/* On failure none of the entries are added to the central directory. */
+MINIZ_EXPORT mz_bool mz_zip_writer_add_range_from_zip_reader(mz_zip_archive *pZip, mz_zip_archive *pSource_zip, mz_uint first_src_file_index, mz_uint num_files);
+
+/* Removes an entry from the archive being written (typically after mz_zip_writer_init_from_reader()). The entries following file_index are renumbered down by one. */
+/* Only the entry's central directory record is dropped: its local header and data are left in place as dead space, so replacing an entry is a delete followed by an add, without rewriting the rest of the archive. */
+/* When the archive is finalized and the dead space exceeds the compaction threshold, the archive is compacted first (this requires the archive to be readable, e.g. opened with mz_zip_writer_init_from_reader() or MZ_ZIP_FLAG_WRITE_ALLOW_READING). */
+/* The archive is cut to its new size when finalized, so this only works for heap archives and for file archives opened by filename on platforms with ftruncate()/_chsize_s() */
+/* (not in strict ANSI builds). Anything else (mz_zip_writer_init_cfile(), custom write callbacks) fails with MZ_ZIP_UNSUPPORTED_FEATURE before the archive is touched. */
+MINIZ_EXPORT mz_bool mz_zip_writer_delete_file(mz_zip_archive *pZip, mz_uint file_index);
+
+/* Returns an estimate (based on the central directory) of the number of bytes in the archive which aren't referenced by any entry. */
+MINIZ_EXPORT mz_uint64 mz_zip_writer_get_dead_space(mz_zip_archive *pZip);
+
+/* Sets the percentage of dead space which triggers compaction when the archive is finalized after entries were deleted, MZ_ZIP_DEFAULT_COMPACT_THRESHOLD by default. 0 compacts whenever entries were deleted, 100 or more disables it. */
+MINIZ_EXPORT mz_bool mz_zip_writer_set_compact_threshold(mz_zip_archive *pZip, mz_uint percent);
+
+/* Slides all entries down over any dead space, rewriting only the local header offsets in the central directory. Entries keep their relative order. */
+/* Has the same restrictions as mz_zip_writer_delete_file(). */
+MINIZ_EXPORT mz_bool mz_zip_writer_compact(mz_zip_archive *pZip);
+
 /* Finalizes the archive by writing the central directory records followed by the end of central directory record. */
 /* After an archive is finalized, the only valid call on the mz_zip_archive struct is mz_zip_writer_end(). */
 /* An archive must be manually finalized by calling this function for it to be valid. */
@@ -1392,6 +1665,11 @@ MINIZ_EXPORT mz_bool mz_zip_writer_finalize_archive(mz_zip_archive *pZip);
 /* The heap block will be allocated using the mz_zip_archive's alloc/realloc callbacks. */
 MINIZ_EXPORT mz_bool mz_zip_writer_finalize_heap_archive(mz_zip_archive *pZip, void **ppBuf, size_t *pSize);
 
+/* Scatter/gather access to an archive written with MZ_ZIP_FLAG_WRITE_HEAP_CHUNKED, without consolidating it into a single block. */
+/* Call after mz_zip_writer_finalize_archive(). Fills up to max_chunks entries of pChunks and returns the number of chunks that hold archive data (pass 0 to just query the count); the last one may be partly filled. */
+/* The chunks remain owned by the archive and are freed by mz_zip_writer_end(). */
+MINIZ_EXPORT mz_uint mz_zip_writer_get_heap_chunks(mz_zip_archive *pZip, mz_zip_heap_chunk *pChunks, mz_uint max_chunks);
+
 /* Ends archive writing, freeing all allocations, and closing the output file if mz_zip_writer_init_file() was used. */
 /* Note for the archive to be valid, it *must* have been finalized before ending (this function will not do it for you). */
 MINIZ_EXPORT mz_bool mz_zip_writer_end(mz_zip_archive *pZip);
@@ -1405,6 +1683,11 @@ MINIZ_EXPORT mz_bool mz_zip_writer_end(mz_zip_archive *pZip);
 MINIZ_EXPORT mz_bool mz_zip_add_mem_to_archive_file_in_place(const char *pZip_filename, const char *pArchive_name, const void *pBuf, size_t buf_size, const void *pComment, mz_uint16 comment_size, mz_uint level_and_flags);
 MINIZ_EXPORT mz_bool mz_zip_add_mem_to_archive_file_in_place_v2(const char *pZip_filename, const char *pArchive_name, const void *pBuf, size_t buf_size, const void *pComment, mz_uint16 comment_size, mz_uint level_and_flags, mz_zip_error *pErr);
 
+/* Like mz_zip_add_mem_to_archive_file_in_place_v2(), except any existing entries named pArchive_name are deleted first (see mz_zip_writer_delete_file()). */
+/* Names are compared case-sensitively, including the path, so an entry whose name differs only in case is kept. */
+/* Only the new data and the central directory are written, unless the archive's dead space exceeds MZ_ZIP_DEFAULT_COMPACT_THRESHOLD, in which case it's compacted. */
+MINIZ_EXPORT mz_bool mz_zip_replace_mem_in_archive_file_in_place(const char *pZip_filename, const char *pArchive_name, const void *pBuf, size_t buf_size, const void *pComment, mz_uint16 comment_size, mz_uint level_and_flags, mz_zip_error *pErr);
+
 #ifndef MINIZ_NO_STDIO
 /* Reads a single file from an archive into a heap block. */
 /* If pComment is not NULL, only the file with the specified comment will be extracted. */
@@ -0,0 +1,242 @@
+/* regress.c - regression tests for bugs fixed in miniz, one function per bug.
+   Build: cc -O2 regress.c miniz.c -o regress
+   Usage: regress
+   Prints one line per failed check and exits with 1 if any check failed. */
+#include "miniz.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int s_failures;
+
+#define REGRESS_CHECK(c)                                                    \
+    do                                                                      \
+    {                                                                       \
+        if (!(c))                                                           \
+        {                                                                   \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #c);    \
+            s_failures++;                                                   \
+        }                                                                   \
+    } while (0)
+
+#define REGRESS_BIG_SIZE 700000
+
+/* Stored entries keep the archive size predictable: the big one spans three chunks */
+static mz_bool regress_write_shrunk_chunked_archive(mz_zip_archive *pZip, const mz_uint8 *pBig)
+{
+    mz_zip_zero_struct(pZip);
+    return mz_zip_writer_init_heap_v2(pZip, 0, 0, MZ_ZIP_FLAG_WRITE_HEAP_CHUNKED | MZ_ZIP_FLAG_WRITE_ALLOW_READING) &&
+           mz_zip_writer_add_mem(pZip, "big", pBig, REGRESS_BIG_SIZE, MZ_NO_COMPRESSION) &&
+           mz_zip_writer_add_mem(pZip, "small", "hello", 5, MZ_NO_COMPRESSION) &&
+           mz_zip_writer_delete_file(pZip, 0) &&
+           mz_zip_writer_compact(pZip);
+}
+
+static void regress_check_shrunk_archive(const void *pBuf, size_t size)
+{
+    mz_zip_archive zip;
+    size_t n = 0;
+    void *p;
+
+    mz_zip_zero_struct(&zip);
+    REGRESS_CHECK(size < MZ_ZIP_HEAP_CHUNK_SIZE);
+    REGRESS_CHECK(mz_zip_reader_init_mem(&zip, pBuf, size, 0));
+    REGRESS_CHECK(mz_zip_reader_get_num_files(&zip) == 1);
+    p = mz_zip_reader_extract_file_to_heap(&zip, "small", &n, 0);
+    REGRESS_CHECK((p) && (n == 5) && (!memcmp(p, "hello", 5)));
+    mz_free(p);
+    mz_zip_reader_end(&zip);
+}
+
+/* A chunked heap archive that shrinks below one chunk used to overflow when consolidated or report bogus chunk sizes */
+static void regress_heap_chunked_shrink(void)
+{
+    mz_uint8 *pBig = (mz_uint8 *)malloc(REGRESS_BIG_SIZE);
+    mz_zip_archive zip;
+    mz_zip_heap_chunk chunks[4];
+    void *pBuf = NULL;
+    size_t size = 0;
+    mz_uint i, num_chunks;
+
+    for (i = 0; i < REGRESS_BIG_SIZE; i++)
+        pBig[i] = (mz_uint8)(i * 2654435761u >> 24);
+
+    REGRESS_CHECK(regress_write_shrunk_chunked_archive(&zip, pBig));
+    REGRESS_CHECK(mz_zip_writer_finalize_heap_archive(&zip, &pBuf, &size));
+    regress_check_shrunk_archive(pBuf, size);
+    mz_free(pBuf);
+    mz_zip_writer_end(&zip);
+
+    REGRESS_CHECK(regress_write_shrunk_chunked_archive(&zip, pBig));
+    REGRESS_CHECK(mz_zip_writer_finalize_archive(&zip));
+    num_chunks = mz_zip_writer_get_heap_chunks(&zip, chunks, 4);
+    REGRESS_CHECK(num_chunks == 1);
+    if (num_chunks == 1)
+        regress_check_shrunk_archive(chunks[0].m_pBuf, chunks[0].m_size);
+    mz_zip_writer_end(&zip);
+
+    free(pBig);
+}
+
+#ifndef MINIZ_NO_ZLIB_APIS
+static mz_ulong regress_gzip_member(const mz_uint8 *pSrc, mz_ulong src_len, mz_uint8 *pDst, mz_ulong dst_len)
+{
+    mz_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (mz_deflateInit2(&stream, MZ_DEFAULT_LEVEL, MZ_DEFLATED, MZ_DEFAULT_WINDOW_BITS + 16, 9, MZ_DEFAULT_STRATEGY) != MZ_OK)
+        return 0;
+    stream.next_in = pSrc;
+    stream.avail_in = (mz_uint32)src_len;
+    stream.next_out = pDst;
+    stream.avail_out = (mz_uint32)dst_len;
+    if (mz_deflate(&stream, MZ_FINISH) != MZ_STREAM_END)
+        stream.total_out = 0;
+    mz_deflateEnd(&stream);
+    return stream.total_out;
+}
+
+/* Fed one byte at a time, mz_inflate() used to return MZ_STREAM_END after the first of two gzip members */
+static void regress_gzip_members_byte_at_a_time(void)
+{
+    static const int s_window_bits[2] = { MZ_DEFAULT_WINDOW_BITS + 16, MZ_DEFAULT_WINDOW_BITS + 32 };
+    static const int s_flushes[2] = { MZ_NO_FLUSH, MZ_SYNC_FLUSH };
+    mz_uint8 src[6000], gz[7000], out[7000];
+    mz_ulong gz_len, first_len;
+    mz_uint i;
+    int w, f;
+
+    for (i = 0; i < 6000; i++)
+        src[i] = (mz_uint8)((i < 1000) ? ('a' + i % 7) : ((i * 2654435761u) >> 27));
+    first_len = regress_gzip_member(src, 1000, gz, sizeof(gz));
+    gz_len = first_len + regress_gzip_member(src + 1000, 5000, gz + first_len, sizeof(gz) - first_len);
+    REGRESS_CHECK((first_len) && (gz_len > first_len));
+
+    for (w = 0; w < 2; w++)
+    {
+        for (f = 0; f < 2; f++)
+        {
+            mz_stream stream;
+            int status = MZ_OK;
+
+            memset(&stream, 0, sizeof(stream));
+            REGRESS_CHECK(mz_inflateInit2(&stream, s_window_bits[w]) == MZ_OK);
+            stream.next_in = gz;
+            stream.next_out = out;
+            stream.avail_out = sizeof(out);
+            while ((status == MZ_OK) && (stream.total_in < gz_len))
+            {
+                stream.avail_in = 1;
+                status = mz_inflate(&stream, s_flushes[f]);
+            }
+            REGRESS_CHECK(status == MZ_OK);
+            REGRESS_CHECK(stream.total_in == gz_len);
+            /* The input has run out, only now is the end of the last member the end of the stream */
+            REGRESS_CHECK(mz_inflate(&stream, MZ_FINISH) == MZ_STREAM_END);
+            REGRESS_CHECK((stream.total_out == 6000) && (!memcmp(out, src, 6000)));
+            mz_inflateEnd(&stream);
+
+            /* Input that doesn't start another member ends the stream */
+            memset(&stream, 0, sizeof(stream));
+            REGRESS_CHECK(mz_inflateInit2(&stream, s_window_bits[w]) == MZ_OK);
+            stream.next_in = gz;
+            stream.avail_in = (mz_uint32)first_len;
+            stream.next_out = out;
+            stream.avail_out = sizeof(out);
+            REGRESS_CHECK(mz_inflate(&stream, s_flushes[f]) == MZ_OK);
+            stream.next_in = (const unsigned char *)"x";
+            stream.avail_in = 1;
+            REGRESS_CHECK(mz_inflate(&stream, s_flushes[f]) == MZ_STREAM_END);
+            REGRESS_CHECK((stream.total_out == 1000) && (stream.avail_in == 1));
+            mz_inflateEnd(&stream);
+        }
+    }
+}
+#endif
+
+static void regress_write_le32(mz_uint8 *p, mz_uint32 v)
+{
+    p[0] = (mz_uint8)v;
+    p[1] = (mz_uint8)(v >> 8);
+    p[2] = (mz_uint8)(v >> 16);
+    p[3] = (mz_uint8)(v >> 24);
+}
+
+/* A persisted index whose sorted table repeated an entry used to be trusted, hiding the entry it replaced from lookups */
+static void regress_index_duplicate_sorted_entry(void)
+{
+    static const mz_uint s_reader_flags[2] = { 0, MZ_ZIP_FLAG_LAZY_CENTRAL_DIRECTORY };
+    mz_zip_archive zip;
+    void *pBuf = NULL;
+    size_t size = 0;
+    mz_uint8 *p;
+    mz_uint32 cdir_ofs, index;
+    int f;
+
+    mz_zip_zero_struct(&zip);
+    REGRESS_CHECK(mz_zip_writer_init_heap_v2(&zip, 0, 0, MZ_ZIP_FLAG_WRITE_INDEX));
+    REGRESS_CHECK(mz_zip_writer_add_mem(&zip, "a", "1", 1, MZ_DEFAULT_LEVEL));
+    REGRESS_CHECK(mz_zip_writer_add_mem(&zip, "b", "2", 1, MZ_DEFAULT_LEVEL));
+    REGRESS_CHECK(mz_zip_writer_add_mem(&zip, "c", "3", 1, MZ_DEFAULT_LEVEL));
+    REGRESS_CHECK(mz_zip_writer_finalize_heap_archive(&zip, &pBuf, &size));
+    mz_zip_writer_end(&zip);
+    if (!pBuf)
+        return;
+
+    /* The index is the offsets, the sorted offsets (0 1 2), then a 20 byte trailer ending in the CRC-32 of both tables; make it 0 0 2 */
+    p = (mz_uint8 *)pBuf;
+    cdir_ofs = MZ_READ_LE32(p + size - 22 + 16);
+    REGRESS_CHECK(MZ_READ_LE32(p + cdir_ofs - 20 - 8) == 1);
+    regress_write_le32(p + cdir_ofs - 20 - 8, 0);
+    regress_write_le32(p + cdir_ofs - 4, (mz_uint32)mz_crc32(MZ_CRC32_INIT, p + cdir_ofs - 20 - 24, 24));
+
+    for (f = 0; f < 2; f++)
+    {
+        mz_zip_zero_struct(&zip);
+        REGRESS_CHECK(mz_zip_reader_init_mem(&zip, pBuf, size, s_reader_flags[f]));
+        REGRESS_CHECK((mz_zip_reader_locate_file_v2(&zip, "b", NULL, 0, &index)) && (index == 1));
+        REGRESS_CHECK((mz_zip_reader_locate_file_v2(&zip, "c", NULL, 0, &index)) && (index == 2));
+        mz_zip_reader_end(&zip);
+    }
+    mz_free(pBuf);
+}
+
+#ifndef MINIZ_NO_STDIO
+/* Replacing an entry used to delete entries whose names only differed in case */
+static void regress_replace_case_sensitive(void)
+{
+    static const char *s_pFilename = "regress_replace.zip";
+    mz_zip_archive zip;
+    mz_uint32 index;
+
+    remove(s_pFilename);
+    REGRESS_CHECK(mz_zip_add_mem_to_archive_file_in_place(s_pFilename, "README.txt", "upper", 5, NULL, 0, MZ_DEFAULT_LEVEL));
+    REGRESS_CHECK(mz_zip_replace_mem_in_archive_file_in_place(s_pFilename, "readme.txt", "lower", 5, NULL, 0, MZ_DEFAULT_LEVEL, NULL));
+    REGRESS_CHECK(mz_zip_replace_mem_in_archive_file_in_place(s_pFilename, "readme.txt", "again", 5, NULL, 0, MZ_DEFAULT_LEVEL, NULL));
+
+    mz_zip_zero_struct(&zip);
+    REGRESS_CHECK(mz_zip_reader_init_file(&zip, s_pFilename, 0));
+    REGRESS_CHECK(mz_zip_reader_get_num_files(&zip) == 2);
+    REGRESS_CHECK(mz_zip_reader_locate_file_v2(&zip, "README.txt", NULL, MZ_ZIP_FLAG_CASE_SENSITIVE, &index));
+    REGRESS_CHECK(mz_zip_reader_locate_file_v2(&zip, "readme.txt", NULL, MZ_ZIP_FLAG_CASE_SENSITIVE, &index));
+    mz_zip_reader_end(&zip);
+    remove(s_pFilename);
+}
+#endif
+
+int main(void)
+{
+    regress_heap_chunked_shrink();
+#ifndef MINIZ_NO_ZLIB_APIS
+    regress_gzip_members_byte_at_a_time();
+#endif
+    regress_index_duplicate_sorted_entry();
+#ifndef MINIZ_NO_STDIO
+    regress_replace_case_sensitive();
+#endif
+
+    if (s_failures)
+        printf("%d check(s) failed\n", s_failures);
+    else
+        printf("all checks passed\n");
+    return s_failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
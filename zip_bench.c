@@ -0,0 +1,380 @@
+/* zip_bench.c - latency of the archive operations (open, locate, extract, add, finalize) for archives of 10 to 1M small entries, and for one huge entry.
+   Build: cc -O2 -DMINIZ_STATS zip_bench.c miniz.c -o zip_bench
+   Usage: zip_bench [-n max_entries] [-H huge_size] [-o temp.zip] > zip_bench.json
+   Results go to stdout as JSON, latencies in microseconds of wall time. Small entries are 128-2047 bytes of text (entry_size 0), lookups pick random entries.
+   Allocations per operation come from mz_zip_get_stats(), without MINIZ_STATS they're null. */
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+#include "miniz.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const char *s_words[] = { "header", "nav", "card", "button", "modal", "gallery", "footer", "sidebar", "panel", "list",
+                                 "item", "title", "icon", "avatar", "badge", "tab", "menu", "form", "input", "label" };
+
+#define BENCH_NUM_WORDS (sizeof(s_words) / sizeof(s_words[0]))
+#define BENCH_MAX_ENTRY_SIZE 2048
+
+static mz_uint32 s_seed = 1;
+
+/* Deterministic LCG, so entries can be regenerated from their index to check what's extracted */
+static mz_uint32 bench_rand(void)
+{
+    s_seed = s_seed * 1664525U + 1013904223U;
+    return s_seed >> 8;
+}
+
+static double bench_now(void)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+/* Entry i's name: modules spread over directories, like an installed package tree */
+static void bench_entry_name(char *pName, mz_uint32 i)
+{
+    sprintf(pName, "modules/%s_%u/src/%s/%s_%u.chtl", s_words[i % BENCH_NUM_WORDS], (unsigned)(i / 1000), s_words[(i / 7) % BENCH_NUM_WORDS], s_words[(i / 3) % BENCH_NUM_WORDS], (unsigned)i);
+}
+
+/* Fills pBuf with generated CHTL-ish markup, returns its size. Small entries are seeded by their index. */
+static size_t bench_fill_text(char *pBuf, size_t size)
+{
+    char snippet[256];
+    size_t ofs = 0;
+    for (;;)
+    {
+        const char *a = s_words[bench_rand() % BENCH_NUM_WORDS], *b = s_words[bench_rand() % BENCH_NUM_WORDS];
+        size_t len;
+        sprintf(snippet, "div\n{\n    class: %s-%s-%u;\n    style\n    {\n        margin: %upx;\n        color: #%06x;\n    }\n    text { \"%s %s\" }\n}\n",
+                a, b, (unsigned)(bench_rand() % 1000), (unsigned)(bench_rand() % 32), (unsigned)(bench_rand() & 0xFFFFFF), b, a);
+        len = strlen(snippet);
+        if (len > size - ofs)
+            len = size - ofs;
+        memcpy(pBuf + ofs, snippet, len);
+        ofs += len;
+        if (ofs == size)
+            return ofs;
+    }
+}
+
+static size_t bench_entry_data(char *pBuf, mz_uint32 i)
+{
+    s_seed = i + 1;
+    return bench_fill_text(pBuf, 128 + bench_rand() % (BENCH_MAX_ENTRY_SIZE - 128));
+}
+
+/* One operation's latencies and allocation counts, turned into a JSON result by bench_report() */
+typedef struct
+{
+    double *m_pSeconds;
+    size_t m_num_ops, m_max_ops;
+    mz_uint64 m_num_allocs, m_bytes_allocated;
+} bench_timer;
+
+static int s_first_result = 1;
+
+static void bench_timer_init(bench_timer *pTimer, size_t max_ops)
+{
+    memset(pTimer, 0, sizeof(*pTimer));
+    pTimer->m_max_ops = max_ops;
+    if (NULL == (pTimer->m_pSeconds = (double *)malloc(MZ_MAX(max_ops, 1) * sizeof(double))))
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* The allocation counters of an archive, 0 without MINIZ_STATS */
+static void bench_allocs(mz_zip_archive *pZip, mz_uint64 *pNum_allocs, mz_uint64 *pBytes_allocated)
+{
+#ifdef MINIZ_STATS
+    mz_zip_stats stats;
+    mz_zip_get_stats(pZip, &stats);
+    *pNum_allocs = stats.m_num_allocs;
+    *pBytes_allocated = stats.m_bytes_allocated;
+#else
+    (void)pZip;
+    *pNum_allocs = *pBytes_allocated = 0;
+#endif
+}
+
+static void bench_timer_add(bench_timer *pTimer, double seconds, mz_uint64 num_allocs, mz_uint64 bytes_allocated)
+{
+    if (pTimer->m_num_ops < pTimer->m_max_ops)
+        pTimer->m_pSeconds[pTimer->m_num_ops++] = seconds;
+    pTimer->m_num_allocs += num_allocs;
+    pTimer->m_bytes_allocated += bytes_allocated;
+}
+
+static int bench_compare_doubles(const void *a, const void *b)
+{
+    const double x = *(const double *)a, y = *(const double *)b;
+    return (x < y) ? -1 : (x > y);
+}
+
+static double bench_percentile(const bench_timer *pTimer, double p)
+{
+    size_t i = (size_t)(p * (pTimer->m_num_ops - 1) + 0.5);
+    return pTimer->m_pSeconds[i] * 1e6;
+}
+
+static void bench_report(bench_timer *pTimer, const char *pOp, mz_uint32 num_entries, mz_uint64 entry_size)
+{
+    double total = 0;
+    size_t i;
+
+    for (i = 0; i < pTimer->m_num_ops; i++)
+        total += pTimer->m_pSeconds[i];
+    qsort(pTimer->m_pSeconds, pTimer->m_num_ops, sizeof(double), bench_compare_doubles);
+
+    printf("%s\n    { \"op\": \"%s\", \"entries\": %u, \"entry_size\": %.0f, \"ops\": %u, \"total_s\": %.6f, \"mean_us\": %.3f, \"p50_us\": %.3f, \"p90_us\": %.3f, \"p99_us\": %.3f, \"p999_us\": %.3f, \"max_us\": %.3f, ",
+           s_first_result ? "" : ",", pOp, (unsigned)num_entries, (double)entry_size, (unsigned)pTimer->m_num_ops, total, total * 1e6 / pTimer->m_num_ops,
+           bench_percentile(pTimer, 0.5), bench_percentile(pTimer, 0.9), bench_percentile(pTimer, 0.99), bench_percentile(pTimer, 0.999), bench_percentile(pTimer, 1.0));
+#ifdef MINIZ_STATS
+    printf("\"allocs_per_op\": %.3f, \"bytes_allocated_per_op\": %.1f }", (double)pTimer->m_num_allocs / pTimer->m_num_ops, (double)pTimer->m_bytes_allocated / pTimer->m_num_ops);
+#else
+    printf("\"allocs_per_op\": null, \"bytes_allocated_per_op\": null }");
+#endif
+    fflush(stdout);
+    s_first_result = 0;
+    free(pTimer->m_pSeconds);
+    pTimer->m_pSeconds = NULL;
+}
+
+static void bench_fail(mz_zip_archive *pZip, const char *pWhat)
+{
+    fprintf(stderr, "%s failed: %s\n", pWhat, mz_zip_get_error_string(mz_zip_get_last_error(pZip)));
+    exit(EXIT_FAILURE);
+}
+
+/* Times adding the entries one at a time and finalizing the archive */
+static void bench_write(const char *pFilename, mz_uint32 num_entries, const char *pHuge, size_t huge_size)
+{
+    mz_zip_archive zip;
+    bench_timer timer;
+    char name[256], *pData = NULL;
+    mz_uint64 allocs0, bytes0, allocs1, bytes1;
+    mz_uint32 i;
+    double start;
+
+    memset(&zip, 0, sizeof(zip));
+    if (!mz_zip_writer_init_file(&zip, pFilename, 0))
+        bench_fail(&zip, "mz_zip_writer_init_file");
+
+    if (NULL == (pData = (char *)malloc(BENCH_MAX_ENTRY_SIZE)))
+        bench_fail(&zip, "malloc");
+    bench_timer_init(&timer, num_entries);
+    for (i = 0; i < num_entries; i++)
+    {
+        const char *pBuf = pHuge;
+        size_t size = huge_size;
+        if (!pHuge)
+        {
+            size = bench_entry_data(pData, i);
+            pBuf = pData;
+        }
+        bench_entry_name(name, i);
+        bench_allocs(&zip, &allocs0, &bytes0);
+        start = bench_now();
+        if (!mz_zip_writer_add_mem_ex_v2(&zip, name, pBuf, size, NULL, 0, MZ_DEFAULT_LEVEL, 0, 0, NULL, NULL, 0, NULL, 0))
+            bench_fail(&zip, "mz_zip_writer_add_mem_ex_v2");
+        start = bench_now() - start;
+        bench_allocs(&zip, &allocs1, &bytes1);
+        bench_timer_add(&timer, start, allocs1 - allocs0, bytes1 - bytes0);
+    }
+    free(pData);
+    bench_report(&timer, pHuge ? "writer_add_mem_ex_v2_huge" : "writer_add_mem_ex_v2", num_entries, pHuge ? huge_size : 0);
+
+    bench_timer_init(&timer, 1);
+    bench_allocs(&zip, &allocs0, &bytes0);
+    start = bench_now();
+    if (!mz_zip_writer_finalize_archive(&zip))
+        bench_fail(&zip, "mz_zip_writer_finalize_archive");
+    start = bench_now() - start;
+    bench_allocs(&zip, &allocs1, &bytes1);
+    bench_timer_add(&timer, start, allocs1 - allocs0, bytes1 - bytes0);
+    bench_report(&timer, "writer_finalize_archive", num_entries, pHuge ? huge_size : 0);
+
+    mz_zip_writer_end(&zip);
+}
+
+/* Times opening the archive from its file and from memory, looking up entries with and without MZ_ZIP_FLAG_CASE_SENSITIVE, and extracting all of them */
+static void bench_read(const char *pFilename, mz_uint32 num_entries, const char *pHuge, size_t huge_size)
+{
+    mz_zip_archive zip;
+    bench_timer timer;
+    char name[256], *pData, *pExpected;
+    void *pArchive = NULL;
+    size_t archive_size = 0, data_size = pHuge ? huge_size : BENCH_MAX_ENTRY_SIZE;
+    mz_uint64 allocs0, bytes0, allocs1, bytes1;
+    mz_uint32 i, num_lookups, pass;
+    FILE *pFile;
+    double start, end;
+
+    /* Small archives open in microseconds, so opening is repeated for a quarter second (at least 3 and at most 1000 times) */
+    for (pass = 0; pass < 2; pass++)
+    {
+        bench_timer_init(&timer, 1000);
+        end = bench_now() + 0.25;
+        if (pass == 1)
+        {
+            if ((NULL == (pFile = fopen(pFilename, "rb"))) || (fseek(pFile, 0, SEEK_END) != 0) || ((archive_size = (size_t)ftell(pFile)) == 0) ||
+                (fseek(pFile, 0, SEEK_SET) != 0) || (NULL == (pArchive = malloc(archive_size))) || (fread(pArchive, 1, archive_size, pFile) != archive_size))
+            {
+                fprintf(stderr, "Couldn't read %s back\n", pFilename);
+                exit(EXIT_FAILURE);
+            }
+            fclose(pFile);
+        }
+        do
+        {
+            memset(&zip, 0, sizeof(zip));
+            start = bench_now();
+            if (!(pass ? mz_zip_reader_init_mem(&zip, pArchive, archive_size, 0) : mz_zip_reader_init_file(&zip, pFilename, 0)))
+                bench_fail(&zip, pass ? "mz_zip_reader_init_mem" : "mz_zip_reader_init_file");
+            start = bench_now() - start;
+            /* The counters start at 0 when the archive is opened */
+            bench_allocs(&zip, &allocs1, &bytes1);
+            bench_timer_add(&timer, start, allocs1, bytes1);
+            if (mz_zip_reader_get_num_files(&zip) != num_entries)
+                bench_fail(&zip, "mz_zip_reader_get_num_files");
+            mz_zip_reader_end(&zip);
+        } while ((timer.m_num_ops < 3) || ((timer.m_num_ops < timer.m_max_ops) && (bench_now() < end)));
+        bench_report(&timer, pass ? "reader_init_mem" : "reader_init_file", num_entries, pHuge ? huge_size : 0);
+    }
+
+    memset(&zip, 0, sizeof(zip));
+    if (!mz_zip_reader_init_mem(&zip, pArchive, archive_size, 0))
+        bench_fail(&zip, "mz_zip_reader_init_mem");
+
+    /* Case sensitive lookups scan the central directory, so large archives get fewer of them */
+    for (pass = 0; pass < 2; pass++)
+    {
+        const mz_uint flags = pass ? MZ_ZIP_FLAG_CASE_SENSITIVE : 0;
+        num_lookups = pass ? MZ_MAX(100, MZ_MIN(100000, 20000000 / num_entries)) : 100000;
+        bench_timer_init(&timer, num_lookups);
+        s_seed = 12345;
+        for (i = 0; i < num_lookups; i++)
+        {
+            mz_uint32 expected = bench_rand() % num_entries, index;
+            bench_entry_name(name, expected);
+            bench_allocs(&zip, &allocs0, &bytes0);
+            start = bench_now();
+            if (!mz_zip_reader_locate_file_v2(&zip, name, NULL, flags, &index))
+                bench_fail(&zip, "mz_zip_reader_locate_file_v2");
+            start = bench_now() - start;
+            bench_allocs(&zip, &allocs1, &bytes1);
+            bench_timer_add(&timer, start, allocs1 - allocs0, bytes1 - bytes0);
+            if (index != expected)
+            {
+                fprintf(stderr, "%s found at %u instead of %u\n", name, (unsigned)index, (unsigned)expected);
+                exit(EXIT_FAILURE);
+            }
+        }
+        bench_report(&timer, pass ? "locate_file_v2_case_sensitive" : "locate_file_v2", num_entries, pHuge ? huge_size : 0);
+    }
+
+    /* Extract every entry and check it against a regenerated copy */
+    pData = (char *)malloc(data_size);
+    pExpected = pHuge ? (char *)pHuge : (char *)malloc(data_size);
+    if ((!pData) || (!pExpected))
+        bench_fail(&zip, "malloc");
+    bench_timer_init(&timer, num_entries);
+    for (i = 0; i < num_entries; i++)
+    {
+        mz_zip_archive_file_stat stat;
+        size_t size = huge_size;
+        if (!pHuge)
+            size = bench_entry_data(pExpected, i);
+        if ((!mz_zip_reader_file_stat(&zip, i, &stat)) || (stat.m_uncomp_size != size))
+            bench_fail(&zip, "mz_zip_reader_file_stat");
+        bench_allocs(&zip, &allocs0, &bytes0);
+        start = bench_now();
+        if (!mz_zip_reader_extract_to_mem(&zip, i, pData, size, 0))
+            bench_fail(&zip, "mz_zip_reader_extract_to_mem");
+        start = bench_now() - start;
+        bench_allocs(&zip, &allocs1, &bytes1);
+        bench_timer_add(&timer, start, allocs1 - allocs0, bytes1 - bytes0);
+        if (memcmp(pData, pExpected, size) != 0)
+        {
+            fprintf(stderr, "Entry %u doesn't match what was added\n", (unsigned)i);
+            exit(EXIT_FAILURE);
+        }
+    }
+    bench_report(&timer, "reader_extract_to_mem", num_entries, pHuge ? huge_size : 0);
+
+    if (!pHuge)
+        free(pExpected);
+    free(pData);
+    mz_zip_reader_end(&zip);
+    free(pArchive);
+}
+
+static void bench_usage(void)
+{
+    fprintf(stderr, "Usage: zip_bench [-n max_entries] [-H huge_size] [-o temp.zip] > zip_bench.json\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *pFilename = "zip_bench.tmp.zip";
+    mz_uint32 num_entries, max_entries = 1000000;
+    size_t huge_size = 100 * 1024 * 1024;
+    char *pHuge;
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if ((!strcmp(argv[i], "-n")) && (i + 1 < argc))
+            max_entries = (mz_uint32)strtoul(argv[++i], NULL, 10);
+        else if ((!strcmp(argv[i], "-H")) && (i + 1 < argc))
+            huge_size = (size_t)strtoul(argv[++i], NULL, 10);
+        else if ((!strcmp(argv[i], "-o")) && (i + 1 < argc))
+            pFilename = argv[++i];
+        else
+            bench_usage();
+    }
+
+    printf("{\n  \"miniz_version\": \"%s\",\n", MZ_VERSION);
+#ifdef __VERSION__
+    printf("  \"compiler\": \"%s\",\n", __VERSION__);
+#endif
+#ifdef MINIZ_STATS
+    printf("  \"miniz_stats\": true,\n  \"results\": [");
+#else
+    printf("  \"miniz_stats\": false,\n  \"results\": [");
+#endif
+
+    for (num_entries = 10; num_entries <= max_entries; num_entries *= 10)
+    {
+        bench_write(pFilename, num_entries, NULL, 0);
+        bench_read(pFilename, num_entries, NULL, 0);
+    }
+
+    if (huge_size)
+    {
+        if (NULL == (pHuge = (char *)malloc(huge_size)))
+        {
+            fprintf(stderr, "Out of memory\n");
+            return EXIT_FAILURE;
+        }
+        s_seed = 1;
+        bench_fill_text(pHuge, huge_size);
+        bench_write(pFilename, 1, pHuge, huge_size);
+        bench_read(pFilename, 1, pHuge, huge_size);
+        free(pHuge);
+    }
+    printf("\n  ]\n}\n");
+
+    remove(pFilename);
+    return EXIT_SUCCESS;
+}